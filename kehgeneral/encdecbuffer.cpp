@@ -305,6 +305,47 @@ uint16_t kehEncDecBuffer::read_ushort()
 }
 
 
+void kehEncDecBuffer::write_varuint(uint32_t value)
+{
+   while (value >= 0x80)
+   {
+      m_buffer.append(uint8_t(value | 0x80));
+      value >>= 7;
+   }
+   m_buffer.append(uint8_t(value));
+}
+
+uint32_t kehEncDecBuffer::read_varuint()
+{
+   uint32_t ret = 0;
+   for (uint32_t shift = 0; shift < 35; shift += 7)
+   {
+      ERR_FAIL_COND_V_MSG(m_rindex >= m_buffer.size(), 0, "Trying to decode varuint but reading index has moved past last byte in the buffer.");
+      uint8_t b = 0;
+      decode_bytes(1, &b);
+      ret |= uint32_t(b & 0x7F) << shift;
+      if (!(b & 0x80))
+         break;
+   }
+
+   return ret;
+}
+
+
+void kehEncDecBuffer::write_varint(int value)
+{
+   // Zigzag: 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...
+   const int32_t v = value;
+   write_varuint((uint32_t(v) << 1) ^ uint32_t(v >> 31));
+}
+
+int kehEncDecBuffer::read_varint()
+{
+   const uint32_t v = read_varuint();
+   return int32_t((v >> 1) ^ (~(v & 1) + 1));
+}
+
+
 void kehEncDecBuffer::write_string(const String& value)
 {
    // Ensure UTF8 encoding
@@ -430,6 +471,12 @@ void kehEncDecBuffer::_bind_methods()
    ClassDB::bind_method(D_METHOD("rewrite_ushort", "value", "offset"), &kehEncDecBuffer::rewrite_ushort);
    ClassDB::bind_method(D_METHOD("read_ushort"), &kehEncDecBuffer::read_ushort);
 
+   ClassDB::bind_method(D_METHOD("write_varuint", "value"), &kehEncDecBuffer::write_varuint);
+   ClassDB::bind_method(D_METHOD("read_varuint"), &kehEncDecBuffer::read_varuint);
+
+   ClassDB::bind_method(D_METHOD("write_varint", "value"), &kehEncDecBuffer::write_varint);
+   ClassDB::bind_method(D_METHOD("read_varint"), &kehEncDecBuffer::read_varint);
+
    ClassDB::bind_method(D_METHOD("write_string", "value"), &kehEncDecBuffer::write_string);
    ClassDB::bind_method(D_METHOD("read_string"), &kehEncDecBuffer::read_string);
 
@@ -150,6 +150,18 @@ public:
    // Read an unsigned 16 bites integer from the internal buffer. Automatically moves the reading index
    uint16_t read_ushort();
 
+   // Append an unsigned integer using a variable amount of bytes (1 to 5). Each byte holds 7 bits of the value
+   // and the highest bit tells if there are more bytes. Small values require fewer bytes.
+   void write_varuint(uint32_t value);
+   // Read an unsigned integer encoded with variable amount of bytes. Automatically moves the reading index
+   uint32_t read_varuint();
+
+   // Append a signed integer using a variable amount of bytes. The value is "zigzag" mapped first, so small
+   // negative values also require fewer bytes
+   void write_varint(int value);
+   // Read a signed integer encoded with variable amount of bytes. Automatically moves the reading index
+   int read_varint();
+
    // Append a String into the buffer array.
    // Note that because strings may have different sizes rewriting them is not supported
    void write_string(const String& value);
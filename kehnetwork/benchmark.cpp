@@ -0,0 +1,734 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "benchmark.h"
+#include "entityinfo.h"
+#include "simdcompare.h"
+#include "network.h"
+#include "snapentity.h"
+#include "snapshot.h"
+#include "snapshotdata.h"
+
+#include "../kehgeneral/encdecbuffer.h"
+#include "../kehgeneral/quantize.h"
+
+#include "core/os/os.h"
+
+
+namespace
+{
+   // Writes "count" values into an empty buffer then reads all of them back. The generator gives the value
+   // to be written given the iteration index.
+   template <class T, class Generator, class Writer, class Reader>
+   Dictionary bench_buffer(uint32_t count, Generator gen, Writer writer, Reader reader)
+   {
+      Vector<T> values;
+      values.resize(count);
+      for (uint32_t i = 0; i < count; i++)
+      {
+         values.write[i] = gen(i);
+      }
+
+      Ref<kehEncDecBuffer> buffer = memnew(kehEncDecBuffer);
+      OS* os = OS::get_singleton();
+
+      uint64_t start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+      {
+         writer(buffer, values[i]);
+      }
+      const uint64_t write_usec = os->get_ticks_usec() - start;
+
+      // Reset the reading index
+      buffer->set_buffer(buffer->get_buffer());
+
+      start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+      {
+         values.write[i] = reader(buffer);
+      }
+      const uint64_t read_usec = os->get_ticks_usec() - start;
+
+      Dictionary ret;
+      ret["write_ns"] = count > 0 ? double(write_usec) * 1000.0 / double(count) : 0.0;
+      ret["read_ns"] = count > 0 ? double(read_usec) * 1000.0 / double(count) : 0.0;
+      ret["bytes"] = buffer->get_current_size();
+      return ret;
+   }
+}
+
+
+Variant kehNetBenchmark::random_value(int type)
+{
+   switch (type)
+   {
+      case Variant::BOOL:
+         return (m_rng.rand() & 1) == 1;
+
+      case Variant::INT:
+         return int(m_rng.rand());
+
+      case Variant::REAL:
+         return m_rng.random(-1000.0f, 1000.0f);
+
+      case Variant::VECTOR2:
+         return Vector2(m_rng.random(-1000.0f, 1000.0f), m_rng.random(-1000.0f, 1000.0f));
+
+      case Variant::RECT2:
+         return Rect2(m_rng.random(-1000.0f, 1000.0f), m_rng.random(-1000.0f, 1000.0f), m_rng.randf() * 100.0f, m_rng.randf() * 100.0f);
+
+      case Variant::QUAT:
+         return Quat(Vector3(m_rng.randf(), m_rng.randf(), m_rng.randf()).normalized(), m_rng.random(-Math_PI, Math_PI));
+
+      case Variant::COLOR:
+         return Color(m_rng.randf(), m_rng.randf(), m_rng.randf(), m_rng.randf());
+
+      case Variant::VECTOR3:
+         return Vector3(m_rng.random(-1000.0f, 1000.0f), m_rng.random(-1000.0f, 1000.0f), m_rng.random(-1000.0f, 1000.0f));
+
+      case kehSnapEntityBase::CTYPE_UINT:
+         return m_rng.rand();
+
+      case kehSnapEntityBase::CTYPE_BYTE:
+         return m_rng.rand() & 0xFF;
+
+      case kehSnapEntityBase::CTYPE_USHORT:
+         return m_rng.rand() & 0xFFFF;
+
+      case Variant::STRING:
+         return vformat("entity_%d", m_rng.rand() % 1000);
+
+      case Variant::POOL_BYTE_ARRAY:
+      {
+         PoolByteArray ret;
+         const uint32_t size = m_rng.rand() % 16;
+         for (uint32_t i = 0; i < size; i++)
+            ret.append(m_rng.rand() & 0xFF);
+         return ret;
+      }
+
+      case Variant::POOL_INT_ARRAY:
+      {
+         PoolIntArray ret;
+         const uint32_t size = m_rng.rand() % 16;
+         for (uint32_t i = 0; i < size; i++)
+            ret.append(int(m_rng.rand()));
+         return ret;
+      }
+
+      case Variant::POOL_REAL_ARRAY:
+      {
+         PoolRealArray ret;
+         const uint32_t size = m_rng.rand() % 16;
+         for (uint32_t i = 0; i < size; i++)
+            ret.append(m_rng.random(-1000.0f, 1000.0f));
+         return ret;
+      }
+   }
+
+   return Variant();
+}
+
+void kehNetBenchmark::randomize_entity(const Ref<kehEntityInfo>& einfo, const Ref<kehSnapEntityBase>& entity)
+{
+   const uint32_t count = einfo->get_replicable_count();
+   for (uint32_t i = 0; i < count; i++)
+   {
+      const String pname = einfo->get_replicable_name(i);
+      if (pname != "id" && pname != "class_hash")
+      {
+         einfo->set_replicable_value(entity, i, random_value(einfo->get_replicable_type(i)));
+      }
+   }
+}
+
+
+Dictionary kehNetBenchmark::run_buffer()
+{
+   typedef Ref<kehEncDecBuffer> Buffer;
+   const uint32_t count = m_iterations;
+   RandomPCG& rng = m_rng;
+
+   Dictionary ret;
+
+   ret["bool"] = bench_buffer<bool>(count,
+         [&rng](uint32_t) { return (rng.rand() & 1) == 1; },
+         [](Buffer& b, bool v) { b->write_bool(v); },
+         [](Buffer& b) { return b->read_bool(); });
+
+   ret["int"] = bench_buffer<int>(count,
+         [&rng](uint32_t) { return int(rng.rand()); },
+         [](Buffer& b, int v) { b->write_int(v); },
+         [](Buffer& b) { return b->read_int(); });
+
+   ret["float"] = bench_buffer<float>(count,
+         [&rng](uint32_t) { return rng.random(-1000.0f, 1000.0f); },
+         [](Buffer& b, float v) { b->write_float(v); },
+         [](Buffer& b) { return b->read_float(); });
+
+   ret["vector2"] = bench_buffer<Vector2>(count,
+         [&rng](uint32_t) { return Vector2(rng.randf(), rng.randf()); },
+         [](Buffer& b, const Vector2& v) { b->write_vector2(v); },
+         [](Buffer& b) { return b->read_vector2(); });
+
+   ret["rect2"] = bench_buffer<Rect2>(count,
+         [&rng](uint32_t) { return Rect2(rng.randf(), rng.randf(), rng.randf(), rng.randf()); },
+         [](Buffer& b, const Rect2& v) { b->write_rect2(v); },
+         [](Buffer& b) { return b->read_rect2(); });
+
+   ret["vector3"] = bench_buffer<Vector3>(count,
+         [&rng](uint32_t) { return Vector3(rng.randf(), rng.randf(), rng.randf()); },
+         [](Buffer& b, const Vector3& v) { b->write_vector3(v); },
+         [](Buffer& b) { return b->read_vector3(); });
+
+   ret["quat"] = bench_buffer<Quat>(count,
+         [&rng](uint32_t) { return Quat(Vector3(rng.randf(), rng.randf(), rng.randf()).normalized(), rng.randf()); },
+         [](Buffer& b, const Quat& v) { b->write_quat(v); },
+         [](Buffer& b) { return b->read_quat(); });
+
+   ret["color"] = bench_buffer<Color>(count,
+         [&rng](uint32_t) { return Color(rng.randf(), rng.randf(), rng.randf(), rng.randf()); },
+         [](Buffer& b, const Color& v) { b->write_color(v); },
+         [](Buffer& b) { return b->read_color(); });
+
+   ret["uint"] = bench_buffer<uint32_t>(count,
+         [&rng](uint32_t) { return rng.rand(); },
+         [](Buffer& b, uint32_t v) { b->write_uint(v); },
+         [](Buffer& b) { return b->read_uint(); });
+
+   ret["byte"] = bench_buffer<uint8_t>(count,
+         [&rng](uint32_t) { return uint8_t(rng.rand() & 0xFF); },
+         [](Buffer& b, uint8_t v) { b->write_byte(v); },
+         [](Buffer& b) { return b->read_byte(); });
+
+   ret["ushort"] = bench_buffer<uint16_t>(count,
+         [&rng](uint32_t) { return uint16_t(rng.rand() & 0xFFFF); },
+         [](Buffer& b, uint16_t v) { b->write_ushort(v); },
+         [](Buffer& b) { return b->read_ushort(); });
+
+   ret["string"] = bench_buffer<String>(count,
+         [&rng](uint32_t) { return vformat("entity_%d", rng.rand() % 1000); },
+         [](Buffer& b, const String& v) { b->write_string(v); },
+         [](Buffer& b) { return b->read_string(); });
+
+   return ret;
+}
+
+
+Dictionary kehNetBenchmark::run_quantize()
+{
+   Dictionary ret;
+   kehQuantize* quant = kehQuantize::get_singleton();
+   if (!quant)
+      return ret;
+
+   const uint32_t count = m_iterations;
+   OS* os = OS::get_singleton();
+
+   Vector<float> floats;
+   Vector<Quat> quats;
+   Vector<uint32_t> packed;
+   floats.resize(count);
+   quats.resize(count);
+   packed.resize(count);
+   for (uint32_t i = 0; i < count; i++)
+   {
+      floats.write[i] = m_rng.randf();
+      quats.write[i] = Quat(Vector3(m_rng.randf(), m_rng.randf(), m_rng.randf()).normalized(), m_rng.random(-Math_PI, Math_PI));
+   }
+
+   // Restored values are stored here just so the compiler doesn't discard the restore calls
+   volatile float sink = 0.0f;
+
+   {
+      uint64_t start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         packed.write[i] = quant->quantize_unit_float(floats[i], 16);
+      const uint64_t compress_usec = os->get_ticks_usec() - start;
+
+      start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         sink = quant->restore_unit_float(packed[i], 16);
+      const uint64_t restore_usec = os->get_ticks_usec() - start;
+
+      Dictionary entry;
+      entry["compress_ns"] = nsec_per_op(compress_usec, count);
+      entry["restore_ns"] = nsec_per_op(restore_usec, count);
+      ret["unit_float_16bits"] = entry;
+   }
+
+   {
+      uint64_t start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         packed.write[i] = quant->compress_rquat_9bits(quats[i]);
+      const uint64_t compress_usec = os->get_ticks_usec() - start;
+
+      start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         sink = quant->restore_rquat_9bits(packed[i]).w;
+      const uint64_t restore_usec = os->get_ticks_usec() - start;
+
+      Dictionary entry;
+      entry["compress_ns"] = nsec_per_op(compress_usec, count);
+      entry["restore_ns"] = nsec_per_op(restore_usec, count);
+      ret["rquat_9bits"] = entry;
+   }
+
+   {
+      uint64_t start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         packed.write[i] = quant->compress_rquat_10bits(quats[i]);
+      const uint64_t compress_usec = os->get_ticks_usec() - start;
+
+      start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         sink = quant->restore_rquat_10bits(packed[i]).w;
+      const uint64_t restore_usec = os->get_ticks_usec() - start;
+
+      Dictionary entry;
+      entry["compress_ns"] = nsec_per_op(compress_usec, count);
+      entry["restore_ns"] = nsec_per_op(restore_usec, count);
+      ret["rquat_10bits"] = entry;
+   }
+
+   {
+      Vector<PoolIntArray> packed15;
+      packed15.resize(count);
+
+      uint64_t start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         packed15.write[i] = quant->compress_rquat_15bits(quats[i]);
+      const uint64_t compress_usec = os->get_ticks_usec() - start;
+
+      start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         sink = quant->restore_rquat_15bits(packed15[i][0], packed15[i][1]).w;
+      const uint64_t restore_usec = os->get_ticks_usec() - start;
+
+      Dictionary entry;
+      entry["compress_ns"] = nsec_per_op(compress_usec, count);
+      entry["restore_ns"] = nsec_per_op(restore_usec, count);
+      ret["rquat_15bits"] = entry;
+   }
+
+   return ret;
+}
+
+
+Dictionary kehNetBenchmark::run_change_detection()
+{
+   // Two columns of values, with roughly half of the elements changed, compared by the scalar and the vectorized
+   // kernels. This is single threaded so the throughput is per core.
+   Dictionary ret;
+   ret["isa"] = kehSimdCompare::get_isa();
+
+   const uint32_t count = m_iterations;
+   const uint32_t passes = 16;
+   OS* os = OS::get_singleton();
+
+   Vector<float> f1;
+   Vector<float> f2;
+   Vector<uint32_t> i1;
+   Vector<uint32_t> i2;
+   Vector<uint8_t> changed;
+   f1.resize(count * 4);
+   f2.resize(count * 4);
+   i1.resize(count);
+   i2.resize(count);
+   changed.resize(count);
+   for (uint32_t i = 0; i < count * 4; i++)
+   {
+      f1.write[i] = m_rng.random(-1000.0f, 1000.0f);
+      f2.write[i] = m_rng.randf() < 0.5f ? f1[i] : f1[i] + m_rng.random(-0.1f, 0.1f);
+   }
+   for (uint32_t i = 0; i < count; i++)
+   {
+      i1.write[i] = m_rng.rand();
+      i2.write[i] = m_rng.randf() < 0.5f ? i1[i] : m_rng.rand();
+   }
+
+   // Changed counts are accumulated here just so the compiler doesn't discard the calls
+   volatile uint32_t sink = 0;
+
+   {
+      uint64_t start = os->get_ticks_usec();
+      for (uint32_t p = 0; p < passes; p++)
+         sink = kehSimdCompare::changed_int_scalar(i1.ptr(), i2.ptr(), count, changed.ptrw());
+      const uint64_t scalar_usec = os->get_ticks_usec() - start;
+
+      start = os->get_ticks_usec();
+      for (uint32_t p = 0; p < passes; p++)
+         sink = kehSimdCompare::changed_int(i1.ptr(), i2.ptr(), count, changed.ptrw());
+      const uint64_t simd_usec = os->get_ticks_usec() - start;
+
+      Dictionary entry;
+      entry["scalar_ns"] = nsec_per_op(scalar_usec, count * passes);
+      entry["simd_ns"] = nsec_per_op(simd_usec, count * passes);
+      entry["simd_per_sec"] = simd_usec > 0 ? double(count * passes) * 1000000.0 / double(simd_usec) : 0.0;
+      ret["int"] = entry;
+   }
+
+   struct FloatCase
+   {
+      const char* name;
+      uint32_t comps;
+      float tolerance;
+   };
+
+   const FloatCase cases[] = {
+      { "float_exact", 1, -1.0f },
+      { "float_auto", 1, 0.0f },
+      { "float_custom", 1, 0.01f },
+      { "vec2_custom", 2, 0.01f },
+      { "vec3_auto", 3, 0.0f },
+      { "vec3_custom", 3, 0.01f },
+      { "quat_custom", 4, 0.01f },
+      { "color_auto", 4, 0.0f },
+   };
+
+   for (uint32_t c = 0; c < sizeof(cases) / sizeof(FloatCase); c++)
+   {
+      const FloatCase& fc = cases[c];
+
+      uint64_t start = os->get_ticks_usec();
+      for (uint32_t p = 0; p < passes; p++)
+         sink = kehSimdCompare::changed_float_scalar(f1.ptr(), f2.ptr(), count, fc.comps, fc.tolerance, changed.ptrw());
+      const uint64_t scalar_usec = os->get_ticks_usec() - start;
+
+      start = os->get_ticks_usec();
+      for (uint32_t p = 0; p < passes; p++)
+         sink = kehSimdCompare::changed_float(f1.ptr(), f2.ptr(), count, fc.comps, fc.tolerance, changed.ptrw());
+      const uint64_t simd_usec = os->get_ticks_usec() - start;
+
+      Dictionary entry;
+      entry["scalar_ns"] = nsec_per_op(scalar_usec, count * passes);
+      entry["simd_ns"] = nsec_per_op(simd_usec, count * passes);
+      entry["simd_per_sec"] = simd_usec > 0 ? double(count * passes) * 1000000.0 / double(simd_usec) : 0.0;
+      ret[fc.name] = entry;
+   }
+
+   return ret;
+}
+
+
+Array kehNetBenchmark::run_entity(const Ref<kehSnapshotData>& sdata, const PoolVector<uint32_t>& types)
+{
+   Array ret;
+   const uint32_t count = m_iterations;
+   OS* os = OS::get_singleton();
+
+   for (int t = 0; t < types.size(); t++)
+   {
+      const Ref<kehEntityInfo> einfo = sdata->get_entity_info(types[t]);
+      if (!einfo.is_valid())
+         continue;
+
+      Ref<kehSnapEntityBase> e1 = einfo->create_instance(1, 0);
+      Ref<kehSnapEntityBase> e2 = einfo->create_instance(1, 0);
+      randomize_entity(einfo, e1);
+      randomize_entity(einfo, e2);
+
+      kehChangeMask cmask;
+      uint64_t start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         cmask |= einfo->calculate_change_mask(e1, e2);
+      const uint64_t cmask_usec = os->get_ticks_usec() - start;
+
+      // Native types also have the batched change mask calculation used by encode_delta. Time it against the
+      // per pair path over the same set of entities
+      uint64_t pair_usec = 0;
+      uint64_t batch_usec = 0;
+      uint32_t batch_ops = 0;
+      if (einfo->is_native())
+      {
+         const uint32_t batch = 256;
+         const uint32_t passes = MAX(1u, count / batch);
+
+         Vector<Ref<kehSnapEntityBase>> old_entity;
+         Vector<Ref<kehSnapEntityBase>> new_entity;
+         Vector<const kehSnapEntityBase*> pold;
+         Vector<const kehSnapEntityBase*> pnew;
+         Vector<kehChangeMask> cmasks;
+         old_entity.resize(batch);
+         new_entity.resize(batch);
+         pold.resize(batch);
+         pnew.resize(batch);
+         cmasks.resize(batch);
+         for (uint32_t i = 0; i < batch; i++)
+         {
+            old_entity.write[i] = einfo->create_instance(i + 1, 0);
+            new_entity.write[i] = einfo->create_instance(i + 1, 0);
+            randomize_entity(einfo, old_entity[i]);
+            randomize_entity(einfo, new_entity[i]);
+            pold.write[i] = old_entity[i].ptr();
+            pnew.write[i] = new_entity[i].ptr();
+         }
+
+         start = os->get_ticks_usec();
+         for (uint32_t p = 0; p < passes; p++)
+         {
+            for (uint32_t i = 0; i < batch; i++)
+               cmasks.write[i] = einfo->calculate_change_mask(old_entity[i], new_entity[i]);
+         }
+         pair_usec = os->get_ticks_usec() - start;
+
+         start = os->get_ticks_usec();
+         for (uint32_t p = 0; p < passes; p++)
+            einfo->calculate_change_masks(pold.ptr(), pnew.ptr(), batch, cmasks.ptrw());
+         batch_usec = os->get_ticks_usec() - start;
+
+         batch_ops = batch * passes;
+      }
+
+      Ref<kehEncDecBuffer> buffer = memnew(kehEncDecBuffer);
+      start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         einfo->encode_full_entity(e1, buffer);
+      const uint64_t full_usec = os->get_ticks_usec() - start;
+      const uint32_t full_bytes = buffer->get_current_size() / count;
+
+      buffer->set_buffer(buffer->get_buffer());
+      start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         einfo->decode_full_entity(buffer);
+      const uint64_t dfull_usec = os->get_ticks_usec() - start;
+
+      buffer->set_buffer(PoolByteArray());
+      start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         einfo->encode_delta_entity(e2, e1, cmask, buffer);
+      const uint64_t delta_usec = os->get_ticks_usec() - start;
+      const uint32_t delta_bytes = buffer->get_current_size() / count;
+
+      buffer->set_buffer(buffer->get_buffer());
+      kehChangeMask outmask;
+      start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+         einfo->decode_delta_entity(buffer->read_uint(), e1, buffer, outmask);
+      const uint64_t ddelta_usec = os->get_ticks_usec() - start;
+
+      Dictionary entry;
+      entry["type"] = einfo->get_type_name();
+      entry["properties"] = einfo->get_replicable_count();
+      entry["change_mask_ns"] = nsec_per_op(cmask_usec, count);
+      if (batch_ops > 0)
+      {
+         entry["pair_change_mask_ns"] = nsec_per_op(pair_usec, batch_ops);
+         entry["batch_change_mask_ns"] = nsec_per_op(batch_usec, batch_ops);
+      }
+      entry["encode_full_ns"] = nsec_per_op(full_usec, count);
+      entry["decode_full_ns"] = nsec_per_op(dfull_usec, count);
+      entry["full_bytes"] = full_bytes;
+      entry["encode_delta_ns"] = nsec_per_op(delta_usec, count);
+      entry["decode_delta_ns"] = nsec_per_op(ddelta_usec, count);
+      entry["delta_bytes"] = delta_bytes;
+      ret.push_back(entry);
+   }
+
+   return ret;
+}
+
+
+Array kehNetBenchmark::run_snapshot(const Ref<kehSnapshotData>& sdata, const PoolVector<uint32_t>& types)
+{
+   Array ret;
+   const uint32_t count = m_snapshot_iterations;
+   OS* os = OS::get_singleton();
+
+   for (int c = 0; c < m_entity_counts.size(); c++)
+   {
+      const uint32_t ecount = MAX(0, m_entity_counts[c]);
+
+      // Build the reference snapshot, spreading the entities through all registered types
+      Ref<kehSnapshot> base = memnew(kehSnapshot(1));
+      for (int t = 0; t < types.size(); t++)
+         base->add_type(types[t]);
+
+      for (uint32_t i = 0; i < ecount; i++)
+      {
+         const uint32_t ehash = types[i % types.size()];
+         const Ref<kehEntityInfo> einfo = sdata->get_entity_info(ehash);
+         Ref<kehSnapEntityBase> entity = einfo->create_instance(i + 1, 0);
+         randomize_entity(einfo, entity);
+         base->add_entity(ehash, entity);
+      }
+      base->finish();
+
+      Ref<kehEncDecBuffer> buffer = memnew(kehEncDecBuffer);
+
+      uint64_t start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+      {
+         buffer->set_buffer(PoolByteArray());
+         sdata->encode_full(base, buffer, 0);
+      }
+      const uint64_t full_usec = os->get_ticks_usec() - start;
+      const PoolByteArray full_data = buffer->get_buffer();
+
+      start = os->get_ticks_usec();
+      for (uint32_t i = 0; i < count; i++)
+      {
+         buffer->set_buffer(full_data);
+         sdata->decode_full(buffer);
+      }
+      const uint64_t dfull_usec = os->get_ticks_usec() - start;
+
+      for (int r = 0; r < m_change_ratios.size(); r++)
+      {
+         const float ratio = CLAMP(m_change_ratios[r], 0.0f, 1.0f);
+
+         // Build the "new" snapshot, with the given ratio of entities changed
+         Ref<kehSnapshot> snap = memnew(kehSnapshot(2));
+         uint32_t changed = 0;
+         for (int t = 0; t < types.size(); t++)
+         {
+            const uint32_t ehash = types[t];
+            const Ref<kehEntityInfo> einfo = sdata->get_entity_info(ehash);
+            snap->add_type(ehash);
+
+            const kehSnapshot::entity_data_t::Element* ecol = base->get_entity_collection(ehash);
+            const Vector<Ref<kehSnapEntityBase>>& earray = ecol->value().entity_array;
+            for (int i = 0; i < earray.size(); i++)
+            {
+               Ref<kehSnapEntityBase> entity = einfo->clone_entity(earray[i]);
+               if (m_rng.randf() < ratio)
+               {
+                  randomize_entity(einfo, entity);
+                  changed++;
+               }
+               snap->add_entity(ehash, entity);
+            }
+         }
+         snap->finish();
+
+         start = os->get_ticks_usec();
+         for (uint32_t i = 0; i < count; i++)
+         {
+            buffer->set_buffer(PoolByteArray());
+            sdata->encode_delta(snap, base, buffer, 0);
+         }
+         const uint64_t delta_usec = os->get_ticks_usec() - start;
+         const PoolByteArray delta_data = buffer->get_buffer();
+
+         start = os->get_ticks_usec();
+         for (uint32_t i = 0; i < count; i++)
+         {
+            buffer->set_buffer(delta_data);
+            sdata->decode_delta(buffer, base);
+         }
+         const uint64_t ddelta_usec = os->get_ticks_usec() - start;
+
+         Dictionary entry;
+         entry["entities"] = ecount;
+         entry["change_ratio"] = ratio;
+         entry["changed"] = changed;
+         entry["encode_full_ns"] = nsec_per_op(full_usec, count);
+         entry["decode_full_ns"] = nsec_per_op(dfull_usec, count);
+         entry["full_bytes"] = full_data.size();
+         entry["encode_delta_ns"] = nsec_per_op(delta_usec, count);
+         entry["decode_delta_ns"] = nsec_per_op(ddelta_usec, count);
+         entry["delta_bytes"] = delta_data.size();
+         ret.push_back(entry);
+      }
+   }
+
+   return ret;
+}
+
+
+Dictionary kehNetBenchmark::run()
+{
+   m_rng.seed(m_seed);
+
+   Dictionary ret;
+   Dictionary config;
+   config["iterations"] = m_iterations;
+   config["snapshot_iterations"] = m_snapshot_iterations;
+   config["entity_counts"] = m_entity_counts;
+   config["change_ratios"] = m_change_ratios;
+   config["seed"] = m_seed;
+   ret["config"] = config;
+
+   ret["buffer"] = run_buffer();
+   ret["quantize"] = run_quantize();
+   ret["change_detection"] = run_change_detection();
+
+   kehNetwork* network = kehNetwork::get_singleton();
+   Ref<kehSnapshotData> sdata = network ? network->get_snapshot_data() : Ref<kehSnapshotData>();
+   PoolVector<uint32_t> types;
+   if (sdata.is_valid())
+   {
+      sdata->get_entity_types(types);
+   }
+
+   if (types.size() == 0)
+   {
+      WARN_PRINT("Network benchmark: there are no registered snapshot entity types, skipping entity and snapshot benchmarks.");
+   }
+   else
+   {
+      ret["entity"] = run_entity(sdata, types);
+      ret["snapshot"] = run_snapshot(sdata, types);
+   }
+
+   return ret;
+}
+
+
+void kehNetBenchmark::_bind_methods()
+{
+   ClassDB::bind_method(D_METHOD("run"), &kehNetBenchmark::run);
+
+   ClassDB::bind_method(D_METHOD("set_iterations", "iterations"), &kehNetBenchmark::set_iterations);
+   ClassDB::bind_method(D_METHOD("get_iterations"), &kehNetBenchmark::get_iterations);
+   ClassDB::bind_method(D_METHOD("set_snapshot_iterations", "iterations"), &kehNetBenchmark::set_snapshot_iterations);
+   ClassDB::bind_method(D_METHOD("get_snapshot_iterations"), &kehNetBenchmark::get_snapshot_iterations);
+   ClassDB::bind_method(D_METHOD("set_entity_counts", "counts"), &kehNetBenchmark::set_entity_counts);
+   ClassDB::bind_method(D_METHOD("get_entity_counts"), &kehNetBenchmark::get_entity_counts);
+   ClassDB::bind_method(D_METHOD("set_change_ratios", "ratios"), &kehNetBenchmark::set_change_ratios);
+   ClassDB::bind_method(D_METHOD("get_change_ratios"), &kehNetBenchmark::get_change_ratios);
+   ClassDB::bind_method(D_METHOD("set_seed", "seed"), &kehNetBenchmark::set_seed);
+   ClassDB::bind_method(D_METHOD("get_seed"), &kehNetBenchmark::get_seed);
+
+   ADD_PROPERTY(PropertyInfo(Variant::INT, "iterations"), "set_iterations", "get_iterations");
+   ADD_PROPERTY(PropertyInfo(Variant::INT, "snapshot_iterations"), "set_snapshot_iterations", "get_snapshot_iterations");
+   ADD_PROPERTY(PropertyInfo(Variant::POOL_INT_ARRAY, "entity_counts"), "set_entity_counts", "get_entity_counts");
+   ADD_PROPERTY(PropertyInfo(Variant::POOL_REAL_ARRAY, "change_ratios"), "set_change_ratios", "get_change_ratios");
+   ADD_PROPERTY(PropertyInfo(Variant::INT, "seed"), "set_seed", "get_seed");
+}
+
+
+kehNetBenchmark::kehNetBenchmark()
+{
+   m_iterations = 10000;
+   m_snapshot_iterations = 100;
+   m_seed = 0;
+
+   m_entity_counts.append(16);
+   m_entity_counts.append(128);
+   m_entity_counts.append(1024);
+
+   m_change_ratios.append(0.0f);
+   m_change_ratios.append(0.1f);
+   m_change_ratios.append(0.5f);
+   m_change_ratios.append(1.0f);
+}
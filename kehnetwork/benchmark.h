@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_BENCHMARK_H
+#define _KEHNETWORK_BENCHMARK_H 1
+
+// Microbenchmarks of the code paths that run every tick when snapshots are replicated: the EncDecBuffer
+// writers/readers, quantization, change detection kernels, change mask calculation, entity encoding and full/delta snapshot encoding
+// and decoding. Entities are taken from the snapshot entity types registered by the project (each type being
+// one property mix), filled with random values. The entity counts and the ratio of changed entities used on
+// the snapshot benchmarks can be configured.
+// Results are given in a Dictionary, which can be converted into JSON in order to compare different versions.
+// Times are in nanoseconds per operation.
+
+#include "core/reference.h"
+#include "core/math/random_pcg.h"
+
+
+class kehEntityInfo;
+class kehSnapEntityBase;
+class kehSnapshot;
+class kehSnapshotData;
+
+
+class kehNetBenchmark : public Reference
+{
+   GDCLASS(kehNetBenchmark, Reference);
+private:
+   // Number of operations of each measurement on the buffer, quantization and entity benchmarks
+   int32_t m_iterations;
+   // Number of operations of each measurement on the snapshot benchmarks
+   int32_t m_snapshot_iterations;
+   // Number of entities within the snapshots. Each count results in one set of snapshot benchmarks
+   PoolIntArray m_entity_counts;
+   // Ratio (0 to 1) of entities that change between the two snapshots used to benchmark delta encoding
+   PoolRealArray m_change_ratios;
+
+   RandomPCG m_rng;
+   int64_t m_seed;
+
+private:
+   static double nsec_per_op(uint64_t usec, uint32_t ops) { return ops > 0 ? double(usec) * 1000.0 / double(ops) : 0.0; }
+
+   // Generate a random value for a replicable property of the given type
+   Variant random_value(int type);
+   // Assign random values into all replicable properties of the entity, except ID and class hash
+   void randomize_entity(const Ref<kehEntityInfo>& einfo, const Ref<kehSnapEntityBase>& entity);
+
+   Dictionary run_buffer();
+   Dictionary run_quantize();
+   Dictionary run_change_detection();
+   Array run_entity(const Ref<kehSnapshotData>& sdata, const PoolVector<uint32_t>& types);
+   Array run_snapshot(const Ref<kehSnapshotData>& sdata, const PoolVector<uint32_t>& types);
+
+protected:
+   static void _bind_methods();
+
+public:
+   // Run all benchmarks. Snapshot data is taken from the kehNetwork singleton, which must be initialized
+   Dictionary run();
+
+   void set_iterations(int32_t iterations) { m_iterations = MAX(1, iterations); }
+   int32_t get_iterations() const { return m_iterations; }
+
+   void set_snapshot_iterations(int32_t iterations) { m_snapshot_iterations = MAX(1, iterations); }
+   int32_t get_snapshot_iterations() const { return m_snapshot_iterations; }
+
+   void set_entity_counts(const PoolIntArray& counts) { m_entity_counts = counts; }
+   PoolIntArray get_entity_counts() const { return m_entity_counts; }
+
+   void set_change_ratios(const PoolRealArray& ratios) { m_change_ratios = ratios; }
+   PoolRealArray get_change_ratios() const { return m_change_ratios; }
+
+   void set_seed(int64_t seed) { m_seed = seed; }
+   int64_t get_seed() const { return m_seed; }
+
+   kehNetBenchmark();
+};
+
+
+#endif
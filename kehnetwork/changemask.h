@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_CHANGEMASK_H
+#define _KEHNETWORK_CHANGEMASK_H 1
+
+// Tells which replicable properties of a snapshot entity have changed, one bit per property. Bit index
+// matches the index of the property within the kehEntityInfo replicable list.
+//
+// Storage is a fixed array of words so no allocation is needed when calculating change masks, which happens
+// for every single entity in every single delta snapshot. The width of the mask is not related to how it is
+// encoded, that is decided by kehEntityInfo based on the amount of properties of the entity type.
+
+#include "core/typedefs.h"
+
+class kehChangeMask
+{
+public:
+   // Maximum amount of replicable properties per entity type
+   static const uint32_t MAX_BITS = 256;
+
+private:
+   static const uint32_t WORD_COUNT = MAX_BITS / 32;
+
+   uint32_t m_word[WORD_COUNT];
+
+   static uint32_t popcount(uint32_t v)
+   {
+      v = v - ((v >> 1) & 0x55555555);
+      v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+      return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+   }
+
+public:
+   void set_bit(uint32_t index) { m_word[index >> 5] |= (1u << (index & 31)); }
+   bool is_set(uint32_t index) const { return (m_word[index >> 5] & (1u << (index & 31))) != 0; }
+
+   // Set the first count bits
+   void set_first(uint32_t count)
+   {
+      clear();
+      for (uint32_t i = 0; i < (count >> 5); i++)
+      {
+         m_word[i] = 0xFFFFFFFF;
+      }
+      if (count & 31)
+      {
+         m_word[count >> 5] = (1u << (count & 31)) - 1;
+      }
+   }
+
+   // Bytes are used as the "groups" when encoding the mask
+   uint8_t get_byte(uint32_t index) const { return (m_word[index >> 2] >> ((index & 3) * 8)) & 0xFF; }
+   void set_byte(uint32_t index, uint8_t value)
+   {
+      const uint32_t shift = (index & 3) * 8;
+      m_word[index >> 2] = (m_word[index >> 2] & ~(0xFFu << shift)) | (uint32_t(value) << shift);
+   }
+
+   // Amount of set bits
+   uint32_t count() const
+   {
+      uint32_t ret = 0;
+      for (uint32_t i = 0; i < WORD_COUNT; i++)
+      {
+         ret += popcount(m_word[i]);
+      }
+      return ret;
+   }
+
+   // Index of the lowest set bit or -1 if the mask is empty
+   int32_t first_set() const
+   {
+      for (uint32_t i = 0; i < WORD_COUNT; i++)
+      {
+         const uint32_t w = m_word[i];
+         if (w != 0)
+         {
+            // Isolate the lowest bit then count the bits bellow it
+            return (i << 5) + popcount((w & (~w + 1)) - 1);
+         }
+      }
+      return -1;
+   }
+
+   bool operator==(const kehChangeMask& other) const
+   {
+      for (uint32_t i = 0; i < WORD_COUNT; i++)
+      {
+         if (m_word[i] != other.m_word[i])
+            return false;
+      }
+      return true;
+   }
+
+   bool is_empty() const
+   {
+      uint32_t acc = 0;
+      for (uint32_t i = 0; i < WORD_COUNT; i++)
+      {
+         acc |= m_word[i];
+      }
+      return acc == 0;
+   }
+
+   void clear()
+   {
+      for (uint32_t i = 0; i < WORD_COUNT; i++)
+      {
+         m_word[i] = 0;
+      }
+   }
+
+   kehChangeMask& operator|=(const kehChangeMask& other)
+   {
+      for (uint32_t i = 0; i < WORD_COUNT; i++)
+      {
+         m_word[i] |= other.m_word[i];
+      }
+      return *this;
+   }
+
+   kehChangeMask() { clear(); }
+};
+
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "clocksync.h"
+
+#include "core/os/os.h"
+#include "core/math/math_funcs.h"
+
+// How much of the difference between the sample and the current estimate is applied
+#define SAMPLE_GAIN 0.1
+// How strongly the dilation reacts to the error between client tick and target tick
+#define DILATION_GAIN 0.05f
+
+
+void kehClockSync::advance(double tick_time)
+{
+   const uint64_t now = OS::get_singleton()->get_ticks_usec();
+   if (m_synced && tick_time > 0.0)
+   {
+      m_server_tick += (double(now - m_last_time) / 1000000.0) / tick_time;
+   }
+   m_last_time = now;
+}
+
+
+void kehClockSync::configure(float max_dilation, float safety_margin, float resync_threshold)
+{
+   m_max_dilation = max_dilation;
+   m_safety_margin = safety_margin;
+   m_resync_threshold = resync_threshold;
+}
+
+
+void kehClockSync::reset()
+{
+   m_synced = false;
+   m_server_tick = 0.0;
+   m_client_tick = 0.0;
+   m_lead = 0.0;
+   m_last_time = 0;
+   m_dilation = 1.0f;
+}
+
+
+void kehClockSync::on_server_tick(uint32_t server_tick, float rtt, float jitter, double tick_time)
+{
+   if (tick_time <= 0.0)
+      return;
+   
+   advance(tick_time);
+
+   // The snapshot left the server about half of the round trip time ago
+   const double half_rtt = (rtt * 0.5) / 1000.0 / tick_time;
+   const double sample = double(server_tick) + half_rtt;
+
+   // Input must travel half of the round trip to reach the server. Jitter and the margin add some room so
+   // slightly late packets still arrive in time
+   m_lead = half_rtt + (jitter * 2.0) / 1000.0 / tick_time + m_safety_margin;
+
+   if (!m_synced)
+   {
+      m_server_tick = sample;
+      m_client_tick = m_server_tick + m_lead;
+      m_synced = true;
+      return;
+   }
+
+   const double diff = sample - m_server_tick;
+   if (Math::abs(diff) > m_resync_threshold)
+   {
+      m_server_tick = sample;
+   }
+   else
+   {
+      m_server_tick += diff * SAMPLE_GAIN;
+   }
+}
+
+
+void kehClockSync::on_local_tick(double tick_time)
+{
+   if (!m_synced)
+      return;
+   
+   advance(tick_time);
+   m_client_tick += 1.0;
+
+   // Positive error means the client is too far ahead, so it must slow down
+   const double error = m_client_tick - get_target_tick();
+
+   if (Math::abs(error) > m_resync_threshold)
+   {
+      m_client_tick = get_target_tick();
+      m_dilation = 1.0f;
+   }
+   else
+   {
+      m_dilation = CLAMP(1.0f - float(error) * DILATION_GAIN, 1.0f - m_max_dilation, 1.0f + m_max_dilation);
+   }
+}
+
+
+kehClockSync::kehClockSync()
+{
+   configure(0.05f, 1.0f, 30.0f);
+   reset();
+}
@@ -0,0 +1,88 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef _KEHNETWORK_CLOCKSYNC_H
+#define _KEHNETWORK_CLOCKSYNC_H 1
+
+#include "core/typedefs.h"
+
+// Snapshot signatures are generated independently on each machine, so nothing ties the simulation tick of a
+// client to the one of the server. This class is meant to be used on clients in order to estimate the current
+// server tick, based on the signatures of incoming snapshots and the measured round trip time.
+// With this estimate the client should run slightly ahead of the server, by half of the round trip time plus a
+// safety margin, so its input data arrives at the server just before it's needed. Instead of directly jumping
+// into the desired tick (which would cause visible "snaps"), a time dilation value is calculated, which slightly
+// speeds up or slows down the client simulation until it reaches the target. Only when the error is too big
+// the client tick is reset.
+// All the "ticks" are given as real numbers because the estimation is continuous.
+
+class kehClockSync
+{
+private:
+   // Maximum deviation of the dilation from 1.0
+   float m_max_dilation;
+   // Extra ticks added to the lead, beyond half of the round trip time and the jitter
+   float m_safety_margin;
+   // If the error (in ticks) is bigger than this, hard reset instead of dilating time
+   float m_resync_threshold;
+
+   // False until the first snapshot sample arrives
+   bool m_synced;
+   // Estimated server tick at the moment of m_last_time
+   double m_server_tick;
+   // The local simulation, in the server tick timeline
+   double m_client_tick;
+   // How many ticks the client should be ahead of the server
+   double m_lead;
+   // Time, in microseconds, in which the server tick estimate was last advanced
+   uint64_t m_last_time;
+   // The calculated time dilation
+   float m_dilation;
+
+private:
+   // Advance the server tick estimate based on the elapsed real time
+   void advance(double tick_time);
+
+public:
+   void configure(float max_dilation, float safety_margin, float resync_threshold);
+
+   void reset();
+
+   // Must be called on clients whenever snapshot data arrives from the server. RTT and jitter in milliseconds
+   // and tick time in seconds.
+   void on_server_tick(uint32_t server_tick, float rtt, float jitter, double tick_time);
+
+   // Must be called on clients once per local simulation tick. This updates the time dilation value.
+   void on_local_tick(double tick_time);
+
+   bool is_synced() const { return m_synced; }
+   double get_estimated_server_tick() const { return m_server_tick; }
+   double get_client_tick() const { return m_client_tick; }
+   double get_target_tick() const { return m_server_tick + m_lead; }
+   float get_dilation() const { return m_dilation; }
+
+   kehClockSync();
+};
+
+
+#endif
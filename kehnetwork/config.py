@@ -11,8 +11,12 @@ def get_doc_classes():
 	return [
 		"kehCustomProperty",
 		"kehInputData",
+		"kehMemoryNetwork",
+		"kehMemoryPeer",
+		"kehNetBenchmark",
 		"kehNetNodeSpawner",
 		"kehNetDefaultSpawner",
+		"kehNetPoolingSpawner",
 		"kehPlayerNode",
 		"kehPlayerData",
 		"kehSnapEntityBase",
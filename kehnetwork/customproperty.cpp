@@ -27,13 +27,30 @@
 
 
 
-bool kehCustomProperty::encode_to(Ref<kehEncDecBuffer>& into, const String& pname, uint32_t expected_type, bool force_encode)
+bool kehCustomProperty::is_encodable(uint32_t type)
+{
+   switch (type)
+   {
+      case Variant::BOOL:
+      case Variant::INT:
+      case Variant::REAL:
+      case Variant::VECTOR2:
+      case Variant::RECT2:
+      case Variant::VECTOR3:
+      case Variant::QUAT:
+      case Variant::COLOR:
+      case Variant::STRING:
+         return true;
+   }
+
+   return false;
+}
+
+
+bool kehCustomProperty::encode_to(Ref<kehEncDecBuffer>& into, uint32_t expected_type, bool force_encode)
 {
    if (!m_dirty && !force_encode)
       return false;
-   
-   // Write the property name
-   into->write_string(pname);
 
    bool e = false;
    // Then the value
@@ -57,6 +74,12 @@ bool kehCustomProperty::encode_to(Ref<kehEncDecBuffer>& into, const String& pnam
          e = true;
       } break;
 
+      case Variant::VECTOR2:
+      {
+         into->write_vector2(m_value);
+         e = true;
+      } break;
+
       case Variant::RECT2:
       {
          into->write_rect2(m_value);
@@ -185,6 +208,7 @@ void kehCustomProperty::_bind_methods()
 kehCustomProperty::kehCustomProperty(const Variant& initial, ReplicationMode mode) :
    m_value(initial),
    m_replicate(mode),
-   m_dirty(false)
+   m_dirty(false),
+   m_id(INVALID_ID)
 {
 }
\ No newline at end of file
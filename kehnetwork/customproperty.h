@@ -51,14 +51,24 @@ private:
    // changing the "value" of the property
    bool m_dirty;
 
+   // Name and numeric ID of this property. The ID is assigned at registration and replaced by the one in the
+   // table given by the server when joining, so it's the same on every machine. Only the ID is replicated.
+   String m_name;
+   uint32_t m_id;
+
 protected:
    static void _bind_methods();
 
 public:
+   // Used as ID of properties that don't exist in the table given by the server
+   static const uint32_t INVALID_ID = 0xFFFF;
+
+   // Returns true if values of the given type can be encoded into the EncDecBuffer
+   static bool is_encodable(uint32_t type);
 
-   // Encode this property into the given EncDecBuffer, provided the expected type is supported.
+   // Encode the value of this property into the given EncDecBuffer, provided the expected type is supported.
    // If force_encode is true then the value will be encoded even if the dirty state is false.
-   bool encode_to(Ref<kehEncDecBuffer>& into, const String& pname, uint32_t expected_type, bool force_encode);
+   bool encode_to(Ref<kehEncDecBuffer>& into, uint32_t expected_type, bool force_encode);
 
    bool decode_from(Ref<kehEncDecBuffer>& from, uint32_t expected_type, bool make_dirty);
 
@@ -70,6 +80,12 @@ public:
    bool is_dirty() const { return m_dirty; }
    void clear_dirt() { m_dirty = false; }
 
+   const String& get_name() const { return m_name; }
+   void set_name(const String& n) { m_name = n; }
+
+   uint32_t get_id() const { return m_id; }
+   void set_id(uint32_t i) { m_id = i; }
+
    kehCustomProperty(const Variant& initial = NULL, ReplicationMode mode = ReplicationMode::ServerOnly);
 };
 
@@ -0,0 +1,128 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_DELTACODEC_H
+#define _KEHNETWORK_DELTACODEC_H 1
+
+// Helpers to encode a changed property relative to its value in the baseline entity, used by the
+// EncodeDelta and EncodeXor property encodings (see kehSnapEntityBase::PropertyEncoding).
+//
+// Integers are written as the zigzag varint of the difference, so a counter going from 1530 to 1529 takes
+// a single byte. Floating point values are written as the varint of their bits XOR'd with the baseline bits.
+// When the value changes a little the sign, exponent and highest mantissa bits are the same, resulting in
+// leading zeros that the varint doesn't have to encode.
+
+#include "core/math/quat.h"
+#include "core/math/rect2.h"
+#include "core/math/vector3.h"
+#include "core/color.h"
+
+#include "../kehgeneral/encdecbuffer.h"
+
+#include <string.h>
+
+struct kehDeltaCodec
+{
+   static uint32_t float_bits(float v) { uint32_t ret; memcpy(&ret, &v, 4); return ret; }
+   static float bits_float(uint32_t b) { float ret; memcpy(&ret, &b, 4); return ret; }
+
+   // Integers. Unsigned values are also dealt with here, wrapping around makes the difference correct
+   static void write_diff(kehEncDecBuffer* into, uint32_t value, uint32_t base) { into->write_varint(int32_t(value - base)); }
+   static uint32_t read_diff(kehEncDecBuffer* from, uint32_t base) { return base + uint32_t(from->read_varint()); }
+
+   static void write_xor(kehEncDecBuffer* into, float value, float base) { into->write_varuint(float_bits(value) ^ float_bits(base)); }
+   static float read_xor(kehEncDecBuffer* from, float base) { return bits_float(from->read_varuint() ^ float_bits(base)); }
+
+   static void write_xor(kehEncDecBuffer* into, const Vector2& value, const Vector2& base)
+   {
+      write_xor(into, value.x, base.x);
+      write_xor(into, value.y, base.y);
+   }
+   static Vector2 read_xor(kehEncDecBuffer* from, const Vector2& base)
+   {
+      const float x = read_xor(from, base.x);
+      return Vector2(x, read_xor(from, base.y));
+   }
+
+   static void write_xor(kehEncDecBuffer* into, const Rect2& value, const Rect2& base)
+   {
+      write_xor(into, value.position, base.position);
+      write_xor(into, value.size, base.size);
+   }
+   static Rect2 read_xor(kehEncDecBuffer* from, const Rect2& base)
+   {
+      const Vector2 p = read_xor(from, base.position);
+      return Rect2(p, read_xor(from, base.size));
+   }
+
+   static void write_xor(kehEncDecBuffer* into, const Vector3& value, const Vector3& base)
+   {
+      write_xor(into, value.x, base.x);
+      write_xor(into, value.y, base.y);
+      write_xor(into, value.z, base.z);
+   }
+   static Vector3 read_xor(kehEncDecBuffer* from, const Vector3& base)
+   {
+      Vector3 ret;
+      ret.x = read_xor(from, base.x);
+      ret.y = read_xor(from, base.y);
+      ret.z = read_xor(from, base.z);
+      return ret;
+   }
+
+   static void write_xor(kehEncDecBuffer* into, const Quat& value, const Quat& base)
+   {
+      write_xor(into, value.x, base.x);
+      write_xor(into, value.y, base.y);
+      write_xor(into, value.z, base.z);
+      write_xor(into, value.w, base.w);
+   }
+   static Quat read_xor(kehEncDecBuffer* from, const Quat& base)
+   {
+      Quat ret;
+      ret.x = read_xor(from, base.x);
+      ret.y = read_xor(from, base.y);
+      ret.z = read_xor(from, base.z);
+      ret.w = read_xor(from, base.w);
+      return ret;
+   }
+
+   static void write_xor(kehEncDecBuffer* into, const Color& value, const Color& base)
+   {
+      write_xor(into, value.r, base.r);
+      write_xor(into, value.g, base.g);
+      write_xor(into, value.b, base.b);
+      write_xor(into, value.a, base.a);
+   }
+   static Color read_xor(kehEncDecBuffer* from, const Color& base)
+   {
+      Color ret;
+      ret.r = read_xor(from, base.r);
+      ret.g = read_xor(from, base.g);
+      ret.b = read_xor(from, base.b);
+      ret.a = read_xor(from, base.a);
+      return ret;
+   }
+};
+
+
+#endif
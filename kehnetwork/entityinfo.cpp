@@ -22,11 +22,14 @@
 
 #include "entityinfo.h"
 #include "snapentity.h"
+#include "nativeentity.h"
+#include "deltacodec.h"
 #include "nodespawner.h"
 
 #include "../kehgeneral/encdecbuffer.h"
 
 #include "core/io/resource_loader.h"
+#include "core/project_settings.h"
 #include "core/resource.h"
 #include "scene/main/node.h"
 
@@ -52,51 +55,113 @@ void kehEntityInfo::register_spawner(uint32_t chash, const Ref<kehNetNodeSpawner
 
 Ref<kehSnapEntityBase> kehEntityInfo::create_instance(uint32_t uid, uint32_t chash) const
 {
-   Ref<kehSnapEntityBase> ret;
-   if (m_resource.is_valid() && m_resource->can_instance())
-   {
-      ret = Ref<kehSnapEntityBase>(memnew(kehSnapEntityBase(uid, chash)));
-
-      ret->set_script(m_resource.get_ref_ptr());
-   }
-
-   return ret;
+   return instance_entity(uid, chash, true);
 }
 
 Ref<kehSnapEntityBase> kehEntityInfo::clone_entity(const Ref<kehSnapEntityBase>& entity) const
 {
    ERR_FAIL_COND_V_MSG(m_resource != entity->get_script(), NULL, "Given object to be cloned does not match entity type descbribed by this info.");
 
-   Ref<kehSnapEntityBase> ret = create_instance(entity->get_uid(), entity->get_class_hash());
+   // Every replicable property will be copied, so no need to reset a recycled object
+   Ref<kehSnapEntityBase> ret = instance_entity(entity->get_uid(), entity->get_class_hash(), false);
 
    for (uint32_t i = 0; i < m_replicable.size(); i++)
    {
-      const String name = m_replicable[i].name;
-      ret->set(name, entity->get(name));
+      const ReplicableProperty& rp = m_replicable[i];
+      if (rp.native)
+      {
+         rp.native->copy(entity.ptr(), ret.ptr());
+      }
+      else
+      {
+         ret->set(rp.name, entity->get(rp.name));
+      }
    }
 
    return ret;
 }
 
 
-uint32_t kehEntityInfo::calculate_change_mask(const Ref<kehSnapEntityBase>& e1, const Ref<kehSnapEntityBase>& e2) const
+void kehEntityInfo::set_replicable_value(const Ref<kehSnapEntityBase>& entity, uint32_t index, const Variant& value) const
+{
+   const ReplicableProperty& rp = m_replicable[index];
+   if (rp.native)
+   {
+      rp.native->set(entity.ptr(), value);
+   }
+   else
+   {
+      entity->set(rp.name, value);
+   }
+}
+
+
+kehChangeMask kehEntityInfo::calculate_change_mask(const Ref<kehSnapEntityBase>& e1, const Ref<kehSnapEntityBase>& e2) const
 {
    // FIXME: properly check if the given entities are indeed of the same type. The get_script() is not working.
    //ERR_FAIL_COND_V_MSG(e1->get_script() == e2->get_script(), 0, "The two given entities are of different types.");
 
-   uint32_t ret = 0;
+   kehChangeMask ret;
+
+   if (m_native)
+   {
+      // Typed comparison, directly on the members
+      for (uint32_t i = 0; i < m_replicable.size(); i++)
+      {
+         if (!m_replicable[i].native->equal(e1.ptr(), e2.ptr()))
+            ret.set_bit(i);
+      }
+
+      return ret;
+   }
+
+   return calculate_script_mask(e1.ptr(), e2.ptr());
+}
+
+
+kehChangeMask kehEntityInfo::calculate_script_mask(const kehSnapEntityBase* e1, const kehSnapEntityBase* e2) const
+{
+   kehChangeMask ret;
 
    for (uint32_t i = 0; i < m_replicable.size(); i++)
    {
-      const String pname = m_replicable[i].name;
-      if (!m_replicable[i].comparer(e1->get(pname), e2->get(pname)))
-         ret |= m_replicable[i].mask;
+      const ReplicableProperty& rp = m_replicable[i];
+      const Variant v1 = e1->get(rp.name);
+      const Variant v2 = e2->get(rp.name);
+      const bool equal = rp.quant.is_enabled() ? rp.quant.equal_variant(rp.type, v1, v2) : rp.comparer(v1, v2);
+      if (!equal)
+         ret.set_bit(i);
    }
 
    return ret;
 }
 
 
+void kehEntityInfo::calculate_change_masks(const kehSnapEntityBase* const* e1, const kehSnapEntityBase* const* e2, uint32_t count, kehChangeMask* out) const
+{
+   for (uint32_t i = 0; i < count; i++)
+   {
+      out[i].clear();
+   }
+
+   if (m_native)
+   {
+      for (uint32_t p = 0; p < m_replicable.size(); p++)
+      {
+         m_replicable[p].native->compare_batch(e1, e2, count, p, out);
+      }
+
+      return;
+   }
+
+   // Scripted entities can only be accessed through Variants, one entity at a time
+   for (uint32_t i = 0; i < count; i++)
+   {
+      out[i] = calculate_script_mask(e1[i], e2[i]);
+   }
+}
+
+
 void kehEntityInfo::encode_full_entity(const Ref<kehSnapEntityBase>& entity, Ref<kehEncDecBuffer>& into) const
 {
    // Ensure the ID is encoded first
@@ -126,7 +191,8 @@ Ref<kehSnapEntityBase> kehEntityInfo::decode_full_entity(Ref<kehEncDecBuffer>& f
    // If the class hash was not disable, read it
    const uint32_t chash = m_has_chash ? from->read_uint() : 0;
 
-   Ref<kehSnapEntityBase> entity = create_instance(uid, chash);
+   // All properties will be decoded, so there is no need to reset a recycled object
+   Ref<kehSnapEntityBase> entity = instance_entity(uid, chash, false);
 
    // Read (decode) the properties
    const uint32_t rsize = m_replicable.size();
@@ -144,39 +210,17 @@ Ref<kehSnapEntityBase> kehEntityInfo::decode_full_entity(Ref<kehEncDecBuffer>& f
 }
 
 
-void kehEntityInfo::encode_delta_entity(uint32_t uid, const Ref<kehSnapEntityBase>& entity, uint32_t cmask, Ref<kehEncDecBuffer>& into) const
+void kehEntityInfo::encode_delta_entity(const Ref<kehSnapEntityBase>& entity, const Ref<kehSnapEntityBase>& baseline, const kehChangeMask& cmask, Ref<kehEncDecBuffer>& into) const
 {
    // Write entity unique ID
    into->write_uint(entity->get_uid());
 
-   // Write change mask - using the cached amount of bits for it.
-   switch (m_cmask_size)
-   {
-      case 1:
-      {
-         into->write_byte(cmask);
-      } break;
-
-      case 2:
-      {
-         into->write_ushort(cmask);
-      } break;
-
-      case 4:
-      {
-         into->write_uint(cmask);
-      } break;
-
-      default:
-      {
-         // TODO: Error out here
-         return;
-      }
-   }
+   // Write change mask - using the cached amount of groups for it.
+   write_change_mask(cmask, into);
 
    // Entity ID and change mask are written. However, if change mask is 0 then there is no need to
    // iterate through replicable properties
-   if (cmask == 0)
+   if (cmask.is_empty())
       return;
    
    // Iterate through replicable properties
@@ -189,39 +233,39 @@ void kehEntityInfo::encode_delta_entity(uint32_t uid, const Ref<kehSnapEntityBas
       if (rp.name == "id")
          continue;
       
-      if (rp.mask & cmask)
+      if (cmask.is_set(i))
       {
          // This is a changed property, so encode it
-         property_writer(rp, entity, into);
+         if (rp.encoding != kehSnapEntityBase::EncodeFull && baseline.is_valid())
+            property_delta_writer(rp, entity, baseline, into);
+         else
+            property_writer(rp, entity, into);
       }
    }
 }
 
 
-Ref<kehSnapEntityBase> kehEntityInfo::decode_delta_entity(Ref<kehEncDecBuffer>& from, uint32_t& outcmask) const
+Ref<kehSnapEntityBase> kehEntityInfo::decode_delta_entity(uint32_t uid, const Ref<kehSnapEntityBase>& baseline, Ref<kehEncDecBuffer>& from, kehChangeMask& outcmask) const
 {
-   // Decode entity ID
-   const uint32_t uid = from->read_uint();
    // Decode the change mask
-   outcmask = extract_change_mask(from);
-
-   if (outcmask == -1)
-      return NULL;
+   extract_change_mask(from, outcmask);
 
    // NOTE: the returned entity is meant to contain only the changed data. The rest that does not match in the change
    // mask will be left with default values
    Ref<kehSnapEntityBase> ret = create_instance(uid, 0);
 
-   // Avoid replicable property looping if the change mask is 0, as this entity is marked for removal and does not
-   // contain any encoded data
-   if (outcmask > 0)
+   // Avoid replicable property looping if the change mask is 0, as there is no encoded data
+   if (!outcmask.is_empty())
    {
       for (uint32_t  i = 0; i < m_replicable.size(); i++)
       {
          ReplicableProperty rp = m_replicable.get(i);
-         if (rp.name != "id" && rp.mask & outcmask)
+         if (rp.name != "id" && outcmask.is_set(i))
          {
-            property_reader(rp, from, ret);
+            if (rp.encoding != kehSnapEntityBase::EncodeFull && baseline.is_valid())
+               property_delta_reader(rp, baseline, from, ret);
+            else
+               property_reader(rp, from, ret);
          }
       }
    }
@@ -232,43 +276,151 @@ Ref<kehSnapEntityBase> kehEntityInfo::decode_delta_entity(Ref<kehEncDecBuffer>&
 
 
 
-uint32_t kehEntityInfo::get_full_change_mask() const
+kehChangeMask kehEntityInfo::get_full_change_mask() const
 {
-   uint32_t ret = 0;
-   switch (m_cmask_size)
+   return m_full_mask;
+}
+
+
+void kehEntityInfo::track_dirty(const Ref<kehSnapEntityBase>& entity, uint32_t sig, uint32_t prevsig)
+{
+   const uint32_t uid = entity->get_uid();
+   const uint32_t pcount = m_replicable.size();
+
+   DirtyRecord* rec = m_dirty.getptr(uid);
+   if (!rec)
    {
-      case 1:
+      m_dirty.set(uid, DirtyRecord());
+      rec = m_dirty.getptr(uid);
+      rec->prop_change.resize(pcount);
+      rec->last_seen = 0;
+      m_earliest_seen = MIN(m_earliest_seen, sig);
+   }
+
+   // Seen in this snapshot already (added more than once) or in the previous one. Anything else means there is a gap
+   const bool continuous = rec->last_seen != 0 && (rec->last_seen == sig || rec->last_seen == prevsig);
+
+   if (!continuous || entity->is_all_dirty())
+   {
+      // New entity or it was not part of the previous snapshot, so the reference snapshot may hold anything
+      for (uint32_t i = 0; i < pcount; i++)
       {
-         ret = 0xFF;
-      } break;
-      case 2:
+         rec->prop_change.write[i] = sig;
+      }
+      rec->last_change = sig;
+   }
+   else
+   {
+      kehChangeMask dirty = entity->get_dirty();
+      const Vector<StringName>& names = entity->get_dirty_names();
+      for (int i = 0; i < names.size(); i++)
       {
-         ret = 0xFFFF;
-      } break;
-      case 4:
+         const uint32_t* index = m_prop_index.getptr(names[i]);
+         if (index)
+            dirty.set_bit(*index);
+         else
+            WARN_PRINT(vformat("Marking unknown property '%s' of snapshot entity '%s' as dirty.", names[i], m_namestr));
+      }
+
+      if (!dirty.is_empty())
       {
-         ret = 0xFFFFFFFF;
-      } break;
+         for (uint32_t i = 0; i < pcount; i++)
+         {
+            if (dirty.is_set(i))
+               rec->prop_change.write[i] = sig;
+         }
+         rec->last_change = sig;
+      }
    }
-   return ret;
+
+   rec->last_seen = sig;
+}
+
+
+bool kehEntityInfo::get_dirty_mask(uint32_t uid, uint32_t refsig, kehChangeMask& out) const
+{
+   const DirtyRecord* rec = m_dirty.getptr(uid);
+   if (!rec)
+   {
+      // Not tracked, so there is no way to tell what changed
+      out = m_full_mask;
+      return true;
+   }
+
+   if (rec->last_change <= refsig)
+      return false;
+
+   out.clear();
+   for (int i = 0; i < rec->prop_change.size(); i++)
+   {
+      if (rec->prop_change[i] > refsig)
+         out.set_bit(i);
+   }
+
+   return true;
 }
 
 
-void kehEntityInfo::match_delta(Ref<kehSnapEntityBase>& changed, const Ref<kehSnapEntityBase>& source, uint32_t cmask) const
+void kehEntityInfo::purge_dirty(uint32_t oldest_sig)
+{
+   // Entities seen every snapshot keep the earliest last_seen recent, so in that case the scan happens once per history
+   // length instead of every snapshot
+   if (oldest_sig <= m_earliest_seen)
+      return;
+   
+   m_earliest_seen = UINT32_MAX;
+   Vector<uint32_t> stale;
+   for (const uint32_t* uid = m_dirty.next(NULL); uid; uid = m_dirty.next(uid))
+   {
+      const uint32_t last_seen = m_dirty.get(*uid).last_seen;
+      if (last_seen < oldest_sig)
+         stale.push_back(*uid);
+      else
+         m_earliest_seen = MIN(m_earliest_seen, last_seen);
+   }
+
+   for (int i = 0; i < stale.size(); i++)
+   {
+      m_dirty.erase(stale[i]);
+   }
+}
+
+
+void kehEntityInfo::match_delta(Ref<kehSnapEntityBase>& changed, const Ref<kehSnapEntityBase>& source, const kehChangeMask& cmask) const
 {
    for (uint32_t i = 0; i < m_replicable.size(); i++)
    {
-      ReplicableProperty rp = m_replicable[i];
+      const ReplicableProperty& rp = m_replicable[i];
 
       // Only take from old value if the replicable property is not marked as changed
-      if (!(rp.mask & cmask))
+      if (!cmask.is_set(i))
       {
-         changed->set(rp.name, source->get(rp.name));
+         if (rp.native)
+         {
+            rp.native->copy(source.ptr(), changed.ptr());
+         }
+         else
+         {
+            changed->set(rp.name, source->get(rp.name));
+         }
       }
    }
 }
 
 
+void kehEntityInfo::apply_state(const Ref<kehSnapEntityBase>& entity, Node* node) const
+{
+   if (m_native)
+   {
+      entity->apply_state(node);
+   }
+   else
+   {
+      entity->call("apply_state", node);
+   }
+}
+
+
 Node* kehEntityInfo::get_game_node(uint32_t uid) const
 {
    const Map<uint32_t, GameEntity>::Element* e = m_entity.find(uid);
@@ -280,11 +432,7 @@ void kehEntityInfo::clear_nodes()
 {
    for (Map<uint32_t, GameEntity>::Element* e = m_entity.front(); e; e = e->next())
    {
-      Node* n = e->value().node;
-      if (!n->is_queued_for_deletion())
-      {
-         n->queue_delete();
-      }
+      release_node(e->value().node);
    }
 
    m_entity.clear();
@@ -328,10 +476,7 @@ void kehEntityInfo::despawn_node(uint32_t uid)
    Map<uint32_t, GameEntity>::Element* gee = m_entity.find(uid);
    if (gee)
    {
-      GameEntity ge = gee->value();
-
-      if (!ge.node->is_queued_for_deletion())
-         ge.node->queue_delete();
+      release_node(gee->value().node);
       
       m_entity.erase(uid);
    }
@@ -394,7 +539,6 @@ String kehEntityInfo::check(const String& cname, const String& cpath)
    kehSnapEntityBase* dummy = memnew(kehSnapEntityBase);
    dummy->set_script(res.get_ref_ptr());
 
-   int mask = 1;
    int min_size = 2;         // Assume class_hash is not disabled
 
    List<PropertyInfo> plist;
@@ -411,16 +555,47 @@ String kehEntityInfo::check(const String& cname, const String& cpath)
             continue;
          }
 
-         ReplicableProperty rprop = build_replicable_prop(p.name, p.type, mask, dummy);
+         ReplicableProperty rprop = build_replicable_prop(p.name, p.type, dummy);
+
+         const String encmeta = p.name + "_encoding";
+         if (rprop.is_valid() && dummy->has_meta(encmeta))
+         {
+            const int enc = dummy->get_meta(encmeta);
+            if (enc != kehSnapEntityBase::EncodeFull && dummy->has_meta(p.name))
+            {
+               // Changes within the tolerance are not sent, so the client value drifts from the server one. Encoding
+               // relative to it would then rebuild something different from what the server has
+               WARN_PRINT(vformat("Encoding %d can't be used by property '%s' of snapshot entity class '%s' because it's compared with a tolerance.", enc, p.name, cname));
+            }
+            else if (enc == kehSnapEntityBase::EncodeFull || enc == get_delta_encoding(rprop.type))
+            {
+               rprop.encoding = enc;
+            }
+            else
+            {
+               WARN_PRINT(vformat("Encoding %d is not supported by property '%s' of snapshot entity class '%s'.", enc, p.name, cname));
+            }
+         }
+
+         const String quantmeta = p.name + "_quantize";
+         if (rprop.is_valid() && dummy->has_meta(quantmeta))
+         {
+            const String qerr = setup_quantization(rprop, dummy->get_meta(quantmeta));
+            if (!qerr.empty())
+               WARN_PRINT(vformat("Ignoring quantization of property '%s' of snapshot entity class '%s'. %s", p.name, cname, qerr));
+         }
 
          if (rprop.is_valid())
          {
             m_replicable.append(rprop);
-            mask = mask << 1;
          }
       }
    }
 
+   m_dirty_tracking = dummy->has_meta("dirty_tracking") && bool(dummy->get_meta("dirty_tracking"));
+   if (m_dirty_tracking)
+      force_full_encoding();
+
    memdelete(dummy);
    plist.clear();
 
@@ -428,18 +603,15 @@ String kehEntityInfo::check(const String& cname, const String& cpath)
    {
       return "There are no defined (supported) replicable properties in class " + cname;
    }
-   else
+
+   const String cmerr = setup_change_mask();
+   if (!cmerr.empty())
    {
-      if (m_replicable.size() <= 8)
-         m_cmask_size = 1;
-      else if (m_replicable.size() <= 16)
-         m_cmask_size = 2;
-      else if (m_replicable.size() <= 32)
-         m_cmask_size = 4;
-      else
-         return "There are more than 32 replicable properties, which is not supported by this system.";
+      return cmerr;
    }
 
+   build_property_index();
+
    m_resource = res;
    m_namestr = cname;
 
@@ -447,12 +619,62 @@ String kehEntityInfo::check(const String& cname, const String& cpath)
 }
 
 
+String kehEntityInfo::check_native(const kehNativeEntityType* type)
+{
+   m_name_hash = type->get_name().hash();
+   m_has_chash = type->has_class_hash();
+
+   const uint32_t fcount = type->get_field_count();
+   for (uint32_t i = 0; i < fcount; i++)
+   {
+      const kehNativeField* field = type->get_field(i);
+
+      ReplicableProperty rprop;
+      rprop.name = field->get_name();
+      rprop.type = field->get_type();
+      rprop.encoding = field->get_encoding();
+      rprop.native = field;
+
+      m_replicable.append(rprop);
+   }
+
+   // ID and class hash (if not disabled) are always part of the fields
+   const uint32_t min_size = m_has_chash ? 2 : 1;
+   if (m_replicable.size() <= min_size)
+   {
+      return "There are no defined replicable fields in native class " + type->get_name();
+   }
+
+   const String cmerr = setup_change_mask();
+   if (!cmerr.empty())
+   {
+      return cmerr;
+   }
+
+   build_property_index();
+
+   m_native = type;
+   m_namestr = type->get_name();
+   m_dirty_tracking = type->has_dirty_tracking();
+   if (m_dirty_tracking)
+      force_full_encoding();
+
+   return "";
+}
+
+
 String kehEntityInfo::get_comp_data() const
 {
    String ret = m_namestr + "\n";
    for (uint32_t i = 0; i < m_replicable.size(); i++)
    {
-      ret += vformat("- %s: %s\n", m_replicable[i].name, m_replicable[i].comparer.get_comparer_name());
+      const ReplicableProperty& rp = m_replicable[i];
+      if (rp.native)
+         ret += vformat("- %s: %s\n", rp.name, rp.native->get_comparer_name());
+      else if (rp.quant.is_enabled())
+         ret += vformat("- %s: %s\n", rp.name, rp.quant.get_name(rp.type));
+      else
+         ret += vformat("- %s: %s\n", rp.name, rp.comparer.get_comparer_name());
    }
 
    return ret;
@@ -461,7 +683,7 @@ String kehEntityInfo::get_comp_data() const
 
 
 
-kehEntityInfo::ReplicableProperty kehEntityInfo::build_replicable_prop(const String& name, Variant::Type type, int mask, kehSnapEntityBase* dummy)
+kehEntityInfo::ReplicableProperty kehEntityInfo::build_replicable_prop(const String& name, Variant::Type type, kehSnapEntityBase* dummy)
 {
    ReplicableProperty ret;
    ret.name = name;
@@ -479,7 +701,7 @@ kehEntityInfo::ReplicableProperty kehEntityInfo::build_replicable_prop(const Str
    if (tp != Variant::NIL)
    {
       ret.type = tp;
-      ret.mask = mask;
+      ret.defval = dummy->get(name);
    }
    
    return ret;
@@ -488,9 +710,21 @@ kehEntityInfo::ReplicableProperty kehEntityInfo::build_replicable_prop(const Str
 
 void kehEntityInfo::property_writer(const ReplicableProperty& rp, const Ref<kehSnapEntityBase>& entity, Ref<kehEncDecBuffer>& into) const
 {
+   if (rp.native)
+   {
+      rp.native->write(entity.ptr(), into.ptr());
+      return;
+   }
+
    // First take the value from the entity. It should be a Variant
    const Variant val = entity->get(rp.name);
 
+   if (rp.quant.is_enabled())
+   {
+      rp.quant.write_variant(rp.type, into.ptr(), val);
+      return;
+   }
+
    switch (rp.type)
    {
       case Variant::BOOL:
@@ -579,6 +813,7 @@ void kehEntityInfo::property_writer(const ReplicableProperty& rp, const Ref<kehS
       {
          const PoolRealArray ra(val);
          ERR_FAIL_COND_MSG(ra.size() > MAX_ARRAY_SIZE, vformat("Cannot encode an entity (%s) array property (%s) with more than 255 elements. Currently with %d.", m_namestr, rp.name, ra.size()));
+         into->write_byte(ra.size());
          for (uint32_t i = 0; i < ra.size(); i++)
          {
             into->write_float(ra[i]);
@@ -590,6 +825,18 @@ void kehEntityInfo::property_writer(const ReplicableProperty& rp, const Ref<kehS
 
 void kehEntityInfo::property_reader(const ReplicableProperty& rp, Ref<kehEncDecBuffer>& from, Ref<kehSnapEntityBase>& into) const
 {
+   if (rp.native)
+   {
+      rp.native->read(from.ptr(), into.ptr());
+      return;
+   }
+
+   if (rp.quant.is_enabled())
+   {
+      into->set(rp.name, rp.quant.read_variant(rp.type, from.ptr()));
+      return;
+   }
+
    switch (rp.type)
    {
       case Variant::BOOL:
@@ -672,7 +919,7 @@ void kehEntityInfo::property_reader(const ReplicableProperty& rp, Ref<kehEncDecB
             a.append(from->read_int());
          }
          into->set(rp.name, a);
-      }
+      } break;
 
       case Variant::POOL_REAL_ARRAY:
       {
@@ -688,19 +935,411 @@ void kehEntityInfo::property_reader(const ReplicableProperty& rp, Ref<kehEncDecB
 }
 
 
-uint32_t kehEntityInfo::extract_change_mask(Ref<kehEncDecBuffer>& from) const
+void kehEntityInfo::property_delta_writer(const ReplicableProperty& rp, const Ref<kehSnapEntityBase>& entity, const Ref<kehSnapEntityBase>& baseline, Ref<kehEncDecBuffer>& into) const
+{
+   kehEncDecBuffer* buf = into.ptr();
+
+   if (rp.native)
+   {
+      rp.native->write_delta(entity.ptr(), baseline.ptr(), buf);
+      return;
+   }
+
+   const Variant val = entity->get(rp.name);
+   const Variant base = baseline->get(rp.name);
+
+   switch (rp.type)
+   {
+      case Variant::INT:
+      case kehSnapEntityBase::CTYPE_UINT:
+      case kehSnapEntityBase::CTYPE_BYTE:
+      case kehSnapEntityBase::CTYPE_USHORT:
+      {
+         kehDeltaCodec::write_diff(buf, uint32_t(val), uint32_t(base));
+      } break;
+
+      case Variant::REAL:
+      {
+         kehDeltaCodec::write_xor(buf, float(val), float(base));
+      } break;
+
+      case Variant::VECTOR2:
+      {
+         kehDeltaCodec::write_xor(buf, Vector2(val), Vector2(base));
+      } break;
+
+      case Variant::RECT2:
+      {
+         kehDeltaCodec::write_xor(buf, Rect2(val), Rect2(base));
+      } break;
+
+      case Variant::QUAT:
+      {
+         kehDeltaCodec::write_xor(buf, Quat(val), Quat(base));
+      } break;
+
+      case Variant::COLOR:
+      {
+         kehDeltaCodec::write_xor(buf, Color(val), Color(base));
+      } break;
+
+      case Variant::VECTOR3:
+      {
+         kehDeltaCodec::write_xor(buf, Vector3(val), Vector3(base));
+      } break;
+
+      default:
+      {
+         // The encoding is validated when registering the entity type, so this should not happen
+         property_writer(rp, entity, into);
+      }
+   }
+}
+
+
+void kehEntityInfo::property_delta_reader(const ReplicableProperty& rp, const Ref<kehSnapEntityBase>& baseline, Ref<kehEncDecBuffer>& from, Ref<kehSnapEntityBase>& into) const
 {
-   switch (m_cmask_size)
+   kehEncDecBuffer* buf = from.ptr();
+
+   if (rp.native)
    {
-      case 1:
-         return from->read_byte();
-      case 2:
-         return from->read_ushort();
-      case 4:
-         return from->read_uint();
+      rp.native->read_delta(baseline.ptr(), buf, into.ptr());
+      return;
    }
-   // TODO: error out here
-   return -1;
+
+   const Variant base = baseline->get(rp.name);
+
+   switch (rp.type)
+   {
+      case Variant::INT:
+      {
+         into->set(rp.name, int32_t(kehDeltaCodec::read_diff(buf, uint32_t(base))));
+      } break;
+
+      case kehSnapEntityBase::CTYPE_UINT:
+      {
+         into->set(rp.name, kehDeltaCodec::read_diff(buf, uint32_t(base)));
+      } break;
+
+      case kehSnapEntityBase::CTYPE_BYTE:
+      {
+         into->set(rp.name, uint8_t(kehDeltaCodec::read_diff(buf, uint32_t(base))));
+      } break;
+
+      case kehSnapEntityBase::CTYPE_USHORT:
+      {
+         into->set(rp.name, uint16_t(kehDeltaCodec::read_diff(buf, uint32_t(base))));
+      } break;
+
+      case Variant::REAL:
+      {
+         into->set(rp.name, kehDeltaCodec::read_xor(buf, float(base)));
+      } break;
+
+      case Variant::VECTOR2:
+      {
+         into->set(rp.name, kehDeltaCodec::read_xor(buf, Vector2(base)));
+      } break;
+
+      case Variant::RECT2:
+      {
+         into->set(rp.name, kehDeltaCodec::read_xor(buf, Rect2(base)));
+      } break;
+
+      case Variant::QUAT:
+      {
+         into->set(rp.name, kehDeltaCodec::read_xor(buf, Quat(base)));
+      } break;
+
+      case Variant::COLOR:
+      {
+         into->set(rp.name, kehDeltaCodec::read_xor(buf, Color(base)));
+      } break;
+
+      case Variant::VECTOR3:
+      {
+         into->set(rp.name, kehDeltaCodec::read_xor(buf, Vector3(base)));
+      } break;
+
+      default:
+      {
+         property_reader(rp, from, into);
+      }
+   }
+}
+
+
+String kehEntityInfo::setup_quantization(ReplicableProperty& rp, const Variant& settings)
+{
+   // Either the number of bits, in which case floating point components are assumed to be in the [0..1] range,
+   // or an array with the number of bits followed by the range
+   int bits = 0;
+   float minval = 0.0f;
+   float maxval = 1.0f;
+   if (settings.get_type() == Variant::INT)
+   {
+      bits = settings;
+   }
+   else if (settings.get_type() == Variant::ARRAY)
+   {
+      const Array arr = settings;
+      if (arr.size() != 1 && arr.size() != 3)
+         return "Expected [bits] or [bits, min, max].";
+
+      bits = arr[0];
+      if (arr.size() == 3)
+      {
+         minval = arr[1];
+         maxval = arr[2];
+      }
+   }
+   else
+   {
+      return "The meta must be either the number of bits or an array.";
+   }
+
+   const String err = rp.quant.setup(rp.type, bits, minval, maxval);
+   if (!err.empty())
+      return err;
+
+   // Quantized values are always fully encoded
+   if (rp.encoding != kehSnapEntityBase::EncodeFull)
+   {
+      WARN_PRINT(vformat("Property '%s' is quantized, its encoding will be ignored.", rp.name));
+      rp.encoding = kehSnapEntityBase::EncodeFull;
+   }
+
+   return "";
+}
+
+
+int kehEntityInfo::get_delta_encoding(int type)
+{
+   switch (type)
+   {
+      case Variant::INT:
+      case kehSnapEntityBase::CTYPE_UINT:
+      case kehSnapEntityBase::CTYPE_BYTE:
+      case kehSnapEntityBase::CTYPE_USHORT:
+         return kehSnapEntityBase::EncodeDelta;
+
+      case Variant::REAL:
+      case Variant::VECTOR2:
+      case Variant::RECT2:
+      case Variant::QUAT:
+      case Variant::COLOR:
+      case Variant::VECTOR3:
+         return kehSnapEntityBase::EncodeXor;
+   }
+
+   return kehSnapEntityBase::EncodeFull;
+}
+
+
+Ref<kehSnapEntityBase> kehEntityInfo::instance_entity(uint32_t uid, uint32_t chash, bool reset) const
+{
+   Ref<kehSnapEntityBase> ret = m_pool.acquire();
+
+   if (ret.is_valid())
+   {
+      ret->set_uid(uid);
+      ret->set_class_hash(chash);
+      ret->clear_dirty();
+
+      if (reset)
+      {
+         for (uint32_t i = 0; i < m_replicable.size(); i++)
+         {
+            const ReplicableProperty& rp = m_replicable[i];
+            // Those two are not script properties and have already been set above
+            if (rp.name != "id" && rp.name != "class_hash")
+            {
+               if (rp.native)
+               {
+                  rp.native->copy(m_native->get_default(), ret.ptr());
+               }
+               else
+               {
+                  ret->set(rp.name, rp.defval);
+               }
+            }
+         }
+      }
+   }
+   else if (m_native)
+   {
+      ret = m_native->create();
+      ret->set_uid(uid);
+      ret->set_class_hash(chash);
+   }
+   else if (m_resource.is_valid() && m_resource->can_instance())
+   {
+      ret = Ref<kehSnapEntityBase>(memnew(kehSnapEntityBase(uid, chash)));
+
+      ret->set_script(m_resource.get_ref_ptr());
+   }
+
+   return ret;
+}
+
+
+void kehEntityInfo::release_node(Node* node)
+{
+   if (node->is_queued_for_deletion())
+      return;
+   
+   // Pre-spawned nodes don't have the class hash and were not created by a spawner
+   if (node->has_meta("chash"))
+   {
+      const Map<uint32_t, SpawnerData>::Element* sdatae = m_spawner_data.find(node->get_meta("chash"));
+      if (sdatae && sdatae->value().spawner->has_method("despawn"))
+      {
+         const bool taken = sdatae->value().spawner->call("despawn", node);
+         if (taken)
+            return;
+      }
+   }
+
+   node->queue_delete();
+}
+
+
+void kehEntityInfo::write_change_mask(const kehChangeMask& cmask, Ref<kehEncDecBuffer>& into) const
+{
+   if (cmask == m_full_mask)
+   {
+      into->write_byte(CM_Full << 6);
+      return;
+   }
+
+   const int32_t first = cmask.first_set();
+   if (first >= 0 && first < 64 && cmask.count() == 1)
+   {
+      into->write_byte((CM_Single << 6) | first);
+      return;
+   }
+
+   if (m_replicable.size() <= 6)
+   {
+      into->write_byte((CM_Bits << 6) | cmask.get_byte(0));
+      return;
+   }
+
+   // Build the group mask, one bit per group of 8 properties. If it doesn't fit in the payload then its size
+   // is the minimum number of bytes necessary to hold all groups of this entity type
+   kehChangeMask gmask;
+   for (uint32_t g = 0; g < m_group_count; g++)
+   {
+      if (cmask.get_byte(g) != 0)
+         gmask.set_bit(g);
+   }
+
+   if (m_group_count <= 6)
+   {
+      into->write_byte((CM_Groups << 6) | gmask.get_byte(0));
+   }
+   else
+   {
+      into->write_byte(CM_Groups << 6);
+      const uint32_t gbytes = (m_group_count + 7) / 8;
+      for (uint32_t i = 0; i < gbytes; i++)
+      {
+         into->write_byte(gmask.get_byte(i));
+      }
+   }
+
+   // Then only the groups that actually contain changes
+   for (uint32_t g = 0; g < m_group_count; g++)
+   {
+      if (gmask.is_set(g))
+         into->write_byte(cmask.get_byte(g));
+   }
+}
+
+
+void kehEntityInfo::extract_change_mask(Ref<kehEncDecBuffer>& from, kehChangeMask& out) const
+{
+   out.clear();
+
+   const uint8_t header = from->read_byte();
+   const uint8_t payload = header & 0x3F;
+
+   switch (header >> 6)
+   {
+      case CM_Single:
+      {
+         out.set_bit(payload);
+      } return;
+
+      case CM_Full:
+      {
+         out = m_full_mask;
+      } return;
+
+      case CM_Bits:
+      {
+         out.set_byte(0, payload);
+      } return;
+   }
+
+   kehChangeMask gmask;
+   if (m_group_count <= 6)
+   {
+      gmask.set_byte(0, payload);
+   }
+   else
+   {
+      const uint32_t gbytes = (m_group_count + 7) / 8;
+      for (uint32_t i = 0; i < gbytes; i++)
+      {
+         gmask.set_byte(i, from->read_byte());
+      }
+   }
+
+   for (uint32_t g = 0; g < m_group_count; g++)
+   {
+      if (gmask.is_set(g))
+         out.set_byte(g, from->read_byte());
+   }
+}
+
+
+void kehEntityInfo::force_full_encoding()
+{
+   PoolVector<ReplicableProperty>::Write w = m_replicable.write();
+   for (uint32_t i = 0; i < m_replicable.size(); i++)
+   {
+      ReplicableProperty& rp = w[i];
+      if (rp.encoding != kehSnapEntityBase::EncodeFull)
+      {
+         WARN_PRINT(vformat("Property '%s' belongs to a dirty tracked entity type, its encoding will be ignored.", rp.name));
+         rp.encoding = kehSnapEntityBase::EncodeFull;
+      }
+   }
+}
+
+
+void kehEntityInfo::build_property_index()
+{
+   m_prop_index.clear();
+   for (uint32_t i = 0; i < m_replicable.size(); i++)
+   {
+      m_prop_index.set(m_replicable[i].name, i);
+   }
+}
+
+
+String kehEntityInfo::setup_change_mask()
+{
+   if (m_replicable.size() > (int)kehChangeMask::MAX_BITS)
+   {
+      return vformat("There are more than %d replicable properties, which is not supported by this system.", kehChangeMask::MAX_BITS);
+   }
+
+   m_group_count = (m_replicable.size() + 7) / 8;
+   m_full_mask.set_first(m_replicable.size());
+
+   return "";
 }
 
 
@@ -709,6 +1348,8 @@ void kehEntityInfo::_notification(int what)
 {
    if (what == NOTIFICATION_PREDELETE)
    {
+      // Pooled entities are holding references to the script resource
+      m_pool.clear();
       m_resource = Ref<Script>(NULL);
       
    }
@@ -718,15 +1359,21 @@ void kehEntityInfo::_notification(int what)
 kehEntityInfo::kehEntityInfo() :
    m_name_hash(0),
    m_resource(NULL),
+   m_native(NULL),
    m_namestr(""),
-   m_has_chash(true)
+   m_has_chash(true),
+   m_group_count(1),
+   m_dirty_tracking(false),
+   m_earliest_seen(UINT32_MAX)
 {
+   m_pool.set_max_size(GLOBAL_GET("keh_modules/network/general/object_pool_size"));
 
 }
 
 
 kehEntityInfo::~kehEntityInfo()
 {
+   m_pool.clear();
    m_resource = Ref<Script>(NULL);
    m_replicable.resize(0);
 }
\ No newline at end of file
@@ -26,12 +26,18 @@
 #include "core/reference.h"
 #include "core/script_language.h"
 #include "core/func_ref.h"
+#include "core/hash_map.h"
 
+#include "changemask.h"
 #include "propcomparer.h"
+#include "quantcodec.h"
+#include "snapentity.h"
+#include "objectpool.h"
 
 
-class kehSnapEntityBase;
 class kehNetNodeSpawner;
+class kehNativeEntityType;
+class kehNativeField;
 
 class kehEncDecBuffer;
 
@@ -41,17 +47,27 @@ class kehEntityInfo : public Reference
 private:
    const int MAX_ARRAY_SIZE = 0xFF;
 
+   // The index of a property within the replicable list is also its bit within the change mask
    struct ReplicableProperty
    {
       String name;
       int type;
-      int mask;
       kehPropComparer comparer;
-
-      bool is_valid() const { return type != 0 && mask != 0 && comparer.is_valid(); }
+      // Initial value of the property, used to reset recycled entities
+      Variant defval;
+      // One of kehSnapEntityBase::PropertyEncoding, how the property is encoded in delta snapshots when
+      // there is a baseline
+      int encoding;
+      // If enabled then the property is quantized when encoded and compared on the quantized values
+      kehQuantCodec quant;
+      // Set when the property belongs to a native entity type. In that case the comparer and defval are
+      // not used, everything goes through this field
+      const kehNativeField* native;
+
+      bool is_valid() const { return type != 0 && (native || comparer.is_valid()); }
       bool compare(const Variant& v1, const Variant& v2) const { return comparer(v1, v2); }
 
-      ReplicableProperty() : type(0), mask(0) {}
+      ReplicableProperty() : type(0), encoding(kehSnapEntityBase::EncodeFull), native(NULL) {}
    };
 
    struct SpawnerData
@@ -84,6 +100,9 @@ private:
    uint32_t m_name_hash;
    // Resource used to create instances of entities described by this EntityInfo
    Ref<Script> m_resource;
+   // If the entity type is declared in C++ then this will point to its description and m_resource will be
+   // invalid. The type is owned by the static list in kehNativeEntityType
+   const kehNativeEntityType* m_native;
    // List of properties that can be replicated
    PoolVector<ReplicableProperty> m_replicable;
    // Class name of the entity. Used mostly for debugging
@@ -91,11 +110,42 @@ private:
    // Snapshot entities may disable class_hash and this info is cached here
    bool m_has_chash;
 
-   // When encoding delta snapshot, the change mask has to be encoded before the entity itself. This variable
-   // holds how many bytes (1, 2 or 4) are used for this information within the raw data for this entity type.
-   // This sort of limit the number of properties per entity to only 30/31 (ID takes one spot and if not disabled)
-   // class_hash takes another).
-   uint8_t m_cmask_size;
+   // When encoding delta snapshot, the change mask has to be encoded before the entity itself. The first byte
+   // holds the encoding mode in the 2 high bits and a 6 bit payload:
+   // - CM_Single: a single property changed, payload is its index (if bellow 64).
+   // - CM_Full: every property changed (newly added entity), nothing else is encoded.
+   // - CM_Bits: types with up to 6 properties, payload is the change mask itself.
+   // - CM_Groups: properties are split into groups of 8 (one byte of the change mask). A group mask, with one
+   //   bit per group, comes in the payload (if up to 6 groups) or in the following bytes. Then only the bytes
+   //   of the groups containing changes.
+   // Most entities change a single property per tick, so the mask is very often just a single byte.
+   enum ChangeMaskMode
+   {
+      CM_Single = 0,
+      CM_Full = 1,
+      CM_Bits = 2,
+      CM_Groups = 3,
+   };
+   uint32_t m_group_count;
+   kehChangeMask m_full_mask;
+
+   // When dirty tracking is enabled, game code marks the changed properties of each entity instead of the server
+   // comparing them against the reference snapshot. For each entity (key is the unique ID) this keeps the signature
+   // of the last snapshot in which each property changed, so the change mask relative to any reference snapshot
+   // still in the history can be built. last_change is the highest of those, allowing unchanged entities to be
+   // skipped without looking at the properties.
+   struct DirtyRecord
+   {
+      uint32_t last_seen;
+      uint32_t last_change;
+      Vector<uint32_t> prop_change;
+   };
+   bool m_dirty_tracking;
+   HashMap<uint32_t, DirtyRecord> m_dirty;
+   // Lower bound of last_seen among the records, so purging doesn't scan them every snapshot
+   uint32_t m_earliest_seen;
+   // Scripted entities mark properties by name
+   HashMap<StringName, uint32_t> m_prop_index;
 
    // Holds all spanwed entities. This will allow the network system to keep track of all entities that require
    // replication within the snapshots. Map key is entity Unique ID.
@@ -106,9 +156,13 @@ private:
    // snapshot system.
    Map<uint32_t, SpawnerData> m_spawner_data;
 
+   // Snapshot entities that were discarded (evicted from the history, as an example) are given back to
+   // this pool so new instances of this entity type can be obtained without allocations.
+   mutable kehObjectPool<kehSnapEntityBase> m_pool;
+
 private:
    // Builds an instance of the inner "class" ReplicableProperty
-   ReplicableProperty build_replicable_prop(const String& name, Variant::Type type, int mask, kehSnapEntityBase* dummy);
+   ReplicableProperty build_replicable_prop(const String& name, Variant::Type type, kehSnapEntityBase* dummy);
 
    // Given an instance of ReplicableProperty, writes the corresponding entity property into the given EncDecBuffer
    void property_writer(const ReplicableProperty& rp, const Ref<kehSnapEntityBase>& entity, Ref<kehEncDecBuffer>& into) const;
@@ -117,8 +171,41 @@ private:
    // kehSnapEntityBase object.
    void property_reader(const ReplicableProperty& rp, Ref<kehEncDecBuffer>& from, Ref<kehSnapEntityBase>& into) const;
 
-   // Helper function to extract the change mask from given EncDecBuffer. 
-   uint32_t extract_change_mask(Ref<kehEncDecBuffer>& from) const;
+   // Same as the two above, but relative to the value in the baseline entity, according to the encoding of the property
+   void property_delta_writer(const ReplicableProperty& rp, const Ref<kehSnapEntityBase>& entity, const Ref<kehSnapEntityBase>& baseline, Ref<kehEncDecBuffer>& into) const;
+   void property_delta_reader(const ReplicableProperty& rp, const Ref<kehSnapEntityBase>& baseline, Ref<kehEncDecBuffer>& from, Ref<kehSnapEntityBase>& into) const;
+
+   // Read the "<property>_quantize" meta value into the given property. Returns an error message if the settings are not valid
+   static String setup_quantization(ReplicableProperty& rp, const Variant& settings);
+
+   // The encoding (other than EncodeFull) that can be used by properties of the given type
+   static int get_delta_encoding(int type);
+
+   // Obtain an instance of the entity, recycled from the pool whenever possible. If reset is true then a recycled
+   // object will have its replicable properties set back to their initial values. Doing so is not necessary
+   // when the caller is going to assign every single replicable property.
+   Ref<kehSnapEntityBase> instance_entity(uint32_t uid, uint32_t chash, bool reset) const;
+
+   // Remove the given game node. If the spawner that created it implements despawn() and takes the node back
+   // then it will not be freed.
+   void release_node(Node* node);
+
+   // Compare every replicable property of two scripted entities, through Variants
+   kehChangeMask calculate_script_mask(const kehSnapEntityBase* e1, const kehSnapEntityBase* e2) const;
+
+   // Helper functions to write/extract the change mask into/from the given EncDecBuffer
+   void write_change_mask(const kehChangeMask& cmask, Ref<kehEncDecBuffer>& into) const;
+   void extract_change_mask(Ref<kehEncDecBuffer>& from, kehChangeMask& out) const;
+
+   // Calculate the amount of mask groups and check the property limit. Returns an error message if the limit is exceeded
+   String setup_change_mask();
+
+   // Dirty tracked types can't use the reference encodings. A change that is not marked never reaches the client, so
+   // its copy diverges from the server one and every later value encoded relative to it would be decoded wrong
+   void force_full_encoding();
+
+   // Fill the property name to index map, used to resolve the properties marked as dirty by scripts
+   void build_property_index();
 
 protected:
    void _notification(int what);
@@ -127,7 +214,14 @@ protected:
 public:
    uint32_t get_name_hash() const { return m_name_hash; }
    Ref<Script> get_resource() const { return m_resource; }
-   
+   const String& get_type_name() const { return m_namestr; }
+   bool is_native() const { return m_native != NULL; }
+
+   // Access to the list of replicable properties, mostly meant for tooling (benchmarks, as an example)
+   uint32_t get_replicable_count() const { return m_replicable.size(); }
+   String get_replicable_name(uint32_t index) const { return m_replicable[index].name; }
+   int get_replicable_type(uint32_t index) const { return m_replicable[index].type; }
+   void set_replicable_value(const Ref<kehSnapEntityBase>& entity, uint32_t index, const Variant& value) const;
 
    void register_spawner(uint32_t chash, const Ref<kehNetNodeSpawner>& spawner, Node* parent, const Ref<FuncRef>& esetup = Ref<FuncRef>());
 
@@ -136,9 +230,17 @@ public:
    // Create a clone of the given entity, as long as it matches this info
    Ref<kehSnapEntityBase> clone_entity(const Ref<kehSnapEntityBase>& entity) const;
 
-   uint32_t get_change_mask_size() const { return m_cmask_size; }
+   // Give a no longer needed entity back to the internal pool. It will only be reused once there are no other
+   // references to it.
+   void recycle(const Ref<kehSnapEntityBase>& entity) const { m_pool.release(entity); }
+
+   uint32_t get_change_mask_groups() const { return m_group_count; }
 
-   uint32_t calculate_change_mask(const Ref<kehSnapEntityBase>& e1, const Ref<kehSnapEntityBase>& e2) const;
+   kehChangeMask calculate_change_mask(const Ref<kehSnapEntityBase>& e1, const Ref<kehSnapEntityBase>& e2) const;
+
+   // Calculate the change masks of count pairs of entities, out[i] being the result of comparing e1[i] and e2[i]. Native
+   // entity types compare one field across all pairs at a time, without Variants
+   void calculate_change_masks(const kehSnapEntityBase* const* e1, const kehSnapEntityBase* const* e2, uint32_t count, kehChangeMask* out) const;
 
    // Encode full entity data into the given EncDecBuffer
    void encode_full_entity(const Ref<kehSnapEntityBase>& entity, Ref<kehEncDecBuffer>& into) const;
@@ -146,18 +248,43 @@ public:
    // Decode full entity data from the given EncDecBuffer
    Ref<kehSnapEntityBase> decode_full_entity(Ref<kehEncDecBuffer>& from) const;
 
-   // Encode delta entity data into the given EncDecBuffer
-   void encode_delta_entity(uint32_t uid, const Ref<kehSnapEntityBase>& entity, uint32_t cmask, Ref<kehEncDecBuffer>& into) const;
+   // Encode delta entity data into the given EncDecBuffer. The baseline is the state of the entity in the snapshot
+   // used as reference for the delta, invalid if the entity is new
+   void encode_delta_entity(const Ref<kehSnapEntityBase>& entity, const Ref<kehSnapEntityBase>& baseline, const kehChangeMask& cmask, Ref<kehEncDecBuffer>& into) const;
+
+   // Decode delta entity data from the given EncDecBuffer. The unique ID has already been read by the caller, which needs
+   // it in order to find the baseline. That must be the same entity given to encode_delta_entity()
+   Ref<kehSnapEntityBase> decode_delta_entity(uint32_t uid, const Ref<kehSnapEntityBase>& baseline, Ref<kehEncDecBuffer>& from, kehChangeMask& outcmask) const;
+
 
-   // Decode delta entity data from the given EncDecBuffer
-   Ref<kehSnapEntityBase> decode_delta_entity(Ref<kehEncDecBuffer>& from, uint32_t& outcmask) const;
+   kehChangeMask get_full_change_mask() const;
 
 
-   uint32_t get_full_change_mask() const;
+   /// Dirty tracking
+   bool has_dirty_tracking() const { return m_dirty_tracking; }
+
+   // Take the properties marked as dirty in the given entity, which was added into the snapshot with the given signature.
+   // prevsig is the signature of the snapshot finished before that one. Entities that are new or were missing in that
+   // previous snapshot are considered fully changed.
+   void track_dirty(const Ref<kehSnapEntityBase>& entity, uint32_t sig, uint32_t prevsig);
+
+   // Build the change mask of the entity relative to the snapshot with the given signature. Returns false, without
+   // touching out, if nothing changed since then so the entity can be skipped
+   bool get_dirty_mask(uint32_t uid, uint32_t refsig, kehChangeMask& out) const;
+
+   // Remove the records of entities that were not seen since the given snapshot signature. Records are only scanned
+   // when that signature moves past the earliest last_seen among them
+   void purge_dirty(uint32_t oldest_sig);
+
+   void clear_dirty() { m_dirty.clear(); m_earliest_seen = UINT32_MAX; }
 
    // Based on the given change mask this function is meant to transfer the different properties from
    // the "source" entity into the "changed" one.
-   void match_delta(Ref<kehSnapEntityBase>& changed, const Ref<kehSnapEntityBase>& source, uint32_t cmask) const;
+   void match_delta(Ref<kehSnapEntityBase>& changed, const Ref<kehSnapEntityBase>& source, const kehChangeMask& cmask) const;
+
+   // Apply the state of the given entity into the game node. Scripted entities are called through the script
+   // instance while native ones directly use the virtual function
+   void apply_state(const Ref<kehSnapEntityBase>& entity, Node* node) const;
 
 
    /// Node spawning, despawning etc
@@ -186,6 +313,9 @@ public:
 
    String check(const String& cname, const String& cpath);
 
+   // Equivalent of check() but for entity types declared in C++
+   String check_native(const kehNativeEntityType* type);
+
    String get_comp_data() const;
 
 
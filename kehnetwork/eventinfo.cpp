@@ -25,6 +25,30 @@
 #include "snapentity.h"
 
 
+bool kehNetEvent::is_relevant(uint32_t pid, bool has_interest, const Vector3& interest) const
+{
+   if (target.size() > 0)
+   {
+      bool found = false;
+      for (int i = 0; i < target.size() && !found; i++)
+      {
+         found = target[i] == pid;
+      }
+
+      if (!found)
+         return false;
+   }
+
+   if (radius > 0.0f && has_interest)
+   {
+      return position.distance_squared_to(interest) <= radius * radius;
+   }
+
+   return true;
+}
+
+
+
 bool kehEventInfo::check_types(const Array& ptypes)
 {
    for (uint32_t i = 0; i < ptypes.size(); i++)
@@ -220,9 +244,10 @@ void kehEventInfo::call_handlers(const Array& params) const
 }
 
 
-kehEventInfo::kehEventInfo(uint16_t type, const Array& param_list)
+kehEventInfo::kehEventInfo(uint16_t type, const Array& param_list, bool reliable)
 {
    m_type_id = type;
+   m_reliable = reliable;
    for (uint32_t i = 0; i < param_list.size(); i++)
    {
       m_param_type.push_back(param_list[i]);
@@ -32,6 +32,20 @@ struct kehNetEvent
 {
    uint16_t type;
    Array params;
+
+   // If not empty, only the peers in this list will receive the event
+   PoolVector<uint32_t> target;
+
+   // If radius is bigger than 0 then only the peers with interest position within that distance from the
+   // position will receive the event
+   Vector3 position;
+   float radius;
+
+   // Tells if the given peer should receive this event. Interest position is only used if has_interest is true,
+   // so peers without one will not be filtered out by distance
+   bool is_relevant(uint32_t pid, bool has_interest, const Vector3& interest) const;
+
+   kehNetEvent() : type(0), radius(0.0f) {}
 };
 
 class kehEventInfo
@@ -54,10 +68,16 @@ private:
 
    // List of handlers for this event
    PoolVector<evt_handler> m_event_handler;
+
+   // If true, events of this type are sent through the reliable ordered channel. Otherwise only the latest event
+   // of this type (per peer) within an update will be sent and it will use the unreliable channel.
+   bool m_reliable;
    
 public:
    static bool check_types(const Array& ptypes);
 
+   bool is_reliable() const { return m_reliable; }
+
    void attach_handler(const Object* obj, const String& fname);
 
    void clear_handlers();
@@ -68,7 +88,7 @@ public:
 
    void call_handlers(const Array& params) const;
 
-   kehEventInfo(uint16_t type = 0, const Array& param_list = Array());
+   kehEventInfo(uint16_t type = 0, const Array& param_list = Array(), bool reliable = true);
 };
 
 #endif
@@ -23,6 +23,9 @@
 
 #include "inputcache.h"
 #include "inputdata.h"
+#include "inputinfo.h"
+
+#include "../kehgeneral/encdecbuffer.h"
 
 
 uint32_t kehInputCache::get_used_input_in_snap(uint32_t snap_sig) const
@@ -82,29 +85,67 @@ Ref<kehInputData> kehInputCache::get_input_data(uint32_t index) const
 }
 
 
-void kehInputCache::clear_older(uint32_t isig)
+void kehInputCache::encode_local(Ref<kehEncDecBuffer>& into, const kehInputInfo* info) const
+{
+   const uint32_t csize = m_cbuffer.size();
+
+   const uint32_t newest_tick = csize > 0 ? m_cbuffer[csize - 1]->get_tick() : 0;
+   into->write_uint(newest_tick);
+
+   // Encode buffer size (that is, how many input objects are there). Using two bytes should
+   // give plenty of packet loss time
+   into->write_ushort(csize);
+
+   for (uint32_t i = 0; i < csize; i++)
+   {
+      const Ref<kehInputData> idata = m_cbuffer[i];
+      const uint32_t tick = idata->get_tick();
+      into->write_byte(tick > 0 && newest_tick - tick < NO_TICK_OFFSET ? newest_tick - tick : NO_TICK_OFFSET);
+      info->encode_to(into, idata);
+   }
+}
+
+
+void kehInputCache::clear_older(uint32_t isig, const kehInputInfo* recycler)
 {
    while (m_cbuffer.size() > 0 && m_cbuffer[0]->get_signature() <= isig)
    {
+      if (recycler)
+      {
+         recycler->recycle(m_cbuffer[0]);
+      }
       m_cbuffer.remove(0);
    }
 }
 
 
-Ref<kehInputData> kehInputCache::get_client_input()
+Ref<kehInputData> kehInputCache::get_client_input(uint32_t server_tick, const kehInputInfo* recycler)
 {
    Ref<kehInputData> ret;
-   const uint32_t using_sig = m_last_sig + 1;
-   Map<uint32_t, Ref<kehInputData>>::Element* mel = m_sbuffer.find(using_sig);
+   Map<uint32_t, Ref<kehInputData>>::Element* mel = m_sbuffer.find(m_last_sig + 1);
 
-   if (mel)
+   while (mel)
    {
-      // There is a valid input object in the cache, so update the last used signature
-      m_last_sig++;
-      // Assign the retrieved object into the return value
+      const uint32_t tick = mel->value()->get_tick();
+
+      // Meant for a future tick. Keep it in the buffer until the server gets there
+      if (tick > server_tick)
+         break;
+
+      // The object is not needed within the container anymore, so remove it while updating the last
+      // used signature
+      if (ret.is_valid() && recycler)
+         recycler->recycle(ret);
       ret = mel->value();
-      // The object is not needed within the container anymore, so remove it
-      m_sbuffer.erase(using_sig);
+      m_last_sig = mel->key();
+      m_sbuffer.erase(mel);
+
+      // Non stamped input is used in sequence, one per tick
+      if (tick == 0)
+         break;
+
+      // If the next object is also due then this one arrived too late. Skip to the newest due input
+      mel = m_sbuffer.find(m_last_sig + 1);
    }
 
    return ret;
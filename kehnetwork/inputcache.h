@@ -27,6 +27,8 @@
 #include "core/reference.h"
 
 class kehInputData;
+class kehInputInfo;
+class kehEncDecBuffer;
 
 // The input cache is used in two different ways, depending on which machine it's
 // running and which player the node owning the cache belongs to.
@@ -56,6 +58,10 @@ class kehInputData;
 
 class kehInputCache
 {
+public:
+   // Tick offset encoded for input objects that were not stamped with the tick they are meant for
+   static const uint8_t NO_TICK_OFFSET = 255;
+
 private:
    // Meant for the server, map from input signature to instance of kehInputData
    Map<uint32_t, Ref<kehInputData>> m_sbuffer;
@@ -104,12 +110,19 @@ public:
 
    Ref<kehInputData> get_input_data(uint32_t index) const;
 
-   // Removes all input objects that are older and equal to the specified input signature
-   void clear_older(uint32_t isig);
+   // Encode all of the (local) cached input objects, in the format expected by the server. The tick each object
+   // is meant for is encoded relative to the newest one, so only a single byte is needed per object
+   void encode_local(Ref<kehEncDecBuffer>& into, const kehInputInfo* info) const;
+
+   // Removes all input objects that are older and equal to the specified input signature. If the
+   // recycler is given, removed objects are given back to its pool.
+   void clear_older(uint32_t isig, const kehInputInfo* recycler = NULL);
 
    // When server requires client input data, use this. This will automatically remove the returned
-   // object from the internal container as it will not be needed anymore.
-   Ref<kehInputData> get_client_input();
+   // object from the internal container as it will not be needed anymore. Input objects stamped with a
+   // tick (see kehClockSync) are only used once the server reaches that tick. Older stamped objects that
+   // arrived too late are skipped (and given back to the recycler, if any) instead of building up latency.
+   Ref<kehInputData> get_client_input(uint32_t server_tick, const kehInputInfo* recycler = NULL);
 
    // Reset the internal state.
    void reset();
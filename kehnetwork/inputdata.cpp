@@ -109,6 +109,26 @@ void kehInputData::set_pressed(const String& name, bool p)
 }
 
 
+void kehInputData::reset(uint32_t s)
+{
+   m_signature = s;
+   m_tick = 0;
+   m_has_input = false;
+
+   for (Map<String, Vector2>::Element* e = m_vec2.front(); e; e = e->next())
+      e->value() = Vector2();
+   
+   for (Map<String, Vector3>::Element* e = m_vec3.front(); e; e = e->next())
+      e->value() = Vector3();
+   
+   for (Map<String, float>::Element* e = m_analog.front(); e; e = e->next())
+      e->value() = 0.0f;
+   
+   for (Map<String, bool>::Element* e = m_action.front(); e; e = e->next())
+      e->value() = false;
+}
+
+
 void kehInputData::_bind_methods()
 {
    ClassDB::bind_method(D_METHOD("get_custom_vec2", "name"), &kehInputData::get_custom_vec2);
@@ -130,7 +150,9 @@ void kehInputData::_bind_methods()
 
 kehInputData::kehInputData(uint32_t s) :
    m_has_input(false),
-   m_signature(s)
+   m_signature(s),
+   m_tick(0),
+   m_pooled(false)
 {
 
 }
\ No newline at end of file
@@ -43,6 +43,11 @@ private:
    Map<String, bool> m_action;
    bool m_has_input;
    uint32_t m_signature;
+   // Server tick (snapshot signature) this input is meant for, as estimated by the client clock sync. 0 means
+   // unknown, in which case the server just uses input objects in sequence
+   uint32_t m_tick;
+   // Set while this object is held by the input data pool
+   bool m_pooled;
 
 
 protected:
@@ -53,6 +58,16 @@ public:
    uint32_t get_signature() const { return m_signature; }
    bool has_input() const { return m_has_input; }
 
+   uint32_t get_tick() const { return m_tick; }
+   void set_tick(uint32_t t) { m_tick = t; }
+
+   bool is_pooled() const { return m_pooled; }
+   void set_pooled(bool p) { m_pooled = p; }
+
+   // Prepare this object to be reused with a new signature. Registered entries are kept within the
+   // internal maps (avoiding allocations), only holding "neutral" values.
+   void reset(uint32_t s);
+
    Vector2 get_custom_vec2(const String& name) const;
    void set_custom_vec2(const String& name, const Vector2& val);
 
@@ -76,12 +76,31 @@ void kehInputInfo::reset_registrations()
    m_vec2_list.clear();
    m_vec3_list.clear();
    m_has_custom_data = false;
+
+   // Pooled objects are holding entries of the old registrations
+   m_pool.clear();
+}
+
+
+Ref<kehInputData> kehInputInfo::create_input(uint32_t sig) const
+{
+   Ref<kehInputData> ret = m_pool.acquire();
+   if (ret.is_valid())
+   {
+      ret->reset(sig);
+   }
+   else
+   {
+      ret = Ref<kehInputData>(memnew(kehInputData(sig)));
+   }
+
+   return ret;
 }
 
 
 Ref<kehInputData> kehInputInfo::make_empty() const
 {
-   Ref<kehInputData> ret = memnew(kehInputData(0));
+   Ref<kehInputData> ret = create_input(0);
 
    if (m_use_mouse_relative)
       ret->set_mouse_relative(Vector2());
@@ -235,7 +254,7 @@ void kehInputInfo::encode_to(Ref<kehEncDecBuffer>& into, const Ref<kehInputData>
 Ref<kehInputData> kehInputInfo::decode_from(Ref<kehEncDecBuffer>& from) const
 {
    // Decode the signature - while at the same time creating the return object
-   Ref<kehInputData> ret = memnew(kehInputData(from->read_uint()));
+   Ref<kehInputData> ret = create_input(from->read_uint());
 
    // Decode the "has_input" flag
    const bool has_input = from->read_bool();
@@ -414,4 +433,5 @@ kehInputInfo::kehInputInfo() :
    m_use_mouse_speed = GLOBAL_GET("keh_modules/network/input/use_mouse_speed");
    m_quantize_analog = GLOBAL_GET("keh_modules/network/input/quantize_analog_data");
    m_print_debug = GLOBAL_GET("keh_modules/network/general/print_debug_info");
+   m_pool.set_max_size(GLOBAL_GET("keh_modules/network/general/object_pool_size"));
 }
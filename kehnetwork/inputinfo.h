@@ -25,8 +25,10 @@
 
 #include "core/input_map.h"
 
+#include "inputdata.h"
+#include "objectpool.h"
+
 
-class kehInputData;
 class kehEncDecBuffer;
 
 // This is meant to hold information regarding which input data (based on
@@ -70,6 +72,10 @@ private:
    // used to generate the data is not set.
    bool m_has_custom_data;
 
+   // Input objects are created every single frame. Those that are not needed anymore are given back
+   // to this pool so they can be reused.
+   mutable kehObjectPool<kehInputData> m_pool;
+
 private:
    // A generic function meant to create the correct entry data within the input containers
    void register_data(Map<String, ActionInfo>& container, const String& name, bool custom);
@@ -113,6 +119,13 @@ public:
    bool use_mouse_relative() const { return m_use_mouse_relative; }
    bool use_mouse_speed() const { return m_use_mouse_speed; }
 
+   // Obtain an input data object with the given signature, recycled from the internal pool whenever possible.
+   Ref<kehInputData> create_input(uint32_t sig) const;
+
+   // Give an input data object back to the internal pool. Objects still referenced elsewhere will only be
+   // reused once those references are gone.
+   void recycle(const Ref<kehInputData>& input) const { m_pool.release(input); }
+
    // Create a "blank" input data object. That is, it will have no input but all the map entries will be present.
    Ref<kehInputData> make_empty() const;
 
@@ -0,0 +1,399 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "loadtest.h"
+#include "inputdata.h"
+#include "inputinfo.h"
+#include "memorypeer.h"
+
+#include "../kehgeneral/encdecbuffer.h"
+
+#include "core/func_ref.h"
+#include "core/io/multiplayer_api.h"
+#include "core/os/os.h"
+
+
+void kehLoadTestPlayer::setup(uint32_t pid)
+{
+   // Same name given to player nodes by kehPlayerNode::set_id()
+   set_name("player_" + String::num_int64(pid));
+
+   rpc_config("_client_receive_net_stats", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_client_ping_broadcast", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_remote_set_custom_property", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+}
+
+
+void kehLoadTestPlayer::_bind_methods()
+{
+   ClassDB::bind_method(D_METHOD("_client_receive_net_stats", "rtt", "rttvar", "jitter", "loss"), &kehLoadTestPlayer::client_receive_net_stats);
+   ClassDB::bind_method(D_METHOD("_client_ping_broadcast", "value"), &kehLoadTestPlayer::client_ping_broadcast);
+   ClassDB::bind_method(D_METHOD("_remote_set_custom_property", "id", "value"), &kehLoadTestPlayer::remote_set_custom_property);
+}
+
+
+
+
+kehLoadTestPlayer* kehLoadTestClient::get_player_node(uint32_t pid) const
+{
+   return Object::cast_to<kehLoadTestPlayer>(get_node_or_null(NodePath("player_" + String::num_int64(pid))));
+}
+
+void kehLoadTestClient::add_player_node(uint32_t pid)
+{
+   if (get_player_node(pid))
+      return;
+   
+   kehLoadTestPlayer* player = memnew(kehLoadTestPlayer);
+   player->setup(pid);
+   add_child(player);
+}
+
+
+void kehLoadTestClient::send_input()
+{
+   Ref<kehInputData> input = m_input_info->create_input(m_input_cache.increment_input());
+   m_owner->fill_input(m_net_id, input, m_input_info, m_rng);
+   m_input_cache.cache_local_input(input);
+
+   // Exactly what kehPlayerNode::dispatch_input_data() sends
+   m_encdec->set_buffer(PoolByteArray());
+   m_input_cache.encode_local(m_encdec, m_input_info);
+
+   const Variant encoded = m_encdec->get_buffer();
+   const Variant* args[1] = { &encoded };
+   m_multiplayer->rpcp(m_player, 1, true, "_server_receive_input", args, 1);
+}
+
+
+void kehLoadTestClient::handle_snapshot(const PoolByteArray& encoded)
+{
+   // Both full and delta snapshots begin with the snapshot signature followed by the input signature
+   m_receiving = true;
+
+   m_encdec->set_buffer(encoded);
+   const uint32_t sig = m_encdec->read_uint();
+   const uint32_t isig = m_encdec->read_uint();
+
+   if (m_owner->should_ack(m_rng))
+   {
+      const Variant vsig = sig;
+      const Variant* args[1] = { &vsig };
+      m_multiplayer->rpcp(this, 1, true, "_server_acknowledge_snapshot", args, 1);
+   }
+
+   if (isig > 0)
+      m_input_cache.clear_older(isig, m_input_info);
+}
+
+
+void kehLoadTestClient::all_register_player(uint32_t pid)
+{
+   add_player_node(pid);
+}
+
+void kehLoadTestClient::all_unregister_player(uint32_t pid)
+{
+   kehLoadTestPlayer* player = get_player_node(pid);
+   if (player && player != m_player)
+      player->queue_delete();
+}
+
+
+void kehLoadTestClient::client_join_accepted(const PoolStringArray& cprop_table)
+{
+   m_net_id = m_multiplayer->get_network_unique_id();
+
+   // The node of the local player, used to send input data, and the one of the host
+   add_player_node(m_net_id);
+   m_player = get_player_node(m_net_id);
+   add_player_node(1);
+
+   // Same sequence of a real client: register then, as there is no game to load, immediately tell the server
+   // this client is ready to receive snapshots
+   const Variant vid = m_net_id;
+   const Variant* args[1] = { &vid };
+   m_multiplayer->rpcp(this, 1, false, "_all_register_player", args, 1);
+   m_multiplayer->rpcp(this, 1, false, "_server_client_is_ready", NULL, 0);
+}
+
+
+void kehLoadTestClient::client_request_credentials()
+{
+   const Variant cred = Dictionary();
+   const Variant* args[1] = { &cred };
+   m_multiplayer->rpcp(this, 1, false, "_server_receive_credentials", args, 1);
+}
+
+
+void kehLoadTestClient::_notification(int what)
+{
+   switch (what)
+   {
+      case NOTIFICATION_INTERNAL_PHYSICS_PROCESS:
+      {
+         // The scene tree only polls its own MultiplayerAPI
+         m_multiplayer->poll();
+
+         // Like a real client, one input object per tick
+         if (m_receiving && m_player)
+            send_input();
+      } break;
+   }
+}
+
+
+void kehLoadTestClient::_bind_methods()
+{
+   ClassDB::bind_method(D_METHOD("_all_register_player", "pid"), &kehLoadTestClient::all_register_player);
+   ClassDB::bind_method(D_METHOD("_all_unregister_player", "pid"), &kehLoadTestClient::all_unregister_player);
+   ClassDB::bind_method(D_METHOD("_all_chat_message", "sender", "msg", "broadcast"), &kehLoadTestClient::all_chat_message);
+   ClassDB::bind_method(D_METHOD("_all_receive_custom_prop_batch", "encoded"), &kehLoadTestClient::all_receive_custom_prop_batch);
+
+   ClassDB::bind_method(D_METHOD("_client_join_accepted", "cprop_table"), &kehLoadTestClient::client_join_accepted);
+   ClassDB::bind_method(D_METHOD("_client_join_rejected", "reason"), &kehLoadTestClient::client_join_rejected);
+   ClassDB::bind_method(D_METHOD("_client_kicked", "reason"), &kehLoadTestClient::client_kicked);
+   ClassDB::bind_method(D_METHOD("_client_receive_full_snapshot", "encoded"), &kehLoadTestClient::client_receive_full_snapshot);
+   ClassDB::bind_method(D_METHOD("_client_receive_delta_snapshot", "encoded"), &kehLoadTestClient::client_receive_delta_snapshot);
+   ClassDB::bind_method(D_METHOD("_client_receive_net_event", "encoded"), &kehLoadTestClient::client_receive_net_event);
+   ClassDB::bind_method(D_METHOD("_client_receive_unreliable_event", "encoded"), &kehLoadTestClient::client_receive_unreliable_event);
+   ClassDB::bind_method(D_METHOD("_client_request_credentials"), &kehLoadTestClient::client_request_credentials);
+}
+
+
+void kehLoadTestClient::setup(kehLoadTest* owner, const kehInputInfo* input_info, uint64_t seed, const String& name)
+{
+   m_owner = owner;
+   m_input_info = input_info;
+   m_rng.seed(seed);
+   set_name(name);
+}
+
+
+void kehLoadTestClient::connect_to(const Ref<kehMemoryNetwork>& network)
+{
+   ERR_FAIL_COND_MSG(!is_inside_tree(), "The load test client must be inside the tree before connecting.");
+
+   // Rooted at the parent, so this node has the same path of the network singleton on a real client
+   m_multiplayer.instance();
+   m_multiplayer->set_root_node(get_parent());
+   m_multiplayer->set_network_peer(network->create_client());
+
+   set_physics_process_internal(true);
+}
+
+
+void kehLoadTestClient::disconnect_from_server()
+{
+   set_physics_process_internal(false);
+   m_receiving = false;
+   m_player = NULL;
+
+   if (!m_multiplayer.is_valid())
+      return;
+   
+   Ref<kehMemoryPeer> peer = m_multiplayer->get_network_peer();
+   if (peer.is_valid())
+      peer->close_connection();
+   
+   m_multiplayer->set_network_peer(Ref<NetworkedMultiplayerPeer>());
+   m_multiplayer = Ref<MultiplayerAPI>();
+
+   m_input_cache.reset();
+}
+
+
+kehLoadTestClient::kehLoadTestClient() :
+   m_owner(NULL),
+   m_input_info(NULL),
+   m_net_id(0),
+   m_receiving(false),
+   m_player(NULL)
+{
+   m_encdec = Ref<kehEncDecBuffer>(memnew(kehEncDecBuffer));
+
+   // Same remote calls a real client accepts from the server
+   rpc_config("_all_register_player", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_all_unregister_player", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_all_chat_message", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_all_receive_custom_prop_batch", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_client_join_accepted", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_client_join_rejected", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_client_kicked", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_client_receive_full_snapshot", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_client_receive_delta_snapshot", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_client_receive_net_event", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_client_receive_unreliable_event", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_client_request_credentials", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+}
+
+kehLoadTestClient::~kehLoadTestClient()
+{
+   disconnect_from_server();
+}
+
+
+
+
+void kehLoadTest::set_input_generator(const Ref<FuncRef>& generator)
+{
+   m_input_generator = generator;
+}
+
+Ref<FuncRef> kehLoadTest::get_input_generator() const
+{
+   return m_input_generator;
+}
+
+
+void kehLoadTest::add_client(Node* parent, const Ref<kehMemoryNetwork>& network, const kehInputInfo* input_info, const String& net_name)
+{
+   // The MultiplayerAPI of the client is rooted at this node
+   Node* root = memnew(Node);
+   root->set_name("load_test_client");
+
+   kehLoadTestClient* client = memnew(kehLoadTestClient);
+   client->setup(this, input_info, (uint64_t(m_rng.rand()) << 32) | m_rng.rand(), net_name);
+   root->add_child(client);
+
+   parent->add_child(root, true);
+   client->connect_to(network);
+
+   m_client.push_back(client->get_instance_id());
+}
+
+
+void kehLoadTest::clear_clients()
+{
+   for (int i = 0; i < m_client.size(); i++)
+   {
+      kehLoadTestClient* client = Object::cast_to<kehLoadTestClient>(ObjectDB::get_instance(m_client[i]));
+      if (!client)
+         continue;
+      
+      client->disconnect_from_server();
+      if (Node* root = client->get_parent())
+         root->queue_delete();
+   }
+
+   m_client.clear();
+}
+
+
+void kehLoadTest::fill_input(uint32_t pid, const Ref<kehInputData>& input, const kehInputInfo* input_info, RandomPCG& rng) const
+{
+   if (m_input_generator.is_valid())
+   {
+      const Variant vpid = pid;
+      const Variant idata = input;
+      const Variant* args[2] = { &vpid, &idata };
+      Variant::CallError cerr;
+      m_input_generator->call_func(args, 2, cerr);
+      return;
+   }
+
+   for (const Map<String, kehInputInfo::ActionInfo>::Element* e = input_info->get_bool_iterator(); e; e = e->next())
+   {
+      input->set_pressed(e->key(), rng.randf() < 0.5f);
+   }
+   for (const Map<String, kehInputInfo::ActionInfo>::Element* e = input_info->get_analog_iterator(); e; e = e->next())
+   {
+      input->set_analog(e->key(), rng.randf());
+   }
+}
+
+
+void kehLoadTest::on_tick_start()
+{
+   m_tick_start = OS::get_singleton()->get_ticks_usec();
+}
+
+void kehLoadTest::on_tick_end()
+{
+   if (m_tick_start == 0)
+      return;
+   
+   const uint64_t elapsed = OS::get_singleton()->get_ticks_usec() - m_tick_start;
+   m_tick_start = 0;
+
+   m_ticks++;
+   m_tick_usec += elapsed;
+   m_max_tick_usec = MAX(m_max_tick_usec, elapsed);
+}
+
+void kehLoadTest::on_snapshot_encoded(uint32_t bytes, uint64_t usec, bool full)
+{
+   m_snapshots++;
+   m_snapshot_bytes += bytes;
+   m_encode_usec += usec;
+
+   if (full)
+      m_full_snapshots++;
+}
+
+
+void kehLoadTest::reset_stats()
+{
+   m_tick_start = 0;
+   m_ticks = 0;
+   m_tick_usec = 0;
+   m_max_tick_usec = 0;
+   m_snapshots = 0;
+   m_full_snapshots = 0;
+   m_snapshot_bytes = 0;
+   m_event_bytes = 0;
+   m_encode_usec = 0;
+}
+
+
+Dictionary kehLoadTest::get_stats(float tick_rate) const
+{
+   const uint32_t clients = m_client.size();
+   const double per_client_tick = (clients > 0 && m_ticks > 0) ? 1.0 / (double(clients) * double(m_ticks)) : 0.0;
+
+   Dictionary ret;
+   ret["clients"] = clients;
+   ret["ticks"] = m_ticks;
+   ret["tick_usec_avg"] = m_ticks > 0 ? double(m_tick_usec) / double(m_ticks) : 0.0;
+   ret["tick_usec_max"] = m_max_tick_usec;
+   ret["snapshots"] = m_snapshots;
+   ret["full_snapshots"] = m_full_snapshots;
+   ret["snapshot_bytes_avg"] = m_snapshots > 0 ? double(m_snapshot_bytes) / double(m_snapshots) : 0.0;
+   ret["encode_usec_per_client"] = m_snapshots > 0 ? double(m_encode_usec) / double(m_snapshots) : 0.0;
+   ret["bytes_per_client_tick"] = double(m_snapshot_bytes + m_event_bytes) * per_client_tick;
+   ret["bytes_per_client_sec"] = double(m_snapshot_bytes + m_event_bytes) * per_client_tick * tick_rate;
+
+   return ret;
+}
+
+
+kehLoadTest::kehLoadTest()
+{
+   m_ack_loss = 0.0f;
+   reset_stats();
+}
+
+kehLoadTest::~kehLoadTest()
+{
+   // The client nodes belong to the tree, which takes care of those
+}
@@ -0,0 +1,193 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_LOADTEST_H
+#define _KEHNETWORK_LOADTEST_H 1
+
+#include "inputcache.h"
+
+#include "core/dictionary.h"
+#include "core/math/random_pcg.h"
+#include "core/vector.h"
+#include "scene/main/node.h"
+
+// Measuring how the server scales with the number of players normally requires launching several instances
+// of the game. Instead, clients can be run within the server process, connected through the in-memory network
+// (see memorypeer.h). To the server those are regular clients: they join, register and are given player nodes,
+// snapshots, events and custom properties are encoded and sent to them, input data comes from them and so do
+// the snapshot acknowledgements. Those clients don't run any game code nor decode the snapshots (other than
+// the signatures necessary for the acknowledgements), so the measured load is the one of the server.
+// Each client is a kehLoadTestClient node, which takes the place of the network singleton of a real client. It
+// has its own MultiplayerAPI, rooted at the parent node so the paths of the remote calls match the ones of a
+// real client. kehLoadTestPlayer takes the place of the player nodes on those clients.
+// kehLoadTest holds the clients, the settings shared by them and the statistics gathered by the server.
+
+class kehInputInfo;
+class kehInputData;
+class kehEncDecBuffer;
+class kehMemoryNetwork;
+class kehLoadTest;
+class FuncRef;
+class MultiplayerAPI;
+
+
+class kehLoadTestPlayer : public Node
+{
+   GDCLASS(kehLoadTestPlayer, Node);
+private:
+   // Remote calls the server makes on player nodes. Nothing is done with the data
+   void client_receive_net_stats(float rtt, float rttvar, float jitter, float loss) {}
+   void client_ping_broadcast(float value) {}
+   void remote_set_custom_property(uint32_t id, const Variant& value) {}
+
+protected:
+   static void _bind_methods();
+
+public:
+   void setup(uint32_t pid);
+};
+
+
+class kehLoadTestClient : public Node
+{
+   GDCLASS(kehLoadTestClient, Node);
+private:
+   kehLoadTest* m_owner;
+   const kehInputInfo* m_input_info;
+
+   Ref<MultiplayerAPI> m_multiplayer;
+   uint32_t m_net_id;
+   // Input is only sent after the first snapshot arrives, which means the server created the player node
+   bool m_receiving;
+
+   // Input data is kept until acknowledged by the server, exactly like on real clients
+   kehInputCache m_input_cache;
+   Ref<kehEncDecBuffer> m_encdec;
+   RandomPCG m_rng;
+
+   // Player node of this client, through which input data is sent
+   kehLoadTestPlayer* m_player;
+
+private:
+   kehLoadTestPlayer* get_player_node(uint32_t pid) const;
+   void add_player_node(uint32_t pid);
+
+   void send_input();
+   void handle_snapshot(const PoolByteArray& encoded);
+
+   // Remote calls coming from the server
+   void all_register_player(uint32_t pid);
+   void all_unregister_player(uint32_t pid);
+   void all_chat_message(uint32_t sender, const String& msg, bool broadcast) {}
+   void all_receive_custom_prop_batch(const PoolByteArray& encoded) {}
+   void client_join_accepted(const PoolStringArray& cprop_table);
+   void client_join_rejected(const String& reason) {}
+   void client_kicked(const String& reason) {}
+   void client_receive_full_snapshot(const PoolByteArray& encoded) { handle_snapshot(encoded); }
+   void client_receive_delta_snapshot(const PoolByteArray& encoded) { handle_snapshot(encoded); }
+   void client_receive_net_event(const PoolByteArray& encoded) {}
+   void client_receive_unreliable_event(const PoolByteArray& encoded) {}
+   void client_request_credentials();
+
+protected:
+   void _notification(int what);
+
+   static void _bind_methods();
+
+public:
+   // The name must match the one of the network singleton, so remote calls reach this node
+   void setup(kehLoadTest* owner, const kehInputInfo* input_info, uint64_t seed, const String& name);
+
+   // Join the server through the given network. This node must already be inside the tree
+   void connect_to(const Ref<kehMemoryNetwork>& network);
+   void disconnect_from_server();
+
+   kehLoadTestClient();
+   ~kehLoadTestClient();
+};
+
+
+class kehLoadTest
+{
+private:
+   // The client nodes belong to the scene tree, which may free them (when the tree itself is freed, for example)
+   // before the load test is cleared. So those are resolved from their IDs
+   Vector<ObjectID> m_client;
+
+   // Each client gets its own random number generator, seeded from this one
+   RandomPCG m_rng;
+   // Probability (0 to 1) of a snapshot not being acknowledged
+   float m_ack_loss;
+   // If valid, called to fill the input data of the clients. Otherwise the registered input is randomized
+   Ref<FuncRef> m_input_generator;
+
+   // Statistics
+   uint64_t m_tick_start;           // When the current tick started, in microseconds
+   uint64_t m_ticks;
+   uint64_t m_tick_usec;
+   uint64_t m_max_tick_usec;
+   uint64_t m_snapshots;
+   uint64_t m_full_snapshots;
+   uint64_t m_snapshot_bytes;
+   uint64_t m_event_bytes;
+   uint64_t m_encode_usec;
+
+public:
+   void set_seed(uint64_t seed) { m_rng.seed(seed); }
+   void set_ack_loss(float loss) { m_ack_loss = loss; }
+
+   void set_input_generator(const Ref<FuncRef>& generator);
+   Ref<FuncRef> get_input_generator() const;
+
+   // Create a client node (under the given parent) and connect it to the server through the memory network
+   void add_client(Node* parent, const Ref<kehMemoryNetwork>& network, const kehInputInfo* input_info, const String& net_name);
+   // Disconnect and remove all the clients
+   void clear_clients();
+
+   uint32_t get_client_count() const { return m_client.size(); }
+   bool is_running() const { return m_client.size() > 0; }
+
+
+   /// Used by the clients
+   // Returns true if a received snapshot should be acknowledged
+   bool should_ack(RandomPCG& rng) const { return m_ack_loss <= 0.0f || rng.randf() >= m_ack_loss; }
+   // Fill the input data of a client
+   void fill_input(uint32_t pid, const Ref<kehInputData>& input, const kehInputInfo* input_info, RandomPCG& rng) const;
+
+
+   /// Statistics, gathered by the server
+   void on_tick_start();
+   void on_tick_end();
+   void on_snapshot_encoded(uint32_t bytes, uint64_t usec, bool full);
+   void on_event_encoded(uint32_t bytes) { m_event_bytes += bytes; }
+
+   void reset_stats();
+
+   // Obtain the gathered statistics. The tick rate is used to calculate the bandwidth per client
+   Dictionary get_stats(float tick_rate) const;
+
+   kehLoadTest();
+   ~kehLoadTest();
+};
+
+
+#endif
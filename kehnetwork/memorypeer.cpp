@@ -0,0 +1,482 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "memorypeer.h"
+
+#include "core/os/os.h"
+
+// Unreliable packets waiting longer than this (in microseconds) for the link bandwidth are dropped, like a
+// router with a full buffer would do
+#define MAX_QUEUE_DELAY 1000000
+
+
+Map<uint32_t, kehMemoryNetwork*> kehMemoryNetwork::s_registry;
+
+
+void kehMemoryNetwork::transmit(int from, int to, NetworkedMultiplayerPeer::TransferMode mode, const Vector<uint8_t>& data)
+{
+   Map<int, kehMemoryPeer*>::Element* dest = m_peer.find(to);
+   if (!dest)
+      return;
+   
+   const bool reliable = mode == NetworkedMultiplayerPeer::TRANSFER_MODE_RELIABLE;
+   const uint64_t now = get_time();
+   const uint64_t link = link_key(from, to);
+
+   if (!reliable && m_loss > 0.0f && m_rng.randf() < m_loss)
+      return;
+   
+   // Serialization through the link
+   uint64_t sent = now;
+   if (m_bandwidth > 0)
+   {
+      Map<uint64_t, uint64_t>::Element* free = m_link_free.find(link);
+      const uint64_t start = free ? MAX(free->value(), now) : now;
+
+      if (!reliable && start - now > MAX_QUEUE_DELAY)
+         return;
+      
+      sent = start + (uint64_t(data.size()) * 1000000) / m_bandwidth;
+      m_link_free[link] = sent;
+   }
+
+   // Propagation
+   float delay = m_latency;
+   if (m_jitter > 0.0f)
+      delay += m_jitter * (m_rng.randf() * 2.0f - 1.0f);
+   
+   if (mode == NetworkedMultiplayerPeer::TRANSFER_MODE_UNRELIABLE && m_reorder > 0.0f && m_rng.randf() < m_reorder)
+   {
+      // Hold this packet long enough for the next ones to pass it
+      delay += MAX(m_latency * 0.5f, 10.0f);
+   }
+
+   kehMemoryPeer::Packet packet;
+   packet.kind = kehMemoryPeer::PK_Data;
+   packet.from = from;
+   packet.deliver = sent + uint64_t(MAX(delay, 0.0f) * 1000.0f);
+   packet.order = m_order++;
+   packet.data = data;
+
+   if (reliable)
+   {
+      // Reliable packets can't pass each other
+      Map<uint64_t, uint64_t>::Element* last = m_link_reliable.find(link);
+      if (last && last->value() > packet.deliver)
+         packet.deliver = last->value();
+      
+      m_link_reliable[link] = packet.deliver;
+   }
+
+   dest->value()->schedule(packet);
+}
+
+
+void kehMemoryNetwork::notify(int to, int kind, int peer)
+{
+   Map<int, kehMemoryPeer*>::Element* dest = m_peer.find(to);
+   if (!dest)
+      return;
+   
+   kehMemoryPeer::Packet packet;
+   packet.kind = (kehMemoryPeer::PacketKind)kind;
+   packet.from = peer;
+   packet.deliver = get_time() + uint64_t(m_latency * 1000.0f);
+   packet.order = m_order++;
+
+   // Connection events follow the reliable ordering of the link, so those don't arrive before data sent earlier
+   const uint64_t link = link_key(peer, to);
+   Map<uint64_t, uint64_t>::Element* last = m_link_reliable.find(link);
+   if (last && last->value() > packet.deliver)
+      packet.deliver = last->value();
+
+   dest->value()->schedule(packet);
+}
+
+
+kehMemoryPeer* kehMemoryNetwork::create_peer(int id)
+{
+   kehMemoryPeer* ret = memnew(kehMemoryPeer);
+   ret->setup(Ref<kehMemoryNetwork>(this), id);
+   m_peer[id] = ret;
+   return ret;
+}
+
+
+kehMemoryNetwork* kehMemoryNetwork::find(uint32_t port)
+{
+   Map<uint32_t, kehMemoryNetwork*>::Element* e = s_registry.find(port);
+   return e ? e->value() : NULL;
+}
+
+void kehMemoryNetwork::register_port(uint32_t port)
+{
+   if (m_port >= 0)
+      s_registry.erase(m_port);
+   
+   m_port = port;
+   s_registry[port] = this;
+}
+
+
+Ref<kehMemoryPeer> kehMemoryNetwork::create_server()
+{
+   ERR_FAIL_COND_V_MSG(m_peer.has(1), Ref<kehMemoryPeer>(), "The memory network already has a server.");
+
+   return Ref<kehMemoryPeer>(create_peer(1));
+}
+
+
+Ref<kehMemoryPeer> kehMemoryNetwork::create_client()
+{
+   Map<int, kehMemoryPeer*>::Element* server = m_peer.find(1);
+   ERR_FAIL_COND_V_MSG(!server, Ref<kehMemoryPeer>(), "The memory network doesn't have a server.");
+
+   // IDs are random, like the ones given by ENet, but still come from the seeded generator
+   int id = 0;
+   while (id < 2 || m_peer.has(id))
+   {
+      id = m_rng.rand() & 0x7FFFFFFF;
+   }
+
+   Ref<kehMemoryPeer> ret(create_peer(id));
+
+   if (server->value()->is_refusing_new_connections())
+   {
+      // The failure is already queued in the peer itself, so it can leave the network right away. That way no one
+      // else is ever told about its connection or disconnection
+      notify(id, kehMemoryPeer::PK_ConnectionFailed, 1);
+      m_peer.erase(id);
+      return ret;
+   }
+
+   // The client learns about the server and every other client, while everyone else learns about the client
+   notify(id, kehMemoryPeer::PK_ConnectionSucceeded, 1);
+   for (Map<int, kehMemoryPeer*>::Element* e = m_peer.front(); e; e = e->next())
+   {
+      if (e->key() == id)
+         continue;
+      
+      notify(id, kehMemoryPeer::PK_PeerConnected, e->key());
+      notify(e->key(), kehMemoryPeer::PK_PeerConnected, id);
+   }
+
+   return ret;
+}
+
+
+uint64_t kehMemoryNetwork::get_time() const
+{
+   return m_manual_clock ? m_clock : OS::get_singleton()->get_ticks_usec();
+}
+
+void kehMemoryNetwork::advance(float seconds)
+{
+   ERR_FAIL_COND_MSG(!m_manual_clock, "The clock of the memory network can only be advanced when in manual mode.");
+   m_clock += uint64_t(MAX(seconds, 0.0f) * 1000000.0f);
+}
+
+void kehMemoryNetwork::set_manual_clock(bool manual)
+{
+   if (manual && !m_manual_clock)
+      m_clock = OS::get_singleton()->get_ticks_usec();
+   
+   m_manual_clock = manual;
+}
+
+
+void kehMemoryNetwork::send(int from, int target, NetworkedMultiplayerPeer::TransferMode mode, const uint8_t* buffer, int size)
+{
+   Vector<uint8_t> data;
+   data.resize(size);
+   copymem(data.ptrw(), buffer, size);
+
+   if (target > 0)
+   {
+      transmit(from, target, mode, data);
+      return;
+   }
+
+   // Broadcast. Iterating through a copy of the keys since nothing here should change the container, but
+   // it's cheap to be safe
+   Vector<int> dests;
+   for (Map<int, kehMemoryPeer*>::Element* e = m_peer.front(); e; e = e->next())
+   {
+      if (e->key() != from && e->key() != -target)
+         dests.push_back(e->key());
+   }
+
+   for (int i = 0; i < dests.size(); i++)
+   {
+      transmit(from, dests[i], mode, data);
+   }
+}
+
+
+void kehMemoryNetwork::remove_peer(int id)
+{
+   if (!m_peer.has(id))
+      return;
+   
+   m_peer.erase(id);
+
+   for (Map<int, kehMemoryPeer*>::Element* e = m_peer.front(); e; e = e->next())
+   {
+      if (id == 1)
+         notify(e->key(), kehMemoryPeer::PK_ServerDisconnected, 1);
+      else
+         notify(e->key(), kehMemoryPeer::PK_PeerDisconnected, id);
+   }
+}
+
+
+void kehMemoryNetwork::kick_peer(int id)
+{
+   Map<int, kehMemoryPeer*>::Element* e = m_peer.find(id);
+   if (!e || id == 1)
+      return;
+   
+   notify(id, kehMemoryPeer::PK_ServerDisconnected, 1);
+   remove_peer(id);
+}
+
+
+void kehMemoryNetwork::_bind_methods()
+{
+   ClassDB::bind_method(D_METHOD("create_server"), &kehMemoryNetwork::create_server);
+   ClassDB::bind_method(D_METHOD("create_client"), &kehMemoryNetwork::create_client);
+   ClassDB::bind_method(D_METHOD("advance", "seconds"), &kehMemoryNetwork::advance);
+
+   ClassDB::bind_method(D_METHOD("set_latency", "ms"), &kehMemoryNetwork::set_latency);
+   ClassDB::bind_method(D_METHOD("get_latency"), &kehMemoryNetwork::get_latency);
+   ClassDB::bind_method(D_METHOD("set_jitter", "ms"), &kehMemoryNetwork::set_jitter);
+   ClassDB::bind_method(D_METHOD("get_jitter"), &kehMemoryNetwork::get_jitter);
+   ClassDB::bind_method(D_METHOD("set_packet_loss", "loss"), &kehMemoryNetwork::set_packet_loss);
+   ClassDB::bind_method(D_METHOD("get_packet_loss"), &kehMemoryNetwork::get_packet_loss);
+   ClassDB::bind_method(D_METHOD("set_reorder", "chance"), &kehMemoryNetwork::set_reorder);
+   ClassDB::bind_method(D_METHOD("get_reorder"), &kehMemoryNetwork::get_reorder);
+   ClassDB::bind_method(D_METHOD("set_bandwidth", "bytes_per_sec"), &kehMemoryNetwork::set_bandwidth);
+   ClassDB::bind_method(D_METHOD("get_bandwidth"), &kehMemoryNetwork::get_bandwidth);
+   ClassDB::bind_method(D_METHOD("set_seed", "seed"), &kehMemoryNetwork::set_seed);
+   ClassDB::bind_method(D_METHOD("get_seed"), &kehMemoryNetwork::get_seed);
+   ClassDB::bind_method(D_METHOD("set_manual_clock", "manual"), &kehMemoryNetwork::set_manual_clock);
+   ClassDB::bind_method(D_METHOD("is_manual_clock"), &kehMemoryNetwork::is_manual_clock);
+
+   ADD_PROPERTY(PropertyInfo(Variant::REAL, "latency"), "set_latency", "get_latency");
+   ADD_PROPERTY(PropertyInfo(Variant::REAL, "jitter"), "set_jitter", "get_jitter");
+   ADD_PROPERTY(PropertyInfo(Variant::REAL, "packet_loss", PROPERTY_HINT_RANGE, "0,1,0.01"), "set_packet_loss", "get_packet_loss");
+   ADD_PROPERTY(PropertyInfo(Variant::REAL, "reorder", PROPERTY_HINT_RANGE, "0,1,0.01"), "set_reorder", "get_reorder");
+   ADD_PROPERTY(PropertyInfo(Variant::INT, "bandwidth"), "set_bandwidth", "get_bandwidth");
+   ADD_PROPERTY(PropertyInfo(Variant::INT, "seed"), "set_seed", "get_seed");
+   ADD_PROPERTY(PropertyInfo(Variant::BOOL, "manual_clock"), "set_manual_clock", "is_manual_clock");
+}
+
+
+kehMemoryNetwork::kehMemoryNetwork()
+{
+   m_latency = 0.0f;
+   m_jitter = 0.0f;
+   m_loss = 0.0f;
+   m_reorder = 0.0f;
+   m_bandwidth = 0;
+   m_manual_clock = false;
+   m_clock = 0;
+   m_order = 0;
+   m_port = -1;
+   set_seed(0);
+}
+
+kehMemoryNetwork::~kehMemoryNetwork()
+{
+   if (m_port >= 0 && find(m_port) == this)
+      s_registry.erase(m_port);
+}
+
+
+
+
+void kehMemoryPeer::setup(const Ref<kehMemoryNetwork>& network, int id)
+{
+   m_network = network;
+   m_unique_id = id;
+   // The server is immediately "connected" while clients must wait for the connection to be accepted
+   m_status = id == 1 ? CONNECTION_CONNECTED : CONNECTION_CONNECTING;
+}
+
+
+void kehMemoryPeer::schedule(const Packet& packet)
+{
+   // Packets tend to arrive in order, so search the insertion point from the back
+   int index = m_in_flight.size();
+   while (index > 0 && packet < m_in_flight[index - 1])
+   {
+      index--;
+   }
+
+   m_in_flight.insert(index, packet);
+}
+
+
+void kehMemoryPeer::close_connection()
+{
+   if (!m_network.is_valid())
+      return;
+   
+   m_network->remove_peer(m_unique_id);
+   m_network = Ref<kehMemoryNetwork>();
+   m_status = CONNECTION_DISCONNECTED;
+   m_in_flight.clear();
+   m_ready.clear();
+}
+
+
+void kehMemoryPeer::disconnect_peer(int id)
+{
+   ERR_FAIL_COND_MSG(!is_server(), "Only the server can disconnect peers.");
+
+   if (m_network.is_valid())
+      m_network->kick_peer(id);
+}
+
+
+int kehMemoryPeer::get_packet_peer() const
+{
+   ERR_FAIL_COND_V(m_ready.size() == 0, 0);
+   return m_ready.front()->get().from;
+}
+
+
+void kehMemoryPeer::poll()
+{
+   if (!m_network.is_valid())
+      return;
+   
+   const uint64_t now = m_network->get_time();
+
+   // Keep the reference alive in case a signal handler drops this peer
+   Ref<kehMemoryPeer> self(this);
+
+   int count = 0;
+   while (count < m_in_flight.size() && m_in_flight[count].deliver <= now)
+   {
+      count++;
+   }
+
+   for (int i = 0; i < count; i++)
+   {
+      // Copy, as signal handlers may schedule new packets into this peer
+      const Packet packet = m_in_flight[i];
+
+      switch (packet.kind)
+      {
+         case PK_Data:
+         {
+            m_ready.push_back(packet);
+         } break;
+
+         case PK_PeerConnected:
+         {
+            emit_signal("peer_connected", packet.from);
+         } break;
+
+         case PK_PeerDisconnected:
+         {
+            emit_signal("peer_disconnected", packet.from);
+         } break;
+
+         case PK_ConnectionSucceeded:
+         {
+            m_status = CONNECTION_CONNECTED;
+            emit_signal("connection_succeeded");
+         } break;
+
+         case PK_ConnectionFailed:
+         {
+            m_status = CONNECTION_DISCONNECTED;
+            emit_signal("connection_failed");
+         } break;
+
+         case PK_ServerDisconnected:
+         {
+            m_status = CONNECTION_DISCONNECTED;
+            emit_signal("server_disconnected");
+         } break;
+      }
+
+      // A signal handler may have closed the connection
+      if (m_in_flight.size() == 0)
+         return;
+   }
+
+   // Remove the delivered packets from the front
+   const int remaining = m_in_flight.size() - count;
+   for (int i = 0; i < remaining; i++)
+   {
+      m_in_flight.write[i] = m_in_flight[i + count];
+   }
+   m_in_flight.resize(remaining);
+}
+
+
+Error kehMemoryPeer::get_packet(const uint8_t** r_buffer, int& r_buffer_size)
+{
+   ERR_FAIL_COND_V(m_ready.size() == 0, ERR_UNAVAILABLE);
+
+   m_current = m_ready.front()->get();
+   m_ready.pop_front();
+
+   *r_buffer = m_current.data.ptr();
+   r_buffer_size = m_current.data.size();
+
+   return OK;
+}
+
+
+Error kehMemoryPeer::put_packet(const uint8_t* buffer, int buffer_size)
+{
+   ERR_FAIL_COND_V_MSG(!m_network.is_valid() || m_status != CONNECTION_CONNECTED, ERR_UNCONFIGURED, "The memory peer is not connected.");
+
+   m_network->send(m_unique_id, m_target_peer, m_transfer_mode, buffer, buffer_size);
+   return OK;
+}
+
+
+void kehMemoryPeer::_bind_methods()
+{
+   ClassDB::bind_method(D_METHOD("close_connection"), &kehMemoryPeer::close_connection);
+   ClassDB::bind_method(D_METHOD("disconnect_peer", "id"), &kehMemoryPeer::disconnect_peer);
+}
+
+
+kehMemoryPeer::kehMemoryPeer()
+{
+   m_unique_id = 0;
+   m_status = CONNECTION_DISCONNECTED;
+   m_transfer_mode = TRANSFER_MODE_RELIABLE;
+   m_target_peer = 0;
+   m_refusing = false;
+}
+
+kehMemoryPeer::~kehMemoryPeer()
+{
+   close_connection();
+}
@@ -0,0 +1,227 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_MEMORYPEER_H
+#define _KEHNETWORK_MEMORYPEER_H 1
+
+// Network peers that don't use sockets at all, with packets moving between peers that live in the same process.
+// All peers created by the same kehMemoryNetwork are connected to each other and that object simulates the
+// network conditions: latency, jitter, packet loss, reordering and bandwidth. Every random decision comes from
+// a seedable generator and the clock can be manually advanced, so runs can be repeated with the exact same
+// network conditions. This is meant for tests and benchmarks.
+//
+// Only unreliable packets can be lost or reordered. Reliable packets are always delivered, in order, although
+// still subject to the latency and bandwidth.
+
+#include "core/io/networked_multiplayer_peer.h"
+#include "core/math/random_pcg.h"
+#include "core/reference.h"
+
+class kehMemoryPeer;
+
+class kehMemoryNetwork : public Reference
+{
+   GDCLASS(kehMemoryNetwork, Reference);
+private:
+   // Networks registered with a port, so kehNetwork can find them when joining a "server"
+   static Map<uint32_t, kehMemoryNetwork*> s_registry;
+
+   // Simulated conditions
+   float m_latency;           // One way latency, in milliseconds
+   float m_jitter;            // Maximum random variation of the latency, in milliseconds
+   float m_loss;              // Probability (0 to 1) of an unreliable packet being lost
+   float m_reorder;           // Probability (0 to 1) of an unreliable packet being delayed past the next ones
+   uint32_t m_bandwidth;      // Bytes per second of each link (sender -> receiver). 0 means unlimited
+
+   RandomPCG m_rng;
+   uint64_t m_seed;
+
+   // If true time only moves through advance(), otherwise the OS clock is used
+   bool m_manual_clock;
+   uint64_t m_clock;          // Manual clock, in microseconds
+
+   // Peers currently connected, keyed by their network IDs. The peers hold a reference to this object, so
+   // those are kept as raw pointers here
+   Map<int, kehMemoryPeer*> m_peer;
+
+   // Per link (sender -> receiver) time in which the link is free to transmit the next packet
+   Map<uint64_t, uint64_t> m_link_free;
+   // Per link delivery time of the last reliable packet, used to keep reliable packets in order
+   Map<uint64_t, uint64_t> m_link_reliable;
+
+   // Used to keep the order of packets delivered at the exact same time
+   uint64_t m_order;
+
+   int32_t m_port;
+
+private:
+   static uint64_t link_key(int from, int to) { return (uint64_t(uint32_t(from)) << 32) | uint64_t(uint32_t(to)); }
+
+   // Schedule a packet to the given peer, applying the simulated conditions
+   void transmit(int from, int to, NetworkedMultiplayerPeer::TransferMode mode, const Vector<uint8_t>& data);
+
+   // Schedule a connection event to the given peer
+   void notify(int to, int kind, int peer);
+
+   kehMemoryPeer* create_peer(int id);
+
+protected:
+   static void _bind_methods();
+
+public:
+   // Find the network registered with the given port. NULL if there is none
+   static kehMemoryNetwork* find(uint32_t port);
+   void register_port(uint32_t port);
+
+   // Create the server peer of this network. There can be only one
+   Ref<kehMemoryPeer> create_server();
+   // Create a client peer, which will connect to the server after the latency
+   Ref<kehMemoryPeer> create_client();
+
+   // Current time in microseconds, either from the manual clock or from the OS
+   uint64_t get_time() const;
+
+   // Advance the manual clock
+   void advance(float seconds);
+
+   void set_latency(float ms) { m_latency = MAX(ms, 0.0f); }
+   float get_latency() const { return m_latency; }
+   void set_jitter(float ms) { m_jitter = MAX(ms, 0.0f); }
+   float get_jitter() const { return m_jitter; }
+   void set_packet_loss(float loss) { m_loss = CLAMP(loss, 0.0f, 1.0f); }
+   float get_packet_loss() const { return m_loss; }
+   void set_reorder(float chance) { m_reorder = CLAMP(chance, 0.0f, 1.0f); }
+   float get_reorder() const { return m_reorder; }
+   void set_bandwidth(uint32_t bytes_per_sec) { m_bandwidth = bytes_per_sec; }
+   uint32_t get_bandwidth() const { return m_bandwidth; }
+   void set_seed(uint64_t seed) { m_seed = seed; m_rng.seed(seed); }
+   uint64_t get_seed() const { return m_seed; }
+   void set_manual_clock(bool manual);
+   bool is_manual_clock() const { return m_manual_clock; }
+
+
+   /// Internal, used by the peers
+   // Send a packet. Target follows the NetworkedMultiplayerPeer rules: 0 means everyone, negative means everyone
+   // but the given peer
+   void send(int from, int target, NetworkedMultiplayerPeer::TransferMode mode, const uint8_t* buffer, int size);
+   // Remove the peer from the network, notifying the others
+   void remove_peer(int id);
+   // Server is kicking a client
+   void kick_peer(int id);
+   bool has_peer(int id) const { return m_peer.has(id); }
+
+
+   kehMemoryNetwork();
+   ~kehMemoryNetwork();
+};
+
+
+class kehMemoryPeer : public NetworkedMultiplayerPeer
+{
+   GDCLASS(kehMemoryPeer, NetworkedMultiplayerPeer);
+public:
+   enum PacketKind
+   {
+      PK_Data,
+      PK_PeerConnected,
+      PK_PeerDisconnected,
+      PK_ConnectionSucceeded,
+      PK_ConnectionFailed,
+      PK_ServerDisconnected,
+   };
+
+   struct Packet
+   {
+      PacketKind kind;
+      int from;
+      uint64_t deliver;          // Time (microseconds) in which the packet arrives
+      uint64_t order;
+      Vector<uint8_t> data;
+
+      Packet() : kind(PK_Data), from(0), deliver(0), order(0) {}
+      bool operator<(const Packet& other) const { return deliver != other.deliver ? deliver < other.deliver : order < other.order; }
+   };
+
+private:
+   Ref<kehMemoryNetwork> m_network;
+   int m_unique_id;
+   ConnectionStatus m_status;
+
+   // Packets not delivered yet, sorted by delivery time
+   Vector<Packet> m_in_flight;
+   // Delivered packets waiting to be retrieved through get_packet()
+   List<Packet> m_ready;
+   // The last retrieved packet must be kept alive while the caller is using its buffer
+   Packet m_current;
+
+   TransferMode m_transfer_mode;
+   int m_target_peer;
+   bool m_refusing;
+
+protected:
+   static void _bind_methods();
+
+public:
+   void setup(const Ref<kehMemoryNetwork>& network, int id);
+
+   // Called by the network to schedule incoming data
+   void schedule(const Packet& packet);
+
+   // Leave the network
+   void close_connection();
+
+   // Only on the server, disconnect the given client
+   void disconnect_peer(int id);
+
+
+   /// NetworkedMultiplayerPeer interface
+   virtual void set_transfer_mode(TransferMode mode) { m_transfer_mode = mode; }
+   virtual TransferMode get_transfer_mode() const { return m_transfer_mode; }
+   virtual void set_target_peer(int peer_id) { m_target_peer = peer_id; }
+
+   virtual int get_packet_peer() const;
+
+   virtual bool is_server() const { return m_unique_id == 1; }
+
+   virtual void poll();
+
+   virtual int get_unique_id() const { return m_unique_id; }
+
+   virtual void set_refuse_new_connections(bool enable) { m_refusing = enable; }
+   virtual bool is_refusing_new_connections() const { return m_refusing; }
+
+   virtual ConnectionStatus get_connection_status() const { return m_status; }
+
+
+   /// PacketPeer interface
+   virtual int get_available_packet_count() const { return m_ready.size(); }
+   virtual Error get_packet(const uint8_t** r_buffer, int& r_buffer_size);
+   virtual Error put_packet(const uint8_t* buffer, int buffer_size);
+   virtual int get_max_packet_size() const { return 1 << 24; }
+
+
+   kehMemoryPeer();
+   ~kehMemoryPeer();
+};
+
+
+#endif
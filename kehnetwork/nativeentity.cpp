@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "nativeentity.h"
+
+
+Vector<kehNativeEntityType*> kehNativeEntityType::s_registered;
+
+
+void kehNativeEntityType::add_type(kehNativeEntityType* type)
+{
+   for (int i = 0; i < s_registered.size(); i++)
+   {
+      if (s_registered[i]->get_name() == type->get_name())
+      {
+         WARN_PRINT(vformat("Native snapshot entity type '%s' was already registered. Replacing it.", type->get_name()));
+         memdelete(s_registered[i]);
+         s_registered.set(i, type);
+         return;
+      }
+   }
+
+   s_registered.push_back(type);
+}
+
+
+void kehNativeEntityType::cleanup()
+{
+   for (int i = 0; i < s_registered.size(); i++)
+   {
+      memdelete(s_registered[i]);
+   }
+   s_registered.clear();
+}
+
+
+int32_t kehNativeEntityType::get_field_index(const String& name) const
+{
+   for (int32_t i = 0; i < m_field.size(); i++)
+   {
+      if (m_field[i]->get_name() == name)
+         return i;
+   }
+   return -1;
+}
+
+
+kehNativeEntityType::kehNativeEntityType(const String& name, bool has_chash, kehSnapEntityBase* def) :
+   m_name(name),
+   m_has_chash(has_chash),
+   m_dirty_tracking(false),
+   m_default(def)
+{
+   // Unique ID and class hash are part of the replicable properties, exactly like in the scripted entities
+   m_field.push_back(memnew(kehNativeBaseField("id", &kehSnapEntityBase::get_uid, &kehSnapEntityBase::set_uid)));
+   if (m_has_chash)
+   {
+      m_field.push_back(memnew(kehNativeBaseField("class_hash", &kehSnapEntityBase::get_class_hash, &kehSnapEntityBase::set_class_hash)));
+   }
+}
+
+
+kehNativeEntityType::~kehNativeEntityType()
+{
+   for (int i = 0; i < m_field.size(); i++)
+   {
+      memdelete(m_field[i]);
+   }
+   m_field.clear();
+
+   // The default instance is never given to a Ref
+   memdelete(m_default);
+}
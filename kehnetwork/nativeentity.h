@@ -0,0 +1,564 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_NATIVEENTITY_H
+#define _KEHNETWORK_NATIVEENTITY_H 1
+
+// Snapshot entities are normally declared in GDScript, deriving from kehSnapEntityBase. Every replicable
+// property is then read and written through the script instance, which means Variant conversions and
+// property lookups by name while comparing, encoding, decoding and cloning entities. For entity types with
+// a high instance count (projectiles, NPCs...) that cost dominates the snapshot building.
+//
+// The classes in here allow entity types to be declared in C++, with the replicable properties given as
+// member pointers. The comparison and encoding code is then generated by the templates, directly accessing
+// the members. As an example, within the register_types of a game module:
+//
+//    ClassDB::register_class<Projectile>();
+//    kehNativeEntityType::register_type<Projectile>()
+//       ->add_field("position", &Projectile::position, 0.0f)
+//       ->add_field("velocity", &Projectile::velocity)
+//       ->add_field("owner", &Projectile::owner);
+//
+// The entity class must derive from kehSnapEntityBase and override apply_state(). Registration must happen
+// before the network system is initialized. Native types are identified by their class name, so the usual
+// entity hash is the hash of that name.
+//
+// The tolerance argument of add_field() follows the same rules of the meta used by scripted entities. If
+// not given then the values are compared for exact equality. If 0 then is_equal_approx() is used and any
+// other value is used as custom tolerance. It's only relevant for floating point types.
+//
+// The encoding of the last added field can be changed with set_encoding(), equivalent to the "<property>_encoding"
+// meta of scripted entities. Integer fields accept EncodeDelta and floating point based fields accept EncodeXor,
+// as long as they are compared for exact equality (no tolerance).
+//
+// Floating point based fields can be quantized with set_quantization(), equivalent to the "<property>_quantize" meta.
+// See quantcodec.h. Quantized fields are always fully encoded and compared on the quantized values:
+//
+//    kehNativeEntityType::register_type<Projectile>()
+//       ->add_field("position", &Projectile::position)->set_quantization(16, -1024.0f, 1024.0f)
+//       ->add_field("rotation", &Projectile::rotation)->set_quantization(10);
+//
+// set_dirty_tracking() is the equivalent of the "dirty_tracking" meta. Game code then marks the changed fields of each
+// entity with kehSnapEntityBase::mark_dirty_index(), the index being given by get_field_index(). The encoding of the
+// fields of such types is ignored, changed values are always sent in full.
+
+#include "core/math/quat.h"
+#include "core/math/rect2.h"
+#include "core/math/vector3.h"
+#include "core/color.h"
+
+#include "changemask.h"
+#include "snapentity.h"
+#include "deltacodec.h"
+#include "quantcodec.h"
+#include "typedcompare.h"
+
+#include "../kehgeneral/encdecbuffer.h"
+
+
+// The codec tells how each supported type is encoded and decoded, comparison is done by kehTypedCompare. Only the specializations
+// bellow are supported, anything else will fail to compile when given to add_field(). The DELTA_ENCODING
+// is the encoding used by write_delta() and read_delta(), which encode the value relative to a baseline.
+template <typename T>
+struct kehNativeCodec;
+
+template <>
+struct kehNativeCodec<bool>
+{
+   static int get_type() { return Variant::BOOL; }
+   static const char* get_prefix() { return "bool"; }
+   static void write(kehEncDecBuffer* into, bool v) { into->write_bool(v); }
+   static bool read(kehEncDecBuffer* from) { return from->read_bool(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeFull;
+   static void write_delta(kehEncDecBuffer* into, bool v, bool) { write(into, v); }
+   static bool read_delta(kehEncDecBuffer* from, bool) { return read(from); }
+};
+
+template <>
+struct kehNativeCodec<int32_t>
+{
+   static int get_type() { return Variant::INT; }
+   static const char* get_prefix() { return "int"; }
+   static void write(kehEncDecBuffer* into, int32_t v) { into->write_int(v); }
+   static int32_t read(kehEncDecBuffer* from) { return from->read_int(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeDelta;
+   static void write_delta(kehEncDecBuffer* into, int32_t v, int32_t base) { kehDeltaCodec::write_diff(into, v, base); }
+   static int32_t read_delta(kehEncDecBuffer* from, int32_t base) { return int32_t(kehDeltaCodec::read_diff(from, base)); }
+};
+
+template <>
+struct kehNativeCodec<uint32_t>
+{
+   static int get_type() { return kehSnapEntityBase::CTYPE_UINT; }
+   static const char* get_prefix() { return "uint"; }
+   static void write(kehEncDecBuffer* into, uint32_t v) { into->write_uint(v); }
+   static uint32_t read(kehEncDecBuffer* from) { return from->read_uint(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeDelta;
+   static void write_delta(kehEncDecBuffer* into, uint32_t v, uint32_t base) { kehDeltaCodec::write_diff(into, v, base); }
+   static uint32_t read_delta(kehEncDecBuffer* from, uint32_t base) { return uint32_t(kehDeltaCodec::read_diff(from, base)); }
+};
+
+template <>
+struct kehNativeCodec<uint8_t>
+{
+   static int get_type() { return kehSnapEntityBase::CTYPE_BYTE; }
+   static const char* get_prefix() { return "byte"; }
+   static void write(kehEncDecBuffer* into, uint8_t v) { into->write_byte(v); }
+   static uint8_t read(kehEncDecBuffer* from) { return from->read_byte(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeDelta;
+   static void write_delta(kehEncDecBuffer* into, uint8_t v, uint8_t base) { kehDeltaCodec::write_diff(into, v, base); }
+   static uint8_t read_delta(kehEncDecBuffer* from, uint8_t base) { return uint8_t(kehDeltaCodec::read_diff(from, base)); }
+};
+
+template <>
+struct kehNativeCodec<uint16_t>
+{
+   static int get_type() { return kehSnapEntityBase::CTYPE_USHORT; }
+   static const char* get_prefix() { return "ushort"; }
+   static void write(kehEncDecBuffer* into, uint16_t v) { into->write_ushort(v); }
+   static uint16_t read(kehEncDecBuffer* from) { return from->read_ushort(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeDelta;
+   static void write_delta(kehEncDecBuffer* into, uint16_t v, uint16_t base) { kehDeltaCodec::write_diff(into, v, base); }
+   static uint16_t read_delta(kehEncDecBuffer* from, uint16_t base) { return uint16_t(kehDeltaCodec::read_diff(from, base)); }
+};
+
+template <>
+struct kehNativeCodec<float>
+{
+   static int get_type() { return Variant::REAL; }
+   static const char* get_prefix() { return "float"; }
+   static void write(kehEncDecBuffer* into, float v) { into->write_float(v); }
+   static float read(kehEncDecBuffer* from) { return from->read_float(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeXor;
+   static void write_delta(kehEncDecBuffer* into, float v, float base) { kehDeltaCodec::write_xor(into, v, base); }
+   static float read_delta(kehEncDecBuffer* from, float base) { return kehDeltaCodec::read_xor(from, base); }
+};
+
+template <>
+struct kehNativeCodec<Vector2>
+{
+   static int get_type() { return Variant::VECTOR2; }
+   static const char* get_prefix() { return "vec2"; }
+   static void write(kehEncDecBuffer* into, const Vector2& v) { into->write_vector2(v); }
+   static Vector2 read(kehEncDecBuffer* from) { return from->read_vector2(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeXor;
+   static void write_delta(kehEncDecBuffer* into, const Vector2& v, const Vector2& base) { kehDeltaCodec::write_xor(into, v, base); }
+   static Vector2 read_delta(kehEncDecBuffer* from, const Vector2& base) { return kehDeltaCodec::read_xor(from, base); }
+};
+
+template <>
+struct kehNativeCodec<Rect2>
+{
+   static int get_type() { return Variant::RECT2; }
+   static const char* get_prefix() { return "rect2"; }
+   static void write(kehEncDecBuffer* into, const Rect2& v) { into->write_rect2(v); }
+   static Rect2 read(kehEncDecBuffer* from) { return from->read_rect2(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeXor;
+   static void write_delta(kehEncDecBuffer* into, const Rect2& v, const Rect2& base) { kehDeltaCodec::write_xor(into, v, base); }
+   static Rect2 read_delta(kehEncDecBuffer* from, const Rect2& base) { return kehDeltaCodec::read_xor(from, base); }
+};
+
+template <>
+struct kehNativeCodec<Vector3>
+{
+   static int get_type() { return Variant::VECTOR3; }
+   static const char* get_prefix() { return "vec3"; }
+   static void write(kehEncDecBuffer* into, const Vector3& v) { into->write_vector3(v); }
+   static Vector3 read(kehEncDecBuffer* from) { return from->read_vector3(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeXor;
+   static void write_delta(kehEncDecBuffer* into, const Vector3& v, const Vector3& base) { kehDeltaCodec::write_xor(into, v, base); }
+   static Vector3 read_delta(kehEncDecBuffer* from, const Vector3& base) { return kehDeltaCodec::read_xor(from, base); }
+};
+
+template <>
+struct kehNativeCodec<Quat>
+{
+   static int get_type() { return Variant::QUAT; }
+   static const char* get_prefix() { return "quat"; }
+   static void write(kehEncDecBuffer* into, const Quat& v) { into->write_quat(v); }
+   static Quat read(kehEncDecBuffer* from) { return from->read_quat(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeXor;
+   static void write_delta(kehEncDecBuffer* into, const Quat& v, const Quat& base) { kehDeltaCodec::write_xor(into, v, base); }
+   static Quat read_delta(kehEncDecBuffer* from, const Quat& base) { return kehDeltaCodec::read_xor(from, base); }
+};
+
+template <>
+struct kehNativeCodec<Color>
+{
+   static int get_type() { return Variant::COLOR; }
+   static const char* get_prefix() { return "color"; }
+   static void write(kehEncDecBuffer* into, const Color& v) { into->write_color(v); }
+   static Color read(kehEncDecBuffer* from) { return from->read_color(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeXor;
+   static void write_delta(kehEncDecBuffer* into, const Color& v, const Color& base) { kehDeltaCodec::write_xor(into, v, base); }
+   static Color read_delta(kehEncDecBuffer* from, const Color& base) { return kehDeltaCodec::read_xor(from, base); }
+};
+
+template <>
+struct kehNativeCodec<String>
+{
+   static int get_type() { return Variant::STRING; }
+   static const char* get_prefix() { return "string"; }
+   static void write(kehEncDecBuffer* into, const String& v) { into->write_string(v); }
+   static String read(kehEncDecBuffer* from) { return from->read_string(); }
+   static const int DELTA_ENCODING = kehSnapEntityBase::EncodeFull;
+   static void write_delta(kehEncDecBuffer* into, const String& v, const String&) { write(into, v); }
+   static String read_delta(kehEncDecBuffer* from, const String&) { return read(from); }
+};
+
+
+
+// Describes a single replicable property of a native entity type. kehEntityInfo holds a pointer to
+// an instance of this within the replicable property list and uses it instead of the Variant path.
+class kehNativeField
+{
+protected:
+   String m_name;
+   // One of kehSnapEntityBase::PropertyEncoding
+   int m_encoding;
+   kehQuantCodec m_quant;
+
+public:
+   const String& get_name() const { return m_name; }
+
+   int get_encoding() const { return m_encoding; }
+   // Returns false if the given encoding is not supported by the type of this field. Values compared with a
+   // tolerance are not encoded relative to the reference, as the client would accumulate the skipped changes
+   bool set_encoding(int encoding)
+   {
+      if (encoding != kehSnapEntityBase::EncodeFull && (encoding != get_delta_encoding() || m_quant.is_enabled() || has_tolerance()))
+         return false;
+      m_encoding = encoding;
+      return true;
+   }
+
+   bool is_quantized() const { return m_quant.is_enabled(); }
+   // Returns an error message if the field type can't be quantized with the given settings
+   String set_quantization(int bits, float minval, float maxval)
+   {
+      const String err = m_quant.setup(get_type(), bits, minval, maxval);
+      if (err.empty())
+         m_encoding = kehSnapEntityBase::EncodeFull;
+      return err;
+   }
+
+   // Variant type (or one of the kehSnapEntityBase::CTYPE_*) of this field
+   virtual int get_type() const = 0;
+   virtual String get_comparer_name() const = 0;
+   virtual int get_delta_encoding() const = 0;
+   virtual bool has_tolerance() const { return false; }
+
+   virtual bool equal(const kehSnapEntityBase* e1, const kehSnapEntityBase* e2) const = 0;
+   // Compare this field across count pairs of entities, setting the given bit within out[i] if the field differs between
+   // e1[i] and e2[i]. A single virtual call for the entire batch, the loop itself works on the typed values
+   virtual void compare_batch(const kehSnapEntityBase* const* e1, const kehSnapEntityBase* const* e2, uint32_t count, uint32_t bit, kehChangeMask* out) const = 0;
+   virtual void write(const kehSnapEntityBase* entity, kehEncDecBuffer* into) const = 0;
+   virtual void read(kehEncDecBuffer* from, kehSnapEntityBase* into) const = 0;
+   virtual void copy(const kehSnapEntityBase* from, kehSnapEntityBase* to) const = 0;
+
+   // Encode/decode relative to the value of the baseline entity, using the delta encoding of the field type
+   virtual void write_delta(const kehSnapEntityBase* entity, const kehSnapEntityBase* baseline, kehEncDecBuffer* into) const = 0;
+   virtual void read_delta(const kehSnapEntityBase* baseline, kehEncDecBuffer* from, kehSnapEntityBase* into) const = 0;
+
+   // Mostly for tooling (benchmarks, as an example), access the field through a Variant
+   virtual Variant get(const kehSnapEntityBase* entity) const = 0;
+   virtual void set(kehSnapEntityBase* entity, const Variant& value) const = 0;
+
+   kehNativeField(const String& name) : m_name(name), m_encoding(kehSnapEntityBase::EncodeFull) {}
+   virtual ~kehNativeField() {}
+};
+
+
+// Field given by a member pointer of the entity class
+template <class E, typename T>
+class kehNativeMemberField : public kehNativeField
+{
+private:
+   // Amount of values gathered into the columns given to kehTypedCompare::compare_column()
+   static const uint32_t BATCH_SIZE = 64;
+
+   T E::*m_member;
+   // Negative means exact comparison
+   float m_tolerance;
+
+   static const E* cast(const kehSnapEntityBase* entity) { return static_cast<const E*>(entity); }
+   static E* cast(kehSnapEntityBase* entity) { return static_cast<E*>(entity); }
+
+public:
+   virtual int get_type() const { return kehNativeCodec<T>::get_type(); }
+   virtual int get_delta_encoding() const { return kehNativeCodec<T>::DELTA_ENCODING; }
+   virtual bool has_tolerance() const { return m_tolerance >= 0.0f; }
+
+   virtual String get_comparer_name() const
+   {
+      if (m_quant.is_enabled())
+         return m_quant.get_name(get_type());
+      if (m_tolerance < 0.0f)
+         return "generic";
+
+      const String prefix = kehNativeCodec<T>::get_prefix();
+      return m_tolerance != 0.0f ? vformat("%s_custom_%f", prefix, m_tolerance) : vformat("%s_auto", prefix);
+   }
+
+   virtual bool equal(const kehSnapEntityBase* e1, const kehSnapEntityBase* e2) const
+   {
+      if (m_quant.is_enabled())
+         return m_quant.equal(cast(e1)->*m_member, cast(e2)->*m_member);
+      return kehTypedCompare::equal(cast(e1)->*m_member, cast(e2)->*m_member, m_tolerance);
+   }
+
+   virtual void compare_batch(const kehSnapEntityBase* const* e1, const kehSnapEntityBase* const* e2, uint32_t count, uint32_t bit, kehChangeMask* out) const
+   {
+      if (m_quant.is_enabled())
+      {
+         for (uint32_t i = 0; i < count; i++)
+         {
+            if (!m_quant.equal(cast(e1[i])->*m_member, cast(e2[i])->*m_member))
+               out[i].set_bit(bit);
+         }
+         return;
+      }
+
+      // The members are gathered into contiguous columns, in chunks, then compared in one go
+      T c1[BATCH_SIZE];
+      T c2[BATCH_SIZE];
+      uint8_t changed[BATCH_SIZE];
+      for (uint32_t base = 0; base < count; base += BATCH_SIZE)
+      {
+         const uint32_t n = MIN(count - base, BATCH_SIZE);
+         for (uint32_t i = 0; i < n; i++)
+         {
+            c1[i] = cast(e1[base + i])->*m_member;
+            c2[i] = cast(e2[base + i])->*m_member;
+         }
+
+         if (kehTypedCompare::compare_column(c1, c2, n, m_tolerance, changed) == 0)
+            continue;
+
+         for (uint32_t i = 0; i < n; i++)
+         {
+            if (changed[i])
+               out[base + i].set_bit(bit);
+         }
+      }
+   }
+
+   virtual void write(const kehSnapEntityBase* entity, kehEncDecBuffer* into) const
+   {
+      if (m_quant.is_enabled())
+         m_quant.write(into, cast(entity)->*m_member);
+      else
+         kehNativeCodec<T>::write(into, cast(entity)->*m_member);
+   }
+
+   virtual void read(kehEncDecBuffer* from, kehSnapEntityBase* into) const
+   {
+      if (m_quant.is_enabled())
+         m_quant.read(from, cast(into)->*m_member);
+      else
+         cast(into)->*m_member = kehNativeCodec<T>::read(from);
+   }
+
+   virtual void copy(const kehSnapEntityBase* from, kehSnapEntityBase* to) const
+   {
+      cast(to)->*m_member = cast(from)->*m_member;
+   }
+
+   virtual void write_delta(const kehSnapEntityBase* entity, const kehSnapEntityBase* baseline, kehEncDecBuffer* into) const
+   {
+      kehNativeCodec<T>::write_delta(into, cast(entity)->*m_member, cast(baseline)->*m_member);
+   }
+
+   virtual void read_delta(const kehSnapEntityBase* baseline, kehEncDecBuffer* from, kehSnapEntityBase* into) const
+   {
+      cast(into)->*m_member = kehNativeCodec<T>::read_delta(from, cast(baseline)->*m_member);
+   }
+
+   virtual Variant get(const kehSnapEntityBase* entity) const { return cast(entity)->*m_member; }
+
+   virtual void set(kehSnapEntityBase* entity, const Variant& value) const
+   {
+      const T v = value;
+      cast(entity)->*m_member = v;
+   }
+
+   kehNativeMemberField(const String& name, T E::*member, float tolerance) :
+      kehNativeField(name), m_member(member), m_tolerance(tolerance) {}
+};
+
+
+// The unique ID and class hash are held by kehSnapEntityBase itself and accessed through functions
+class kehNativeBaseField : public kehNativeField
+{
+private:
+   uint32_t (kehSnapEntityBase::*m_getter)() const;
+   void (kehSnapEntityBase::*m_setter)(uint32_t);
+
+public:
+   virtual int get_type() const { return kehSnapEntityBase::CTYPE_UINT; }
+   virtual String get_comparer_name() const { return "generic"; }
+   virtual int get_delta_encoding() const { return kehSnapEntityBase::EncodeDelta; }
+
+   virtual bool equal(const kehSnapEntityBase* e1, const kehSnapEntityBase* e2) const { return (e1->*m_getter)() == (e2->*m_getter)(); }
+   virtual void compare_batch(const kehSnapEntityBase* const* e1, const kehSnapEntityBase* const* e2, uint32_t count, uint32_t bit, kehChangeMask* out) const
+   {
+      for (uint32_t i = 0; i < count; i++)
+      {
+         if ((e1[i]->*m_getter)() != (e2[i]->*m_getter)())
+            out[i].set_bit(bit);
+      }
+   }
+   virtual void write(const kehSnapEntityBase* entity, kehEncDecBuffer* into) const { into->write_uint((entity->*m_getter)()); }
+   virtual void read(kehEncDecBuffer* from, kehSnapEntityBase* into) const { (into->*m_setter)(from->read_uint()); }
+   virtual void copy(const kehSnapEntityBase* from, kehSnapEntityBase* to) const { (to->*m_setter)((from->*m_getter)()); }
+
+   virtual void write_delta(const kehSnapEntityBase* entity, const kehSnapEntityBase* baseline, kehEncDecBuffer* into) const
+   {
+      kehDeltaCodec::write_diff(into, (entity->*m_getter)(), (baseline->*m_getter)());
+   }
+   virtual void read_delta(const kehSnapEntityBase* baseline, kehEncDecBuffer* from, kehSnapEntityBase* into) const
+   {
+      (into->*m_setter)(kehDeltaCodec::read_diff(from, (baseline->*m_getter)()));
+   }
+
+   virtual Variant get(const kehSnapEntityBase* entity) const { return (entity->*m_getter)(); }
+   virtual void set(kehSnapEntityBase* entity, const Variant& value) const { (entity->*m_setter)(value); }
+
+   kehNativeBaseField(const String& name, uint32_t (kehSnapEntityBase::*getter)() const, void (kehSnapEntityBase::*setter)(uint32_t)) :
+      kehNativeField(name), m_getter(getter), m_setter(setter) {}
+};
+
+
+
+template <class E>
+class kehNativeEntity;
+
+// Describes a native entity type. Registered types are kept in a static list, which is read by kehSnapshotData
+// when the entity types are registered.
+class kehNativeEntityType
+{
+private:
+   static Vector<kehNativeEntityType*> s_registered;
+
+protected:
+   String m_name;
+   bool m_has_chash;
+   bool m_dirty_tracking;
+   Vector<kehNativeField*> m_field;
+
+   // Instance with the initial values of every field, used to reset recycled entities
+   kehSnapEntityBase* m_default;
+
+   static void add_type(kehNativeEntityType* type);
+
+public:
+   const String& get_name() const { return m_name; }
+   bool has_class_hash() const { return m_has_chash; }
+   bool has_dirty_tracking() const { return m_dirty_tracking; }
+
+   uint32_t get_field_count() const { return m_field.size(); }
+   const kehNativeField* get_field(uint32_t index) const { return m_field[index]; }
+   // Index of the field with the given name or -1 if there is none
+   int32_t get_field_index(const String& name) const;
+
+   const kehSnapEntityBase* get_default() const { return m_default; }
+
+   virtual Ref<kehSnapEntityBase> create() const = 0;
+
+   // Register the entity class E. If has_chash is false then the class hash will not be encoded within the snapshots,
+   // the equivalent of setting the "class_hash" meta to 0 in scripted entities.
+   template <class E>
+   static kehNativeEntity<E>* register_type(bool has_chash = true);
+
+   static const Vector<kehNativeEntityType*>& get_registered() { return s_registered; }
+
+   // Delete every registered type. Called when the module is unregistered
+   static void cleanup();
+
+   kehNativeEntityType(const String& name, bool has_chash, kehSnapEntityBase* def);
+   virtual ~kehNativeEntityType();
+};
+
+
+template <class E>
+class kehNativeEntity : public kehNativeEntityType
+{
+public:
+   virtual Ref<kehSnapEntityBase> create() const { return Ref<kehSnapEntityBase>(memnew(E)); }
+
+   // Add a replicable property. Returns this so calls can be chained
+   template <typename T>
+   kehNativeEntity* add_field(const String& name, T E::*member, float tolerance = -1.0f)
+   {
+      // memnew does not deal well with the comma within the template arguments
+      typedef kehNativeMemberField<E, T> FieldT;
+      m_field.push_back(memnew(FieldT(name, member, tolerance)));
+      return this;
+   }
+
+   // Change the encoding (kehSnapEntityBase::PropertyEncoding) of the last added field
+   kehNativeEntity* set_encoding(int encoding)
+   {
+      ERR_FAIL_COND_V_MSG(m_field.size() == 0, this, "Setting encoding of native entity field, but no field was added.");
+      kehNativeField* field = m_field[m_field.size() - 1];
+      if (!field->set_encoding(encoding))
+      {
+         WARN_PRINT(vformat("Encoding %d is not supported by field '%s' of native entity type '%s'.", encoding, field->get_name(), m_name));
+      }
+      return this;
+   }
+
+   // Quantize the last added field. The range is ignored by rotation quaternions, which use the smallest three method
+   kehNativeEntity* set_quantization(int bits, float minval = 0.0f, float maxval = 1.0f)
+   {
+      ERR_FAIL_COND_V_MSG(m_field.size() == 0, this, "Setting quantization of native entity field, but no field was added.");
+      kehNativeField* field = m_field[m_field.size() - 1];
+      const String err = field->set_quantization(bits, minval, maxval);
+      if (!err.empty())
+      {
+         WARN_PRINT(vformat("Ignoring quantization of field '%s' of native entity type '%s'. %s", field->get_name(), m_name, err));
+      }
+      return this;
+   }
+
+   // Changed fields are marked by game code instead of found by comparison. See kehSnapEntityBase::mark_dirty_index()
+   kehNativeEntity* set_dirty_tracking(bool enabled)
+   {
+      m_dirty_tracking = enabled;
+      return this;
+   }
+
+   kehNativeEntity(bool has_chash) :
+      kehNativeEntityType(E::get_class_static(), has_chash, memnew(E)) {}
+};
+
+
+template <class E>
+kehNativeEntity<E>* kehNativeEntityType::register_type(bool has_chash)
+{
+   kehNativeEntity<E>* ret = memnew(kehNativeEntity<E>(has_chash));
+   add_type(ret);
+   return ret;
+}
+
+
+#endif
@@ -24,16 +24,23 @@
 #include "network.h"
 #include "../kehgeneral/encdecbuffer.h"
 
+#include "core/engine.h"
+#include "core/io/json.h"
+#include "core/io/multiplayer_api.h"
+#include "core/os/os.h"
 #include "core/script_language.h"
 #include "scene/main/viewport.h"
 #include "core/func_ref.h"
 
+#include "benchmark.h"
 #include "inputdata.h"
+#include "memorypeer.h"
 #include "networknode.h"
 #include "playerdata.h"
 #include "playernode.h"
 #include "snapentity.h"
 #include "snapshotdata.h"
+#include "threadedpeer.h"
 #include "updtcontrol.h"
 
 
@@ -80,6 +87,18 @@ void kehNetwork::initialize()
    m_full_snap_threshold = GLOBAL_GET("keh_modules/network/snapshot/full_threshold");
    m_max_history_size = GLOBAL_GET("keh_modules/network/snapshot/max_history");
    m_max_client_history_size = GLOBAL_GET("keh_modules/network/snapshot/max_client_history");
+   m_use_io_thread = GLOBAL_GET("keh_modules/network/io_thread/enabled");
+   m_io_queue_size = GLOBAL_GET("keh_modules/network/io_thread/queue_size");
+   m_io_idle_usec = GLOBAL_GET("keh_modules/network/io_thread/idle_usec");
+   m_apply_time_scale = GLOBAL_GET("keh_modules/network/clock_sync/apply_time_scale");
+   m_clock_sync.configure(GLOBAL_GET("keh_modules/network/clock_sync/max_dilation"), GLOBAL_GET("keh_modules/network/clock_sync/safety_margin"), GLOBAL_GET("keh_modules/network/clock_sync/resync_threshold"));
+   m_simulation_rate = GLOBAL_GET("keh_modules/network/tick/simulation_rate");
+   m_send_rate = GLOBAL_GET("keh_modules/network/tick/send_rate");
+   m_max_ticks_per_frame = GLOBAL_GET("keh_modules/network/tick/max_ticks_per_frame");
+   m_profiler.set_enabled(GLOBAL_GET("keh_modules/network/profiler/enabled"));
+   m_max_trace_events = GLOBAL_GET("keh_modules/network/profiler/max_trace_events");
+   m_replay_keyframe_interval = GLOBAL_GET("keh_modules/network/replay/keyframe_interval");
+   uint32_t spectator_delay = GLOBAL_GET("keh_modules/network/spectator/delay_ticks");
 
    if (m_max_history_size < m_full_snap_threshold + 1)
    {
@@ -87,6 +106,13 @@ void kehNetwork::initialize()
       m_max_history_size = m_full_snap_threshold + 1;
    }
 
+   if (spectator_delay >= m_max_history_size)
+   {
+      WARN_PRINT(vformat("The spectator delay (%d) must be smaller than the max snapshot history, so setting it to %d", spectator_delay, m_max_history_size - 1));
+      spectator_delay = m_max_history_size - 1;
+   }
+   m_spectator.configure(spectator_delay, GLOBAL_GET("keh_modules/network/spectator/keyframe_interval"));
+
    check_backmode();
 
 
@@ -101,6 +127,7 @@ void kehNetwork::initialize()
    st->connect("network_peer_disconnected", this, "_on_player_disconnected");
    st->connect("connection_failed", this, "_on_connection_failed");
    st->connect("server_disconnected", this, "_on_disconnected");
+   st->get_multiplayer()->connect("network_peer_packet", this, "_on_network_packet");
 
    // Setup the remote functions
    rpc_config("_all_register_player", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
@@ -114,6 +141,7 @@ void kehNetwork::initialize()
    rpc_config("_client_receive_full_snapshot", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
    rpc_config("_client_receive_delta_snapshot", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
    rpc_config("_client_receive_net_event", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_client_receive_unreliable_event", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
    rpc_config("_client_request_credentials", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
 
    rpc_config("_server_client_is_ready", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
@@ -121,6 +149,7 @@ void kehNetwork::initialize()
    rpc_config("_server_acknowledge_snapshot", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
    rpc_config("_server_broadcast_custom_prop", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
    rpc_config("_server_receive_credentials", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+   rpc_config("_server_register_spectator", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
 
 
    m_snapshot_data = Ref<kehSnapshotData>(memnew(kehSnapshotData));
@@ -131,13 +160,24 @@ void kehNetwork::initialize()
    m_update_control->set_snapshot_finished(kehUpdateControl::SnapshotFinishedT(this, &kehNetwork::on_snapshot_finished));
    m_update_control->set_event_dispatcher(kehUpdateControl::EventDispatcherT(this, &kehNetwork::on_dispatch_events));
 
+   // Accumulated data is sent only once every this amount of ticks
+   if (m_send_rate > 0)
+   {
+      m_update_control->set_send_interval(MAX(1, (uint32_t)Math::round(get_tick_rate() / m_send_rate)));
+   }
+
    m_snapshot_data->get_entity_types(m_entity_type);
 
    m_player_data->set_ping_signaler(kehFunctoid<void(uint32_t, float)>(this, &kehNetwork::ping_signaler));
    m_player_data->set_cprop_signaler(kehFunctoid<void(uint32_t, const String&, const Variant&)>(this, &kehNetwork::custom_prop_signaler));
+   m_player_data->set_cprop_broadcaster(kehFunctoid<void(uint32_t, const Variant&)>(this, &kehNetwork::custom_prop_broadcast_requester));
 
    add_child(m_player_data->create_local_player());
 
+   // The tick scheduler runs from the internal physics process, so it doesn't interfere with the processing
+   // toggled by the WebSocket polling.
+   m_tick_accumulator = 0.0f;
+   set_physics_process_internal(m_simulation_rate > 0);
 
    m_initialized = true;
 }
@@ -149,6 +189,12 @@ void kehNetwork::reset_system()
    m_snapshot_data->reset();
    m_player_data->get_local_player()->reset_data();
 
+   m_last_unreliable_evt_sig = 0;
+   m_pending_event.resize(0);
+   m_tick_accumulator = 0.0f;
+   m_spectator.reset_stream();
+   reset_clock_sync();
+
    // Reset incrementing IDs. Well, should this system even exist?
 
    // Clear the event handlers
@@ -353,12 +399,36 @@ void kehNetwork::create_server(uint32_t port, const String& sname, uint32_t max_
          }
 #endif
       } break;
+
+      case BM_Memory:
+      {
+         // The network simulating the conditions. It's registered with the port so clients (in this process)
+         // can find it
+         Ref<kehMemoryNetwork> net(memnew(kehMemoryNetwork));
+         net->set_latency(GLOBAL_GET("keh_modules/network/memory/latency_ms"));
+         net->set_jitter(GLOBAL_GET("keh_modules/network/memory/jitter_ms"));
+         net->set_packet_loss(GLOBAL_GET("keh_modules/network/memory/packet_loss"));
+         net->set_reorder(GLOBAL_GET("keh_modules/network/memory/reorder"));
+         net->set_bandwidth(GLOBAL_GET("keh_modules/network/memory/bandwidth"));
+         net->set_seed((int)GLOBAL_GET("keh_modules/network/memory/seed"));
+         net->register_port(port);
+
+         netpeer = net->create_server();
+         if (netpeer.is_valid())
+         {
+            m_memory_network = net;
+         }
+         else
+         {
+            emit_signal("server_creation_failed");
+         }
+      } break;
    }
 
    if (netpeer.is_valid())
    {
       // Assign the network peer into the scene tree
-      st->set_network_peer(netpeer);
+      st->set_network_peer(wrap_netpeer(netpeer));
 
       // Server has been created so emit the signal indicating this fact
       emit_signal("server_created");
@@ -385,6 +455,9 @@ void kehNetwork::close_server(const String& message)
       if (!st->is_network_server())
          return;
       
+      // Simulated clients live in this process, so disconnect those from their side and remove the nodes
+      remove_simulated_clients();
+
       // Must kick connected players. Normal iteration through the player list can't be done because at each
       // one a disconnect_peer() signal will be caleed, which will remove that player node from the list. So,
       // first retrieve the list of keys (network IDs) then iterate through that list in order to kick everyone.
@@ -395,6 +468,17 @@ void kehNetwork::close_server(const String& message)
       {
          kick_player(pids[i], message);
       }
+
+      // The same goes for the spectators
+      Vector<uint32_t> sids;
+      for (Set<uint32_t>::Element* e = m_spectator.get_spectators().front(); e; e = e->next())
+      {
+         sids.push_back(e->get());
+      }
+      for (int i = 0; i < sids.size(); i++)
+      {
+         kick_player(sids[i], message);
+      }
    }
 
    // This is necessary if running in websocket mode, but there is absolutely no problem in doing this in
@@ -407,6 +491,12 @@ void kehNetwork::close_server(const String& message)
 }
 
 
+Ref<kehMemoryNetwork> kehNetwork::get_memory_network() const
+{
+   return m_memory_network;
+}
+
+
 void kehNetwork::kick_player(uint32_t id, const String& reason)
 {
    if (!is_inside_tree())
@@ -428,9 +518,15 @@ void kehNetwork::kick_player(uint32_t id, const String& reason)
          // On ENet first remote call the function that will give the reason to the kicked player
          rpc_id(id, "_client_kicked", reason);
 
-         // Then remove the player
+         // Then remove the player. If the network thread is running, the disconnection is queued after the
+         // RPC above
+         Ref<kehThreadedPeer> tpeer = get_tree()->get_network_peer();
          Ref<NetworkedMultiplayerENet> peer = get_tree()->get_network_peer();
-         if (peer.is_valid())
+         if (tpeer.is_valid())
+         {
+            tpeer->disconnect_peer(id);
+         }
+         else if (peer.is_valid())
          {
             peer->disconnect_peer(id);
          }
@@ -448,9 +544,25 @@ void kehNetwork::kick_player(uint32_t id, const String& reason)
          net->disconnect_peer(id, 1000, reason);
 #endif
       } break;
+
+      case BM_Memory:
+      {
+         // Packets are delivered in order, so the reason arrives before the disconnection
+         rpc_id(id, "_client_kicked", reason);
+
+         Ref<kehMemoryPeer> peer = get_tree()->get_network_peer();
+         if (peer.is_valid())
+         {
+            peer->disconnect_peer(id);
+         }
+      } break;
    }
 
    // Ensure internal remote player container is properly cleaned
+   if (m_spectator.remove(id))
+   {
+      emit_signal("spectator_removed", id);
+   }
    all_unregister_player(id);
 }
 
@@ -466,7 +578,35 @@ void kehNetwork::join_server(const String& IP, uint32_t port)
       return;
    }
 
-   Ref<NetworkedMultiplayerPeer> netpeer;;
+   Ref<NetworkedMultiplayerPeer> netpeer = create_client_peer(IP, port);
+
+   if (netpeer.is_valid())
+   {
+#ifdef MODULE_WEBSOCKET_ENABLED
+      // Must listen to this signal because it will arrive before the actual disconnection.
+      Ref<WebSocketClient> ws = netpeer;
+      if (ws.is_valid())
+      {
+         ws->connect("server_close_request", this, "_client_on_websocket_close_request");
+      }
+#endif
+
+      st->set_network_peer(wrap_netpeer(netpeer));
+
+      // At this point it does not necessarily mean that the connection is successful, only that
+      // the attempt is now going on. In other words, there isn't much else to do here besides
+      // waiting for the signal indicating either a success or failure.
+   }
+   else
+   {
+      emit_signal("join_fail");
+   }
+}
+
+
+Ref<NetworkedMultiplayerPeer> kehNetwork::create_client_peer(const String& IP, uint32_t port) const
+{
+   Ref<NetworkedMultiplayerPeer> netpeer;
 
    switch (m_backmode)
    {
@@ -476,11 +616,7 @@ void kehNetwork::join_server(const String& IP, uint32_t port)
          Ref<NetworkedMultiplayerENet> enet(memnew(NetworkedMultiplayerENet));
          enet->set_compression_mode((NetworkedMultiplayerENet::CompressionMode)m_compression);
 
-         if (enet->create_client(IP, port) != OK)
-         {
-            emit_signal("join_fail");
-         }
-         else
+         if (enet->create_client(IP, port) == OK)
          {
             netpeer = enet;
          }
@@ -492,33 +628,28 @@ void kehNetwork::join_server(const String& IP, uint32_t port)
 #ifdef MODULE_WEBSOCKET_ENABLED
          Ref<WebSocketClient> net(WebSocketClient::create());
 
-         // Must listen to this signal because it will arrive before the actual disconnection.
-         net->connect("server_close_request", this, "_client_on_websocket_close_request");
-
          // Websocket connections require a "w://" at the beginning of the address
          const String url(vformat("ws://%s:%d", IP, port));
 
-         if (net->connect_to_url(url, Vector<String>(), true) != OK)
-         {
-            emit_signal("join_fail");
-         }
-         else
+         if (net->connect_to_url(url, Vector<String>(), true) == OK)
          {
             netpeer = net;
          }
 #endif
       } break;
-   }
-   
 
-   if (netpeer.is_valid())
-   {
-      st->set_network_peer(netpeer);
-
-      // At this point it does not necessarily mean that the connection is successful, only that
-      // the attempt is now going on. In other words, there isn't much else to do here besides
-      // waiting for the signal indicating either a success or failure.
+      case BM_Memory:
+      {
+         // The IP is irrelevant, only the port is used to find the memory network
+         kehMemoryNetwork* net = kehMemoryNetwork::find(port);
+         if (net)
+         {
+            netpeer = net->create_client();
+         }
+      } break;
    }
+
+   return netpeer;
 }
 
 
@@ -534,9 +665,72 @@ void kehNetwork::disconnect_from_server()
 }
 
 
+void kehNetwork::join_server_as_spectator(const String& IP, uint32_t port)
+{
+   if (SceneTree::get_singleton()->has_network_peer())
+      return;
+   
+   m_is_spectator = true;
+   join_server(IP, port);
+}
+
+
+void kehNetwork::start_relay(const String& IP, uint32_t port, uint32_t listen_port, uint32_t max_spectators)
+{
+   ERR_FAIL_COND_MSG(m_backmode == BM_Invalid, "Cannot start a relay with invalid connection mode.");
+   ERR_FAIL_COND_MSG(is_relay(), "The relay is already running.");
+
+   SceneTree* st = SceneTree::get_singleton();
+   if (st->has_network_peer())
+      return;
+   
+   Ref<NetworkedMultiplayerPeer> netpeer = create_client_peer(IP, port);
+   if (!netpeer.is_valid())
+   {
+      emit_signal("join_fail");
+      return;
+   }
+
+   // The spectators connect to the server assigned to the scene tree
+   create_server(listen_port, "", max_spectators);
+   if (!st->has_network_peer())
+      return;
+   
+   // The upstream connection gets its own MultiplayerAPI, rooted at the same node as the one in the scene tree.
+   // Because of that, remote calls coming from the upstream server reach this node and the ones sent through it
+   // (rpcp) are resolved by the upstream server to its network singleton
+   m_relay_upstream.instance();
+   m_relay_upstream->set_root_node(st->get_root());
+   m_relay_upstream->set_network_peer(wrap_netpeer(netpeer));
+   m_relay_upstream->connect("network_peer_packet", this, "_on_relay_packet");
+   m_relay_upstream->connect("connection_failed", this, "_on_relay_upstream_lost");
+   m_relay_upstream->connect("server_disconnected", this, "_on_relay_upstream_lost");
+
+   // The scene tree only polls its own MultiplayerAPI
+   set_process_internal(true);
+}
+
+void kehNetwork::stop_relay()
+{
+   if (!is_relay())
+      return;
+   
+   set_process_internal(false);
+
+   m_relay_upstream->disconnect("network_peer_packet", this, "_on_relay_packet");
+   m_relay_upstream->disconnect("connection_failed", this, "_on_relay_upstream_lost");
+   m_relay_upstream->disconnect("server_disconnected", this, "_on_relay_upstream_lost");
+   m_relay_upstream->set_network_peer(Ref<NetworkedMultiplayerPeer>());
+   m_relay_upstream = Ref<MultiplayerAPI>();
+
+   close_server("The relay is closing");
+   m_spectator.clear();
+}
+
+
 void kehNetwork::notify_ready()
 {
-   if (!has_authority())
+   if (!has_authority() && !m_is_spectator)
    {
       m_is_ready = true;
       rpc_id(1, "_server_client_is_ready");
@@ -545,9 +739,101 @@ void kehNetwork::notify_ready()
 
 
 
+void kehNetwork::reset_clock_sync()
+{
+   m_clock_sync.reset();
+
+   if (m_apply_time_scale)
+      Engine::get_singleton()->set_time_scale(1.0f);
+}
+
+
+float kehNetwork::get_tick_rate() const
+{
+   return m_simulation_rate > 0 ? m_simulation_rate : Engine::get_singleton()->get_iterations_per_second();
+}
+
+
+void kehNetwork::run_scheduled_ticks(float delta)
+{
+   m_tick_accumulator += delta;
+
+   const float tick_time = 1.0f / m_simulation_rate;
+   uint32_t count = 0;
+
+   while (m_tick_accumulator >= tick_time)
+   {
+      if (count >= m_max_ticks_per_frame)
+      {
+         // Too far behind. Drop the remaining time instead of trying to catch up, otherwise each frame would
+         // take longer and longer
+         m_tick_accumulator = 0.0f;
+         break;
+      }
+
+      m_tick_accumulator -= tick_time;
+      count++;
+
+      init_snapshot();
+      emit_signal("simulation_tick", tick_time);
+      m_update_control->finish();
+   }
+}
+
+
 void kehNetwork::init_snapshot()
 {
-   m_update_control->start(m_entity_type);
+   // When the tick scheduler is enabled the snapshot is finished right after the "simulation_tick" signal
+   m_update_control->start(m_entity_type, m_simulation_rate == 0);
+
+   if (m_load_test.is_running() && has_authority())
+      m_load_test.on_tick_start();
+
+   if (!has_authority())
+   {
+      m_clock_sync.on_local_tick(1.0 / get_tick_rate());
+
+      if (m_apply_time_scale && m_clock_sync.is_synced())
+         Engine::get_singleton()->set_time_scale(m_clock_sync.get_dilation());
+
+      // Stamp the input polled during this tick with the server tick it's meant for, so the server uses it
+      // at the right moment rather than in whatever order it arrives
+      if (kehPlayerNode* lplayer = m_player_data->get_local_player())
+         lplayer->set_input_tick(m_clock_sync.is_synced() ? (uint32_t)Math::round(m_clock_sync.get_client_tick()) : 0);
+   }
+}
+
+
+void kehNetwork::set_player_send_rate(uint32_t pid, uint32_t rate)
+{
+   kehPlayerNode* pnode = m_player_data->get_pnode(pid);
+   ERR_FAIL_COND_MSG(!pnode, vformat("Trying to set send rate of player %d, which is not registered.", pid));
+
+   pnode->set_send_rate(rate);
+}
+
+void kehNetwork::set_player_bandwidth_limit(uint32_t pid, uint32_t bytes_per_sec)
+{
+   kehPlayerNode* pnode = m_player_data->get_pnode(pid);
+   ERR_FAIL_COND_MSG(!pnode, vformat("Trying to set bandwidth limit of player %d, which is not registered.", pid));
+
+   pnode->set_bandwidth_limit(bytes_per_sec);
+}
+
+
+double kehNetwork::get_estimated_server_tick() const
+{
+   return has_authority() ? m_update_control->get_signature() : m_clock_sync.get_estimated_server_tick();
+}
+
+double kehNetwork::get_client_tick() const
+{
+   return has_authority() ? m_update_control->get_signature() : m_clock_sync.get_client_tick();
+}
+
+float kehNetwork::get_clock_dilation() const
+{
+   return has_authority() ? 1.0f : m_clock_sync.get_dilation();
 }
 
 
@@ -562,17 +848,27 @@ Ref<kehSnapEntityBase> kehNetwork::create_snap_entity(const Ref<Script>& snap_sc
    return m_snapshot_data->instantiate_snap_entity(snap_script, uid, class_hash);
 }
 
+Ref<kehSnapEntityBase> kehNetwork::create_native_entity(const StringName& cname, uint32_t uid, uint32_t class_hash) const
+{
+   return m_snapshot_data->instantiate_native_entity(cname, uid, class_hash);
+}
+
 
 void kehNetwork::snapshot_entity(const Ref<kehSnapEntityBase>& entity)
 {
    ERR_FAIL_COND_MSG(!m_update_control->is_building(), "Trying to add entity into invalid snapshot. Did you call kehNetwork.init_snapshot()?");
 
-   Ref<Script> script = entity->get_script();
-   const uint32_t ehash = m_snapshot_data->get_ehash(script);
+   const uint32_t ehash = m_snapshot_data->get_entity_hash(entity);
 
    if (ehash > 0)
    {
       m_update_control->add_to_snapshot(ehash, entity);
+
+      // Only the server encodes delta snapshots
+      if (has_authority())
+      {
+         m_snapshot_data->track_dirty(ehash, entity, m_update_control->get_signature(), m_update_control->get_previous_signature());
+      }
    }
 }
 
@@ -581,13 +877,14 @@ void kehNetwork::correct_in_snapshot(const Ref<kehSnapEntityBase>& entity, const
    Ref<kehSnapshot> snap = m_snapshot_data->get_snapshot_by_input(input->get_signature());
    if (snap.is_valid())
    {
-      const uint32_t ehash = m_snapshot_data->get_ehash(entity->get_script());
+      const uint32_t ehash = m_snapshot_data->get_entity_hash(entity);
       snap->add_entity(ehash, entity);
+      snap->finish();
    }
 }
 
 
-void kehNetwork::register_event_type(uint16_t code, const Array& param_types)
+void kehNetwork::register_event_type(uint16_t code, const Array& param_types, bool reliable)
 {
    if (!kehEventInfo::check_types(param_types))
    {
@@ -595,7 +892,7 @@ void kehNetwork::register_event_type(uint16_t code, const Array& param_types)
       return;
    }
 
-   m_event_info[code] = kehEventInfo(code, param_types);
+   m_event_info[code] = kehEventInfo(code, param_types, reliable);
 }
 
 void kehNetwork::attach_event_handler(uint16_t code, const Object* obj, const String& fname)
@@ -610,16 +907,52 @@ void kehNetwork::attach_event_handler(uint16_t code, const Object* obj, const St
    m_event_info[code].attach_handler(obj, fname);
 }
 
-void kehNetwork::send_event(uint16_t code, const Array& params)
+bool kehNetwork::can_send_event(uint16_t code) const
 {
    // TODO: remove this fail condition from non editor release builds
-   ERR_FAIL_COND_MSG(!m_event_info.has(code), vformat("Tryint to send an event (%d) that is not registered.", code));
+   ERR_FAIL_COND_V_MSG(!m_event_info.has(code), false, vformat("Trying to send an event (%d) that is not registered.", code));
 
    // Only authority can replicate events
-   if (!has_authority())
+   return has_authority();
+}
+
+void kehNetwork::send_event(uint16_t code, const Array& params)
+{
+   if (!can_send_event(code))
+      return;
+   
+   kehNetEvent evt;
+   evt.type = code;
+   evt.params = params;
+   m_update_control->push_event(evt);
+}
+
+void kehNetwork::send_event_to(uint16_t code, const Array& params, const PoolIntArray& peers)
+{
+   if (!can_send_event(code))
+      return;
+   
+   kehNetEvent evt;
+   evt.type = code;
+   evt.params = params;
+   for (int i = 0; i < peers.size(); i++)
+   {
+      evt.target.push_back(peers[i]);
+   }
+   m_update_control->push_event(evt);
+}
+
+void kehNetwork::send_event_near(uint16_t code, const Array& params, const Vector3& position, float radius)
+{
+   if (!can_send_event(code))
       return;
    
-   m_update_control->push_event(code, params);
+   kehNetEvent evt;
+   evt.type = code;
+   evt.params = params;
+   evt.position = position;
+   evt.radius = radius;
+   m_update_control->push_event(evt);
 }
 
 
@@ -648,6 +981,282 @@ void kehNetwork::send_chat_message(const String& msg, uint32_t send_to)
 }
 
 
+Dictionary kehNetwork::get_peer_stats(uint32_t pid) const
+{
+   Dictionary ret;
+   const kehPlayerNode* pnode = m_player_data->get_pnode(pid);
+   if (pnode)
+   {
+      ret["rtt"] = pnode->get_rtt();
+      ret["rtt_variance"] = pnode->get_rtt_variance();
+      ret["jitter"] = pnode->get_jitter();
+      ret["packet_loss"] = pnode->get_packet_loss();
+   }
+
+   return ret;
+}
+
+
+void kehNetwork::add_simulated_clients(uint32_t count)
+{
+   SceneTree* st = get_tree();
+   ERR_FAIL_COND_MSG(!st || !st->has_network_peer() || !st->is_network_server(), "Simulated clients can only be added to a running server.");
+   ERR_FAIL_COND_MSG(!m_memory_network.is_valid(), "Simulated clients connect through the memory network, so the server must be created in the memory mode.");
+
+   // Those join like any other client, so the player nodes are created when the registration requests arrive
+   for (uint32_t i = 0; i < count; i++)
+   {
+      m_load_test.add_client(this, m_memory_network, m_player_data->get_input_info(), get_name());
+   }
+}
+
+void kehNetwork::remove_simulated_clients()
+{
+   // The disconnections reach the server through the network, which then unregisters the players
+   m_load_test.clear_clients();
+}
+
+
+void kehNetwork::set_load_test_input_generator(const Ref<FuncRef>& fref)
+{
+   m_load_test.set_input_generator(fref);
+}
+
+Ref<FuncRef> kehNetwork::get_load_test_input_generator() const
+{
+   return m_load_test.get_input_generator();
+}
+
+
+void kehNetwork::check_load_test_cmdline()
+{
+   const List<String> args = OS::get_singleton()->get_cmdline_args();
+
+   int32_t clients = -1;
+   float duration = 30.0f;
+   uint32_t port = 34000;
+   
+   for (const List<String>::Element* e = args.front(); e; e = e->next())
+   {
+      if (!e->next())
+         break;
+      
+      if (e->get() == "--keh-load-test")
+         clients = e->next()->get().to_int();
+      else if (e->get() == "--keh-load-test-time")
+         duration = e->next()->get().to_float();
+      else if (e->get() == "--keh-load-test-port")
+         port = e->next()->get().to_int();
+      else if (e->get() == "--keh-load-test-seed")
+         m_load_test.set_seed(e->next()->get().to_int());
+   }
+
+   if (clients < 0)
+      return;
+   
+   // The clients run in this process, connected through the memory network
+   m_backmode = BM_Memory;
+   create_server(port, "Load Test", clients);
+   if (!get_tree()->has_network_peer())
+   {
+      print_error("Load test: could not create the server.");
+      get_tree()->quit();
+      return;
+   }
+
+   add_simulated_clients(clients);
+   get_tree()->create_timer(duration, false)->connect("timeout", this, "_on_load_test_finished");
+}
+
+void kehNetwork::on_load_test_finished()
+{
+   print_line(JSON::print(get_load_test_stats()));
+   get_tree()->quit();
+}
+
+
+void kehNetwork::check_benchmark_cmdline()
+{
+   const List<String> args = OS::get_singleton()->get_cmdline_args();
+
+   // Most runs don't request the benchmark, so only create it when the flag is present
+   bool run = false;
+   for (const List<String>::Element* e = args.front(); e && !run; e = e->next())
+      run = e->get() == "--keh-net-benchmark";
+
+   if (!run)
+      return;
+
+   Ref<kehNetBenchmark> benchmark = memnew(kehNetBenchmark);
+
+   for (const List<String>::Element* e = args.front(); e; e = e->next())
+   {
+      if (!e->next())
+         break;
+
+      if (e->get() == "--keh-net-benchmark-iterations")
+         benchmark->set_iterations(e->next()->get().to_int());
+      else if (e->get() == "--keh-net-benchmark-snapshot-iterations")
+         benchmark->set_snapshot_iterations(e->next()->get().to_int());
+      else if (e->get() == "--keh-net-benchmark-entities")
+      {
+         // Comma separated list of entity counts
+         const Vector<int> counts = e->next()->get().split_ints(",", false);
+         PoolIntArray arr;
+         for (int i = 0; i < counts.size(); i++)
+            arr.append(counts[i]);
+         benchmark->set_entity_counts(arr);
+      }
+      else if (e->get() == "--keh-net-benchmark-ratios")
+      {
+         // Comma separated list of change ratios
+         const Vector<float> ratios = e->next()->get().split_floats(",", false);
+         PoolRealArray arr;
+         for (int i = 0; i < ratios.size(); i++)
+            arr.append(ratios[i]);
+         benchmark->set_change_ratios(arr);
+      }
+      else if (e->get() == "--keh-net-benchmark-seed")
+         benchmark->set_seed(e->next()->get().to_int());
+   }
+
+   print_line(JSON::print(benchmark->run()));
+   get_tree()->quit();
+}
+
+
+void kehNetwork::start_net_trace()
+{
+   m_profiler.set_enabled(true);
+   m_profiler.start_trace(m_max_trace_events);
+}
+
+
+Error kehNetwork::start_recording(const String& path)
+{
+   ERR_FAIL_COND_V_MSG(!has_authority(), ERR_UNAUTHORIZED, "Only the authority can record snapshots.");
+   return m_snapshot_data->start_recording(path, get_tick_rate(), m_replay_keyframe_interval);
+}
+
+void kehNetwork::stop_recording()
+{
+   m_snapshot_data->stop_recording();
+}
+
+bool kehNetwork::is_recording() const
+{
+   return m_snapshot_data->is_recording();
+}
+
+
+Error kehNetwork::start_replay(const String& path)
+{
+   ERR_FAIL_COND_V_MSG(get_tree()->has_network_peer(), ERR_ALREADY_IN_USE, "Replays can only be played without any connection.");
+
+   const Error err = m_snapshot_data->open_replay(path);
+   if (err != OK)
+      return err;
+   
+   m_replay_paused = false;
+   m_replay_accumulator = 0.0f;
+   set_physics_process_internal(true);
+
+   return OK;
+}
+
+void kehNetwork::stop_replay()
+{
+   if (!is_replaying())
+      return;
+   
+   m_snapshot_data->close_replay();
+   set_physics_process_internal(m_simulation_rate > 0);
+}
+
+bool kehNetwork::is_replaying() const
+{
+   return m_snapshot_data->is_replaying();
+}
+
+
+bool kehNetwork::step_replay()
+{
+   PoolVector<PoolByteArray> events;
+   if (!m_snapshot_data->replay_step(events))
+   {
+      if (is_replaying())
+      {
+         stop_replay();
+         emit_signal("replay_finished");
+      }
+      return false;
+   }
+
+   Ref<kehEncDecBuffer> edec = m_update_control->get_enc_dec();
+   for (int i = 0; i < events.size(); i++)
+   {
+      edec->set_buffer(events[i]);
+      decode_events(edec);
+   }
+
+   return true;
+}
+
+bool kehNetwork::seek_replay(uint32_t signature)
+{
+   m_replay_accumulator = 0.0f;
+   return m_snapshot_data->replay_seek(signature);
+}
+
+
+uint32_t kehNetwork::get_replay_signature() const
+{
+   return m_snapshot_data->get_replay_signature();
+}
+
+uint32_t kehNetwork::get_replay_first_signature() const
+{
+   return m_snapshot_data->get_replay_first_signature();
+}
+
+uint32_t kehNetwork::get_replay_last_signature() const
+{
+   return m_snapshot_data->get_replay_last_signature();
+}
+
+
+void kehNetwork::run_replay(float delta)
+{
+   if (m_replay_paused)
+      return;
+   
+   const float rate = m_snapshot_data->get_replay_tick_rate();
+   if (rate <= 0.0f)
+   {
+      step_replay();
+      return;
+   }
+
+   m_replay_accumulator += delta;
+   const float tick_time = 1.0f / rate;
+   uint32_t count = 0;
+
+   while (m_replay_accumulator >= tick_time && is_replaying())
+   {
+      if (count >= m_max_ticks_per_frame)
+      {
+         m_replay_accumulator = 0.0f;
+         break;
+      }
+
+      m_replay_accumulator -= tick_time;
+      count++;
+
+      step_replay();
+   }
+}
+
+
 void kehNetwork::set_credential_checker(const Ref<FuncRef>& fref)
 {
    m_credential_checker = fref;
@@ -660,6 +1269,15 @@ Ref<FuncRef> kehNetwork::get_credential_checker() const
 
 void kehNetwork::dispatch_credentials(const Dictionary& cred)
 {
+   if (is_relay())
+   {
+      // The credentials requested by the upstream server
+      const Variant arg = cred;
+      const Variant* argptr[1] = { &arg };
+      m_relay_upstream->rpcp(this, 1, false, "_server_receive_credentials", argptr, 1);
+      return;
+   }
+
    // This function must be run only on clients and is irrelevant on servers.
    if (has_authority())
       return;
@@ -704,6 +1322,25 @@ void kehNetwork::check_backmode()
          }
       } break;
    }
+
+   if (m_use_io_thread && m_backmode != BM_ENet)
+   {
+      // WebSocket relies on extra signals (server_close_request) and explicit polling, which are not relayed
+      // by the threaded peer. The memory peer doesn't have any socket to begin with
+      WARN_PRINT("The network thread is only supported in ENet mode, so it will not be used.");
+      m_use_io_thread = false;
+   }
+}
+
+
+Ref<NetworkedMultiplayerPeer> kehNetwork::wrap_netpeer(const Ref<NetworkedMultiplayerPeer>& peer) const
+{
+   if (!m_use_io_thread || !peer.is_valid())
+      return peer;
+   
+   Ref<kehThreadedPeer> ret(memnew(kehThreadedPeer));
+   ret->start(peer, m_io_queue_size, m_io_idle_usec);
+   return ret;
 }
 
 
@@ -717,6 +1354,8 @@ void kehNetwork::on_root_completed()
    SceneTree::get_singleton()->get_root()->add_child((Node*)this);
    m_on_enter_tree();
 
+   check_load_test_cmdline();
+   check_benchmark_cmdline();
 
 }
 
@@ -728,6 +1367,7 @@ void kehNetwork::on_root_shutdown()
    }
 
    // If not in multiplayer or if this is not server, nothing (hopefully) bad will happen.
+   stop_relay();
    close_server();
 
    if (m_update_control)
@@ -755,7 +1395,7 @@ void kehNetwork::on_player_connected(uint32_t id)
       {
          // Credential checker is not set so assume this feature is not desired.
          // Automatically accept the new player.
-         rpc_id(id, "_client_join_accepted");
+         rpc_id(id, "_client_join_accepted", m_player_data->get_custom_prop_table());
       }
    }
 }
@@ -764,6 +1404,13 @@ void kehNetwork::on_player_disconnected(uint32_t id)
 {
    if (get_tree()->is_network_server())
    {
+      // Spectators are not known by anyone else, so there is nothing to broadcast
+      if (m_spectator.remove(id))
+      {
+         emit_signal("spectator_removed", id);
+         return;
+      }
+
       // Unregister the player from server's list
       all_unregister_player(id);
 
@@ -818,17 +1465,25 @@ void kehNetwork::clear_netpeer()
    // As explained, this function is just to relay a deferred call to the scene tree, because directly
    // doing so is not working.
    get_tree()->set_network_peer(NULL);
+   m_memory_network = Ref<kehMemoryNetwork>();
 }
 
 void kehNetwork::handle_disconnection()
 {
    // Well, since disconnected, it's sure there are no remote players, so clear the list.
    m_player_data->clear_remote();
+   m_load_test.clear_clients();
 
    // Ensure local player is holding ID corresponding to authority (1) as now this machine is "alone"
    // This call will also take care of correctly updating the Node name within the tree.
    m_player_data->get_local_player()->set_id(1);
 
+   m_last_unreliable_evt_sig = 0;
+   m_pending_event.resize(0);
+   m_is_spectator = false;
+   m_spectator.clear();
+   reset_clock_sync();
+
    // It doesn't hurt to call this even on ENet mode
    set_process(false);
 
@@ -846,6 +1501,13 @@ void kehNetwork::all_register_player(uint32_t pid)
    // has a multiplayer API assigned to it
    const bool is_server = SceneTree::get_singleton()->is_network_server();
 
+   if (is_server && is_relay())
+   {
+      // A relay only accepts spectators
+      kick_player(pid, "This server only accepts spectators");
+      return;
+   }
+
    // Create the player node - this will *not* register the player within the container yet.
    kehPlayerNode* player = m_player_data->create_player(pid);
 
@@ -859,10 +1521,15 @@ void kehNetwork::all_register_player(uint32_t pid)
       // Start the ping/pong loop
       player->start_ping();
 
-      // Server server's custom properties that are meant to be broadcast to the new player
-      if (m_player_data->get_local_player()->encode_custom_props(edec, m_player_data->get_custom_props(), true, true))
+      // Gather custom properties of the server and of the already registered players, sending those in a
+      // single batch to the new player
+      PoolVector<PoolByteArray> segment;
+      PoolVector<uint32_t> owner;
+
+      if (m_player_data->get_local_player()->encode_custom_props(edec, m_player_data->get_custom_props_by_id(), true, true))
       {
-         rpc_id(pid, "_all_receive_custom_prop_batch", edec->get_buffer());
+         segment.push_back(edec->get_buffer());
+         owner.push_back(m_player_data->get_local_player()->get_id());
       }
 
       for (Map<uint32_t, kehPlayerNode*>::Element* p = m_player_data->get_remote_iterator(); p; p = p->next())
@@ -873,16 +1540,21 @@ void kehNetwork::all_register_player(uint32_t pid)
          // Send new player to currently iterated one
          rpc_id(p->value()->get_id(), "_all_register_player", pid);
 
-         // If there are custom properties meant to be broadcast, take the data of current iterated player and
-         // send to the new one.
-         if (p->value()->encode_custom_props(edec, m_player_data->get_custom_props(), true, true))
+         // If there are custom properties meant to be broadcast, take the data of current iterated player
+         if (p->value()->encode_custom_props(edec, m_player_data->get_custom_props_by_id(), true, true))
          {
-            rpc_id(pid, "_all_receive_custom_prop_batch", edec->get_buffer());
+            segment.push_back(edec->get_buffer());
+            owner.push_back(p->key());
          }
 
          // Custom property data of the new player will be sent to the server only when it begins the
          // snapshot cycle, so there is no point in trying to send that to the other players at this moment.
       }
+
+      if (segment.size() > 0)
+      {
+         rpc_id(pid, "_all_receive_custom_prop_batch", build_custom_prop_batch(segment, owner, 0));
+      }
    }
 
    // Perform the actual registration of the node within the internal container
@@ -942,8 +1614,19 @@ void kehNetwork::all_chat_message(uint32_t sender, const String& msg, bool broad
 
 
 
-void kehNetwork::client_join_accepted()
+void kehNetwork::client_join_accepted(const PoolStringArray& cprop_table)
 {
+   if (is_relay())
+   {
+      // The upstream server accepted the relay. It doesn't need anything other than the stream
+      m_relay_upstream->rpcp(this, 1, false, "_server_register_spectator", NULL, 0);
+      emit_signal("join_accepted");
+      return;
+   }
+
+   // Use the same custom property IDs as the server
+   m_player_data->apply_custom_prop_table(cprop_table);
+
    // Enable processsing - which will poll network data if in WebSocket mode
    if (m_backmode == BM_WebSocket)
       set_process(true);
@@ -956,6 +1639,13 @@ void kehNetwork::client_join_accepted()
    // This should also update the node name
    m_player_data->get_local_player()->set_id(nid);
 
+   if (m_is_spectator)
+   {
+      // Spectators are not registered as players, so no player node is created on any machine
+      rpc_id(1, "_server_register_spectator");
+      return;
+   }
+
    // Create a node representing the host
    all_register_player(1);
 
@@ -987,11 +1677,19 @@ void kehNetwork::client_on_websocket_close_request(int code, const String& reaso
 void kehNetwork::handle_snapshot(const Ref<kehSnapshot>& snapshot)
 {
    // Acknowledge to the server the received snapshot
+   m_profiler.on_sent(1, kehNetProfiler::MSG_Ack, sizeof(uint32_t));
    rpc_unreliable_id(1, "_server_acknowledge_snapshot", snapshot->get_signature());
 
+   // Each snapshot is a sample of the server clock
+   const kehPlayerNode* lplayer = m_player_data->get_local_player();
+   m_clock_sync.on_server_tick(snapshot->get_signature(), lplayer->get_rtt(), lplayer->get_jitter(), 1.0 / get_tick_rate());
+
    // Check this snapshot comparing to the predicted one. This function also updates
    // the internal m_server_state property, which must match the most recent received data.
-   m_snapshot_data->client_check_snapshot(snapshot);
+   {
+      kehNetProfileScope scope(kehNetProfiler::SEC_ClientCheck);
+      m_snapshot_data->client_check_snapshot(snapshot);
+   }
 
    // The snapshot may contain input signature, which serves as an acknowledgement from
    // the server about that input data. So perform clearing of internal input cache so
@@ -1011,9 +1709,15 @@ void kehNetwork::client_receive_full_snapshot(const PoolByteArray& encoded)
       return;
    }
 
+   m_profiler.on_received(1, kehNetProfiler::MSG_FullSnapshot, encoded.size());
+
    Ref<kehEncDecBuffer> encdec = m_update_control->get_enc_dec();
    encdec->set_buffer(encoded);
-   Ref<kehSnapshot> decoded = m_snapshot_data->decode_full(encdec);
+   Ref<kehSnapshot> decoded;
+   {
+      kehNetProfileScope scope(kehNetProfiler::SEC_SnapshotDecode);
+      decoded = m_snapshot_data->decode_full(encdec);
+   }
    if (decoded.is_valid())
    {
       handle_snapshot(decoded);
@@ -1029,10 +1733,16 @@ void kehNetwork::client_receive_delta_snapshot(const PoolByteArray& encoded)
       return;
    }
 
+   m_profiler.on_received(1, kehNetProfiler::MSG_DeltaSnapshot, encoded.size());
+
    Ref<kehEncDecBuffer> encdec = m_update_control->get_enc_dec();
    encdec->set_buffer(encoded);
 
-   Ref<kehSnapshot> decoded = m_snapshot_data->decode_delta(encdec);
+   Ref<kehSnapshot> decoded;
+   {
+      kehNetProfileScope scope(kehNetProfiler::SEC_SnapshotDecode);
+      decoded = m_snapshot_data->decode_delta(encdec);
+   }
    if (decoded.is_valid())
    {
       handle_snapshot(decoded);
@@ -1047,9 +1757,39 @@ void kehNetwork::client_receive_net_event(const PoolByteArray& encoded)
    if (has_authority())
       return;
    
+   m_profiler.on_received(1, kehNetProfiler::MSG_Event, encoded.size());
+
+   Ref<kehEncDecBuffer> edec = m_update_control->get_enc_dec();
+   edec->set_buffer(encoded);
+
+   decode_events(edec);
+}
+
+
+void kehNetwork::client_receive_unreliable_event(const PoolByteArray& encoded)
+{
+   if (has_authority())
+      return;
+   
+   m_profiler.on_received(1, kehNetProfiler::MSG_UnreliableEvent, encoded.size());
+
    Ref<kehEncDecBuffer> edec = m_update_control->get_enc_dec();
    edec->set_buffer(encoded);
 
+   // Unreliable events only care about the latest state, so discard anything older than what has already
+   // been processed
+   const uint32_t sig = edec->read_uint();
+   if (sig <= m_last_unreliable_evt_sig)
+      return;
+   
+   m_last_unreliable_evt_sig = sig;
+
+   decode_events(edec);
+}
+
+
+void kehNetwork::decode_events(Ref<kehEncDecBuffer>& edec)
+{
    // Decode number of events
    const uint16_t evtcount = edec->read_ushort();
 
@@ -1120,15 +1860,19 @@ void kehNetwork::server_acknowledge_snapshot(uint32_t sig)
    }
 
    uint32_t pid = SceneTree::get_singleton()->get_rpc_sender_id();
+   m_profiler.on_received(pid, kehNetProfiler::MSG_Ack, sizeof(uint32_t));
+
    kehPlayerNode* player = m_player_data->get_remote_player(pid);
    if (player)
    {
-      player->server_acknowledge_snapshot(sig);
+      // When the network thread is used, the time in which the packet actually arrived is known
+      Ref<kehThreadedPeer> tpeer = SceneTree::get_singleton()->get_network_peer();
+      player->server_acknowledge_snapshot(sig, tpeer.is_valid() ? tpeer->get_packet_timestamp() : 0);
    }
 }
 
 
-void kehNetwork::server_broadcast_custom_prop(const String& pname, const Variant& value)
+void kehNetwork::server_broadcast_custom_prop(uint32_t id, const Variant& value)
 {
    if (!has_authority())
       return;
@@ -1142,14 +1886,14 @@ void kehNetwork::server_broadcast_custom_prop(const String& pname, const Variant
    if (pnode)
    {
       // First set the property locally - on the server
-      pnode->remote_set_custom_property(pname, value);
+      pnode->remote_set_custom_property(id, value);
 
       // Then broadcast to every other player
       for (Map<uint32_t, kehPlayerNode*>::Element* p = m_player_data->get_remote_iterator(); p; p = p->next())
       {
          if (pnode != p->value())
          {
-            pnode->rpc_id(p->key(), "_remote_set_custom_property", pname, value);
+            pnode->rpc_id(p->key(), "_remote_set_custom_property", id, value);
          }
       }
    }
@@ -1171,7 +1915,7 @@ void kehNetwork::server_receive_credentials(const Dictionary& cred)
    const String reason = ((m_credential_checker.is_valid() && m_credential_checker->is_valid()) ? m_credential_checker->call_funcv(args) : "");
    if (reason.length() == 0)
    {
-      rpc_id(pid, "on_join_accepted");
+      rpc_id(pid, "_client_join_accepted", m_player_data->get_custom_prop_table());
    }
    else
    {
@@ -1182,65 +1926,221 @@ void kehNetwork::server_receive_credentials(const Dictionary& cred)
 }
 
 
+void kehNetwork::server_register_spectator()
+{
+   if (!get_tree()->is_network_server())
+      return;
+   
+   const uint32_t pid = get_tree()->get_rpc_sender_id();
+
+   // A player can't become a spectator
+   if (m_player_data->get_remote_player(pid) || !m_spectator.add(pid))
+      return;
+   
+   // Give the cached packets so the spectator can catch up, starting from the last keyframe
+   Ref<MultiplayerAPI> mapi = get_tree()->get_multiplayer();
+   const Vector<PoolByteArray>& cache = m_spectator.get_cache();
+   for (int i = 0; i < cache.size(); i++)
+   {
+      m_profiler.on_sent(pid, kehNetProfiler::MSG_SpectatorStream, cache[i].size());
+      mapi->send_bytes(cache[i], pid, NetworkedMultiplayerPeer::TRANSFER_MODE_RELIABLE);
+   }
+
+   emit_signal("spectator_added", pid);
+}
+
+
+void kehNetwork::send_to_spectators(const PoolByteArray& packet)
+{
+   Ref<MultiplayerAPI> mapi = get_tree()->get_multiplayer();
+   for (Set<uint32_t>::Element* e = m_spectator.get_spectators().front(); e; e = e->next())
+   {
+      m_profiler.on_sent(e->get(), kehNetProfiler::MSG_SpectatorStream, packet.size());
+      mapi->send_bytes(packet, e->get(), NetworkedMultiplayerPeer::TRANSFER_MODE_RELIABLE);
+   }
+}
+
+
+void kehNetwork::on_network_packet(uint32_t id, const PoolByteArray& packet)
+{
+   // Currently only the spectator stream is sent as raw packets
+   if (!m_is_spectator || packet.size() == 0)
+      return;
+   
+   m_profiler.on_received(id, kehNetProfiler::MSG_SpectatorStream, packet.size());
+
+   Ref<kehEncDecBuffer> encdec = m_update_control->get_enc_dec();
+   encdec->set_buffer(packet);
+   const uint8_t kind = encdec->read_byte();
+
+   Ref<kehSnapshot> decoded;
+   {
+      kehNetProfileScope scope(kehNetProfiler::SEC_SnapshotDecode);
+      decoded = kind == kehSpectatorStream::PK_Keyframe ? m_snapshot_data->decode_full(encdec) : m_snapshot_data->decode_delta(encdec);
+   }
+
+   // There is no prediction on spectators, so the state is just applied
+   if (decoded.is_valid())
+   {
+      m_snapshot_data->apply_snapshot(decoded);
+   }
+}
+
+
+void kehNetwork::on_relay_packet(uint32_t id, const PoolByteArray& packet)
+{
+   // Keep the packet so spectators joining later can catch up, then forward it without decoding anything
+   m_profiler.on_received(id, kehNetProfiler::MSG_SpectatorStream, packet.size());
+   m_spectator.push_packet(packet);
+   send_to_spectators(packet);
+}
+
+void kehNetwork::on_relay_upstream_lost()
+{
+   emit_signal("relay_disconnected");
+
+   // The upstream MultiplayerAPI is emitting this signal, so it can't be destroyed from here
+   call_deferred("stop_relay");
+}
+
+
 
 void kehNetwork::all_receive_custom_prop_batch(const PoolByteArray& encoded)
 {
    Ref<kehEncDecBuffer> edec = m_update_control->get_enc_dec();
    edec->set_buffer(encoded);
 
-   const uint32_t belong_to = edec->read_uint();
-   kehPlayerNode* pnode = m_player_data->get_pnode(belong_to);
-   if (!pnode)
-      return;
-   
    const bool authority = has_authority();
-   pnode->decode_custom_props(edec, m_player_data->get_custom_props(), authority);
+   const uint32_t caller = SceneTree::get_singleton()->get_rpc_sender_id();
+   m_profiler.on_received(caller, kehNetProfiler::MSG_CustomProps, encoded.size());
 
-   if (authority)
+   // Number of players with data within this batch
+   const uint32_t pcount = edec->read_ushort();
+
+   for (uint32_t i = 0; i < pcount; i++)
    {
-      if (pnode->encode_custom_props(edec, m_player_data->get_custom_props(), authority, false))
-      {
-         // If here there is encoded data that must be broadcast to clients
-         const uint32_t caller = SceneTree::get_singleton()->get_rpc_sender_id();
+      const uint32_t belong_to = edec->read_uint();
 
-         // Send the encoded data to remote players, skipping the caller
-         for (Map<uint32_t, kehPlayerNode*>::Element* p = m_player_data->get_remote_iterator(); p; p = p->next())
-         {
-            if (caller != p->key())
-            {
-               rpc_id(p->key(), "_all_receive_custom_prop_batch", edec->get_buffer());
-            }
-         }
-      }
+      // Clients are only allowed to send their own properties
+      if (authority && belong_to != caller)
+         return;
+      
+      kehPlayerNode* pnode = m_player_data->get_pnode(belong_to);
+      if (!pnode)
+         return;
+      
+      // On the server this makes the properties dirty, so those will be broadcast with the next aggregated batch
+      pnode->decode_custom_props(edec, m_player_data->get_custom_props_by_id(), authority);
+   }
+}
+
+
+PoolByteArray kehNetwork::build_custom_prop_batch(const PoolVector<PoolByteArray>& segment, const PoolVector<uint32_t>& owner, uint32_t skip)
+{
+   uint32_t count = 0;
+   for (int i = 0; i < owner.size(); i++)
+   {
+      if (owner[i] != skip)
+         count++;
    }
+
+   if (count == 0)
+      return PoolByteArray();
+   
+   Ref<kehEncDecBuffer> edec = m_update_control->get_enc_dec();
+   edec->set_buffer(PoolByteArray());
+   edec->write_ushort(count);
+
+   PoolByteArray ret = edec->get_buffer();
+   for (int i = 0; i < segment.size(); i++)
+   {
+      if (owner[i] != skip)
+         ret.append_array(segment[i]);
+   }
+
+   return ret;
 }
 
 
 
 void kehNetwork::on_check_custom_properties()
 {
-   kehPlayerNode* pn = m_player_data->get_local_player();
-   if (!pn->has_dirty_custom_prop())
+   kehNetProfileScope scope(kehNetProfiler::SEC_CustomProps);
+   const bool authority = has_authority();
+
+   // In between send ticks the server keeps the dirty flags, so multiple changes are sent together
+   if (authority && !m_update_control->is_send_tick())
       return;
    
-   const bool authority = has_authority();
+   // Spectators are not registered as players, so the server has nowhere to store their properties
+   if (!authority && m_is_spectator)
+      return;
+
    Ref<kehEncDecBuffer> edec = m_update_control->get_enc_dec();
+   kehPlayerNode* pn = m_player_data->get_local_player();
+
+   PoolVector<PoolByteArray> segment;
+   PoolVector<uint32_t> owner;
 
-   if (pn->encode_custom_props(edec, m_player_data->get_custom_props(), authority, false))
+   if (pn->has_dirty_custom_prop() && pn->encode_custom_props(edec, m_player_data->get_custom_props_by_id(), authority, false))
    {
-      // There is at least one encoded custom property. Send the data
-      if (authority)
+      segment.push_back(edec->get_buffer());
+      owner.push_back(pn->get_id());
+   }
+
+   if (!authority)
+   {
+      // This is a client so only its own properties are sent to the server
+      if (segment.size() > 0)
       {
-         // If here the data is meant to be broadcast to all clients
-         for (Map<uint32_t, kehPlayerNode*>::Element* pit = m_player_data->get_remote_iterator(); pit; pit = pit->next())
-         {
-            rpc_id(pit->key(), "_all_receive_custom_prop_batch", edec->get_buffer());
-         }
+         const PoolByteArray batch = build_custom_prop_batch(segment, owner, 0);
+         m_profiler.on_sent(1, kehNetProfiler::MSG_CustomProps, batch.size());
+         rpc_id(1, "_all_receive_custom_prop_batch", batch);
+      }
+      
+      return;
+   }
+
+   // On the server gather the dirty properties of every player. Those received from clients were made dirty
+   // when decoded
+   for (Map<uint32_t, kehPlayerNode*>::Element* pit = m_player_data->get_remote_iterator(); pit; pit = pit->next())
+   {
+      kehPlayerNode* rpn = pit->value();
+      if (rpn->has_dirty_custom_prop() && rpn->encode_custom_props(edec, m_player_data->get_custom_props_by_id(), authority, false))
+      {
+         segment.push_back(edec->get_buffer());
+         owner.push_back(pit->key());
+      }
+   }
+
+   if (segment.size() == 0)
+      return;
+   
+   // Encoded once, then reused for every peer. The only exception is when the peer owns one of the segments, since
+   // there is no point in sending back its own properties
+   const PoolByteArray all = build_custom_prop_batch(segment, owner, 0);
+
+   for (Map<uint32_t, kehPlayerNode*>::Element* pit = m_player_data->get_remote_iterator(); pit; pit = pit->next())
+   {
+      bool owns = false;
+      for (int i = 0; i < owner.size() && !owns; i++)
+      {
+         owns = owner[i] == pit->key();
+      }
+
+      if (!owns)
+      {
+         m_profiler.on_sent(pit->key(), kehNetProfiler::MSG_CustomProps, all.size());
+         rpc_id(pit->key(), "_all_receive_custom_prop_batch", all);
       }
       else
       {
-         // This is a client and the data is encoded. Send to the server
-         rpc_id(1, "_all_receive_custom_prop_batch", edec->get_buffer());
+         const PoolByteArray filtered = build_custom_prop_batch(segment, owner, pit->key());
+         if (filtered.size() > 0)
+         {
+            m_profiler.on_sent(pit->key(), kehNetProfiler::MSG_CustomProps, filtered.size());
+            rpc_id(pit->key(), "_all_receive_custom_prop_batch", filtered);
+         }
       }
    }
 }
@@ -1257,6 +2157,10 @@ void kehNetwork::on_snapshot_finished(Ref<kehSnapshot>& snap)
    //     "full snapshot flag"
    // 3 - If the "full snapshot flag" is not triggered, then send delta snapshot.
 
+   // The relay only forwards the upstream stream to its spectators, so locally built snapshots are discarded
+   if (is_relay())
+      return;
+
    kehPlayerNode* lplayer = m_player_data->get_local_player();
 
    // Attach the input signature into the finished snapshot. It's irrelevant on servers but
@@ -1268,18 +2172,25 @@ void kehNetwork::on_snapshot_finished(Ref<kehSnapshot>& snap)
    if (has_authority())
    {
       m_snapshot_data->check_history_size(m_max_history_size, true);
+      m_snapshot_data->record_snapshot(snap);
    }
    else
    {
       m_snapshot_data->check_history_size(m_max_client_history_size, false);
 
-      // Dispatch input data to the server
-      m_player_data->get_local_player()->dispatch_input_data();
+      // Dispatch input data to the server. Spectators don't send any, as the server has no player node for them
+      if (!m_is_spectator)
+         m_player_data->get_local_player()->dispatch_input_data();
 
       // Clients don't have anything else to do here, so bail
       return;
    }
 
+   kehNetProfileScope scope(kehNetProfiler::SEC_Snapshot);
+
+   const uint32_t base_interval = m_update_control->get_send_interval();
+   const float tick_rate = get_tick_rate();
+
    PoolVector<kehPlayerNode*> remote_players;
    m_player_data->fill_remote_player_node(remote_players);
    const uint32_t psize = remote_players.size();
@@ -1292,14 +2203,21 @@ void kehNetwork::on_snapshot_finished(Ref<kehSnapshot>& snap)
          continue;
       }
 
+      // Each player may have its own send rate. When not sending, the ticks in between are still included in the
+      // next delta, since it's built from the last acknowledged snapshot
+      const uint32_t interval = player->get_send_interval(base_interval, tick_rate);
+      if (!player->is_send_due(snap->get_signature(), interval))
+         continue;
+
       // Assume delta snapshot will be encoded
       bool send_full = false;
 
       // Obtain the list of non acknowledged snapshots for this client, including the corresponding input signatures
       uint32_t non_ack_count = player->get_non_acked_snap_count();
 
-      // First check - if number of non acknowledged snapshots is too big, send full data.
-      if (non_ack_count > m_full_snap_threshold)
+      // First check - if number of non acknowledged snapshots is too big, send full data. Snapshots that were
+      // not sent are also not acknowledged, so take the send interval into account
+      if (non_ack_count > m_full_snap_threshold * interval)
       {
          send_full = true;
       }
@@ -1328,17 +2246,65 @@ void kehNetwork::on_snapshot_finished(Ref<kehSnapshot>& snap)
       // During the simulation a player input was used. Retrieve the signature of that data, which must be attached into the encoded data.
       const uint32_t isig = player->get_used_input_in_snap(snap->get_signature());
 
-      if (send_full)
+      const uint64_t enc_start = m_load_test.is_running() ? OS::get_singleton()->get_ticks_usec() : 0;
+
       {
-         m_snapshot_data->encode_full(snap, encdec, isig);
-         rpc_unreliable_id(player->get_id(), "_client_receive_full_snapshot", encdec->get_buffer());
+         kehNetProfileScope encode_scope(kehNetProfiler::SEC_Encode, player->get_id());
+         if (send_full)
+            m_snapshot_data->encode_full(snap, encdec, isig);
+         else
+            m_snapshot_data->encode_delta(snap, refsnap, encdec, isig);
       }
-      else
+
+      if (m_load_test.is_running())
+         m_load_test.on_snapshot_encoded(encdec->get_buffer().size(), OS::get_singleton()->get_ticks_usec() - enc_start, send_full);
+
+      {
+         kehNetProfileScope send_scope(kehNetProfiler::SEC_Send, player->get_id());
+         const PoolByteArray encoded = encdec->get_buffer();
+         if (send_full)
+         {
+            m_profiler.on_sent(player->get_id(), kehNetProfiler::MSG_FullSnapshot, encoded.size());
+            rpc_unreliable_id(player->get_id(), "_client_receive_full_snapshot", encoded);
+         }
+         else
+         {
+            m_profiler.on_sent(player->get_id(), kehNetProfiler::MSG_DeltaSnapshot, encoded.size());
+            rpc_unreliable_id(player->get_id(), "_client_receive_delta_snapshot", encoded);
+         }
+      }
+
+      // Keep track of the sending time so the round trip can be measured when the client acknowledges this
+      player->on_snapshot_sent(snap->get_signature(), encdec->get_buffer().size());
+   }
+
+   // A single delayed stream is encoded for all spectators
+   if (m_spectator.get_count() > 0)
+   {
+      if (m_spectator.is_send_due(snap->get_signature(), base_interval))
       {
-         m_snapshot_data->encode_delta(snap, refsnap, encdec, isig);
-         rpc_unreliable_id(player->get_id(), "_client_receive_delta_snapshot", encdec->get_buffer());
+         Ref<kehEncDecBuffer> encdec = m_update_control->get_enc_dec();
+         PoolByteArray packet;
+         {
+            kehNetProfileScope encode_scope(kehNetProfiler::SEC_Encode);
+            packet = m_spectator.encode(snap->get_signature(), m_snapshot_data, encdec);
+         }
+
+         if (packet.size() > 0)
+         {
+            kehNetProfileScope send_scope(kehNetProfiler::SEC_Send);
+            send_to_spectators(packet);
+         }
       }
    }
+   else
+   {
+      // Don't hold snapshots nobody is going to receive. The next spectator begins with a keyframe
+      m_spectator.reset_stream();
+   }
+
+   if (m_load_test.is_running())
+      m_load_test.on_tick_end();
 }
 
 void kehNetwork::on_dispatch_events(const PoolVector<kehNetEvent>& event)
@@ -1348,49 +2314,166 @@ void kehNetwork::on_dispatch_events(const PoolVector<kehNetEvent>& event)
    // machine. However, encoding will only occur if not in single player and if there is at least one connected
    // player
 
-   // Only authority can send events. And if there are no events, no need to continue here
-   if (!has_authority() || event.size() == 0)
+   // Only authority can send events
+   if (!has_authority())
+      return;
+   
+   kehNetProfileScope scope(kehNetProfiler::SEC_Events);
+   const bool has_remote = m_player_data->get_player_count() > 1;
+
+   // Call attached event handlers on every tick. This allows the server to act on the events. Sending to the
+   // clients only happens on send ticks, so accumulate the events until then
+   for (int i = 0; i < event.size(); i++)
+   {
+      const Map<uint16_t, kehEventInfo>::Element* einfo = m_event_info.find(event[i].type);
+      if (!einfo)
+      {
+         print_error(vformat("While preparing to encode events, found an event code (%d) that is not registered. Aborting.", event[i].type));
+         return;
+      }
+
+      einfo->value().call_handlers(event[i].params);
+
+      // Only keep something if there is at least one remote player
+      if (has_remote)
+         m_pending_event.push_back(event[i]);
+   }
+
+   if (event.size() > 0 && m_snapshot_data->is_recording())
+      record_events(event);
+
+   if (!has_remote || m_pending_event.size() == 0 || !m_update_control->is_send_tick())
       return;
    
    Ref<kehEncDecBuffer> edec = m_update_control->get_enc_dec();
+   const uint32_t ecount = m_pending_event.size();
+
+   // Each event is encoded only once, then the data is concatenated into the batches of the peers that
+   // should receive it.
+   PoolVector<PoolByteArray> encoded;
+   PoolVector<bool> reliable;
 
-   // Only encode something if there are remote players
-   if (m_player_data->get_player_count() > 1)
+   for (uint32_t i = 0; i < ecount; i++)
    {
-      // Initialize the EncDecBuffer
+      const kehNetEvent& evt = m_pending_event[i];
+      const kehEventInfo& einfo = m_event_info[evt.type];
+
       edec->set_buffer(PoolByteArray());
 
-      // Then write number of events. 16 bits should be more than enough
-      edec->write_ushort(event.size());
+      // Write event type code
+      edec->write_ushort(evt.type);
+
+      // Now the parameters
+      einfo.encode(edec, evt.params);
+
+      encoded.push_back(edec->get_buffer());
+      reliable.push_back(einfo.is_reliable());
    }
 
-   // Iterate through the events
-   for (uint32_t i = 0; i < event.size(); i++)
+   const uint32_t sig = m_update_control->get_signature();
+
+   PoolVector<kehPlayerNode*> remote_players;
+   m_player_data->fill_remote_player_node(remote_players);
+   const uint32_t psize = remote_players.size();
+
+   // Per peer lists of indices into the encoded events
+   PoolVector<int> rindex;
+   PoolVector<int> uindex;
+   // For unreliable events only the latest of each type is sent. Map from type into the position within uindex
+   Map<uint16_t, int> ulatest;
+
+   for (uint32_t p = 0; p < psize; p++)
    {
-      const Map<uint16_t, kehEventInfo>::Element* einfo = m_event_info.find(event[i].type);
-      if (!einfo)
+      const kehPlayerNode* player = remote_players[p];
+      const uint32_t pid = player->get_id();
+
+      rindex.resize(0);
+      uindex.resize(0);
+      ulatest.clear();
+
+      for (uint32_t i = 0; i < ecount; i++)
       {
-         print_error(vformat("While preparing to encode events, found an event code (%d) that is not registered. Aborting.", event[i].type));
-         return;
+         const kehNetEvent& evt = m_pending_event[i];
+         if (!evt.is_relevant(pid, player->has_interest_position(), player->get_interest_position()))
+            continue;
+         
+         if (reliable[i])
+         {
+            rindex.push_back(i);
+         }
+         else
+         {
+            Map<uint16_t, int>::Element* le = ulatest.find(evt.type);
+            if (le)
+            {
+               uindex.set(le->value(), i);
+            }
+            else
+            {
+               ulatest[evt.type] = uindex.size();
+               uindex.push_back(i);
+            }
+         }
       }
 
-      // Again, only encode something if there is at least one remote player
-      if (m_player_data->get_player_count() > 1)
+      if (rindex.size() > 0)
       {
-         // Write event type code
-         edec->write_ushort(event[i].type);
-
-         // Now the parameters
-         einfo->value().encode(edec, event[i].params);
+         const PoolByteArray batch = build_event_batch(encoded, rindex, sig, false);
+         m_profiler.on_sent(pid, kehNetProfiler::MSG_Event, batch.size());
+         if (m_load_test.is_running())
+            m_load_test.on_event_encoded(batch.size());
+         rpc_id(pid, "_client_receive_net_event", batch);
+      }
+      
+      if (uindex.size() > 0)
+      {
+         const PoolByteArray batch = build_event_batch(encoded, uindex, sig, true);
+         m_profiler.on_sent(pid, kehNetProfiler::MSG_UnreliableEvent, batch.size());
+         if (m_load_test.is_running())
+            m_load_test.on_event_encoded(batch.size());
+         rpc_unreliable_id(pid, "_client_receive_unreliable_event", batch);
       }
+   }
 
-      // Call attached event handlers for this event. This allows the server to act on this event
-      einfo->value().call_handlers(event[i].params);
+   m_pending_event.resize(0);
+}
+
+
+void kehNetwork::record_events(const PoolVector<kehNetEvent>& event)
+{
+   // Every event is recorded, regardless of relevancy, in the same format of the reliable batches
+   Ref<kehEncDecBuffer> edec = m_update_control->get_enc_dec();
+   edec->set_buffer(PoolByteArray());
+   edec->write_ushort(event.size());
+
+   for (int i = 0; i < event.size(); i++)
+   {
+      edec->write_ushort(event[i].type);
+      m_event_info[event[i].type].encode(edec, event[i].params);
+   }
+
+   m_snapshot_data->record_events(m_update_control->get_signature(), edec->get_buffer());
+}
+
+
+PoolByteArray kehNetwork::build_event_batch(const PoolVector<PoolByteArray>& encoded, const PoolVector<int>& index, uint32_t sig, bool with_sig)
+{
+   Ref<kehEncDecBuffer> edec = m_update_control->get_enc_dec();
+   edec->set_buffer(PoolByteArray());
+
+   if (with_sig)
+      edec->write_uint(sig);
+   
+   // Number of events. 16 bits should be more than enough
+   edec->write_ushort(index.size());
+
+   PoolByteArray ret = edec->get_buffer();
+   for (int i = 0; i < index.size(); i++)
+   {
+      ret.append_array(encoded[index[i]]);
    }
 
-   // All events processed. If any connected player, dispatch the events.
-   if (m_player_data->get_player_count() > 1)
-      rpc("_client_receive_net_event", edec->get_buffer());
+   return ret;
 }
 
 
@@ -1405,12 +2488,12 @@ void kehNetwork::custom_prop_signaler(uint32_t pid, const String& pname, const V
    emit_signal("custom_property_changed", pid, pname, val);
 }
 
-void kehNetwork::custom_prop_broadcast_requester(const String& pname, const Variant& val)
+void kehNetwork::custom_prop_broadcast_requester(uint32_t id, const Variant& val)
 {
    if (has_authority())
       return;
    
-   rpc_id(1, "_server_broadcast_custom_prop", pname, val);
+   rpc_id(1, "_server_broadcast_custom_prop", id, val);
 }
 
 
@@ -1431,6 +2514,21 @@ void kehNetwork::_notification(int what)
          // only when necessary - that is, creating/joining WebSocket server
          get_tree()->get_network_peer()->poll();
       } break;
+
+      case NOTIFICATION_INTERNAL_PROCESS:
+      {
+         // When relaying, the upstream connection must be polled as it's not the one in the scene tree
+         if (m_relay_upstream.is_valid())
+            m_relay_upstream->poll();
+      } break;
+
+      case NOTIFICATION_INTERNAL_PHYSICS_PROCESS:
+      {
+         if (is_replaying())
+            run_replay(get_physics_process_delta_time());
+         else if (m_simulation_rate > 0)
+            run_scheduled_ticks(get_physics_process_delta_time());
+      } break;
    }
 }
 
@@ -1446,8 +2544,12 @@ void kehNetwork::_bind_methods()
    ClassDB::bind_method(D_METHOD("_on_player_disconnected", "id"), &kehNetwork::on_player_disconnected);
    ClassDB::bind_method(D_METHOD("_on_connection_failed"), &kehNetwork::on_connection_failed);
    ClassDB::bind_method(D_METHOD("_on_disconnected"), &kehNetwork::on_disconnected);
+   ClassDB::bind_method(D_METHOD("_on_network_packet", "id", "packet"), &kehNetwork::on_network_packet);
+   ClassDB::bind_method(D_METHOD("_on_relay_packet", "id", "packet"), &kehNetwork::on_relay_packet);
+   ClassDB::bind_method(D_METHOD("_on_relay_upstream_lost"), &kehNetwork::on_relay_upstream_lost);
 
    ClassDB::bind_method(D_METHOD("_clear_netpeer"), &kehNetwork::clear_netpeer);
+   ClassDB::bind_method(D_METHOD("_on_load_test_finished"), &kehNetwork::on_load_test_finished);
 
 
    ClassDB::bind_method(D_METHOD("_all_register_player", "pid"), &kehNetwork::all_register_player);
@@ -1455,20 +2557,22 @@ void kehNetwork::_bind_methods()
    ClassDB::bind_method(D_METHOD("_all_chat_message", "sender", "msg", "broadcast"), &kehNetwork::all_chat_message);
    ClassDB::bind_method(D_METHOD("_all_receive_custom_prop_batch", "encoded"), &kehNetwork::all_receive_custom_prop_batch);
    
-   ClassDB::bind_method(D_METHOD("_client_join_accepted"), &kehNetwork::client_join_accepted);
+   ClassDB::bind_method(D_METHOD("_client_join_accepted", "cprop_table"), &kehNetwork::client_join_accepted);
    ClassDB::bind_method(D_METHOD("_client_join_rejected", "reason"), &kehNetwork::client_join_rejected);
    ClassDB::bind_method(D_METHOD("_client_kicked", "reason"), &kehNetwork::client_kicked);
    ClassDB::bind_method(D_METHOD("_client_on_websocket_close_request", "code", "reason"), &kehNetwork::client_on_websocket_close_request);
    ClassDB::bind_method(D_METHOD("_client_receive_full_snapshot", "encoded"), &kehNetwork::client_receive_full_snapshot);
    ClassDB::bind_method(D_METHOD("_client_receive_delta_snapshot", "encoded"), &kehNetwork::client_receive_delta_snapshot);
    ClassDB::bind_method(D_METHOD("_client_receive_net_event", "encoded"), &kehNetwork::client_receive_net_event);
+   ClassDB::bind_method(D_METHOD("_client_receive_unreliable_event", "encoded"), &kehNetwork::client_receive_unreliable_event);
    ClassDB::bind_method(D_METHOD("_client_request_credentials"), &kehNetwork::client_request_credentials);
 
    ClassDB::bind_method(D_METHOD("_server_client_is_ready"), &kehNetwork::server_client_is_ready);
    ClassDB::bind_method(D_METHOD("_server_client_not_ready"), &kehNetwork::server_client_not_ready);
    ClassDB::bind_method(D_METHOD("_server_acknowledge_snapshot", "sig"), &kehNetwork::server_acknowledge_snapshot);
-   ClassDB::bind_method(D_METHOD("_server_broadcast_custom_prop", "pname", "value"), &kehNetwork::server_broadcast_custom_prop);
+   ClassDB::bind_method(D_METHOD("_server_broadcast_custom_prop", "id", "value"), &kehNetwork::server_broadcast_custom_prop);
    ClassDB::bind_method(D_METHOD("_server_receive_credentials", "cred"), &kehNetwork::server_receive_credentials);
+   ClassDB::bind_method(D_METHOD("_server_register_spectator"), &kehNetwork::server_register_spectator);
 
    // Bind functions that will be exposed to scripting
    ClassDB::bind_method(D_METHOD("initialize"), &kehNetwork::initialize);
@@ -1499,23 +2603,73 @@ void kehNetwork::_bind_methods()
    ClassDB::bind_method(D_METHOD("create_server", "port", "server_name", "max_players"), &kehNetwork::create_server);
    ClassDB::bind_method(D_METHOD("close_server", "message"), &kehNetwork::close_server, DEFVAL(String("Server is closing")));
    ClassDB::bind_method(D_METHOD("kick_player", "id", "reason"), &kehNetwork::kick_player);
+   ClassDB::bind_method(D_METHOD("get_memory_network"), &kehNetwork::get_memory_network);
 
    ClassDB::bind_method(D_METHOD("join_server", "ip", "port"), &kehNetwork::join_server);
    ClassDB::bind_method(D_METHOD("disconnect_from_server"), &kehNetwork::disconnect_from_server);
    ClassDB::bind_method(D_METHOD("notify_ready"), &kehNetwork::notify_ready);
 
+   ClassDB::bind_method(D_METHOD("join_server_as_spectator", "ip", "port"), &kehNetwork::join_server_as_spectator);
+   ClassDB::bind_method(D_METHOD("is_spectator"), &kehNetwork::is_spectator);
+   ClassDB::bind_method(D_METHOD("get_spectator_count"), &kehNetwork::get_spectator_count);
+   ClassDB::bind_method(D_METHOD("start_relay", "ip", "port", "listen_port", "max_spectators"), &kehNetwork::start_relay);
+   ClassDB::bind_method(D_METHOD("stop_relay"), &kehNetwork::stop_relay);
+   ClassDB::bind_method(D_METHOD("is_relay"), &kehNetwork::is_relay);
+
    ClassDB::bind_method(D_METHOD("init_snapshot"), &kehNetwork::init_snapshot);
    ClassDB::bind_method(D_METHOD("get_snap_building_signature"), &kehNetwork::get_snap_building_signature);
+   ClassDB::bind_method(D_METHOD("is_tick_scheduler_enabled"), &kehNetwork::is_tick_scheduler_enabled);
+   ClassDB::bind_method(D_METHOD("set_player_send_rate", "pid", "rate"), &kehNetwork::set_player_send_rate);
+   ClassDB::bind_method(D_METHOD("set_player_bandwidth_limit", "pid", "bytes_per_sec"), &kehNetwork::set_player_bandwidth_limit);
+
+   ClassDB::bind_method(D_METHOD("get_estimated_server_tick"), &kehNetwork::get_estimated_server_tick);
+   ClassDB::bind_method(D_METHOD("get_client_tick"), &kehNetwork::get_client_tick);
+   ClassDB::bind_method(D_METHOD("get_clock_dilation"), &kehNetwork::get_clock_dilation);
    ClassDB::bind_method(D_METHOD("create_snap_entity", "snap_entity_class", "uid", "class_hash"), &kehNetwork::create_snap_entity);
    ClassDB::bind_method(D_METHOD("snapshot_entity", "entity"), &kehNetwork::snapshot_entity);
    ClassDB::bind_method(D_METHOD("correct_in_snapshot", "entity", "input"), &kehNetwork::correct_in_snapshot);
 
-   ClassDB::bind_method(D_METHOD("register_event_type", "code", "param_types"), &kehNetwork::register_event_type);
+   ClassDB::bind_method(D_METHOD("register_event_type", "code", "param_types", "reliable"), &kehNetwork::register_event_type, DEFVAL(true));
    ClassDB::bind_method(D_METHOD("attach_event_handler", "code", "obj", "funcname"), &kehNetwork::attach_event_handler);
    ClassDB::bind_method(D_METHOD("send_event", "code", "params"), &kehNetwork::send_event);
+   ClassDB::bind_method(D_METHOD("send_event_to", "code", "params", "peers"), &kehNetwork::send_event_to);
+   ClassDB::bind_method(D_METHOD("send_event_near", "code", "params", "position", "radius"), &kehNetwork::send_event_near);
 
    ClassDB::bind_method(D_METHOD("send_chat_message", "msg", "send_to"), &kehNetwork::send_chat_message, DEFVAL(0));
 
+   ClassDB::bind_method(D_METHOD("get_peer_stats", "pid"), &kehNetwork::get_peer_stats);
+
+   ClassDB::bind_method(D_METHOD("add_simulated_clients", "count"), &kehNetwork::add_simulated_clients);
+   ClassDB::bind_method(D_METHOD("remove_simulated_clients"), &kehNetwork::remove_simulated_clients);
+   ClassDB::bind_method(D_METHOD("set_simulated_ack_loss", "loss"), &kehNetwork::set_simulated_ack_loss);
+   ClassDB::bind_method(D_METHOD("set_load_test_seed", "seed"), &kehNetwork::set_load_test_seed);
+   ClassDB::bind_method(D_METHOD("set_load_test_input_generator", "fref"), &kehNetwork::set_load_test_input_generator);
+   ClassDB::bind_method(D_METHOD("get_load_test_input_generator"), &kehNetwork::get_load_test_input_generator);
+   ClassDB::bind_method(D_METHOD("get_load_test_stats"), &kehNetwork::get_load_test_stats);
+   ClassDB::bind_method(D_METHOD("reset_load_test_stats"), &kehNetwork::reset_load_test_stats);
+
+   ClassDB::bind_method(D_METHOD("set_profiling_enabled", "enabled"), &kehNetwork::set_profiling_enabled);
+   ClassDB::bind_method(D_METHOD("is_profiling_enabled"), &kehNetwork::is_profiling_enabled);
+   ClassDB::bind_method(D_METHOD("get_net_stats"), &kehNetwork::get_net_stats);
+   ClassDB::bind_method(D_METHOD("reset_net_stats"), &kehNetwork::reset_net_stats);
+   ClassDB::bind_method(D_METHOD("start_net_trace"), &kehNetwork::start_net_trace);
+   ClassDB::bind_method(D_METHOD("stop_net_trace"), &kehNetwork::stop_net_trace);
+   ClassDB::bind_method(D_METHOD("save_net_trace", "path"), &kehNetwork::save_net_trace);
+
+   ClassDB::bind_method(D_METHOD("start_recording", "path"), &kehNetwork::start_recording);
+   ClassDB::bind_method(D_METHOD("stop_recording"), &kehNetwork::stop_recording);
+   ClassDB::bind_method(D_METHOD("is_recording"), &kehNetwork::is_recording);
+   ClassDB::bind_method(D_METHOD("start_replay", "path"), &kehNetwork::start_replay);
+   ClassDB::bind_method(D_METHOD("stop_replay"), &kehNetwork::stop_replay);
+   ClassDB::bind_method(D_METHOD("is_replaying"), &kehNetwork::is_replaying);
+   ClassDB::bind_method(D_METHOD("set_replay_paused", "paused"), &kehNetwork::set_replay_paused);
+   ClassDB::bind_method(D_METHOD("is_replay_paused"), &kehNetwork::is_replay_paused);
+   ClassDB::bind_method(D_METHOD("step_replay"), &kehNetwork::step_replay);
+   ClassDB::bind_method(D_METHOD("seek_replay", "signature"), &kehNetwork::seek_replay);
+   ClassDB::bind_method(D_METHOD("get_replay_signature"), &kehNetwork::get_replay_signature);
+   ClassDB::bind_method(D_METHOD("get_replay_first_signature"), &kehNetwork::get_replay_first_signature);
+   ClassDB::bind_method(D_METHOD("get_replay_last_signature"), &kehNetwork::get_replay_last_signature);
+
    ClassDB::bind_method(D_METHOD("set_credential_checker", "fref"), &kehNetwork::set_credential_checker);
    ClassDB::bind_method(D_METHOD("get_credential_checker"), &kehNetwork::get_credential_checker);
    ClassDB::bind_method(D_METHOD("dispatch_credentials", "cred"), &kehNetwork::dispatch_credentials);
@@ -1526,6 +2680,9 @@ void kehNetwork::_bind_methods()
    ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "player_data", PROPERTY_HINT_RESOURCE_TYPE, "kehPlayerData", NULL), "", "get_player_data");
 
    ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "credential_checker", PROPERTY_HINT_RESOURCE_TYPE, "FuncRef", NULL), "set_credential_checker", "get_credential_checker");
+   ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "load_test_input_generator", PROPERTY_HINT_RESOURCE_TYPE, "FuncRef", NULL), "set_load_test_input_generator", "get_load_test_input_generator");
+   ADD_PROPERTY(PropertyInfo(Variant::BOOL, "profiling_enabled"), "set_profiling_enabled", "is_profiling_enabled");
+   ADD_PROPERTY(PropertyInfo(Variant::BOOL, "replay_paused"), "set_replay_paused", "is_replay_paused");
 
    // Register the signals.
    ADD_SIGNAL(MethodInfo("server_created"));
@@ -1534,6 +2691,11 @@ void kehNetwork::_bind_methods()
    ADD_SIGNAL(MethodInfo("player_added", PropertyInfo(Variant::INT, "id")));
    ADD_SIGNAL(MethodInfo("player_removed", PropertyInfo(Variant::INT, "id")));
 
+   ADD_SIGNAL(MethodInfo("spectator_added", PropertyInfo(Variant::INT, "id")));
+   ADD_SIGNAL(MethodInfo("spectator_removed", PropertyInfo(Variant::INT, "id")));
+   // Only on relays, when the connection with the upstream server is lost
+   ADD_SIGNAL(MethodInfo("relay_disconnected"));
+
    // If the credential system is being used this signal will be emitted only on client machines
    // trying to join the server, indicating that the server is requesting the credential data.
    ADD_SIGNAL(MethodInfo("credentials_requested"));
@@ -1550,6 +2712,10 @@ void kehNetwork::_bind_methods()
 
    ADD_SIGNAL(MethodInfo("chat_message_received", PropertyInfo(Variant::STRING, "msg"), PropertyInfo(Variant::INT, "sender")));
 
+   ADD_SIGNAL(MethodInfo("simulation_tick", PropertyInfo(Variant::REAL, "delta")));
+
+   ADD_SIGNAL(MethodInfo("replay_finished"));
+
    ADD_SIGNAL(MethodInfo("custom_property_changed", PropertyInfo(Variant::INT, "pid"), PropertyInfo(Variant::STRING, "pname"), PropertyInfo(Variant::NIL, "value")));
 }
 
@@ -1559,6 +2725,7 @@ kehNetwork::kehNetwork(fptr on_entered_tree) :
    m_initialized(false)
 {
    s_singleton = this;
+   kehNetProfiler::set_singleton(&m_profiler);
 
    set_name("__kehNetwork");
 
@@ -1571,10 +2738,24 @@ kehNetwork::kehNetwork(fptr on_entered_tree) :
    m_max_client_history_size = 60;
 
    m_is_ready = false;
+   m_last_unreliable_evt_sig = 0;
+   m_apply_time_scale = false;
+   m_use_io_thread = false;
+   m_io_queue_size = 2048;
+   m_io_idle_usec = 1000;
+   m_simulation_rate = 0;
+   m_send_rate = 0;
+   m_max_ticks_per_frame = 5;
+   m_tick_accumulator = 0.0f;
+   m_max_trace_events = 100000;
+   m_replay_keyframe_interval = 60;
+   m_replay_paused = false;
+   m_replay_accumulator = 0.0f;
+   m_is_spectator = false;
 
 }
 
 kehNetwork::~kehNetwork()
 {
-
+   kehNetProfiler::set_singleton(NULL);
 }
\ No newline at end of file
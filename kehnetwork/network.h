@@ -24,8 +24,13 @@
 #define _KEHNETWORK_NETWORK_H 1
 
 #include "scene/main/node.h"
+#include "core/io/networked_multiplayer_peer.h"
 
 #include "eventinfo.h"
+#include "clocksync.h"
+#include "loadtest.h"
+#include "profiler.h"
+#include "spectator.h"
 
 class kehSnapshotData;
 class kehPlayerData;
@@ -33,8 +38,11 @@ class kehInputData;
 class kehSnapshot;
 class kehSnapEntityBase;
 class kehUpdateControl;
+class kehEncDecBuffer;
 
 class FuncRef;
+class MultiplayerAPI;
+class kehMemoryNetwork;
 
 
 
@@ -47,6 +55,7 @@ private:
    {
       BM_ENet,
       BM_WebSocket,
+      BM_Memory,
 
       BM_Invalid,
    };
@@ -77,6 +86,9 @@ private:
    // Hold registered replicated event types as well as their handlers
    Map<uint16_t, kehEventInfo> m_event_info;
 
+   // Events are accumulated here during the ticks in between send ticks, so those can be encoded together
+   PoolVector<kehNetEvent> m_pending_event;
+
    // The next ones will be obtained from ProjectSettings
    uint32_t m_compression;
    uint32_t m_backmode;             // ENet, WebSocket...
@@ -84,7 +96,57 @@ private:
    uint32_t m_full_snap_threshold;
    uint32_t m_max_history_size;
    uint32_t m_max_client_history_size;
-
+   bool m_use_io_thread;
+   uint32_t m_io_queue_size;
+   uint32_t m_io_idle_usec;
+
+
+   // Only relevant on clients, estimates the server tick and how fast the local simulation should run
+   kehClockSync m_clock_sync;
+   // If true, the time dilation calculated by the clock sync will be applied into Engine.time_scale
+   bool m_apply_time_scale;
+
+   // Tick scheduler. If the simulation rate is bigger than 0 then snapshots will be automatically initialized and
+   // finished at this rate (ticks per second), independently of the frame rate. Otherwise game code must call
+   // init_snapshot() as usual.
+   uint32_t m_simulation_rate;
+   // Rate (per second) in which accumulated data is sent to the clients. 0 means every tick
+   uint32_t m_send_rate;
+   // Maximum amount of ticks that can be performed within a single frame. Prevents the "spiral of death"
+   uint32_t m_max_ticks_per_frame;
+   // Time accumulated by the tick scheduler that still didn't result in a tick
+   float m_tick_accumulator;
+
+   // Simulated clients used for load testing, only on the server
+   kehLoadTest m_load_test;
+
+   // Timing of the network sections and bytes per message type per peer
+   kehNetProfiler m_profiler;
+   // Maximum amount of events recorded by start_net_trace()
+   uint32_t m_max_trace_events;
+
+   // When recording snapshots, a full one is written every this amount of snapshots
+   uint32_t m_replay_keyframe_interval;
+   // Replay playback state. Time is accumulated so snapshots are applied at the recorded tick rate
+   bool m_replay_paused;
+   float m_replay_accumulator;
+
+   // On the server, the shared stream given to the spectators. On a relay, the stream received from the upstream
+   // server, which is forwarded to the spectators connected to the relay
+   kehSpectatorStream m_spectator;
+   // Only relevant on clients. If true, join as a spectator rather than as a player
+   bool m_is_spectator;
+
+   // Only on relays. The connection with the upstream server is not the one assigned to the scene tree, which
+   // is the server the spectators connect to
+   Ref<MultiplayerAPI> m_relay_upstream;
+
+   // Only on servers created in the memory mode (BM_Memory). The network simulating the conditions
+   Ref<kehMemoryNetwork> m_memory_network;
+
+   // Only relevant on clients. Signature of the newest batch of unreliable events, used to discard batches
+   // arriving out of order.
+   uint32_t m_last_unreliable_evt_sig;
 
    // Only relevant on clients and will automatically change based on the calls to the notify_ready() and
    // notify_not_ready() functions. Basically when this is false, incoming snapshots will be ignored.
@@ -97,20 +159,55 @@ private:
    // not present in the current Godot build.
    void check_backmode();
 
+   // If the network thread is enabled, wrap the given peer so its polling and sending happens in a dedicated
+   // thread. Otherwise the peer is returned as is.
+   Ref<NetworkedMultiplayerPeer> wrap_netpeer(const Ref<NetworkedMultiplayerPeer>& peer) const;
+
    void on_root_completed();
    void on_root_shutdown();
 
+   // Check the command line for the load test mode, which creates a server, adds simulated clients and after the
+   // specified time prints the statistics (JSON) then quits
+   void check_load_test_cmdline();
+   void on_load_test_finished();
+
+   // Check the command line for the benchmark mode, which runs the encoding/decoding microbenchmarks, prints the
+   // results (JSON) then quits
+   void check_benchmark_cmdline();
+
+   // Advance the replay playback by the given time
+   void run_replay(float delta);
+
    void on_player_connected(uint32_t id);
    void on_player_disconnected(uint32_t id);
 
    void on_connection_failed();
    void on_disconnected();
 
+   // Raw packets arriving through the scene tree network peer. On spectators those hold the snapshot stream
+   void on_network_packet(uint32_t id, const PoolByteArray& packet);
+
+   // Relay - stream packets coming from the upstream server and lost connection with it
+   void on_relay_packet(uint32_t id, const PoolByteArray& packet);
+   void on_relay_upstream_lost();
+
+   // Create the network peer used to connect to a server, based on the mode (ENet, WebSocket...)
+   Ref<NetworkedMultiplayerPeer> create_client_peer(const String& IP, uint32_t port) const;
+
 
    void clear_netpeer();
    // A little helper that will perform some cleanup
    void handle_disconnection();
 
+   // Reset the clock synchronization, restoring the time scale if it was being changed
+   void reset_clock_sync();
+
+   // Obtain the amount of simulation ticks per second
+   float get_tick_rate() const;
+
+   // Called from the internal physics process when the tick scheduler is enabled, performing all the ticks that are due
+   void run_scheduled_ticks(float delta);
+
 
    /// Remote functions - that is, those that will be called by other machines in the network.
    void all_register_player(uint32_t pid);
@@ -123,7 +220,8 @@ private:
 
    // Called by the server and must run on client. Basically server will notify the client that a connection
    // attempt was accepted through this call.
-   void client_join_accepted();
+   // The table of custom property names is given so all machines use the same numeric IDs for the properties.
+   void client_join_accepted(const PoolStringArray& cprop_table);
    // Server will call this to tell a client that a connection was rejected
    void client_join_rejected(const String& reason);
 
@@ -147,6 +245,19 @@ private:
    //  Server will call this when dispatching events to the client
    void client_receive_net_event(const PoolByteArray& encoded);
 
+   // Server will call this through the unreliable channel when dispatching events registered as unreliable.
+   // The batch is prefixed by the signature of the snapshot so old batches can be ignored.
+   void client_receive_unreliable_event(const PoolByteArray& encoded);
+
+   // Decode the events within the EncDecBuffer and call the handlers
+   void decode_events(Ref<kehEncDecBuffer>& from);
+
+   // Helper used to concatenate per event encoded data into a batch, prefixed by the amount of events
+   PoolByteArray build_event_batch(const PoolVector<PoolByteArray>& encoded, const PoolVector<int>& index, uint32_t sig, bool with_sig);
+
+   // Encode all the given events into the snapshot recording
+   void record_events(const PoolVector<kehNetEvent>& event);
+
    // Server will call this to request client to send credentials
    void client_request_credentials();
 
@@ -166,22 +277,36 @@ private:
    // This function is meant to be called by clients and only run on the server. It should broadcast
    // the specified property to all connected clients skipping the one that called it. This function will only
    // deal with properties that were not sent in a packet (supported by EncDecBuffer)
-   void server_broadcast_custom_prop(const String& pname, const Variant& value);
+   void server_broadcast_custom_prop(uint32_t id, const Variant& value);
 
    // Client will call this when sending credentials to the server
    void server_receive_credentials(const Dictionary& cred);
 
+   // A client that joined as spectator will call this instead of registering itself as a player. The cached
+   // stream is sent to it so it can catch up
+   void server_register_spectator();
+
+   // Send the given stream packet to all spectators
+   void send_to_spectators(const PoolByteArray& packet);
+
    // Custom properties that are supported by the EncDecbuffer will use this function to perform the synchronization.
-   // Basically when this is called there is incoming data. On the server the properties must first be decoded and
-   // applied ot the node corresponding to the remote player. Then the data must be encoded again but excluding any
-   // property that is set to "ServerOnly"
+   // Basically when this is called there is incoming data, which may contain properties of several players. On the
+   // server the properties are decoded and applied to the node corresponding to the remote player, becoming dirty
+   // so those will be part of the aggregated batch built on the next on_check_custom_properties().
    void all_receive_custom_prop_batch(const PoolByteArray& encoded);
 
+   // Concatenate per player encoded custom properties into a single batch, skipping the segment owned by the
+   // specified player (0 to not skip anything).
+   PoolByteArray build_custom_prop_batch(const PoolVector<PoolByteArray>& segment, const PoolVector<uint32_t>& owner, uint32_t skip);
 
-   // When a snapshot is being finished, this function will be called in order to synchronize custom player properties
+
+   // When a snapshot is being finished, this function will be called in order to synchronize custom player properties.
+   // On the server dirty properties of all players are gathered into a single batch that is reused for every peer.
    void on_check_custom_properties();
    // This will be called when snapshot is finished and must perform the encoding to send to connected players.
    void on_snapshot_finished(Ref<kehSnapshot>& snap);
+   // Validate the event code. Returns true if the event can be sent from this machine, which must be the authority
+   bool can_send_event(uint16_t code) const;
    // Called as part of the "snapshot finished" process. This must send accumulated events to the connected clients
    void on_dispatch_events(const PoolVector<kehNetEvent>& event);
 
@@ -189,7 +314,7 @@ private:
    /// "Signaler" functions
    void ping_signaler(uint32_t pid, float ping);
    void custom_prop_signaler(uint32_t pid, const String& pname, const Variant& val);
-   void custom_prop_broadcast_requester(const String& pname, const Variant& val);
+   void custom_prop_broadcast_requester(uint32_t id, const Variant& val);
 
 protected:
    void _notification(int what);
@@ -259,11 +384,30 @@ public:
 
    void kick_player(uint32_t id, const String& reason);
 
+   // The network created by create_server() in the memory mode. Through it the simulated conditions can be
+   // changed while running and the clock advanced. Invalid on other modes or if not hosting
+   Ref<kehMemoryNetwork> get_memory_network() const;
+
 
    /// Client
    void join_server(const String& IP, uint32_t port);
    void disconnect_from_server();
 
+   /// Spectators
+   // Join the server as a spectator. No player node is created and nothing is sent to the server. Snapshots
+   // arrive through a shared (delayed) stream and are applied as is, spawning and despawning game nodes
+   void join_server_as_spectator(const String& IP, uint32_t port);
+   bool is_spectator() const { return m_is_spectator; }
+
+   // On the server (or relay), the amount of connected spectators
+   uint32_t get_spectator_count() const { return m_spectator.get_count(); }
+
+   // Connect to the given server as a spectator and create a server (on listen_port) that spectators can join,
+   // forwarding the stream to those. Nothing is decoded so the relay doesn't need any of the game code
+   void start_relay(const String& IP, uint32_t port, uint32_t listen_port, uint32_t max_spectators);
+   void stop_relay();
+   bool is_relay() const { return m_relay_upstream.is_valid(); }
+
 
    void notify_ready();
 
@@ -275,9 +419,32 @@ public:
    // Obtain the signature of the snapshot that is currently being built
    uint32_t get_snap_building_signature() const;
 
+   // Returns true if the built-in tick scheduler is enabled, meaning that snapshots are automatically
+   // initialized and the "simulation_tick" signal is given to perform the simulation
+   bool is_tick_scheduler_enabled() const { return m_simulation_rate > 0; }
+
+   // Per player send rate (in Hz). 0 means the global send rate. Only relevant on the server
+   void set_player_send_rate(uint32_t pid, uint32_t rate);
+   // Per player bandwidth limit for the snapshot data, in bytes per second. 0 means unlimited
+   void set_player_bandwidth_limit(uint32_t pid, uint32_t bytes_per_sec);
+
+
+   /// Clock synchronization
+   // On clients, the estimated tick (snapshot signature) the server is currently at
+   double get_estimated_server_tick() const;
+   // On clients, the tick (in the server timeline) the local simulation is currently at. It should be ahead of
+   // the server so input data arrives in time
+   double get_client_tick() const;
+   // Time scale the client simulation should run at in order to converge into the target tick. Always 1 on
+   // the server
+   float get_clock_dilation() const;
+
    // Create an instance of the given Snap Entity script. This will take care of setting unique
    // ID and class hash
    Ref<kehSnapEntityBase> create_snap_entity(const Ref<Script>& snap_script, uint32_t uid, uint32_t class_hash) const;
+   // Same as above, but for entity types declared in C++ (see nativeentity.h), given by class name. Entities
+   // obtained through this are recycled from the pool of the entity type whenever possible
+   Ref<kehSnapEntityBase> create_native_entity(const StringName& cname, uint32_t uid, uint32_t class_hash) const;
 
    // Add the given snapshot entity into the snapshot currently being built.
    void snapshot_entity(const Ref<kehSnapEntityBase>& entity);
@@ -288,8 +455,9 @@ public:
 
 
    /// Replicated event system
-   // Register an event type
-   void register_event_type(uint16_t code, const Array& param_types);
+   // Register an event type. If reliable is false then only the latest event of this type within an update
+   // will be sent, using the unreliable channel.
+   void register_event_type(uint16_t code, const Array& param_types, bool reliable = true);
 
    // Attach an event handler into the given event type
    void attach_event_handler(uint16_t code, const Object* obj, const String& fname);
@@ -297,12 +465,89 @@ public:
    // Accumulate an event to be sent to the clients. This will do nothing if not on authority machine
    void send_event(uint16_t code, const Array& params);
 
+   // Accumulate an event that will only be sent to the peers in the given list
+   void send_event_to(uint16_t code, const Array& params, const PoolIntArray& peers);
+
+   // Accumulate an event that will only be sent to peers with interest position (see kehPlayerNode) within the
+   // given radius from the position. Peers without interest position will still receive the event
+   void send_event_near(uint16_t code, const Array& params, const Vector3& position, float radius);
+
    /// Chat system
    // Send a chat message. If the second argument is set to 0, then the message will be broadcast, otherwise
    // it will be sent to the specified peer ID
    void send_chat_message(const String& msg, uint32_t send_to = 0);
 
 
+   /// Network statistics
+   // Obtain a Dictionary with the round trip time ("rtt"), its variance ("rtt_variance"), "jitter" (all in
+   // milliseconds) and "packet_loss" (0 to 1) of the given player. On clients complete information is only
+   // available for the local player.
+   Dictionary get_peer_stats(uint32_t pid) const;
+
+
+   /// Load testing
+   // Add simulated clients. A server must be running in the memory mode. Simulated clients run in this process and
+   // connect through the memory network like real clients, generating input data every tick and acknowledging the
+   // snapshots (see loadtest.h)
+   void add_simulated_clients(uint32_t count);
+   // Remove all simulated clients
+   void remove_simulated_clients();
+
+   // Probability (0 to 1) of a snapshot not being acknowledged by the simulated clients
+   void set_simulated_ack_loss(float loss) { m_load_test.set_ack_loss(loss); }
+   // Seed of the random number generator used by the simulated clients
+   void set_load_test_seed(uint32_t seed) { m_load_test.set_seed(seed); }
+
+   // The generator is called with the player ID and the kehInputData object that must be filled
+   void set_load_test_input_generator(const Ref<FuncRef>& fref);
+   Ref<FuncRef> get_load_test_input_generator() const;
+
+   // Obtain the statistics gathered since the simulated clients were added (or since the last reset)
+   Dictionary get_load_test_stats() const { return m_load_test.get_stats(get_tick_rate()); }
+   void reset_load_test_stats() { m_load_test.reset_stats(); }
+
+
+   /// Profiling
+   void set_profiling_enabled(bool enabled) { m_profiler.set_enabled(enabled); }
+   bool is_profiling_enabled() const { return m_profiler.is_enabled(); }
+
+   // Obtain the gathered profiling data: timing of each instrumented section and bytes of each message type
+   // sent to or received from each peer
+   Dictionary get_net_stats() const { return m_profiler.get_stats(); }
+   void reset_net_stats() { m_profiler.reset(); }
+
+   // Record the timed sections into a timeline, which can then be saved in the Chrome trace format. Profiling
+   // is automatically enabled
+   void start_net_trace();
+   void stop_net_trace() { m_profiler.stop_trace(); }
+   Error save_net_trace(const String& path) const { return m_profiler.save_trace(path); }
+
+
+   /// Snapshot recording and replay
+   // Only on the authority. Record every snapshot (and replicated events) into the given file
+   Error start_recording(const String& path);
+   void stop_recording();
+   bool is_recording() const;
+
+   // Play a recorded file, decoding and applying the snapshots (spawning and despawning nodes as necessary) and
+   // calling the event handlers. Meant to be used without any connection, with the game simulation stopped
+   Error start_replay(const String& path);
+   void stop_replay();
+   bool is_replaying() const;
+
+   void set_replay_paused(bool paused) { m_replay_paused = paused; }
+   bool is_replay_paused() const { return m_replay_paused; }
+
+   // Manually advance the replay by one snapshot. Returns false once the end is reached
+   bool step_replay();
+   // Jump to the given snapshot signature
+   bool seek_replay(uint32_t signature);
+
+   uint32_t get_replay_signature() const;
+   uint32_t get_replay_first_signature() const;
+   uint32_t get_replay_last_signature() const;
+
+
    /// Credential system
    void set_credential_checker(const Ref<FuncRef>& fref);
    Ref<FuncRef> get_credential_checker() const;
@@ -26,6 +26,7 @@
 void kehNetNodeSpawner::_bind_methods()
 {
    BIND_VMETHOD(MethodInfo(PropertyInfo(Variant::OBJECT, "node", PROPERTY_HINT_RESOURCE_TYPE, "Node"), "spawn"));
+   BIND_VMETHOD(MethodInfo(Variant::BOOL, "despawn", PropertyInfo(Variant::OBJECT, "node", PROPERTY_HINT_RESOURCE_TYPE, "Node")));
 }
 
 
@@ -69,4 +70,150 @@ kehNetDefaultSpawner::kehNetDefaultSpawner(const Ref<PackedScene>& scene_class)
    m_scene_class(scene_class)
 {}
 kehNetDefaultSpawner::~kehNetDefaultSpawner()
-{}
\ No newline at end of file
+{}
+
+
+
+void kehNetPoolingSpawner::fill_pool()
+{
+   if (!m_scene_class.is_valid())
+      return;
+   
+   while ((uint32_t)m_pooled.size() < m_prewarm_count)
+   {
+      Node* n = m_scene_class->instance();
+      if (!n)
+         return;
+      
+      m_pooled.push_back(n);
+   }
+}
+
+
+Node* kehNetPoolingSpawner::spawn()
+{
+   Node* ret = NULL;
+
+   if (m_pooled.size() > 0)
+   {
+      ret = m_pooled[m_pooled.size() - 1];
+      m_pooled.resize(m_pooled.size() - 1);
+   }
+   else if (m_scene_class.is_valid())
+   {
+      ret = m_scene_class->instance();
+   }
+
+   return ret;
+}
+
+
+bool kehNetPoolingSpawner::despawn(Node* node)
+{
+   if (!node || node->is_queued_for_deletion())
+      return false;
+   
+   if (m_max_pooled > 0 && (uint32_t)m_pooled.size() >= m_max_pooled)
+      return false;
+   
+   Node* parent = node->get_parent();
+   if (parent)
+   {
+      parent->remove_child(node);
+   }
+
+   if (node->has_method("_pool_reset"))
+   {
+      node->call("_pool_reset");
+   }
+
+   m_pooled.push_back(node);
+
+   return true;
+}
+
+
+void kehNetPoolingSpawner::clear()
+{
+   for (int i = 0; i < m_pooled.size(); i++)
+   {
+      memdelete(m_pooled[i]);
+   }
+
+   m_pooled.clear();
+}
+
+
+void kehNetPoolingSpawner::set_scene_class(const Ref<PackedScene>& sc)
+{
+   if (sc != m_scene_class)
+   {
+      // Nodes of the previous scene must not be given by spawn()
+      clear();
+   }
+
+   m_scene_class = sc;
+   fill_pool();
+}
+
+Ref<PackedScene> kehNetPoolingSpawner::get_scene_class() const
+{
+   return m_scene_class;
+}
+
+
+void kehNetPoolingSpawner::set_prewarm_count(uint32_t count)
+{
+   m_prewarm_count = count;
+   fill_pool();
+}
+
+uint32_t kehNetPoolingSpawner::get_prewarm_count() const
+{
+   return m_prewarm_count;
+}
+
+
+void kehNetPoolingSpawner::set_max_pooled(uint32_t max)
+{
+   m_max_pooled = max;
+}
+
+uint32_t kehNetPoolingSpawner::get_max_pooled() const
+{
+   return m_max_pooled;
+}
+
+
+void kehNetPoolingSpawner::_bind_methods()
+{
+   ClassDB::bind_method(D_METHOD("spawn"), &kehNetPoolingSpawner::spawn);
+   ClassDB::bind_method(D_METHOD("despawn", "node"), &kehNetPoolingSpawner::despawn);
+   ClassDB::bind_method(D_METHOD("clear"), &kehNetPoolingSpawner::clear);
+   ClassDB::bind_method(D_METHOD("get_pooled_count"), &kehNetPoolingSpawner::get_pooled_count);
+
+   ClassDB::bind_method(D_METHOD("set_scene_class", "scene_class"), &kehNetPoolingSpawner::set_scene_class);
+   ClassDB::bind_method(D_METHOD("get_scene_class"), &kehNetPoolingSpawner::get_scene_class);
+   ClassDB::bind_method(D_METHOD("set_prewarm_count", "count"), &kehNetPoolingSpawner::set_prewarm_count);
+   ClassDB::bind_method(D_METHOD("get_prewarm_count"), &kehNetPoolingSpawner::get_prewarm_count);
+   ClassDB::bind_method(D_METHOD("set_max_pooled", "max"), &kehNetPoolingSpawner::set_max_pooled);
+   ClassDB::bind_method(D_METHOD("get_max_pooled"), &kehNetPoolingSpawner::get_max_pooled);
+
+   ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "scene_class", PROPERTY_HINT_RESOURCE_TYPE, "PackedScene", NULL), "set_scene_class", "get_scene_class");
+   ADD_PROPERTY(PropertyInfo(Variant::INT, "prewarm_count"), "set_prewarm_count", "get_prewarm_count");
+   ADD_PROPERTY(PropertyInfo(Variant::INT, "max_pooled"), "set_max_pooled", "get_max_pooled");
+}
+
+
+kehNetPoolingSpawner::kehNetPoolingSpawner(const Ref<PackedScene>& scene_class, uint32_t prewarm_count) :
+   m_scene_class(scene_class),
+   m_prewarm_count(prewarm_count),
+   m_max_pooled(0)
+{
+   fill_pool();
+}
+
+kehNetPoolingSpawner::~kehNetPoolingSpawner()
+{
+   clear();
+}
@@ -61,4 +61,54 @@ public:
 };
 
 
+// This spawner keeps despawned nodes out of the tree instead of freeing them, so those can be reused by
+// subsequent spawn requests. Because spawners are registered per class hash, the pre-warm count is also
+// per class hash. When a node is given back it's removed from its parent and, if the node script contains
+// a function named "_pool_reset", that function will be called so the state can be restored.
+class kehNetPoolingSpawner : public kehNetNodeSpawner
+{
+   GDCLASS(kehNetPoolingSpawner, kehNetNodeSpawner);
+private:
+   Ref<PackedScene> m_scene_class;
+
+   // Nodes that are outside of the tree and ready to be reused. This spawner owns those.
+   Vector<Node*> m_pooled;
+
+   // How many nodes should be instanced beforehand
+   uint32_t m_prewarm_count;
+   // Maximum amount of nodes kept in the pool. If 0 then there is no limit
+   uint32_t m_max_pooled;
+
+   // Instance nodes until the pool reaches the pre-warm count
+   void fill_pool();
+
+protected:
+   static void _bind_methods();
+
+public:
+   Node* spawn();
+
+   // Returns true if the node has been taken back into the pool. Otherwise the caller must free it
+   bool despawn(Node* node);
+
+   // Free all the nodes held by the pool
+   void clear();
+
+   uint32_t get_pooled_count() const { return m_pooled.size(); }
+
+   void set_scene_class(const Ref<PackedScene>& sc);
+   Ref<PackedScene> get_scene_class() const;
+
+   void set_prewarm_count(uint32_t count);
+   uint32_t get_prewarm_count() const;
+
+   void set_max_pooled(uint32_t max);
+   uint32_t get_max_pooled() const;
+
+
+   kehNetPoolingSpawner(const Ref<PackedScene>& scene_class = NULL, uint32_t prewarm_count = 0);
+   ~kehNetPoolingSpawner();
+};
+
+
 #endif
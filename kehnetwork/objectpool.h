@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_OBJECTPOOL_H
+#define _KEHNETWORK_OBJECTPOOL_H 1
+
+// Input data and snapshot entities are created (and discarded) every single tick. Since those are
+// reference counted objects, each one of them means a trip to the allocator, which is visible as
+// frame time spikes on low end machines. This class holds discarded instances so they can be given
+// back (recycled) instead of creating new ones.
+//
+// Released objects may still be referenced somewhere else (game code holding an input object, as an
+// example). Because of that, an object is only reused when the pool holds the single remaining
+// reference to it. Objects found still in use when acquiring are dropped from the pool and left to
+// the reference counting, so those don't make later acquisitions slower. Each acquisition checks at
+// most MAX_SCAN objects.
+//
+// The pooled type must provide is_pooled() and set_pooled(bool). This flag prevents the same object
+// from being stored multiple times, which can happen if a single reference is added into more than
+// one snapshot.
+
+#include "core/reference.h"
+
+template <class T>
+class kehObjectPool
+{
+private:
+   // Released objects.
+   PoolVector<Ref<T>> m_free;
+
+   // Maximum amount of objects checked by a single acquire()
+   static const uint32_t MAX_SCAN = 8;
+
+   // Maximum amount of objects held by this pool. Anything released after this limit is reached will
+   // be left to the reference counting.
+   uint32_t m_max_size;
+
+public:
+   void set_max_size(uint32_t s) { m_max_size = s; }
+   uint32_t get_max_size() const { return m_max_size; }
+   uint32_t get_size() const { return m_free.size(); }
+
+   // Retrieve an object that can be reused. If there is none, the returned reference will be invalid and
+   // the caller is expected to create a new instance.
+   Ref<T> acquire()
+   {
+      // Objects are taken from the back of the container. Every checked object is removed from the pool,
+      // either to be reused or because it's still referenced somewhere else
+      for (uint32_t checked = 0; checked < MAX_SCAN && m_free.size() > 0; checked++)
+      {
+         const int32_t last = m_free.size() - 1;
+         Ref<T> obj = m_free[last];
+         m_free.resize(last);
+         obj->set_pooled(false);
+
+         // With the container entry gone, the local reference must be the only one
+         if (obj->reference_get_count() <= 1)
+            return obj;
+      }
+
+      return Ref<T>();
+   }
+
+   // Give an object back to the pool so it can be reused later.
+   void release(const Ref<T>& obj)
+   {
+      if (!obj.is_valid() || obj->is_pooled() || (uint32_t)m_free.size() >= m_max_size)
+         return;
+      
+      obj->set_pooled(true);
+      m_free.push_back(obj);
+   }
+
+   void clear()
+   {
+      for (int32_t i = 0; i < m_free.size(); i++)
+      {
+         m_free[i]->set_pooled(false);
+      }
+      m_free.resize(0);
+   }
+
+   kehObjectPool(uint32_t max_size = 512) : m_max_size(max_size) {}
+};
+
+
+#endif
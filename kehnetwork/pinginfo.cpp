@@ -22,84 +22,124 @@
 
 #include "pinginfo.h"
 
-// Wait one second between ping requests
-const float kehPingInfo::PING_INTERVAL = 1.0f;
-// Wait five seconds before considering a ping request as lost
-const float kehPingInfo::PING_TIMEOUT = 5.0f;
+#include "core/os/os.h"
 
+// Don't report measured values more than once every second
+const float kehPingInfo::REPORT_INTERVAL = 1.0f;
 
-float kehPingInfo::calculate_and_restart(uint32_t sig)
+// Gains used to smooth the RTT and variance. These are the values recommended by RFC 6298
+#define RTT_ALPHA 0.125f
+#define RTT_BETA 0.25f
+// Gain used to smooth jitter, as in RFC 3550
+#define JITTER_GAIN 0.0625f
+// Gain used to smooth packet loss rate
+#define LOSS_GAIN 0.05f
+
+
+void kehPingInfo::add_loss_sample(bool lost)
+{
+   m_loss += ((lost ? 1.0f : 0.0f) - m_loss) * LOSS_GAIN;
+}
+
+void kehPingInfo::pop_sent()
 {
-   float ret = -1.0f;
-   if (m_signature == sig)
+   m_sent_first = (m_sent_first + 1) % MAX_PENDING;
+   m_sent_count--;
+}
+
+
+void kehPingInfo::on_snapshot_sent(uint32_t sig)
+{
+   if (m_sent_count == MAX_PENDING)
    {
-      // Obtain the amount of time and convert to milliseconds
-      m_last_ping = (PING_TIMEOUT - m_timeout->get_time_left()) * 1000.0f;
-      ret = m_last_ping;
-      m_timeout->stop();
-      m_interval->start();
+      // No answer for a long time. Assume the oldest snapshot has been lost
+      add_loss_sample(true);
+      pop_sent();
    }
 
-   return ret;
+   SentSnapshot& entry = m_sent[(m_sent_first + m_sent_count) % MAX_PENDING];
+   entry.sig = sig;
+   entry.time = OS::get_singleton()->get_ticks_usec();
+   m_sent_count++;
 }
 
 
+bool kehPingInfo::on_snapshot_acked(uint32_t sig, uint64_t recv_time)
+{
+   const uint64_t now = recv_time > 0 ? recv_time : OS::get_singleton()->get_ticks_usec();
+   bool found = false;
+
+   while (m_sent_count > 0 && !found)
+   {
+      const SentSnapshot& entry = m_sent[m_sent_first];
+      if (entry.sig > sig)
+      {
+         // Acknowledgement of a snapshot that is not pending anymore (duplicated or arrived too late)
+         break;
+      }
+
+      found = entry.sig == sig;
+      if (found)
+      {
+         const float sample = float(now - entry.time) / 1000.0f;
+
+         if (!m_has_sample)
+         {
+            m_srtt = sample;
+            m_rttvar = sample * 0.5f;
+            m_has_sample = true;
+         }
+         else
+         {
+            m_rttvar += (Math::abs(m_srtt - sample) - m_rttvar) * RTT_BETA;
+            m_srtt += (sample - m_srtt) * RTT_ALPHA;
+            m_jitter += (Math::abs(sample - m_last_sample) - m_jitter) * JITTER_GAIN;
+         }
+
+         m_last_sample = sample;
+      }
+
+      // Older snapshots without acknowledgement are considered lost
+      add_loss_sample(!found);
+      pop_sent();
+   }
 
+   if (found && now - m_last_report >= uint64_t(REPORT_INTERVAL * 1000000.0f))
+   {
+      m_last_report = now;
+      return true;
+   }
 
-void kehPingInfo::request_ping(uint32_t pid)
-{
-   m_signature += 1;
-   m_interval->stop();
-   m_timeout->start();
-   m_parent->rpc_unreliable_id(pid, "_client_ping", m_signature, m_last_ping);
+   return false;
 }
 
-void kehPingInfo::on_ping_timeout(uint32_t pid)
-{
-   // The last ping request has timed out. No answer received, so assume the packet has been lost
-   m_lost_packets++;
 
-   // Request a new ping - no need to wait through interval since there was already 5 seconds from
-   // the previous request.
-   request_ping(pid);
+void kehPingInfo::set_stats(float rtt, float rttvar, float jitter, float loss)
+{
+   m_srtt = rtt;
+   m_rttvar = rttvar;
+   m_jitter = jitter;
+   m_loss = loss;
+   m_last_sample = rtt;
+   m_has_sample = true;
 }
 
-void kehPingInfo::_bind_methods()
+
+void kehPingInfo::reset()
 {
-   ClassDB::bind_method(D_METHOD("_request_ping", "pid"), &kehPingInfo::request_ping);
-   ClassDB::bind_method(D_METHOD("_on_ping_timeout", "pid"), &kehPingInfo::on_ping_timeout);
+   m_sent_first = 0;
+   m_sent_count = 0;
+   m_has_sample = false;
+   m_last_sample = 0.0f;
+   m_srtt = 0.0f;
+   m_rttvar = 0.0f;
+   m_jitter = 0.0f;
+   m_loss = 0.0f;
+   m_last_report = 0;
 }
 
 
-kehPingInfo::kehPingInfo(uint32_t pid, Node* parent)
+kehPingInfo::kehPingInfo()
 {
-   m_signature = 0;
-   m_lost_packets = 0;
-   m_last_ping = 0.0f;
-   m_parent = parent;
-
-   // This vector will be used to add a payload to the connected functions
-   Vector<Variant> payload;
-   payload.push_back(pid);
-
-   // Initialize the two timers
-   m_interval = memnew(Timer());
-   m_interval->set_wait_time(PING_INTERVAL);
-   m_interval->set_timer_process_mode(Timer::TimerProcessMode::TIMER_PROCESS_IDLE);
-   m_interval->set_name("net_ping_interval");
-   m_interval->connect("timeout", this, "_request_ping", payload);
-
-   m_timeout = memnew(Timer());
-   m_timeout->set_wait_time(PING_TIMEOUT);
-   m_interval->set_timer_process_mode(Timer::TimerProcessMode::TIMER_PROCESS_IDLE);
-   m_interval->set_name("net_ping_timeout");
-   m_interval->connect("timeout", this, "_on_ping_timeout", payload);
-
-   // Timers must be added into the tree otherwise they aren't updated
-   m_parent->add_child(m_interval);
-   m_parent->add_child(m_timeout);
-
-   // Make sure the timeout is stopped while the interval is running
-   m_timeout->stop();
-   m_interval->start();
-}
\ No newline at end of file
+   reset();
+}
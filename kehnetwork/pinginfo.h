@@ -35,40 +35,72 @@
 // the other end send it back, check the difference, and do with it as you
 // will."
 //
-// That said, that's basically how the internal ping measurement will occur.
+// That said, that's basically how the internal ping measurement will occur. However instead of sending
+// dedicated ping requests, the snapshots themselves are used. The server knows when each snapshot was sent
+// to a client and the client acknowledges every received snapshot, so the time between sending and receiving
+// the acknowledgement gives a round trip time sample. Snapshots that are never acknowledged are counted as
+// lost. From those samples smoothed RTT and variance (as in RFC 6298), jitter (as in RFC 3550) and packet
+// loss rate are calculated.
 
 #ifndef _KEHNETWORK_PINGINFO_H
 #define _KEHNETWORK_PINGINFO_H 1
 
-#include "scene/main/node.h"
-#include "scene/main/timer.h"
+#include "core/reference.h"
 
 class kehPingInfo : public Reference
 {
    GDCLASS(kehPingInfo, Reference)
 private:
-   static const float PING_INTERVAL;
-   static const float PING_TIMEOUT;
+   // Maximum number of snapshots waiting for acknowledgement. If more than this are sent without answer then
+   // the oldest ones are considered lost
+   static const uint32_t MAX_PENDING = 64;
+   // Minimum interval, in seconds, between reporting the measured values
+   static const float REPORT_INTERVAL;
 
-   Timer* m_interval;              // Timer to control interval between ping requests
-   Timer* m_timeout;               // Timer to control ping timeouts
-   uint32_t m_signature;           // Signature of the ping request
-   uint32_t m_lost_packets;        // Number of packets considered lost
-   float m_last_ping;              // Last measured ping, in milliseconds
-   Node* m_parent;                 // Node to hold the timers and remote functions. It should be a kehPlayerNode
+   struct SentSnapshot
+   {
+      uint32_t sig;
+      uint64_t time;       // In microseconds
+   };
 
-private:
-   void request_ping(uint32_t pid);
+   SentSnapshot m_sent[MAX_PENDING];  // Ring buffer of snapshots waiting for acknowledgement, ordered by signature
+   uint32_t m_sent_first;             // Index of the oldest entry in the ring buffer
+   uint32_t m_sent_count;             // Number of entries in the ring buffer
 
-   void on_ping_timeout(uint32_t pid);
+   bool m_has_sample;              // False until the first RTT sample is taken
+   float m_last_sample;            // Last RTT sample, in milliseconds
+   float m_srtt;                   // Smoothed round trip time, in milliseconds
+   float m_rttvar;                 // Round trip time variance, in milliseconds
+   float m_jitter;                 // Interarrival jitter, in milliseconds
+   float m_loss;                   // Packet loss rate, from 0 to 1
+   uint64_t m_last_report;         // Time, in microseconds, of the last report
 
-protected:
-   static void _bind_methods();
+private:
+   void add_loss_sample(bool lost);
+   void pop_sent();
 
 public:
-   float calculate_and_restart(uint32_t sig);
+   // Must be called by the server whenever a snapshot is sent to the client
+   void on_snapshot_sent(uint32_t sig);
+
+   // Must be called by the server when the client acknowledges a snapshot. Returns true if the measured values
+   // should be reported, which happens at most once every REPORT_INTERVAL.
+   // If the time (in microseconds) in which the acknowledgement arrived is known, it should be given through
+   // recv_time. Otherwise the current time is used.
+   bool on_snapshot_acked(uint32_t sig, uint64_t recv_time = 0);
+
+   // Clients don't measure anything, the values are given by the server
+   void set_stats(float rtt, float rttvar, float jitter, float loss);
+
+   float get_rtt() const { return m_srtt; }
+   float get_rtt_variance() const { return m_rttvar; }
+   float get_jitter() const { return m_jitter; }
+   float get_packet_loss() const { return m_loss; }
+   float get_last_sample() const { return m_last_sample; }
+
+   void reset();
 
-   kehPingInfo(uint32_t pid, Node* parent);
+   kehPingInfo();
 };
 
 
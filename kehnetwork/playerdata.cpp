@@ -93,6 +93,22 @@ kehPlayerNode* kehPlayerData::get_pnode(uint32_t pid) const
 void kehPlayerData::add_custom_property(const String& pname, const Variant& default_value, kehCustomProperty::ReplicationMode mode)
 {
    Ref<kehCustomProperty> prop = Ref<kehCustomProperty>(memnew(kehCustomProperty(default_value, mode)));
+   prop->set_name(pname);
+
+   // If the property is being registered again, keep its ID
+   const Map<String, Ref<kehCustomProperty>>::Element* existing = m_custom_property.find(pname);
+   uint32_t id = existing ? existing->value()->get_id() : kehCustomProperty::INVALID_ID;
+   if (id == kehCustomProperty::INVALID_ID)
+   {
+      id = m_custom_id.size();
+      m_custom_id.push_back(prop);
+   }
+   else
+   {
+      m_custom_id.set(id, prop);
+   }
+   prop->set_id(id);
+
    m_custom_property[pname] = prop;
 
    // Add this property to the local player
@@ -122,6 +138,59 @@ void kehPlayerData::set_custom_property(const String& pname, const Variant& valu
    }
 }
 
+PoolStringArray kehPlayerData::get_custom_prop_table() const
+{
+   PoolStringArray ret;
+   ret.resize(m_custom_id.size());
+   for (int i = 0; i < m_custom_id.size(); i++)
+   {
+      ret.set(i, m_custom_id[i].is_valid() ? m_custom_id[i]->get_name() : "");
+   }
+
+   return ret;
+}
+
+
+void kehPlayerData::apply_custom_prop_table(const PoolStringArray& table)
+{
+   for (Map<String, Ref<kehCustomProperty>>::Element* e = m_custom_property.front(); e; e = e->next())
+   {
+      e->value()->set_id(kehCustomProperty::INVALID_ID);
+   }
+
+   m_custom_id.clear();
+   m_custom_id.resize(table.size());
+
+   for (int i = 0; i < table.size(); i++)
+   {
+      Map<String, Ref<kehCustomProperty>>::Element* e = m_custom_property.find(table[i]);
+      if (!e)
+      {
+         if (!table[i].empty())
+            WARN_PRINT(vformat("Custom property '%s' exists on the server but is not registered locally.", table[i]));
+         
+         continue;
+      }
+
+      e->value()->set_id(i);
+      m_custom_id.set(i, e->value());
+   }
+
+   for (Map<String, Ref<kehCustomProperty>>::Element* e = m_custom_property.front(); e; e = e->next())
+   {
+      if (e->value()->get_id() == kehCustomProperty::INVALID_ID)
+         WARN_PRINT(vformat("Custom property '%s' is not registered on the server and will not be replicated.", e->key()));
+   }
+
+   // Player nodes hold copies of the properties, so update their IDs too
+   m_local_player->rebuild_custom_ids(m_custom_property);
+   for (Map<uint32_t, kehPlayerNode*>::Element* e = m_remote_player.front(); e; e = e->next())
+   {
+      e->value()->rebuild_custom_ids(m_custom_property);
+   }
+}
+
+
 Variant kehPlayerData::get_custom_property(const String& pname, const Variant& defval) const
 {
    return m_local_player->get_custom_property(pname, defval);
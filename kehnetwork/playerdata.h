@@ -50,6 +50,9 @@ private:
    // This also have a secondary use: since it will always hold the initial value it will server to determine the
    // expected value type when encoding and decoding.
    Map<String, Ref<kehCustomProperty>> m_custom_property;
+   // The same registered properties, indexed by their numeric IDs. IDs are given in registration order but when
+   // joining a server the table sent by it replaces those, ensuring all machines agree on the IDs.
+   Vector<Ref<kehCustomProperty>> m_custom_id;
 
 
    // This will be used to hold the actual function that will emit a signal whenever a new ping value arrives.
@@ -57,7 +60,7 @@ private:
    kehFunctoid<void(uint32_t, float)> m_ping_signaler;
 
    kehFunctoid<void(uint32_t, const String&, const Variant&)> m_cprop_signaler;
-   kehFunctoid<void(const String&, const Variant&)> m_cprop_broadcaster;
+   kehFunctoid<void(uint32_t, const Variant&)> m_cprop_broadcaster;
 
 private:
    // This helper function is meant to create player node, set everything that is necessary and return the pointer.
@@ -72,10 +75,19 @@ public:
    // Signaler setters
    void set_ping_signaler(const kehFunctoid<void(uint32_t, float)>& functoid) { m_ping_signaler = functoid; }
    void set_cprop_signaler(const kehFunctoid<void(uint32_t, const String&, const Variant&)>& functoid) { m_cprop_signaler = functoid; }
-   void set_cprop_broadcaster(const kehFunctoid<void(const String&, const Variant&)>& functoid) { m_cprop_broadcaster = functoid; }
+   void set_cprop_broadcaster(const kehFunctoid<void(uint32_t, const Variant&)>& functoid) { m_cprop_broadcaster = functoid; }
 
 
    const Map<String, Ref<kehCustomProperty>>& get_custom_props() const { return m_custom_property; }
+   const Vector<Ref<kehCustomProperty>>& get_custom_props_by_id() const { return m_custom_id; }
+
+   // Obtain the names of the registered custom properties, where the index corresponds to the ID. The server sends
+   // this to clients when accepting the connection
+   PoolStringArray get_custom_prop_table() const;
+   // Assign custom property IDs based on the given table (as returned by get_custom_prop_table())
+   void apply_custom_prop_table(const PoolStringArray& table);
+
+   const kehInputInfo* get_input_info() const { return &m_input_info; }
 
    kehPlayerNode* create_local_player();
    kehPlayerNode* get_local_player() const { return m_local_player; }
@@ -25,10 +25,12 @@
 #include "inputinfo.h"
 #include "inputdata.h"
 #include "pinginfo.h"
+#include "profiler.h"
 
 #include "../kehgeneral/encdecbuffer.h"
 
 #include "core/os/input.h"
+#include "core/project_settings.h"
 
 
 
@@ -43,6 +45,8 @@ void kehPlayerNode::set_id(uint32_t pid)
 void kehPlayerNode::reset_data()
 {
    m_input_cache.reset();
+   m_input_tick = 0;
+   m_last_sent_sig = 0;
 }
 
 
@@ -66,6 +70,12 @@ Ref<kehInputData> kehPlayerNode::get_input(uint32_t snapsig)
          // Input will be sent to the server when the snapshot is finished. This gives some chance for
          // any custom input to be correctly set before dispatching the data.
       }
+      else
+      {
+         // Nothing else will need this object after the game code is done with it. The pool will only
+         // hand it out again when there are no other references to it.
+         m_input_info->recycle(ret);
+      }
    }
    else
    {
@@ -75,7 +85,7 @@ Ref<kehInputData> kehPlayerNode::get_input(uint32_t snapsig)
          return ret;
       
       // Running on server but requiring data for a client. Must retrieve the data from the input cache.
-      ret = m_input_cache.get_client_input();
+      ret = m_input_cache.get_client_input(snapsig, m_input_info);
 
       if (!ret.is_valid() || ret.is_null())
       {
@@ -85,6 +95,9 @@ Ref<kehInputData> kehPlayerNode::get_input(uint32_t snapsig)
       
       // Associate the used input with the snapshot signature. This will be needed later
       m_input_cache.associate(snapsig, ret->get_signature());
+
+      // The input object itself is not needed anymore after the game code is done with it
+      m_input_info->recycle(ret);
    }
 
    return ret;
@@ -102,21 +115,15 @@ void kehPlayerNode::dispatch_input_data()
    // Prepare the EncDecBuffer to encode input data
    m_encdec->set_buffer(PoolByteArray());
 
-   const uint32_t csize = m_input_cache.get_cache_size();
-
-   // Encode buffer size (that is, how many input objects are there). Using two bytes should
-   // give plenty of packet loss time
-   m_encdec->write_ushort(csize);
-
-   for (uint32_t i = 0; i < csize; i++)
-   {
-      Ref<kehInputData> idata = m_input_cache.get_input_data(i);
-      m_input_info->encode_to(m_encdec, idata);
-   }
+   m_input_cache.encode_local(m_encdec, m_input_info);
 
    // Send the encoded data to the server - this should go directly to the correct player node
    // within the server
-   rpc_unreliable_id(1, "_server_receive_input", m_encdec->get_buffer());
+   const PoolByteArray encoded = m_encdec->get_buffer();
+   if (kehNetProfiler* profiler = kehNetProfiler::get_singleton())
+      profiler->on_sent(1, kehNetProfiler::MSG_Input, encoded.size());
+   
+   rpc_unreliable_id(1, "_server_receive_input", encoded);
 }
 
 
@@ -133,7 +140,7 @@ void kehPlayerNode::client_acknowledge_input(uint32_t isig)
    SceneTree* st = SceneTree::get_singleton();
    ERR_FAIL_COND_MSG(!st->has_network_peer() && !st->is_network_server(), "Trying to acknowledge input data but this is not a client.");
 
-   m_input_cache.clear_older(isig);
+   m_input_cache.clear_older(isig, m_input_info);
 }
 
 
@@ -142,13 +149,143 @@ void kehPlayerNode::start_ping()
    SceneTree* st = SceneTree::get_singleton();
    ERR_FAIL_COND_MSG(!st->has_network_peer() && !st->is_network_server(), "Starting the ping system is meant to be run only on servers.");
 
-   m_ping = Ref<kehPingInfo>(memnew(kehPingInfo(m_net_id, this)));
+   m_ping->reset();
+}
+
+
+void kehPlayerNode::on_snapshot_sent(uint32_t sig, uint32_t bytes)
+{
+   m_ping->on_snapshot_sent(sig);
+
+   m_last_sent_sig = sig;
+   m_avg_snap_size = m_avg_snap_size > 0.0f ? Math::lerp(m_avg_snap_size, (float)bytes, 0.1f) : bytes;
+}
+
+
+uint32_t kehPlayerNode::get_send_interval(uint32_t base_interval, float tick_rate) const
+{
+   uint32_t ret = base_interval;
+
+   if (m_send_rate > 0 && tick_rate > 0.0f)
+   {
+      ret = MAX(1, (uint32_t)Math::round(tick_rate / m_send_rate));
+   }
+
+   if (m_bandwidth_limit > 0 && m_avg_snap_size > 0.0f)
+   {
+      // Average amount of ticks necessary to "earn" enough bytes to send a snapshot of the usual size
+      const uint32_t bw_interval = (uint32_t)Math::ceil(m_avg_snap_size * tick_rate / m_bandwidth_limit);
+      ret = MAX(ret, bw_interval);
+   }
+
+   return ret;
+}
+
+
+void kehPlayerNode::server_acknowledge_snapshot(uint32_t sig, uint64_t recv_time)
+{
+   m_input_cache.acknowledge(sig);
+
+   if (m_ping->on_snapshot_acked(sig, recv_time))
+   {
+      report_ping();
+   }
+}
+
+
+float kehPlayerNode::get_rtt() const
+{
+   return m_ping->get_rtt();
+}
+
+float kehPlayerNode::get_rtt_variance() const
+{
+   return m_ping->get_rtt_variance();
+}
+
+float kehPlayerNode::get_jitter() const
+{
+   return m_ping->get_jitter();
+}
+
+float kehPlayerNode::get_packet_loss() const
+{
+   return m_ping->get_packet_loss();
+}
+
+
+void kehPlayerNode::set_dirty_bit(uint32_t id)
+{
+   if (id == kehCustomProperty::INVALID_ID)
+      return;
+   
+   const int word = id >> 5;
+   if (word >= m_custom_dirty.size())
+   {
+      const int old_size = m_custom_dirty.size();
+      m_custom_dirty.resize(word + 1);
+      for (int i = old_size; i <= word; i++)
+      {
+         m_custom_dirty.set(i, 0);
+      }
+   }
+
+   m_custom_dirty.set(word, m_custom_dirty[word] | (1u << (id & 31)));
 }
 
 
 void kehPlayerNode::add_custom_property(const String& pname, const Ref<kehCustomProperty>& prop)
 {
-   m_custom_data[pname] = Ref<kehCustomProperty>(memnew(kehCustomProperty(prop->get_value(), prop->get_mode())));
+   Ref<kehCustomProperty> cprop = Ref<kehCustomProperty>(memnew(kehCustomProperty(prop->get_value(), prop->get_mode())));
+   cprop->set_name(pname);
+   cprop->set_id(prop->get_id());
+   m_custom_data[pname] = cprop;
+
+   const uint32_t id = cprop->get_id();
+   if (id != kehCustomProperty::INVALID_ID)
+   {
+      if (id >= (uint32_t)m_custom_id.size())
+         m_custom_id.resize(id + 1);
+      
+      m_custom_id.set(id, cprop);
+   }
+}
+
+
+void kehPlayerNode::rebuild_custom_ids(const Map<String, Ref<kehCustomProperty>>& props)
+{
+   m_custom_id.clear();
+   m_custom_dirty.clear();
+
+   for (Map<String, Ref<kehCustomProperty>>::Element* cprop = m_custom_data.front(); cprop; cprop = cprop->next())
+   {
+      const Map<String, Ref<kehCustomProperty>>::Element* reg = props.find(cprop->key());
+      const uint32_t id = reg ? reg->value()->get_id() : kehCustomProperty::INVALID_ID;
+      cprop->value()->set_id(id);
+
+      if (id == kehCustomProperty::INVALID_ID)
+         continue;
+      
+      if (id >= (uint32_t)m_custom_id.size())
+         m_custom_id.resize(id + 1);
+      
+      m_custom_id.set(id, cprop->value());
+
+      if (cprop->value()->is_dirty())
+         set_dirty_bit(id);
+   }
+}
+
+
+bool kehPlayerNode::has_dirty_custom_prop() const
+{
+   for (int i = 0; i < m_custom_dirty.size(); i++)
+   {
+      if (m_custom_dirty[i] != 0)
+         return true;
+   }
+
+   return false;
 }
 
 
@@ -160,23 +297,23 @@ void kehPlayerNode::set_custom_property(const String& pname, const Variant& valu
       e->value()->set_value(value);
       if (e->value()->is_dirty())
       {
-         m_custom_prop_dirty_count++;
+         set_dirty_bit(e->value()->get_id());
       }
    }
    // NOTE: should this error out if the custom property does not exist?
 }
 
 
-void kehPlayerNode::remote_set_custom_property(const String& pname, const Variant& value)
+void kehPlayerNode::remote_set_custom_property(uint32_t id, const Variant& value)
 {
-   Map<String, Ref<kehCustomProperty>>::Element* prop = m_custom_data.find(pname);
-   if (prop)
-   {
-      prop->value()->set_value(value);
+   if (id >= (uint32_t)m_custom_id.size() || m_custom_id[id].is_null())
+      return;
+   
+   Ref<kehCustomProperty> prop = m_custom_id[id];
+   prop->set_value(value);
 
-      if (m_custom_prop_signaler.is_valid())
-         m_custom_prop_signaler(m_net_id, pname, value);
-   }
+   if (m_custom_prop_signaler.is_valid())
+      m_custom_prop_signaler(m_net_id, prop->get_name(), value);
 }
 
 
@@ -187,9 +324,9 @@ Variant kehPlayerNode::get_custom_property(const String& pname, const Variant& d
 }
 
 
-bool kehPlayerNode::encode_custom_props(Ref<kehEncDecBuffer>& into, const Map<String, Ref<kehCustomProperty>>& props, bool is_authority, bool force_nd)
+bool kehPlayerNode::encode_custom_props(Ref<kehEncDecBuffer>& into, const Vector<Ref<kehCustomProperty>>& props, bool is_authority, bool force_nd)
 {
-   if (!has_dirty_custom_prop())
+   if (!force_nd && !has_dirty_custom_prop())
       return false;
    
    into->set_buffer(PoolByteArray());
@@ -203,52 +340,74 @@ bool kehPlayerNode::encode_custom_props(Ref<kehEncDecBuffer>& into, const Map<St
    
    uint32_t encoded_props = 0;
 
-   // NOTE:
-   // In theory both the "reference properties" map and the "local map" should have the exact same layout, only
-   // holding different values. This means that it would be possible to have two iterators (one for each map)
-   // pointing to the exact same property name. For now just making the straightforward and process that is
-   // sure to work. IF this hit performance then change the iteration method here.
-   for (Map<String, Ref<kehCustomProperty>>::Element* cprop = m_custom_data.front(); cprop; cprop = cprop->next())
+   // Property IDs are encoded as a single byte unless there are more than 256 registered properties
+   const bool wide_id = props.size() > 256;
+   const uint32_t pcount = MIN(props.size(), m_custom_id.size());
+   const int wcount = force_nd ? (pcount + 31) >> 5 : m_custom_dirty.size();
+
+   for (int w = 0; w < wcount && encoded_props < 255; w++)
    {
-      if (cprop->value()->get_mode() == kehCustomProperty::ReplicationMode::ServerOnly && is_authority)
+      // Bits that are cleared from this word are the ones that have been dealt with
+      uint32_t bits = force_nd ? 0xFFFFFFFF : m_custom_dirty[w];
+      uint32_t remaining = bits;
+
+      for (uint32_t b = 0; b < 32 && bits != 0 && encoded_props < 255; b++)
       {
-         // The property is meant to be "server only" and the code is already running on the server. Ensure the
-         // property is not dirty and don't encode it.
-         cprop->value()->clear_dirt();
-         continue;
-      }
+         const uint32_t mask = 1u << b;
+         if (!(bits & mask))
+            continue;
+         
+         bits &= ~mask;
+         remaining &= ~mask;
+
+         const uint32_t id = (w << 5) + b;
+         if (id >= pcount || m_custom_id[id].is_null() || props[id].is_null())
+            continue;
+         
+         Ref<kehCustomProperty> cprop = m_custom_id[id];
+
+         if (cprop->get_mode() == kehCustomProperty::ReplicationMode::ServerOnly && is_authority)
+         {
+            // The property is meant to be "server only" and the code is already running on the server. Ensure the
+            // property is not dirty and don't encode it.
+            cprop->clear_dirt();
+            continue;
+         }
 
-      // Get the type of the reference value. In here relying on the fact that both maps **should** have the
-      // property key, only potentially holding different property values.
-      const uint32_t reftype = props.find(cprop->key())->value()->get_value().get_type();
+         // Get the type of the reference value
+         const uint32_t reftype = props[id]->get_value().get_type();
 
-      // And the type of the actual stored value. If they are different then push a warning telling about the problem
-      // Also, leave the replication to the check_replication() function if the property is dirty
-      const uint32_t stype = cprop->value()->get_value().get_type();
-      
-      if (reftype == stype && cprop->value()->encode_to(into, cprop->key(), stype, force_nd))
-      {
-         // If here the property was encoded - that means, it is of a supported type and was dirty. Update the encoded counter
-         encoded_props++;
-      }
-      else if (cprop->value()->is_dirty() || force_nd)
-      {
-         if (reftype != stype)
+         // And the type of the actual stored value. If they are different then push a warning telling about the problem
+         // Also, leave the replication to the check_replication() function if the property is dirty
+         const uint32_t stype = cprop->get_value().get_type();
+
+         if (reftype == stype && kehCustomProperty::is_encodable(stype) && (cprop->is_dirty() || force_nd))
          {
-            // This extra check is mostly to output a warning telling about the fact that a custom property will be
-            // replicated but its expected type does not match
-            WARN_PRINT(vformat("Replication of custom property '%s' mismatched value type. Replicating the property in a different packet.", cprop->key()));            
+            if (wide_id)
+               into->write_ushort(id);
+            else
+               into->write_byte(id);
+            
+            cprop->encode_to(into, stype, force_nd);
+            encoded_props++;
          }
+         else if (cprop->is_dirty() || force_nd)
+         {
+            if (reftype != stype)
+            {
+               // This extra check is mostly to output a warning telling about the fact that a custom property will be
+               // replicated but its expected type does not match
+               WARN_PRINT(vformat("Replication of custom property '%s' mismatched value type. Replicating the property in a different packet.", cprop->get_name()));
+            }
 
-         check_replication(cprop->key(), cprop->value(), is_authority);
+            check_replication(cprop, is_authority);
+         }
       }
 
-      if (encoded_props == 255)
-      {
-         // Do not allow encoding go past 255 properties. Yet, with this system any property that still need to be synchronized
-         // will be dispatched on the next loop iteration.
-         break;
-      }
+      // Bits not visited because of the 255 limit remain set, so those properties will be dealt with on the next
+      // loop iteration
+      if (!force_nd)
+         m_custom_dirty.set(w, remaining);
    }
 
    if (encoded_props > 0)
@@ -261,49 +420,50 @@ bool kehPlayerNode::encode_custom_props(Ref<kehEncDecBuffer>& into, const Map<St
 }
 
 
-void kehPlayerNode::decode_custom_props(Ref<kehEncDecBuffer>& from, const Map<String, Ref<kehCustomProperty>>& props, bool is_authority)
+void kehPlayerNode::decode_custom_props(Ref<kehEncDecBuffer>& from, const Vector<Ref<kehCustomProperty>>& props, bool is_authority)
 {
    const uint32_t ecount = from->read_byte();
+   const bool wide_id = props.size() > 256;
 
    for (uint32_t i = 0; i < ecount; i++)
    {
-      const String pname = from->read_string();
+      const uint32_t id = wide_id ? from->read_ushort() : from->read_byte();
 
-      const Map<String, Ref<kehCustomProperty>>::Element* pref = props.find(pname);
-      if (!pref)
+      if (id >= (uint32_t)props.size() || props[id].is_null())
       {
          // Should this error out?
          return;
       }
 
-      Map<String, Ref<kehCustomProperty>>::Element* stored = m_custom_data.find(pname);
-      if (!stored)
+      if (id >= (uint32_t)m_custom_id.size() || m_custom_id[id].is_null())
       {
          // Should this error out?
          return;
       }
 
+      Ref<kehCustomProperty> stored = m_custom_id[id];
+
       // Decode the property, making it dirty if in server. This will allow the property to be verified
       // during the loop iteration and broadcast it if necessary.
-      if (stored->value()->decode_from(from, pref->value()->get_value().get_type(), is_authority))
+      if (stored->decode_from(from, props[id]->get_value().get_type(), is_authority))
       {
          // Allow the "core" of the networking system to emit a signal indicating that a custom property
          // has been changed through synchronization
          if (m_custom_prop_signaler.is_valid())
-            m_custom_prop_signaler(m_net_id, pname, stored->value()->get_value());
+            m_custom_prop_signaler(m_net_id, stored->get_name(), stored->get_value());
       }
       else
       {
          return;
       }
       
-      if (stored->value()->is_dirty())
-         m_custom_prop_dirty_count++;
+      if (stored->is_dirty())
+         set_dirty_bit(id);
    }
 }
 
 
-void kehPlayerNode::check_replication(const String& pname, Ref<kehCustomProperty>& prop, bool is_authority)
+void kehPlayerNode::check_replication(Ref<kehCustomProperty>& prop, bool is_authority)
 {
    switch (prop->get_mode())
    {
@@ -314,7 +474,7 @@ void kehPlayerNode::check_replication(const String& pname, Ref<kehCustomProperty
          // automatically given to the correct player node.
          if (!is_authority)
          {
-            rpc_id(1, "_remote_set_custom_property", pname, prop->get_value());
+            rpc_id(1, "_remote_set_custom_property", prop->get_id(), prop->get_value());
          }
       } break;
 
@@ -325,12 +485,12 @@ void kehPlayerNode::check_replication(const String& pname, Ref<kehCustomProperty
          // to do the broadcasting
          if (is_authority)
          {
-            rpc("_remote_set_custom_property", pname, prop->get_value());
+            rpc("_remote_set_custom_property", prop->get_id(), prop->get_value());
          }
          else
          {
             if (m_custom_prop_broadcast_requester.is_valid())
-               m_custom_prop_broadcast_requester(pname, prop->get_value());
+               m_custom_prop_broadcast_requester(prop->get_id(), prop->get_value());
          }
       } break;
    }
@@ -347,7 +507,8 @@ Ref<kehInputData> kehPlayerNode::poll_input()
 {
    ERR_FAIL_COND_V_MSG(!m_is_local, NULL, "Trying to poll input data from a node not belonging to local player.");
 
-   Ref<kehInputData> ret = memnew(kehInputData(m_input_cache.increment_input()));
+   Ref<kehInputData> ret = m_input_info->create_input(m_input_cache.increment_input());
+   ret->set_tick(m_input_tick);
 
    if (m_input_info->use_mouse_relative() && m_input_enabled)
    {
@@ -401,72 +562,93 @@ void kehPlayerNode::server_receive_input(const PoolByteArray& encoded)
 {
    ERR_FAIL_COND_MSG(!get_tree()->is_network_server(), "");
 
+   kehNetProfileScope scope(kehNetProfiler::SEC_InputDecode, m_net_id);
+   if (kehNetProfiler* profiler = kehNetProfiler::get_singleton())
+      profiler->on_received(m_net_id, kehNetProfiler::MSG_Input, encoded.size());
+
    m_encdec->set_buffer(encoded);
 
+   // Tick the newest input object is meant for
+   const uint32_t newest_tick = m_encdec->read_uint();
+
    // Decode amount of InputData objects within the encoded data
    const uint16_t count = m_encdec->read_ushort();
 
    // Decode each one of the objects
    for (uint16_t i = 0; i < count; i++)
    {
+      const uint8_t tick_offset = m_encdec->read_byte();
       Ref<kehInputData> input = m_input_info->decode_from(m_encdec);
+      input->set_tick(tick_offset != kehInputCache::NO_TICK_OFFSET && newest_tick > tick_offset ? newest_tick - tick_offset : 0);
 
       // If this is newer than the last input signature in the cache, add it into the buffer
       if (input->get_signature() > m_input_cache.get_last_sig())
       {
          m_input_cache.cache_remote_input(input);
       }
+      else
+      {
+         // Already used (or too old) input, most likely a redundant copy
+         m_input_info->recycle(input);
+      }
    }
 }
 
 
-void kehPlayerNode::client_ping(uint32_t sig, float last)
+void kehPlayerNode::client_receive_net_stats(float rtt, float rttvar, float jitter, float loss)
 {
-   // Answer back to the server
-   rpc_unreliable_id(1, "_server_pong", sig);
+   if (kehNetProfiler* profiler = kehNetProfiler::get_singleton())
+      profiler->on_received(1, kehNetProfiler::MSG_NetStats, 4 * sizeof(float));
+
+   m_ping->set_stats(rtt, rttvar, jitter, loss);
 
    // Use the signaler so the kehNetwork singleton node can properly emit the signal indicating
    // that a new measured ping value has arrived.
-   if (sig > 1 && m_ping_signaler.is_valid())
+   if (m_ping_signaler.is_valid())
    {
-      m_ping_signaler(m_net_id, last);
+      m_ping_signaler(m_net_id, rtt);
    }
 }
 
-void kehPlayerNode::server_pong(uint32_t sig)
+void kehPlayerNode::report_ping()
 {
-   // Bail if not the server - this should be an error though
-   if (!SceneTree::get_singleton()->is_network_server())
-      return;
-   
-   // The RPC call arrives at the node corresponding to the player that called it.
-   // This mens that the m_net_id holds teh correct network of the client
-   float measured = m_ping->calculate_and_restart(sig);
-   if (measured >= 0.0f)
+   const float measured = m_ping->get_rtt();
+   kehNetProfiler* profiler = kehNetProfiler::get_singleton();
+
+   // The client owning this node gets the complete statistics
+   if (profiler)
+      profiler->on_sent(m_net_id, kehNetProfiler::MSG_NetStats, 4 * sizeof(float));
+   rpc_unreliable_id(m_net_id, "_client_receive_net_stats", measured, m_ping->get_rtt_variance(), m_ping->get_jitter(), m_ping->get_packet_loss());
+
+   if (m_broadcast_ping)
    {
-      if (m_broadcast_ping)
+      Vector<int> cpeers = SceneTree::get_singleton()->get_network_connected_peers();
+      for (uint32_t i = 0; i < cpeers.size(); i++)
       {
-         Vector<int> cpeers = SceneTree::get_singleton()->get_network_connected_peers();
-         for (uint32_t i = 0; i < cpeers.size(); i++)
+         // Skip the player corresponding to the measured ping
+         if (cpeers[i] != m_net_id)
          {
-            // Skip the player corresponding to the measured ping
-            if (cpeers[i] != m_net_id)
-            {
-               rpc_unreliable_id(cpeers[i], "_client_ping_broadcast", measured);
-            }
+            if (profiler)
+               profiler->on_sent(cpeers[i], kehNetProfiler::MSG_NetStats, sizeof(float));
+            rpc_unreliable_id(cpeers[i], "_client_ping_broadcast", measured);
          }
       }
+   }
 
-      // The server must get a signal with the measured value
-      if (m_ping_signaler.is_valid())
-      {
-         m_ping_signaler(m_net_id, measured);
-      }
+   // The server must get a signal with the measured value
+   if (m_ping_signaler.is_valid())
+   {
+      m_ping_signaler(m_net_id, measured);
    }
 }
 
 void kehPlayerNode::client_ping_broadcast(float value)
 {
+   if (kehNetProfiler* profiler = kehNetProfiler::get_singleton())
+      profiler->on_received(1, kehNetProfiler::MSG_NetStats, sizeof(float));
+
+   m_ping->set_stats(value, 0.0f, 0.0f, 0.0f);
+
    // When this is called it will run on the player node corresponding to the correct player.
    // This means that the m_net_id is properly set for the signal that must be emitted.
    if (m_ping_signaler.is_valid())
@@ -487,8 +669,7 @@ void kehPlayerNode::_notification(int what)
          set_process_input(m_is_local);
 
          rpc_config("_server_receive_input", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
-         rpc_config("_client_ping", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
-         rpc_config("_server_pong", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
+         rpc_config("_client_receive_net_stats", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
          rpc_config("_client_ping_broadcast", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
 
          rpc_config("_remote_set_custom_property", MultiplayerAPI::RPCMode::RPC_MODE_REMOTE);
@@ -517,16 +698,30 @@ void kehPlayerNode::_bind_methods()
    ClassDB::bind_method(D_METHOD("_input", "event"), &kehPlayerNode::_input);
    ClassDB::bind_method(D_METHOD("_server_receive_input", "encoded"), &kehPlayerNode::server_receive_input);
 
-   ClassDB::bind_method(D_METHOD("_client_ping", "sig", "last"), &kehPlayerNode::client_ping);
-   ClassDB::bind_method(D_METHOD("_server_pong", "sig"), &kehPlayerNode::server_pong);
+   ClassDB::bind_method(D_METHOD("_client_receive_net_stats", "rtt", "rttvar", "jitter", "loss"), &kehPlayerNode::client_receive_net_stats);
    ClassDB::bind_method(D_METHOD("_client_ping_broadcast", "value"), &kehPlayerNode::client_ping_broadcast);
 
-   ClassDB::bind_method(D_METHOD("_remote_set_custom_property", "pname", "value"), &kehPlayerNode::remote_set_custom_property);
+   ClassDB::bind_method(D_METHOD("_remote_set_custom_property", "id", "value"), &kehPlayerNode::remote_set_custom_property);
 
    // Bind exposed functions
    ClassDB::bind_method(D_METHOD("get_uid"), &kehPlayerNode::get_id);
    ClassDB::bind_method(D_METHOD("reset_data"), &kehPlayerNode::reset_data);
 
+   ClassDB::bind_method(D_METHOD("set_interest_position", "position"), &kehPlayerNode::set_interest_position);
+   ClassDB::bind_method(D_METHOD("clear_interest_position"), &kehPlayerNode::clear_interest_position);
+
+   ClassDB::bind_method(D_METHOD("get_rtt"), &kehPlayerNode::get_rtt);
+   ClassDB::bind_method(D_METHOD("get_rtt_variance"), &kehPlayerNode::get_rtt_variance);
+   ClassDB::bind_method(D_METHOD("get_jitter"), &kehPlayerNode::get_jitter);
+   ClassDB::bind_method(D_METHOD("get_packet_loss"), &kehPlayerNode::get_packet_loss);
+   ClassDB::bind_method(D_METHOD("get_interest_position"), &kehPlayerNode::get_interest_position);
+   ClassDB::bind_method(D_METHOD("has_interest_position"), &kehPlayerNode::has_interest_position);
+
+   ClassDB::bind_method(D_METHOD("set_send_rate", "rate"), &kehPlayerNode::set_send_rate);
+   ClassDB::bind_method(D_METHOD("get_send_rate"), &kehPlayerNode::get_send_rate);
+   ClassDB::bind_method(D_METHOD("set_bandwidth_limit", "bytes_per_sec"), &kehPlayerNode::set_bandwidth_limit);
+   ClassDB::bind_method(D_METHOD("get_bandwidth_limit"), &kehPlayerNode::get_bandwidth_limit);
+
    ClassDB::bind_method(D_METHOD("set_custom_property", "pname", "value"), &kehPlayerNode::set_custom_property);
    ClassDB::bind_method(D_METHOD("get_custom_property", "pname", "defval"), &kehPlayerNode::get_custom_property, DEFVAL(NULL));
    
@@ -538,9 +733,17 @@ void kehPlayerNode::_bind_methods()
 kehPlayerNode::kehPlayerNode(uint32_t pid, bool is_local, kehInputInfo* input_info) :
    m_is_local(is_local),
    m_is_ready(false),
+   m_input_tick(0),
    m_input_info(input_info),
-   m_custom_prop_dirty_count(0)
+   m_send_rate(0),
+   m_bandwidth_limit(0),
+   m_avg_snap_size(0.0f),
+   m_last_sent_sig(0),
+   m_has_interest(false)
 {
+   m_broadcast_ping = GLOBAL_GET("keh_modules/network/general/broadcast_measured_ping");
+   m_ping = Ref<kehPingInfo>(memnew(kehPingInfo));
+
    // Authority by default
    set_id(pid);
 
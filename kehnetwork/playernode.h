@@ -52,6 +52,10 @@ private:
    // local player)
    bool m_input_enabled;
 
+   // Server tick that polled input objects are meant for. Updated by the network singleton, from the clock
+   // sync, at the beginning of each client tick. 0 while the clock is not synced
+   uint32_t m_input_tick;
+
    // These vectors will be used to cache mouse data through the _input() function.
    // Obviously those will only be used on the local machine
    Vector2 m_mrelative;
@@ -71,21 +75,41 @@ private:
    // from server to all connected clients.
    bool m_broadcast_ping;
 
-   // Created only on servers for remote players, this will control the entire "ping/pong" loop.
+   // Network statistics of this player. On the server these are measured from the snapshot acknowledgements,
+   // while clients receive the values from the server.
    Ref<kehPingInfo> m_ping;
 
+   // Snapshot send rate (in Hz) for this player. If 0 then the global send rate is used. Only meaningful on the server
+   uint32_t m_send_rate;
+   // Maximum amount of bytes per second that should be used to send snapshot data to this player. 0 means unlimited
+   uint32_t m_bandwidth_limit;
+   // Moving average of the encoded snapshot size sent to this player, used to enforce the bandwidth limit
+   float m_avg_snap_size;
+   // Signature of the last snapshot sent to this player
+   uint32_t m_last_sent_sig;
+
+
+   // Position used by the server to filter events that were sent with a relevance radius. Only meaningful on the
+   // server and only when m_has_interest is true.
+   Vector3 m_interest_position;
+   bool m_has_interest;
 
    // Hold the custom properties of this player
    Map<String, Ref<kehCustomProperty>> m_custom_data;
-   // And cache how many dirty properties have been changed and not replicated yet
-   uint32_t m_custom_prop_dirty_count;
+   // The same properties, indexed by their numeric IDs
+   Vector<Ref<kehCustomProperty>> m_custom_id;
+   // Bitset (indexed by property ID) telling which properties have been changed and not replicated yet
+   Vector<uint32_t> m_custom_dirty;
 
 
    kehFunctoid<void(uint32_t, float)> m_ping_signaler;
    kehFunctoid<void(uint32_t, const String&, const Variant&)> m_custom_prop_signaler;
-   kehFunctoid<void(const String&, const Variant&)> m_custom_prop_broadcast_requester;
+   kehFunctoid<void(uint32_t, const Variant&)> m_custom_prop_broadcast_requester;
 
 private:
+   // Flag the custom property with the given ID as dirty
+   void set_dirty_bit(uint32_t id);
+
    // Will be internally called only if this node is belonging to the local player.
    Ref<kehInputData> poll_input();
 
@@ -93,18 +117,17 @@ private:
    // received and decoded to be added into internal cache
    void server_receive_input(const PoolByteArray& encoded);
 
-   // When the interval timer expires, a function will be called and that function will remote call this, which
-   // is meant to be run only on client machines. When this function is executed, it will remote call the "server_pong",
-   // which is basically where the time will be measured
-   void client_ping(uint32_t sig, float last);
-
-   void server_pong(uint32_t sig);
+   // Server will call this on the client owning this node, giving the measured network statistics
+   void client_receive_net_stats(float rtt, float rttvar, float jitter, float loss);
 
    // If the broadcast ping option is enabled then the server will call this function on each client in
    // order to give the measure ping value and allow other clients to display somewhere the player's
    // latency values.
    void client_ping_broadcast(float value);
 
+   // Server side, send the measured values to the clients and emit the ping signal
+   void report_ping();
+
 
 protected:
    void _notification(int what);
@@ -116,7 +139,7 @@ protected:
 public:
    void set_ping_signaler(const kehFunctoid<void(uint32_t, float)>& functoid) { m_ping_signaler = functoid; }
    void set_cprop_signaler(const kehFunctoid<void(uint32_t, const String&, const Variant&)>& functoid) { m_custom_prop_signaler = functoid; }
-   void set_cprop_broadcaster(const kehFunctoid<void(const String&, const Variant&)>& functoid) { m_custom_prop_broadcast_requester = functoid; }
+   void set_cprop_broadcaster(const kehFunctoid<void(uint32_t, const Variant&)>& functoid) { m_custom_prop_broadcast_requester = functoid; }
    
 
    uint32_t get_id() const { return m_net_id; }
@@ -127,6 +150,14 @@ public:
 
    void set_input_enabled(bool enabled) { m_input_enabled = enabled; }
 
+   void set_input_tick(uint32_t tick) { m_input_tick = tick; }
+
+   // Interest position, used by the server when filtering events that should only be sent to nearby peers
+   void set_interest_position(const Vector3& pos) { m_interest_position = pos; m_has_interest = true; }
+   void clear_interest_position() { m_has_interest = false; }
+   const Vector3& get_interest_position() const { return m_interest_position; }
+   bool has_interest_position() const { return m_has_interest; }
+
    void reset_data();
 
    // Obtain input data. If running on the local machine the state will be polled. If on a
@@ -165,44 +196,74 @@ public:
    // This function is meant to be run on servers but not called remotely. Basically when a client receives
    // snapshot data, an answer must be given specifying the signature of the newest received. With this, internal
    // clenaup can be performed and then later only the relevant data can be sent to the client
-   void server_acknowledge_snapshot(uint32_t sig) { m_input_cache.acknowledge(sig); }
+   // This is also where the round trip time is measured.
+   // The receive time (in microseconds) is optional and if 0 the current time is used.
+   void server_acknowledge_snapshot(uint32_t sig, uint64_t recv_time = 0);
 
    /// "ping" system.
-   // This must be called only on servers, which will initialize the entire "ping/pong loop"
+   // This must be called only on servers, which will reset the measured values
    void start_ping();
 
+   // Must be called by the server whenever snapshot data is sent to the client owning this node. The size
+   // of the encoded data is used to keep the bandwidth estimate
+   void on_snapshot_sent(uint32_t sig, uint32_t bytes);
+
+   /// Send rate
+   void set_send_rate(uint32_t rate) { m_send_rate = rate; }
+   uint32_t get_send_rate() const { return m_send_rate; }
+   void set_bandwidth_limit(uint32_t bytes_per_sec) { m_bandwidth_limit = bytes_per_sec; }
+   uint32_t get_bandwidth_limit() const { return m_bandwidth_limit; }
+
+   // Calculate the amount of ticks between each snapshot sent to this player. The base interval corresponds to
+   // the global send rate while the tick rate is the amount of simulation ticks per second
+   uint32_t get_send_interval(uint32_t base_interval, float tick_rate) const;
+
+   // Returns true if, given the send interval, the snapshot with the specified signature should be sent to this player
+   bool is_send_due(uint32_t sig, uint32_t interval) const { return (m_last_sent_sig == 0 || sig >= m_last_sent_sig + interval); }
+
+   // Network statistics. On clients, only the RTT is known for players other than the local one.
+   // Times are in milliseconds while packet loss is in the [0..1] range.
+   float get_rtt() const;
+   float get_rtt_variance() const;
+   float get_jitter() const;
+   float get_packet_loss() const;
+
 
 
    /// Custom property system
    // Add/register a custom property into this player node. Note that a new kehCustomProperty will be created
    void add_custom_property(const String& pname, const Ref<kehCustomProperty>& prop);
 
+   // Take the IDs of the given registered properties, which is necessary after the table given by the
+   // server has been applied.
+   void rebuild_custom_ids(const Map<String, Ref<kehCustomProperty>>& props);
+
    // Returns true if there is any dirty custom property that needs replication
-   bool has_dirty_custom_prop() const { return m_custom_prop_dirty_count > 0; }
+   bool has_dirty_custom_prop() const;
 
    // Exposed to scripting, allows one to set a custom property value
    void set_custom_property(const String& pname, const Variant& value);
 
    // This is meant to set custom property but using remote calls. This should be automatically called based
    // on the replication setting. One thing to note is that this will be called using the reliable channel.
-   void remote_set_custom_property(const String& pname, const Variant& value);
+   void remote_set_custom_property(uint32_t id, const Variant& value);
 
    // Get custom property. If it's not found, return the "defval" instead
    Variant get_custom_property(const String& pname, const Variant& defval = NULL) const;
 
    // Encode the "dirty" supported custom properties into the given EncDecBuffer. If a non supported property is
    // found then it will be directly sent with the check_replication() function.
-   // The props argument here is the map holding the list of registered custom properties holding their initial,
+   // The props argument here is the list (indexed by ID) of registered custom properties holding their initial,
    // values, which are then used to determine the expected value type.
    // Returns true if at least one of the dirty properties is supported by the EncDecBuffer
-   bool encode_custom_props(Ref<kehEncDecBuffer>& into, const Map<String, Ref<kehCustomProperty>>& props, bool is_authority, bool force_nd);
+   bool encode_custom_props(Ref<kehEncDecBuffer>& into, const Vector<Ref<kehCustomProperty>>& props, bool is_authority, bool force_nd);
 
-   void decode_custom_props(Ref<kehEncDecBuffer>& from, const Map<String, Ref<kehCustomProperty>>& props, bool is_authority);
+   void decode_custom_props(Ref<kehEncDecBuffer>& from, const Vector<Ref<kehCustomProperty>>& props, bool is_authority);
 
    // This is used to check a property replication mode and immediately send it through the network outside
    // of the "packed custom properties". This is meant to be used when a custom property is not supported by
    // the EncDecBuffer system OR if the current value type mismatches the initial type.
-   void check_replication(const String& pname, Ref<kehCustomProperty>& prop, bool is_authority);
+   void check_replication(Ref<kehCustomProperty>& prop, bool is_authority);
 
 
 
@@ -0,0 +1,248 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "profiler.h"
+
+#include "core/os/file_access.h"
+
+#include <chrono>
+
+
+namespace
+{
+   const char* s_section_name[kehNetProfiler::SEC_COUNT] = {
+      "tick",
+      "custom_props",
+      "snapshot",
+      "change_mask",
+      "encode",
+      "send",
+      "events",
+      "snapshot_decode",
+      "client_check",
+      "input_decode",
+   };
+
+   const char* s_message_name[kehNetProfiler::MSG_COUNT] = {
+      "full_snapshot",
+      "delta_snapshot",
+      "event",
+      "unreliable_event",
+      "custom_props",
+      "input",
+      "spectator_stream",
+      "ack",
+      "net_stats",
+   };
+}
+
+
+kehNetProfiler* kehNetProfiler::s_singleton = NULL;
+
+
+kehNetProfiler::PeerStats::PeerStats()
+{
+   for (uint32_t i = 0; i < MSG_COUNT; i++)
+   {
+      sent[i] = 0;
+      received[i] = 0;
+   }
+}
+
+
+uint64_t kehNetProfiler::now()
+{
+   // OS::get_ticks_usec() is not precise enough for the smaller sections
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void kehNetProfiler::on_tick_start()
+{
+   if (!m_enabled)
+      return;
+   
+   m_ticks++;
+   m_tick_start = now();
+}
+
+void kehNetProfiler::on_tick_end()
+{
+   if (!m_enabled || m_tick_start == 0)
+      return;
+   
+   add_section(SEC_Tick, 0, m_tick_start, now() - m_tick_start);
+   m_tick_start = 0;
+}
+
+
+void kehNetProfiler::add_section(Section section, uint32_t peer, uint64_t start, uint64_t duration)
+{
+   SectionStats& stats = m_section[section];
+   stats.calls++;
+   stats.total += duration;
+   stats.max = MAX(stats.max, duration);
+
+   if (m_recording)
+   {
+      if ((uint32_t)m_trace.size() >= m_max_trace_events)
+      {
+         m_recording = false;
+         return;
+      }
+
+      TraceEvent evt;
+      evt.section = section;
+      evt.peer = peer;
+      evt.start = start;
+      evt.duration = duration;
+      m_trace.push_back(evt);
+   }
+}
+
+void kehNetProfiler::add_accumulated(Section section, uint64_t calls, uint64_t duration)
+{
+   SectionStats& stats = m_section[section];
+   stats.calls += calls;
+   stats.total += duration;
+}
+
+
+void kehNetProfiler::on_sent(uint32_t peer, Message msg, uint32_t bytes)
+{
+   if (m_enabled)
+      m_peer[peer].sent[msg] += bytes;
+}
+
+void kehNetProfiler::on_received(uint32_t peer, Message msg, uint32_t bytes)
+{
+   if (m_enabled)
+      m_peer[peer].received[msg] += bytes;
+}
+
+
+void kehNetProfiler::start_trace(uint32_t max_events)
+{
+   m_trace.clear();
+   m_max_trace_events = max_events;
+   m_trace_origin = now();
+   m_recording = true;
+}
+
+Error kehNetProfiler::save_trace(const String& path) const
+{
+   Error err;
+   FileAccess* file = FileAccess::open(path, FileAccess::WRITE, &err);
+   ERR_FAIL_COND_V_MSG(!file, err, vformat("Unable to open '%s' to save the network profiling trace.", path));
+
+   file->store_string("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+   const int count = m_trace.size();
+   for (int i = 0; i < count; i++)
+   {
+      const TraceEvent& evt = m_trace[i];
+      // Events recorded before the trace started (tracing restarted within a section) are clamped to the origin
+      const uint64_t start = evt.start > m_trace_origin ? evt.start - m_trace_origin : 0;
+
+      // Chrome trace timestamps are in microseconds
+      String entry = vformat("{\"name\":\"%s\",\"cat\":\"keh_network\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%s,\"dur\":%s",
+            s_section_name[evt.section], String::num_real(double(start) / 1000.0), String::num_real(double(evt.duration) / 1000.0));
+      
+      if (evt.peer != 0)
+         entry += vformat(",\"args\":{\"peer\":%d}", evt.peer);
+      
+      entry += (i < count - 1) ? "},\n" : "}\n";
+      file->store_string(entry);
+   }
+
+   file->store_string("]}\n");
+   file->close();
+   memdelete(file);
+
+   return OK;
+}
+
+
+void kehNetProfiler::reset()
+{
+   m_ticks = 0;
+   m_tick_start = 0;
+
+   for (uint32_t i = 0; i < SEC_COUNT; i++)
+      m_section[i] = SectionStats();
+   
+   m_peer.clear();
+}
+
+
+Dictionary kehNetProfiler::get_stats() const
+{
+   Dictionary sections;
+   for (uint32_t i = 0; i < SEC_COUNT; i++)
+   {
+      const SectionStats& s = m_section[i];
+
+      Dictionary entry;
+      entry["calls"] = s.calls;
+      entry["total_usec"] = double(s.total) / 1000.0;
+      entry["avg_usec"] = s.calls > 0 ? double(s.total) / double(s.calls) / 1000.0 : 0.0;
+      entry["max_usec"] = double(s.max) / 1000.0;
+      entry["usec_per_tick"] = m_ticks > 0 ? double(s.total) / double(m_ticks) / 1000.0 : 0.0;
+      sections[s_section_name[i]] = entry;
+   }
+
+   Dictionary peers;
+   for (const Map<uint32_t, PeerStats>::Element* p = m_peer.front(); p; p = p->next())
+   {
+      Dictionary sent;
+      Dictionary received;
+      for (uint32_t i = 0; i < MSG_COUNT; i++)
+      {
+         sent[s_message_name[i]] = p->value().sent[i];
+         received[s_message_name[i]] = p->value().received[i];
+      }
+
+      Dictionary entry;
+      entry["sent"] = sent;
+      entry["received"] = received;
+      peers[p->key()] = entry;
+   }
+
+   Dictionary ret;
+   ret["enabled"] = m_enabled;
+   ret["ticks"] = m_ticks;
+   ret["sections"] = sections;
+   ret["peers"] = peers;
+   ret["trace_events"] = m_trace.size();
+
+   return ret;
+}
+
+
+kehNetProfiler::kehNetProfiler()
+{
+   m_enabled = false;
+   m_recording = false;
+   m_max_trace_events = 0;
+   m_trace_origin = 0;
+   reset();
+}
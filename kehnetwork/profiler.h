@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_PROFILER_H
+#define _KEHNETWORK_PROFILER_H 1
+
+// Instrumentation of the networking system. When enabled, the time spent within the relevant sections of each
+// tick (custom property checking, snapshot encoding and sending per client, event dispatching, snapshot
+// decoding and checking, input decoding) is accumulated, as well as the bytes of each message type sent to or
+// received from each peer. Optionally the timed sections can also be recorded into a timeline that can be saved
+// in the Chrome trace format (chrome://tracing or https://ui.perfetto.dev).
+// When disabled, the cost is a single check per instrumented section.
+
+#include "core/dictionary.h"
+#include "core/map.h"
+#include "core/vector.h"
+
+
+class kehNetProfiler
+{
+public:
+   enum Section
+   {
+      SEC_Tick,                  // From init_snapshot() up to the end of the snapshot finishing
+      SEC_CustomProps,           // Checking, encoding and sending custom properties
+      SEC_Snapshot,              // Server, handling the finished snapshot for all clients
+      SEC_ChangeMask,            // Server, calculating change masks while encoding delta snapshots
+      SEC_Encode,                // Server, encoding a snapshot for one client (includes change mask)
+      SEC_Send,                  // Server, sending encoded snapshot to one client
+      SEC_Events,                // Server, calling event handlers then encoding and sending events
+      SEC_SnapshotDecode,        // Client, decoding incoming snapshots
+      SEC_ClientCheck,           // Client, comparing incoming snapshot with the predicted one
+      SEC_InputDecode,           // Server, decoding incoming input data
+
+      SEC_COUNT
+   };
+
+   enum Message
+   {
+      MSG_FullSnapshot,
+      MSG_DeltaSnapshot,
+      MSG_Event,
+      MSG_UnreliableEvent,
+      MSG_CustomProps,
+      MSG_Input,
+      MSG_SpectatorStream,
+      MSG_Ack,                   // Snapshot acknowledgements, which are also the ping measurements
+      MSG_NetStats,              // Measured network statistics sent by the server, including the ping broadcast
+
+      MSG_COUNT
+   };
+
+   // Keeps track of timed sections, in nanoseconds
+   struct SectionStats
+   {
+      uint64_t calls;
+      uint64_t total;
+      uint64_t max;
+
+      SectionStats() : calls(0), total(0), max(0) {}
+   };
+
+   struct PeerStats
+   {
+      uint64_t sent[MSG_COUNT];
+      uint64_t received[MSG_COUNT];
+
+      PeerStats();
+   };
+
+   // An entry in the recorded timeline
+   struct TraceEvent
+   {
+      uint8_t section;
+      uint32_t peer;
+      uint64_t start;
+      uint64_t duration;
+   };
+
+private:
+   static kehNetProfiler* s_singleton;
+
+   bool m_enabled;
+
+   uint64_t m_ticks;
+   uint64_t m_tick_start;
+
+   SectionStats m_section[SEC_COUNT];
+   Map<uint32_t, PeerStats> m_peer;
+
+   // Timeline recording. Once max events is reached recording stops
+   bool m_recording;
+   uint32_t m_max_trace_events;
+   Vector<TraceEvent> m_trace;
+   // Timestamps in the trace are relative to this
+   uint64_t m_trace_origin;
+
+public:
+   // Current time, in nanoseconds
+   static uint64_t now();
+
+   // The instance owned by the kehNetwork singleton
+   static kehNetProfiler* get_singleton() { return s_singleton; }
+   static void set_singleton(kehNetProfiler* profiler) { s_singleton = profiler; }
+
+   void set_enabled(bool enabled) { m_enabled = enabled; }
+   bool is_enabled() const { return m_enabled; }
+
+   void on_tick_start();
+   void on_tick_end();
+
+   // Add a timed section. Start is given so the section can be placed in the timeline. Peer is 0 when the section
+   // is not related to a specific peer
+   void add_section(Section section, uint32_t peer, uint64_t start, uint64_t duration);
+   // Add time that was accumulated from several small pieces, so there is no meaningful placement in the timeline.
+   // Only the total of the batch is known, so the max of the section is not updated
+   void add_accumulated(Section section, uint64_t calls, uint64_t duration);
+
+   void on_sent(uint32_t peer, Message msg, uint32_t bytes);
+   void on_received(uint32_t peer, Message msg, uint32_t bytes);
+
+   void start_trace(uint32_t max_events);
+   void stop_trace() { m_recording = false; }
+   bool is_tracing() const { return m_recording; }
+   // Write the recorded timeline into the given file, in the Chrome trace event format
+   Error save_trace(const String& path) const;
+
+   void reset();
+
+   Dictionary get_stats() const;
+
+   kehNetProfiler();
+};
+
+
+// Times the enclosing scope, if the profiler is enabled
+class kehNetProfileScope
+{
+private:
+   kehNetProfiler* m_profiler;
+   kehNetProfiler::Section m_section;
+   uint32_t m_peer;
+   uint64_t m_start;
+
+public:
+   kehNetProfileScope(kehNetProfiler::Section section, uint32_t peer = 0) :
+      m_profiler(NULL), m_section(section), m_peer(peer), m_start(0)
+   {
+      kehNetProfiler* profiler = kehNetProfiler::get_singleton();
+      if (profiler && profiler->is_enabled())
+      {
+         m_profiler = profiler;
+         m_start = kehNetProfiler::now();
+      }
+   }
+
+   ~kehNetProfileScope()
+   {
+      if (m_profiler)
+         m_profiler->add_section(m_section, m_peer, m_start, kehNetProfiler::now() - m_start);
+   }
+};
+
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "propcomparer.h"
 #include "snapentity.h"
+#include "typedcompare.h"
 
 typedef kehPropComparer::ComparerProxy CProxy;
 
@@ -40,205 +41,33 @@ struct TheComparer : public CProxy
    static Ref<TheComparer> create() { return memnew(TheComparer); }
 };
 
-// Floating point comparer using automatic tolerance calculation, with Math::is_equal_approx()
-template <>
-struct TheComparer<float, true, false> : public CProxy
-{
-   bool compare(const Variant& var1, const Variant& var2) const { return Math::is_equal_approx(float(var1), float(var2)); }
-   String get_comp_name() const { return "float_auto"; }
-
-   static Ref<TheComparer> create() { return memnew(TheComparer); }
-};
-
-// Floating point comparer with custom tolerance value
-template <>
-struct TheComparer<float, true, true> : public CProxy
-{
-   TheComparer(float t) : m_tolerance(t) {}
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const float v1 = var1;
-      const float v2 = var2;
-      return (Math::abs(v1 - v2) < m_tolerance);
-   }
-   String get_comp_name() const { return vformat("float_custom_%f", m_tolerance); }
-
-   static Ref<TheComparer> create(float t) { return memnew(TheComparer(t)); }
-
-private:
-   float m_tolerance;
-};
-
-// Vector2 with automatic tolerance, using Vector2's method to perform is_equal_approx() on each component
-template <>
-struct TheComparer<Vector2, true, false> : public CProxy
-{
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const Vector2 v1(var1);
-      return v1.is_equal_approx(var2);
-   }
-   String get_comp_name() const { return "vector2_auto"; }
-
-   static Ref<TheComparer> create() { return memnew(TheComparer); }
-};
-
-// Vector2 with custom tolerance value
-template <>
-struct TheComparer<Vector2, true, true> : public CProxy
-{
-   TheComparer(float t) : m_tolerance(t) {}
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const Vector2 v1(var1);
-      const Vector2 v2(var2);
-      return (Math::abs(v1.x - v2.x) < m_tolerance && Math::abs(v1.y - v2.y) < m_tolerance);
-   }
-   String get_comp_name() const { return vformat("vector2_custom_%f", m_tolerance); }
-
-   static Ref<TheComparer> create(float t) { return memnew(TheComparer(t)); }
-
-private:
-   float m_tolerance;
-};
-
-
-// Rect2 with automatic tolerance. Again, the class offers a method to use is_equal_approx() on each component
-template <>
-struct TheComparer<Rect2, true, false> : public CProxy
-{
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const Rect2 v1(var1);
-      return v1.is_equal_approx(var2);
-   }
-
-   static Ref<TheComparer> create() { return memnew(TheComparer); }
-};
-
-// Rect2 with custom tolerance value
-template <>
-struct TheComparer<Rect2, true, true> : public CProxy
-{
-   TheComparer(float t) : m_tolerance(t) {}
-
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const Rect2 v1(var1);
-      const Rect2 v2(var2);
-      return (Math::abs(v1.position.x - v2.position.x) < m_tolerance &&
-            Math::abs(v1.position.y - v2.position.y) < m_tolerance &&
-            Math::abs(v1.size.x - v2.size.x) < m_tolerance &&
-            Math::abs(v1.size.y - v2.size.y) < m_tolerance);
-      return false;
-   }
-
-   static Ref<TheComparer> create(float t) { return memnew(TheComparer(t)); }
-private:
-   float m_tolerance;
-};
-
-// Quat with automatic tolerance value
-template <>
-struct TheComparer<Quat, true, false> : public CProxy
-{
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const Quat v1(var1);
-      return v1.is_equal_approx(var2);
-   }
-
-   static Ref<TheComparer> create() { return memnew(TheComparer); }
-};
-
-// Quat with custom tolerance value
-template <>
-struct TheComparer<Quat, true, true> : public CProxy
-{
-   TheComparer(float t): m_tolerance(t) {}
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const Quat v1(var1);
-      const Quat v2(var2);
-
-      return (Math::abs(v1.x - v2.x) < m_tolerance &&
-         Math::abs(v1.y - v2.y) < m_tolerance &&
-         Math::abs(v1.z - v2.z) < m_tolerance &&
-         Math::abs(v1.w - v2.w) < m_tolerance);
-   }
-
-   static Ref<TheComparer> create(float t) { return memnew(TheComparer(t)); }
-
-private:
-   float m_tolerance;
-};
-
-// Vector3 with automatic tolerance
-template <>
-struct TheComparer<Vector3, true, false> : public CProxy
-{
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const Vector3 v1(var1);
-      return v1.is_equal_approx(var2);
-   }
-
-   static Ref<TheComparer> create() { return memnew(TheComparer); }
-};
-
-// Vector3 with custom tolerance
-template <>
-struct TheComparer<Vector3, true, true> : public CProxy
+// Floating point based types with automatic tolerance calculation, with is_equal_approx(). The Variants are converted
+// once and the actual comparison is done by kehTypedCompare, which is shared with the native entity fields
+template <typename T>
+struct TheComparer<T, true, false> : public CProxy
 {
-   TheComparer(float t) : m_tolerance(t) {}
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const Vector3 v1(var1);
-      const Vector3 v2(var2);
-
-      return (Math::abs(v1.x - v2.x) < m_tolerance &&
-         Math::abs(v1.y - v2.y) < m_tolerance &&
-         Math::abs(v1.z - v2.z) < m_tolerance);
-   }
+   TheComparer(const String& n) : m_name(n) {}
+   bool compare(const Variant& var1, const Variant& var2) const { return kehTypedCompare::approx(T(var1), T(var2)); }
+   String get_comp_name() const { return m_name; }
 
-   static Ref<TheComparer> create(float t) { return memnew(TheComparer(t)); }
+   static Ref<TheComparer> create(const String& n) { return memnew(TheComparer(n)); }
 
 private:
-   float m_tolerance;
+   String m_name;
 };
 
-// Color with automatic tolerance
-template <>
-struct TheComparer<Color, true, false> : public CProxy
-{
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const Color v1(var1);
-      return v1.is_equal_approx(var2);
-   }
-
-   static Ref<TheComparer> create() { return memnew(TheComparer); }
-};
-
-// Color with custom tolerance
-template <>
-struct TheComparer<Color, true, true> : public CProxy
+// Floating point based types with custom tolerance value
+template <typename T>
+struct TheComparer<T, true, true> : public CProxy
 {
-   TheComparer(float t) : m_tolerance(t) {}
-   bool compare(const Variant& var1, const Variant& var2) const
-   {
-      const Color v1(var1);
-      const Color v2(var2);
-
-      return (Math::abs(v1.r - v2.r) < m_tolerance &&
-         Math::abs(v1.g - v2.g) < m_tolerance &&
-         Math::abs(v1.b - v2.b) < m_tolerance &&
-         Math::abs(v1.a - v2.a) < m_tolerance);
-   }
+   TheComparer(const String& n, float t) : m_name(n), m_tolerance(t) {}
+   bool compare(const Variant& var1, const Variant& var2) const { return kehTypedCompare::within(T(var1), T(var2), m_tolerance); }
+   String get_comp_name() const { return m_name; }
 
-   static Ref<TheComparer> create(float t) { return memnew(TheComparer(t)); }
+   static Ref<TheComparer> create(const String& n, float t) { return memnew(TheComparer(n, t)); }
 
 private:
+   String m_name;
    float m_tolerance;
 };
 
@@ -257,9 +86,9 @@ static Ref<CProxy> get_or_create(const String& name, float tol, Map<String, Ref<
    else
    {
       if (tol != 0.0f)
-         ret = TheComparer<T, true, true>::create(tol);
+         ret = TheComparer<T, true, true>::create(name, tol);
       else
-         ret = TheComparer<T, true, false>::create();
+         ret = TheComparer<T, true, false>::create(name);
       
       collection[name] = ret;
    }
@@ -0,0 +1,242 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_QUANTCODEC_H
+#define _KEHNETWORK_QUANTCODEC_H 1
+
+// Quantization of snapshot entity properties, declared through the "<property>_quantize" meta on scripted
+// entities or kehNativeEntity::set_quantization() on native ones.
+//
+// Floating point based properties (float, Vector2, Rect2, Vector3 and Color) are quantized per component
+// into the given number of bits, within the [minval..maxval] range. Values outside of the range are clamped.
+// Each component then takes a byte (up to 8 bits), two bytes (up to 16 bits) or four bytes (up to 24 bits).
+// Rotation quaternions use the smallest three method, with the number of bits per component. The three
+// components, the index of the dropped one and its signal are packed into 2, 4 or 6 bytes.
+//
+// Comparison is done on the quantized values, so changes that are smaller than the quantization step don't
+// mark the property as changed.
+
+#include "core/math/quat.h"
+#include "core/math/rect2.h"
+#include "core/math/vector3.h"
+#include "core/color.h"
+
+#include "../kehgeneral/encdecbuffer.h"
+#include "../kehgeneral/quantize.h"
+
+
+struct kehQuantCodec
+{
+   // 0 means quantization is disabled
+   uint8_t bits;
+   float minval;
+   float maxval;
+
+   bool is_enabled() const { return bits > 0; }
+
+   // Returns an error message if the settings can't be used with the given type (Variant::Type)
+   String setup(int type, int nbits, float minv, float maxv)
+   {
+      switch (type)
+      {
+         case Variant::REAL:
+         case Variant::VECTOR2:
+         case Variant::RECT2:
+         case Variant::VECTOR3:
+         case Variant::COLOR:
+         {
+            if (nbits < 1 || nbits > 24)
+               return vformat("Number of quantization bits must be in the [1..24] range, got %d.", nbits);
+            if (minv >= maxv)
+               return vformat("Invalid quantization range [%f..%f].", minv, maxv);
+         } break;
+
+         case Variant::QUAT:
+         {
+            if (nbits < 2 || nbits > 15)
+               return vformat("Number of quantization bits of a rotation quaternion must be in the [2..15] range, got %d.", nbits);
+         } break;
+
+         default:
+            return "Quantization is only supported by floating point based properties.";
+      }
+
+      bits = nbits;
+      minval = minv;
+      maxval = maxv;
+      return "";
+   }
+
+   String get_name(int type) const { return type == Variant::QUAT ? vformat("quantized_%d", bits) : vformat("quantized_%d_%f_%f", bits, minval, maxval); }
+
+
+   uint32_t quantize(float value) const
+   {
+      return kehQuantize::get_singleton()->quantize_float(CLAMP(value, minval, maxval), minval, maxval, bits);
+   }
+   float restore(uint32_t quantized) const { return kehQuantize::get_singleton()->restore_float(quantized, minval, maxval, bits); }
+
+   // Smallest three components, index and signal of the rotation quaternion packed into a single integer
+   uint64_t pack(const Quat& q) const
+   {
+      const kehQuantize::uquat_data d = kehQuantize::get_singleton()->compress_rotation_quat(q, bits);
+      return uint64_t(d.a) | (uint64_t(d.b) << bits) | (uint64_t(d.c) << (bits * 2)) |
+            (uint64_t(d.index) << (bits * 3)) | (uint64_t(d.signal) << (bits * 3 + 2));
+   }
+   Quat unpack(uint64_t p) const
+   {
+      const uint64_t cmask = (uint64_t(1) << bits) - 1;
+      const kehQuantize::uquat_data d(p & cmask, (p >> bits) & cmask, (p >> (bits * 2)) & cmask, (p >> (bits * 3)) & 3, (p >> (bits * 3 + 2)) & 1);
+      return kehQuantize::get_singleton()->restore_rotation_quat(d, bits);
+   }
+
+
+   bool equal(float v1, float v2) const { return quantize(v1) == quantize(v2); }
+   bool equal(const Vector2& v1, const Vector2& v2) const { return equal(v1.x, v2.x) && equal(v1.y, v2.y); }
+   bool equal(const Rect2& v1, const Rect2& v2) const { return equal(v1.position, v2.position) && equal(v1.size, v2.size); }
+   bool equal(const Vector3& v1, const Vector3& v2) const { return equal(v1.x, v2.x) && equal(v1.y, v2.y) && equal(v1.z, v2.z); }
+   bool equal(const Color& v1, const Color& v2) const { return equal(v1.r, v2.r) && equal(v1.g, v2.g) && equal(v1.b, v2.b) && equal(v1.a, v2.a); }
+   bool equal(const Quat& v1, const Quat& v2) const { return pack(v1) == pack(v2); }
+
+
+   void write(kehEncDecBuffer* into, float v) const
+   {
+      const uint32_t q = quantize(v);
+      if (bits <= 8)
+         into->write_byte(q);
+      else if (bits <= 16)
+         into->write_ushort(q);
+      else
+         into->write_uint(q);
+   }
+   void write(kehEncDecBuffer* into, const Vector2& v) const { write(into, v.x); write(into, v.y); }
+   void write(kehEncDecBuffer* into, const Rect2& v) const { write(into, v.position); write(into, v.size); }
+   void write(kehEncDecBuffer* into, const Vector3& v) const { write(into, v.x); write(into, v.y); write(into, v.z); }
+   void write(kehEncDecBuffer* into, const Color& v) const { write(into, v.r); write(into, v.g); write(into, v.b); write(into, v.a); }
+   void write(kehEncDecBuffer* into, const Quat& v) const
+   {
+      const uint64_t p = pack(v);
+      const uint32_t total = bits * 3 + 3;
+      if (total <= 16)
+      {
+         into->write_ushort(uint16_t(p));
+      }
+      else
+      {
+         into->write_uint(uint32_t(p));
+         if (total > 32)
+            into->write_ushort(uint16_t(p >> 32));
+      }
+   }
+
+   void read(kehEncDecBuffer* from, float& out) const
+   {
+      uint32_t q;
+      if (bits <= 8)
+         q = from->read_byte();
+      else if (bits <= 16)
+         q = from->read_ushort();
+      else
+         q = from->read_uint();
+      out = restore(q);
+   }
+   void read(kehEncDecBuffer* from, Vector2& out) const { read(from, out.x); read(from, out.y); }
+   void read(kehEncDecBuffer* from, Rect2& out) const { read(from, out.position); read(from, out.size); }
+   void read(kehEncDecBuffer* from, Vector3& out) const { read(from, out.x); read(from, out.y); read(from, out.z); }
+   void read(kehEncDecBuffer* from, Color& out) const { read(from, out.r); read(from, out.g); read(from, out.b); read(from, out.a); }
+   void read(kehEncDecBuffer* from, Quat& out) const
+   {
+      const uint32_t total = bits * 3 + 3;
+      uint64_t p;
+      if (total <= 16)
+      {
+         p = from->read_ushort();
+      }
+      else
+      {
+         p = from->read_uint();
+         if (total > 32)
+            p |= uint64_t(from->read_ushort()) << 32;
+      }
+      out = unpack(p);
+   }
+
+   // Types that can't be quantized are refused by setup(), so those are never reached. They exist only so
+   // templated code (kehNativeMemberField) compiles for every field type
+   template <typename T>
+   bool equal(const T& v1, const T& v2) const { return v1 == v2; }
+   template <typename T>
+   void write(kehEncDecBuffer*, const T&) const {}
+   template <typename T>
+   void read(kehEncDecBuffer*, T&) const {}
+
+
+   // Variant versions, used by scripted entities. The type is the one of the replicable property
+   bool equal_variant(int type, const Variant& v1, const Variant& v2) const
+   {
+      switch (type)
+      {
+         case Variant::REAL: return equal(float(v1), float(v2));
+         case Variant::VECTOR2: return equal(Vector2(v1), Vector2(v2));
+         case Variant::RECT2: return equal(Rect2(v1), Rect2(v2));
+         case Variant::VECTOR3: return equal(Vector3(v1), Vector3(v2));
+         case Variant::COLOR: return equal(Color(v1), Color(v2));
+         case Variant::QUAT: return equal(Quat(v1), Quat(v2));
+      }
+      return v1 == v2;
+   }
+
+   void write_variant(int type, kehEncDecBuffer* into, const Variant& v) const
+   {
+      switch (type)
+      {
+         case Variant::REAL: write(into, float(v)); break;
+         case Variant::VECTOR2: write(into, Vector2(v)); break;
+         case Variant::RECT2: write(into, Rect2(v)); break;
+         case Variant::VECTOR3: write(into, Vector3(v)); break;
+         case Variant::COLOR: write(into, Color(v)); break;
+         case Variant::QUAT: write(into, Quat(v)); break;
+      }
+   }
+
+   template <typename T>
+   Variant read_as(kehEncDecBuffer* from) const { T ret; read(from, ret); return ret; }
+
+   Variant read_variant(int type, kehEncDecBuffer* from) const
+   {
+      switch (type)
+      {
+         case Variant::REAL: return read_as<float>(from);
+         case Variant::VECTOR2: return read_as<Vector2>(from);
+         case Variant::RECT2: return read_as<Rect2>(from);
+         case Variant::VECTOR3: return read_as<Vector3>(from);
+         case Variant::COLOR: return read_as<Color>(from);
+         case Variant::QUAT: return read_as<Quat>(from);
+      }
+      return Variant();
+   }
+
+   kehQuantCodec() : bits(0), minval(0.0f), maxval(1.0f) {}
+};
+
+
+#endif
@@ -29,7 +29,10 @@
 #include "scene/main/scene_tree.h"
 #include "scene/main/viewport.h"
 
+#include "benchmark.h"
 #include "customproperty.h"
+#include "memorypeer.h"
+#include "nativeentity.h"
 #include "playernode.h"
 #include "playerdata.h"
 #include "snapentity.h"
@@ -86,8 +89,12 @@ void register_kehnetwork_types()
    // Register the classes
    ClassDB::register_class<kehCustomProperty>();
    ClassDB::register_class<kehInputData>();
+   ClassDB::register_class<kehMemoryNetwork>();
+   ClassDB::register_class<kehMemoryPeer>();
+   ClassDB::register_class<kehNetBenchmark>();
    ClassDB::register_virtual_class<kehNetNodeSpawner>();
    ClassDB::register_class<kehNetDefaultSpawner>();
+   ClassDB::register_class<kehNetPoolingSpawner>();
    ClassDB::register_class<kehPlayerNode>();
    ClassDB::register_class<kehPlayerData>();
    ClassDB::register_virtual_class<kehSnapEntityBase>();
@@ -105,8 +112,9 @@ void register_kehnetwork_types()
    {
       create_psetting("keh_modules/network/general/print_debug_info", false);
       create_psetting("keh_modules/network/generatel/compression", 1, Variant::INT, PROPERTY_HINT_ENUM, "None, Rangecoder, FastLZ, ZLib, ZSTD");
-      create_psetting("keh_modules/network/general/mode", 0, Variant::INT, PROPERTY_HINT_ENUM, "ENet, WebSocket");
+      create_psetting("keh_modules/network/general/mode", 0, Variant::INT, PROPERTY_HINT_ENUM, "ENet, WebSocket, Memory");
       create_psetting("keh_modules/network/general/broadcast_measured_ping", true);
+      create_psetting("keh_modules/network/general/object_pool_size", 512);
 
       create_psetting("keh_modules/network/snapshot/max_history", 120);
       create_psetting("keh_modules/network/snapshot/max_client_history", 60);
@@ -115,6 +123,34 @@ void register_kehnetwork_types()
       create_psetting("keh_modules/network/input/use_mouse_relative", false);
       create_psetting("keh_modules/network/input/use_mouse_speed", false);
       create_psetting("keh_modules/network/input/quantize_analog_data", false);
+
+      create_psetting("keh_modules/network/clock_sync/max_dilation", 0.05f);
+      create_psetting("keh_modules/network/clock_sync/safety_margin", 1.0f);
+      create_psetting("keh_modules/network/clock_sync/resync_threshold", 30.0f);
+      create_psetting("keh_modules/network/clock_sync/apply_time_scale", false);
+
+      create_psetting("keh_modules/network/tick/simulation_rate", 0);
+      create_psetting("keh_modules/network/tick/send_rate", 0);
+      create_psetting("keh_modules/network/tick/max_ticks_per_frame", 5);
+
+      create_psetting("keh_modules/network/io_thread/enabled", false);
+      create_psetting("keh_modules/network/io_thread/queue_size", 2048);
+      create_psetting("keh_modules/network/io_thread/idle_usec", 1000);
+
+      create_psetting("keh_modules/network/memory/latency_ms", 0.0f);
+      create_psetting("keh_modules/network/memory/jitter_ms", 0.0f);
+      create_psetting("keh_modules/network/memory/packet_loss", 0.0f, Variant::REAL, PROPERTY_HINT_RANGE, "0,1,0.01");
+      create_psetting("keh_modules/network/memory/reorder", 0.0f, Variant::REAL, PROPERTY_HINT_RANGE, "0,1,0.01");
+      create_psetting("keh_modules/network/memory/bandwidth", 0);
+      create_psetting("keh_modules/network/memory/seed", 0);
+
+      create_psetting("keh_modules/network/profiler/enabled", false);
+      create_psetting("keh_modules/network/profiler/max_trace_events", 100000);
+
+      create_psetting("keh_modules/network/replay/keyframe_interval", 60);
+
+      create_psetting("keh_modules/network/spectator/delay_ticks", 30);
+      create_psetting("keh_modules/network/spectator/keyframe_interval", 120);
    }
 }
 
@@ -128,4 +164,6 @@ void unregister_kehnetwork_types()
 
    // Nullifying the pointers is probably not necessary, but...
    keh_network = NULL;
+
+   kehNativeEntityType::cleanup();
 }
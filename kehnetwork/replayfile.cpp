@@ -0,0 +1,278 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "replayfile.h"
+
+
+bool kehReplayFile::read_footer()
+{
+   const uint64_t len = m_file->get_len();
+   if (len < HEADER_SIZE + FOOTER_SIZE)
+      return false;
+   
+   m_file->seek(len - FOOTER_SIZE);
+   const uint32_t first = m_file->get_32();
+   const uint32_t last = m_file->get_32();
+   const uint64_t index_pos = m_file->get_64();
+
+   uint8_t magic[4];
+   m_file->get_buffer(magic, 4);
+   if (magic[0] != 'K' || magic[1] != 'I' || magic[2] != 'D' || magic[3] != 'X')
+      return false;
+   
+   if (index_pos < HEADER_SIZE || index_pos > len - FOOTER_SIZE)
+      return false;
+   
+   m_file->seek(index_pos);
+   const uint32_t count = m_file->get_32();
+   if (index_pos + 4 + uint64_t(count) * 12 != len - FOOTER_SIZE)
+      return false;
+   
+   m_index.resize(count);
+   for (uint32_t i = 0; i < count; i++)
+   {
+      m_index.write[i].signature = m_file->get_32();
+      m_index.write[i].position = m_file->get_64();
+   }
+
+   m_first_sig = first;
+   m_last_sig = last;
+   m_records_end = index_pos;
+
+   return true;
+}
+
+void kehReplayFile::rebuild_index()
+{
+   // Scan every record header. A truncated last record (incomplete write) marks the end of the usable data
+   const uint64_t len = m_file->get_len();
+   uint64_t pos = HEADER_SIZE;
+
+   m_index.clear();
+   m_first_sig = 0;
+   m_last_sig = 0;
+
+   while (pos + 9 <= len)
+   {
+      m_file->seek(pos);
+      const uint8_t type = m_file->get_8();
+      const uint32_t sig = m_file->get_32();
+      const uint32_t size = m_file->get_32();
+
+      if (pos + 9 + size > len)
+         break;
+      
+      if (type == REC_Keyframe)
+      {
+         IndexEntry entry;
+         entry.signature = sig;
+         entry.position = pos;
+         m_index.push_back(entry);
+      }
+
+      if (type != REC_Events)
+      {
+         if (m_first_sig == 0)
+            m_first_sig = sig;
+         m_last_sig = sig;
+      }
+
+      pos += 9 + size;
+   }
+
+   m_records_end = pos;
+}
+
+
+Error kehReplayFile::create(const String& path, float tick_rate)
+{
+   close();
+
+   Error err;
+   m_file = FileAccess::open(path, FileAccess::WRITE, &err);
+   ERR_FAIL_COND_V_MSG(!m_file, err, vformat("Unable to create the replay file '%s'.", path));
+
+   m_writing = true;
+   m_tick_rate = tick_rate;
+
+   m_file->store_buffer((const uint8_t*)"KEHR", 4);
+   m_file->store_32(VERSION);
+   m_file->store_float(tick_rate);
+
+   return OK;
+}
+
+Error kehReplayFile::open(const String& path)
+{
+   close();
+
+   Error err;
+   m_file = FileAccess::open(path, FileAccess::READ, &err);
+   ERR_FAIL_COND_V_MSG(!m_file, err, vformat("Unable to open the replay file '%s'.", path));
+
+   m_writing = false;
+
+   uint8_t magic[4];
+   m_file->get_buffer(magic, 4);
+   const uint32_t version = m_file->get_32();
+   m_tick_rate = m_file->get_float();
+
+   if (m_file->eof_reached() || magic[0] != 'K' || magic[1] != 'E' || magic[2] != 'H' || magic[3] != 'R' || version != VERSION)
+   {
+      close();
+      ERR_FAIL_V_MSG(ERR_FILE_UNRECOGNIZED, vformat("The file '%s' is not a valid replay.", path));
+   }
+
+   if (!read_footer())
+   {
+      WARN_PRINT(vformat("The replay file '%s' was not properly closed, rebuilding its index.", path));
+      rebuild_index();
+   }
+
+   m_file->seek(HEADER_SIZE);
+
+   return OK;
+}
+
+void kehReplayFile::close()
+{
+   if (!m_file)
+      return;
+   
+   if (m_writing)
+   {
+      const uint64_t index_pos = m_file->get_position();
+
+      m_file->store_32(m_index.size());
+      for (int i = 0; i < m_index.size(); i++)
+      {
+         m_file->store_32(m_index[i].signature);
+         m_file->store_64(m_index[i].position);
+      }
+
+      m_file->store_32(m_first_sig);
+      m_file->store_32(m_last_sig);
+      m_file->store_64(index_pos);
+      m_file->store_buffer((const uint8_t*)"KIDX", 4);
+   }
+
+   m_file->close();
+   memdelete(m_file);
+   m_file = NULL;
+
+   m_index.clear();
+   m_first_sig = 0;
+   m_last_sig = 0;
+   m_records_end = 0;
+}
+
+
+void kehReplayFile::write_record(RecordType type, uint32_t signature, const PoolByteArray& data)
+{
+   ERR_FAIL_COND(!is_writing());
+
+   if (type == REC_Keyframe)
+   {
+      IndexEntry entry;
+      entry.signature = signature;
+      entry.position = m_file->get_position();
+      m_index.push_back(entry);
+   }
+
+   if (type != REC_Events)
+   {
+      if (m_first_sig == 0)
+         m_first_sig = signature;
+      m_last_sig = signature;
+   }
+
+   m_file->store_8(type);
+   m_file->store_32(signature);
+   m_file->store_32(data.size());
+
+   PoolByteArray::Read r = data.read();
+   m_file->store_buffer(r.ptr(), data.size());
+}
+
+
+bool kehReplayFile::read_record(Record& out)
+{
+   ERR_FAIL_COND_V(!is_reading(), false);
+
+   if (m_file->get_position() + 9 > m_records_end)
+      return false;
+   
+   out.type = m_file->get_8();
+   out.signature = m_file->get_32();
+   const uint32_t size = m_file->get_32();
+
+   out.data.resize(size);
+   PoolByteArray::Write w = out.data.write();
+   return m_file->get_buffer(w.ptr(), size) == int(size);
+}
+
+
+bool kehReplayFile::seek_keyframe(uint32_t signature)
+{
+   ERR_FAIL_COND_V(!is_reading(), false);
+
+   // Keyframes are in increasing signature order, so binary search the newest one not past the requested signature
+   int low = 0;
+   int high = m_index.size() - 1;
+   int found = -1;
+
+   while (low <= high)
+   {
+      const int mid = (low + high) / 2;
+      if (m_index[mid].signature <= signature)
+      {
+         found = mid;
+         low = mid + 1;
+      }
+      else
+      {
+         high = mid - 1;
+      }
+   }
+
+   if (found < 0)
+      return false;
+   
+   m_file->seek(m_index[found].position);
+   return true;
+}
+
+
+kehReplayFile::kehReplayFile()
+{
+   m_file = NULL;
+   m_writing = false;
+   m_tick_rate = 0.0f;
+   m_first_sig = 0;
+   m_last_sig = 0;
+   m_records_end = 0;
+}
+
+kehReplayFile::~kehReplayFile()
+{
+   close();
+}
@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_REPLAYFILE_H
+#define _KEHNETWORK_REPLAYFILE_H 1
+
+// Replay files hold a stream of encoded snapshots and events, exactly as those would be sent to a client.
+// Data is only appended while recording: a small header followed by records. Most snapshot records are delta
+// encoded against the previous one, with periodic full snapshots (keyframes) so playback can start from any
+// point without decoding the entire file.
+// When the recording is closed an index with the position of each keyframe is appended, followed by a fixed
+// size footer. If the footer is missing (the game crashed while recording, as an example) the index is rebuilt
+// by scanning the records when the file is opened.
+//
+// Layout (little endian):
+// Header:   "KEHR", version (uint32), tick rate (float)
+// Record:   type (uint8), snapshot signature (uint32), size (uint32), data (size bytes)
+// Index:    count (uint32), then count times: signature (uint32), position (uint64)
+// Footer:   first signature (uint32), last signature (uint32), index position (uint64), "KIDX"
+
+#include "core/os/file_access.h"
+#include "core/vector.h"
+
+
+class kehReplayFile
+{
+public:
+   enum RecordType
+   {
+      REC_Keyframe,
+      REC_Delta,
+      REC_Events,
+   };
+
+   struct Record
+   {
+      uint8_t type;
+      uint32_t signature;
+      PoolByteArray data;
+   };
+
+   struct IndexEntry
+   {
+      uint32_t signature;
+      uint64_t position;
+   };
+
+private:
+   static const uint32_t VERSION = 4;
+   static const uint32_t HEADER_SIZE = 12;
+   static const uint32_t FOOTER_SIZE = 20;
+
+   FileAccess* m_file;
+   bool m_writing;
+
+   float m_tick_rate;
+   Vector<IndexEntry> m_index;
+   uint32_t m_first_sig;
+   uint32_t m_last_sig;
+
+   // When reading, records end here (the index starts)
+   uint64_t m_records_end;
+
+private:
+   bool read_footer();
+   void rebuild_index();
+
+public:
+   // Create the file, overwriting if it already exists
+   Error create(const String& path, float tick_rate);
+   // Open an existing file for playback
+   Error open(const String& path);
+   // Closes the file. When recording, the index and footer are written
+   void close();
+
+   bool is_open() const { return m_file != NULL; }
+   bool is_writing() const { return m_file && m_writing; }
+   bool is_reading() const { return m_file && !m_writing; }
+
+   void write_record(RecordType type, uint32_t signature, const PoolByteArray& data);
+
+   // Read the record at the current position. Returns false when there are no more records
+   bool read_record(Record& out);
+
+   uint64_t get_position() const { return m_file ? m_file->get_position() : 0; }
+   void set_position(uint64_t pos) { if (m_file) m_file->seek(pos); }
+
+   // Move to the newest keyframe with signature smaller than or equal to the given one. Returns false if there is
+   // no such keyframe
+   bool seek_keyframe(uint32_t signature);
+
+   float get_tick_rate() const { return m_tick_rate; }
+   uint32_t get_first_signature() const { return m_first_sig; }
+   uint32_t get_last_signature() const { return m_last_sig; }
+   uint32_t get_keyframe_count() const { return m_index.size(); }
+
+   kehReplayFile();
+   ~kehReplayFile();
+};
+
+
+#endif
@@ -0,0 +1,363 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "simdcompare.h"
+
+#include "core/math/math_funcs.h"
+
+#if defined(__AVX2__)
+   #define KEH_SIMD_AVX2 1
+   #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+   #define KEH_SIMD_SSE2 1
+   #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+   #define KEH_SIMD_NEON 1
+   #include <arm_neon.h>
+#endif
+
+
+// How floating point values are compared. Resolved once per column so the kernels don't branch on it
+enum FloatMode
+{
+   FM_Exact,
+   FM_Approx,
+   FM_Custom,
+};
+
+// Elements are processed in chunks when those have more than one component, so the per float flags fit in the stack
+static const uint32_t CHUNK_SIZE = 256;
+
+
+template <int MODE>
+static inline bool float_differs(float v1, float v2, float tolerance)
+{
+   switch (MODE)
+   {
+      case FM_Exact: return !(v1 == v2);
+      case FM_Approx: return !Math::is_equal_approx(v1, v2);
+   }
+   return !(Math::abs(v1 - v2) < tolerance);
+}
+
+// Sets one flag per lane from a bit mask in which set bits are the lanes that compared as equal
+static inline void store_flags(int eqmask, uint32_t lanes, uint8_t* flags)
+{
+   for (uint32_t i = 0; i < lanes; i++)
+   {
+      flags[i] = ((eqmask >> i) & 1) ^ 1;
+   }
+}
+
+
+#if defined(KEH_SIMD_AVX2)
+
+static const char* ISA_NAME = "avx2";
+
+static uint32_t vec_int_flags(const uint32_t* v1, const uint32_t* v2, uint32_t count, uint8_t* flags)
+{
+   uint32_t i = 0;
+   for (; i + 8 <= count; i += 8)
+   {
+      const __m256i a = _mm256_loadu_si256((const __m256i*)(v1 + i));
+      const __m256i b = _mm256_loadu_si256((const __m256i*)(v2 + i));
+      store_flags(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))), 8, flags + i);
+   }
+   return i;
+}
+
+template <int MODE>
+static uint32_t vec_float_flags(const float* v1, const float* v2, uint32_t count, float tolerance, uint8_t* flags)
+{
+   const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+   const __m256 eps = _mm256_set1_ps(CMP_EPSILON);
+   const __m256 tol = _mm256_set1_ps(tolerance);
+
+   uint32_t i = 0;
+   for (; i + 8 <= count; i += 8)
+   {
+      const __m256 a = _mm256_loadu_ps(v1 + i);
+      const __m256 b = _mm256_loadu_ps(v2 + i);
+      __m256 eq;
+      switch (MODE)
+      {
+         case FM_Exact:
+         {
+            eq = _mm256_cmp_ps(a, b, _CMP_EQ_OQ);
+         } break;
+
+         case FM_Approx:
+         {
+            const __m256 diff = _mm256_and_ps(_mm256_sub_ps(a, b), absmask);
+            const __m256 t = _mm256_max_ps(_mm256_mul_ps(_mm256_and_ps(a, absmask), eps), eps);
+            eq = _mm256_or_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ), _mm256_cmp_ps(diff, t, _CMP_LT_OQ));
+         } break;
+
+         default:
+         {
+            const __m256 diff = _mm256_and_ps(_mm256_sub_ps(a, b), absmask);
+            eq = _mm256_cmp_ps(diff, tol, _CMP_LT_OQ);
+         }
+      }
+      store_flags(_mm256_movemask_ps(eq), 8, flags + i);
+   }
+   return i;
+}
+
+#elif defined(KEH_SIMD_SSE2)
+
+static const char* ISA_NAME = "sse2";
+
+static uint32_t vec_int_flags(const uint32_t* v1, const uint32_t* v2, uint32_t count, uint8_t* flags)
+{
+   uint32_t i = 0;
+   for (; i + 4 <= count; i += 4)
+   {
+      const __m128i a = _mm_loadu_si128((const __m128i*)(v1 + i));
+      const __m128i b = _mm_loadu_si128((const __m128i*)(v2 + i));
+      store_flags(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))), 4, flags + i);
+   }
+   return i;
+}
+
+template <int MODE>
+static uint32_t vec_float_flags(const float* v1, const float* v2, uint32_t count, float tolerance, uint8_t* flags)
+{
+   const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+   const __m128 eps = _mm_set1_ps(CMP_EPSILON);
+   const __m128 tol = _mm_set1_ps(tolerance);
+
+   uint32_t i = 0;
+   for (; i + 4 <= count; i += 4)
+   {
+      const __m128 a = _mm_loadu_ps(v1 + i);
+      const __m128 b = _mm_loadu_ps(v2 + i);
+      __m128 eq;
+      switch (MODE)
+      {
+         case FM_Exact:
+         {
+            eq = _mm_cmpeq_ps(a, b);
+         } break;
+
+         case FM_Approx:
+         {
+            const __m128 diff = _mm_and_ps(_mm_sub_ps(a, b), absmask);
+            const __m128 t = _mm_max_ps(_mm_mul_ps(_mm_and_ps(a, absmask), eps), eps);
+            eq = _mm_or_ps(_mm_cmpeq_ps(a, b), _mm_cmplt_ps(diff, t));
+         } break;
+
+         default:
+         {
+            eq = _mm_cmplt_ps(_mm_and_ps(_mm_sub_ps(a, b), absmask), tol);
+         }
+      }
+      store_flags(_mm_movemask_ps(eq), 4, flags + i);
+   }
+   return i;
+}
+
+#elif defined(KEH_SIMD_NEON)
+
+static const char* ISA_NAME = "neon";
+
+static inline void store_neon_flags(uint32x4_t eq, uint8_t* flags)
+{
+   flags[0] = vgetq_lane_u32(eq, 0) == 0;
+   flags[1] = vgetq_lane_u32(eq, 1) == 0;
+   flags[2] = vgetq_lane_u32(eq, 2) == 0;
+   flags[3] = vgetq_lane_u32(eq, 3) == 0;
+}
+
+static uint32_t vec_int_flags(const uint32_t* v1, const uint32_t* v2, uint32_t count, uint8_t* flags)
+{
+   uint32_t i = 0;
+   for (; i + 4 <= count; i += 4)
+   {
+      store_neon_flags(vceqq_u32(vld1q_u32(v1 + i), vld1q_u32(v2 + i)), flags + i);
+   }
+   return i;
+}
+
+template <int MODE>
+static uint32_t vec_float_flags(const float* v1, const float* v2, uint32_t count, float tolerance, uint8_t* flags)
+{
+   const float32x4_t eps = vdupq_n_f32(CMP_EPSILON);
+   const float32x4_t tol = vdupq_n_f32(tolerance);
+
+   uint32_t i = 0;
+   for (; i + 4 <= count; i += 4)
+   {
+      const float32x4_t a = vld1q_f32(v1 + i);
+      const float32x4_t b = vld1q_f32(v2 + i);
+      uint32x4_t eq;
+      switch (MODE)
+      {
+         case FM_Exact:
+         {
+            eq = vceqq_f32(a, b);
+         } break;
+
+         case FM_Approx:
+         {
+            const float32x4_t t = vmaxq_f32(vmulq_f32(vabsq_f32(a), eps), eps);
+            eq = vorrq_u32(vceqq_f32(a, b), vcltq_f32(vabdq_f32(a, b), t));
+         } break;
+
+         default:
+         {
+            eq = vcltq_f32(vabdq_f32(a, b), tol);
+         }
+      }
+      store_neon_flags(eq, flags + i);
+   }
+   return i;
+}
+
+#else
+
+static const char* ISA_NAME = "scalar";
+
+static uint32_t vec_int_flags(const uint32_t*, const uint32_t*, uint32_t, uint8_t*) { return 0; }
+
+template <int MODE>
+static uint32_t vec_float_flags(const float*, const float*, uint32_t, float, uint8_t*) { return 0; }
+
+#endif
+
+
+// One flag per float, vectorized part followed by the scalar remainder
+template <int MODE>
+static void float_flags(const float* v1, const float* v2, uint32_t count, float tolerance, uint8_t* flags)
+{
+   for (uint32_t i = vec_float_flags<MODE>(v1, v2, count, tolerance, flags); i < count; i++)
+   {
+      flags[i] = float_differs<MODE>(v1[i], v2[i], tolerance);
+   }
+}
+
+// Reduce the per float flags into per element flags
+template <int MODE>
+static uint32_t float_elements(const float* v1, const float* v2, uint32_t count, uint32_t comps, float tolerance, uint8_t* changed)
+{
+   uint32_t ret = 0;
+
+   if (comps == 1)
+   {
+      float_flags<MODE>(v1, v2, count, tolerance, changed);
+      for (uint32_t i = 0; i < count; i++)
+      {
+         ret += changed[i];
+      }
+      return ret;
+   }
+
+   uint8_t flags[CHUNK_SIZE * 4];
+   for (uint32_t base = 0; base < count; base += CHUNK_SIZE)
+   {
+      const uint32_t n = MIN(count - base, CHUNK_SIZE);
+      float_flags<MODE>(v1 + base * comps, v2 + base * comps, n * comps, tolerance, flags);
+
+      for (uint32_t i = 0; i < n; i++)
+      {
+         uint8_t c = 0;
+         for (uint32_t k = 0; k < comps; k++)
+         {
+            c |= flags[i * comps + k];
+         }
+         changed[base + i] = c;
+         ret += c;
+      }
+   }
+
+   return ret;
+}
+
+
+
+const char* kehSimdCompare::get_isa()
+{
+   return ISA_NAME;
+}
+
+
+uint32_t kehSimdCompare::changed_int(const uint32_t* v1, const uint32_t* v2, uint32_t count, uint8_t* changed)
+{
+   uint32_t ret = 0;
+   for (uint32_t i = vec_int_flags(v1, v2, count, changed); i < count; i++)
+   {
+      changed[i] = v1[i] != v2[i];
+   }
+   for (uint32_t i = 0; i < count; i++)
+   {
+      ret += changed[i];
+   }
+   return ret;
+}
+
+
+uint32_t kehSimdCompare::changed_float(const float* v1, const float* v2, uint32_t count, uint32_t comps, float tolerance, uint8_t* changed)
+{
+   ERR_FAIL_COND_V(comps < 1 || comps > 4, 0);
+
+   if (tolerance < 0.0f)
+      return float_elements<FM_Exact>(v1, v2, count, comps, tolerance, changed);
+   if (tolerance == 0.0f)
+      return float_elements<FM_Approx>(v1, v2, count, comps, tolerance, changed);
+   return float_elements<FM_Custom>(v1, v2, count, comps, tolerance, changed);
+}
+
+
+uint32_t kehSimdCompare::changed_int_scalar(const uint32_t* v1, const uint32_t* v2, uint32_t count, uint8_t* changed)
+{
+   uint32_t ret = 0;
+   for (uint32_t i = 0; i < count; i++)
+   {
+      changed[i] = v1[i] != v2[i];
+      ret += changed[i];
+   }
+   return ret;
+}
+
+
+uint32_t kehSimdCompare::changed_float_scalar(const float* v1, const float* v2, uint32_t count, uint32_t comps, float tolerance, uint8_t* changed)
+{
+   uint32_t ret = 0;
+   for (uint32_t i = 0; i < count; i++)
+   {
+      bool c = false;
+      for (uint32_t k = 0; k < comps; k++)
+      {
+         const float a = v1[i * comps + k];
+         const float b = v2[i * comps + k];
+         if (tolerance < 0.0f)
+            c = c || float_differs<FM_Exact>(a, b, tolerance);
+         else if (tolerance == 0.0f)
+            c = c || float_differs<FM_Approx>(a, b, tolerance);
+         else
+            c = c || float_differs<FM_Custom>(a, b, tolerance);
+      }
+      changed[i] = c;
+      ret += c;
+   }
+   return ret;
+}
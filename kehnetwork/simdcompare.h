@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_SIMDCOMPARE_H
+#define _KEHNETWORK_SIMDCOMPARE_H 1
+
+// Vectorized change detection over columns of values, used by kehTypedCompare::compare_column() for the types that
+// can be seen as arrays of 32 bit integers or floats. The instruction set is selected when compiling: AVX2 if the
+// build enables it, SSE2 on x86/x86_64, NEON on ARM, otherwise plain scalar code. Values that don't fill a vector
+// register are dealt with by scalar code.
+//
+// Floating point comparison follows the same rules of kehTypedCompare: negative tolerance means exact comparison,
+// 0 means is_equal_approx() and anything else is an absolute tolerance. Note that the vector path of
+// is_equal_approx() calculates the automatic tolerance in single precision.
+
+#include "core/typedefs.h"
+
+struct kehSimdCompare
+{
+   // Name of the instruction set the kernels were built with
+   static const char* get_isa();
+
+   // Exact comparison of 32 bit integers. Sets changed[i] to 1 if v1[i] != v2[i] or 0 otherwise and returns the
+   // amount of changed values
+   static uint32_t changed_int(const uint32_t* v1, const uint32_t* v2, uint32_t count, uint8_t* changed);
+
+   // Each element is made of comps consecutive floats (1 for float, 2 for Vector2, 3 for Vector3 and 4 for Quat,
+   // Color or Rect2). An element is considered changed if any of its components changed. Returns the amount of
+   // changed elements
+   static uint32_t changed_float(const float* v1, const float* v2, uint32_t count, uint32_t comps, float tolerance, uint8_t* changed);
+
+   // The scalar versions, always available. Mostly meant to compare against the vectorized ones
+   static uint32_t changed_int_scalar(const uint32_t* v1, const uint32_t* v2, uint32_t count, uint8_t* changed);
+   static uint32_t changed_float_scalar(const float* v1, const float* v2, uint32_t count, uint32_t comps, float tolerance, uint8_t* changed);
+};
+
+
+#endif
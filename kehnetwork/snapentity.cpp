@@ -28,8 +28,14 @@ void kehSnapEntityBase::_bind_methods()
 {
    ClassDB::bind_method(D_METHOD("get_id"), &kehSnapEntityBase::get_uid);
    ClassDB::bind_method(D_METHOD("get_class_hash"), &kehSnapEntityBase::get_class_hash);
+   ClassDB::bind_method(D_METHOD("mark_dirty", "property"), &kehSnapEntityBase::mark_dirty);
+   ClassDB::bind_method(D_METHOD("mark_all_dirty"), &kehSnapEntityBase::mark_all_dirty);
 
    BIND_VMETHOD(MethodInfo("apply_state", PropertyInfo(Variant::OBJECT, "node", PROPERTY_HINT_RESOURCE_TYPE, "Node")));
+
+   BIND_ENUM_CONSTANT(EncodeFull);
+   BIND_ENUM_CONSTANT(EncodeDelta);
+   BIND_ENUM_CONSTANT(EncodeXor);
    
    
 
@@ -39,7 +45,7 @@ void kehSnapEntityBase::_bind_methods()
 
 
 kehSnapEntityBase::kehSnapEntityBase(uint32_t id, uint32_t chash)
-   : m_id(id), m_class_hash(chash)
+   : m_id(id), m_class_hash(chash), m_pooled(false), m_dirty_all(false)
 {
    
 }
\ No newline at end of file
@@ -25,6 +25,8 @@
 
 #include "core/reference.h"
 
+#include "changemask.h"
+
 class kehSnapEntityBase : public Reference
 {
    GDCLASS(kehSnapEntityBase, Reference);
@@ -34,6 +36,15 @@ public:
    const static uint32_t CTYPE_BYTE = 131074;
    const static uint32_t CTYPE_USHORT = 196610;
 
+   // How a changed property is encoded within delta snapshots. Selected through the "<property>_encoding" meta.
+   // When there is no baseline (the entity is new to the client) the full value is always encoded.
+   enum PropertyEncoding
+   {
+      EncodeFull,       // The full value (default)
+      EncodeDelta,      // Difference from the baseline value, zigzag varint. Only integer properties
+      EncodeXor,        // Bits XOR'd with the baseline value, varint. Only floating point based properties
+   };
+
 private:
    // Unique ID representing this entity within the snapshots.
    uint32_t m_id;
@@ -41,6 +52,15 @@ private:
    // This can also be seen as a way to categorize this entity.
    uint32_t m_class_hash;
 
+   // Set while this object is held by the entity pool of its kehEntityInfo
+   bool m_pooled;
+
+   // Properties marked as changed by game code, only used by entity types with dirty tracking enabled. Scripts mark
+   // properties by name, which are resolved into indices by kehEntityInfo when the entity is added into a snapshot
+   kehChangeMask m_dirty;
+   Vector<StringName> m_dirty_name;
+   bool m_dirty_all;
+
 protected:
    static void _bind_methods();
 
@@ -51,6 +71,18 @@ public:
    void set_class_hash(uint32_t chash) { m_class_hash = chash; }
    uint32_t get_class_hash() const { return m_class_hash; }
 
+   bool is_pooled() const { return m_pooled; }
+   void set_pooled(bool p) { m_pooled = p; }
+
+   // Dirty tracking. Native entities should mark fields by index (the order in which those were added to the type)
+   void mark_dirty_index(uint32_t index) { m_dirty.set_bit(index); }
+   void mark_dirty(const StringName& property) { m_dirty_name.push_back(property); }
+   void mark_all_dirty() { m_dirty_all = true; }
+   const kehChangeMask& get_dirty() const { return m_dirty; }
+   const Vector<StringName>& get_dirty_names() const { return m_dirty_name; }
+   bool is_all_dirty() const { return m_dirty_all; }
+   void clear_dirty() { m_dirty.clear(); m_dirty_name.clear(); m_dirty_all = false; }
+
 
    virtual void apply_state(Node* to_node) {}
 
@@ -60,4 +92,7 @@ public:
 };
 
 
+VARIANT_ENUM_CAST(kehSnapEntityBase::PropertyEncoding);
+
+
 #endif
@@ -39,7 +39,7 @@ uint32_t kehSnapshot::get_entity_count(uint32_t nhash) const
 {
    const entity_data_t::Element* e = m_entity_data.find(nhash);
    ERR_FAIL_COND_V_MSG(!e, 0, vformat("Trying to obtain entity count for a type (%d) that is not registered within the snapshot.", nhash));
-   return e->value().entity_array.size();
+   return e->value().entity_array.size() - e->value().removed;
 }
 
 void kehSnapshot::add_entity(uint32_t nhash, const Ref<kehSnapEntityBase>& entity)
@@ -47,74 +47,46 @@ void kehSnapshot::add_entity(uint32_t nhash, const Ref<kehSnapEntityBase>& entit
    entity_data_t::Element* e = m_entity_data.find(nhash);
    ERR_FAIL_COND_MSG(!e, vformat("Trying to add an entity of type (%d) that is not registered within the snapshot.", nhash));
 
-   // First check if the entity already exists. The thing is, if so, most likely the reference is different
-   // and must be updated within the internal containers.
-   Map<uint32_t, Ref<kehSnapEntityBase>>::Element* el = e->value().uid_to_entity.find(entity->get_uid());
-   if (el)
+   EntityCollection& col = e->value();
+   const uint32_t uid = entity->get_uid();
+
+   const uint32_t* index = col.uid_to_index.getptr(uid);
+   if (index)
    {
-      // Entity already exists. Must update both containers
-      el->value() = entity;
-      // The array is a little bit more complicated as the entity's correct index must be found
-      uint32_t i = 0;
-      if (get_entity_index(e->value().entity_array, entity->get_uid(), i))
-      {
-         e->value().entity_array.set(i, entity);
-      }
-      else
-      {
-         // This should not happen! But, should this error out?
-      }
+      // Entity already exists. Most likely the reference is different so it must be updated
+      col.entity_array.set(*index, entity);
+      return;
    }
-   else
+
+   // Decoding and cloning add entities in order, so the array normally remains sorted. Otherwise it will be
+   // sorted once, when the snapshot is finished
+   const int size = col.entity_array.size();
+   if (col.sorted && size > 0)
    {
-      // This is indeed a new entity, so add into both inner containers.
-      e->value().entity_array.push_back(entity);
-      e->value().uid_to_entity[entity->get_uid()] = entity;
+      // The last slot may be empty, left by a removed entity, in which case order can't be told here
+      const Ref<kehSnapEntityBase>& last = col.entity_array[size - 1];
+      if (!last.is_valid() || last->get_uid() > uid)
+         col.sorted = false;
    }
+
+   col.uid_to_index.set(uid, size);
+   col.entity_array.push_back(entity);
 }
 
 void kehSnapshot::remove_entity(uint32_t nhash, uint32_t uid)
 {
    entity_data_t::Element* e = m_entity_data.find(nhash);
    ERR_FAIL_COND_MSG(!e, vformat("Trying to remove entity of a type (%d) that is not registered within the snapshot.", nhash));
-   if (e->value().uid_to_entity.erase(uid))
-   {
-      // If here, something was deleted from the inner map. This means the entity must exist on the array.
-      uint32_t i = 0;
-      if (get_entity_index(e->value().entity_array, uid, i))
-      {
-         e->value().entity_array.remove(i);
-      }
-   }
-}
-
-
-/*
-void kehSnapshot::get_entity_uids(uint32_t ehash, Vector<uint32_t>& out) const
-{
-   const entity_data_t::Element* e = m_entity_data.find(ehash);
-   if (e)
-   {
-      const uint32_t ecount = e->value().entity_array.size();
-      for (uint32_t i = 0; i < ecount; i++)
-      {
-         out.push_back(e->value().entity_array[i]->get_uid());
-      }
-   }
-}*/
 
-void kehSnapshot::get_entity_uids(uint32_t ehash, Set<uint32_t>& out) const
-{
-   out.clear();
-   const entity_data_t::Element* e = m_entity_data.find(ehash);
-   if (e)
-   {
-      const uint32_t ecount = e->value().entity_array.size();
-      for (uint32_t i = 0; i < ecount; i++)
-      {
-         out.insert(e->value().entity_array[i]->get_uid());
-      }
-   }
+   EntityCollection& col = e->value();
+   const uint32_t* index = col.uid_to_index.getptr(uid);
+   if (!index)
+      return;
+   
+   // Leave the slot empty so the order of the other entities is kept. It's removed by finish()
+   col.entity_array.set(*index, Ref<kehSnapEntityBase>());
+   col.uid_to_index.erase(uid);
+   col.removed++;
 }
 
 
@@ -122,39 +94,64 @@ Ref<kehSnapEntityBase> kehSnapshot::get_entity(uint32_t nhash, uint32_t uid) con
 {
    const entity_data_t::Element* e = m_entity_data.find(nhash);
    ERR_FAIL_COND_V_MSG(!e, NULL, vformat("Trying to retrieve entity of a type (%d) that is not registered within the snapshot.", nhash));
-   const Map<uint32_t, Ref<kehSnapEntityBase>>::Element* entel = e->value().uid_to_entity.find(uid);
 
-   return entel ? entel->value() : NULL;
+   const uint32_t* index = e->value().uid_to_index.getptr(uid);
+   return index ? e->value().entity_array[*index] : NULL;
 }
 
 
-void kehSnapshot::build_tracker(Map<uint32_t, Set<uint32_t>>& output) const
+struct kehEntityUIDComparator
 {
-   for (const entity_data_t::Element* ecol = m_entity_data.front(); ecol; ecol = ecol->next())
+   bool operator()(const Ref<kehSnapEntityBase>& a, const Ref<kehSnapEntityBase>& b) const
    {
-      const uint32_t ecount = ecol->value().entity_array.size();
+      return a->get_uid() < b->get_uid();
+   }
+};
 
-      output[ecol->key()] = Set<uint32_t>();
-      Map<uint32_t, Set<uint32_t>>::Element* s = output.find(ecol->key());
+void kehSnapshot::finish()
+{
+   for (entity_data_t::Element* e = m_entity_data.front(); e; e = e->next())
+   {
+      EntityCollection& col = e->value();
+      if (col.is_finished())
+         continue;
+      
+      if (col.removed > 0)
+      {
+         // Single pass moving the remaining entities over the empty slots
+         const int size = col.entity_array.size();
+         int w = 0;
+         for (int r = 0; r < size; r++)
+         {
+            if (col.entity_array[r].is_valid())
+            {
+               if (w != r)
+                  col.entity_array.write[w] = col.entity_array[r];
+               w++;
+            }
+         }
+         col.entity_array.resize(w);
+         col.removed = 0;
+      }
 
-      for (uint32_t i = 0; i < ecount; i++)
+      if (!col.sorted)
       {
-         s->value().insert(ecol->value().entity_array[i]->get_uid());
+         col.entity_array.sort_custom<kehEntityUIDComparator>();
+         col.sorted = true;
+      }
+
+      const int size = col.entity_array.size();
+      for (int i = 0; i < size; i++)
+      {
+         col.uid_to_index.set(col.entity_array[i]->get_uid(), i);
       }
    }
 }
 
 
-bool kehSnapshot::get_entity_index(const PoolVector<Ref<kehSnapEntityBase>>& arr, uint32_t uid, uint32_t& out) const
+const kehSnapshot::entity_data_t::Element* kehSnapshot::get_entity_collection(uint32_t ehash) const
 {
-   const uint32_t ecount = arr.size();
-   for (uint32_t i = 0; i < ecount; i++)
-   {
-      if (arr[i]->get_uid() == uid)
-      {
-         out = i;
-         return true;
-      }
-   }
-   return false;
+   const entity_data_t::Element* e = m_entity_data.find(ehash);
+   ERR_FAIL_COND_V_MSG(e && !e->value().is_finished(), e, vformat("Retrieving the entities of type (%d) from snapshot %d, which was changed without being finished.", ehash, m_signature));
+   return e;
 }
@@ -23,7 +23,10 @@
 #ifndef _KEHNETWORK_SNAPSHOT_H
 #define _KEHNETWORK_SNAPSHOT_H 1
 
+#include "core/hash_map.h"
+#include "core/map.h"
 #include "core/reference.h"
+#include "core/vector.h"
 
 class kehSnapEntityBase;
 
@@ -32,12 +35,19 @@ class kehSnapshot : public Reference
 public:
    struct EntityCollection
    {
-      // Container used mostly for querying
-      Map<uint32_t, Ref<kehSnapEntityBase>> uid_to_entity;
-      // Container used for iteration
-      PoolVector<Ref<kehSnapEntityBase>> entity_array;
-
-      EntityCollection() {}
+      // Entities sorted by their unique IDs, so comparing two collections is a single linear merge. The order is
+      // only guaranteed after finish() has been called on the snapshot
+      Vector<Ref<kehSnapEntityBase>> entity_array;
+      // Unique ID into the index within entity_array, giving constant time lookup, replace, insert and remove
+      HashMap<uint32_t, uint32_t> uid_to_index;
+      // Removed entities leave an empty slot in the array, which is compacted by finish()
+      uint32_t removed;
+      // False when an entity was appended out of unique ID order
+      bool sorted;
+
+      bool is_finished() const { return sorted && removed == 0; }
+
+      EntityCollection() : removed(0), sorted(true) {}
    };
 
    // Typedef that should help with obtaining iterators outside of the class
@@ -53,13 +63,9 @@ private:
    // incoming snapshot data.
    uint32_t m_inputsig;
 
-   // Map from entity type into inner double container
+   // Map from entity type into the entity collection
    entity_data_t m_entity_data;
 
-private:
-   //bool get_entity_index(entity_array_t::Element* arr_el, uint32_t uid, uint32_t& out);
-   bool get_entity_index(const PoolVector<Ref<kehSnapEntityBase>>& arr, uint32_t uid, uint32_t& out) const;
-
 public:
    bool has_type(uint32_t ehash) const;
    void add_type(uint32_t nhash);
@@ -70,21 +76,19 @@ public:
 
    void remove_entity(uint32_t nhash, uint32_t uid);
 
-   // Given an entity type, obtain the list of unique IDs, filling the provided Set
-   void get_entity_uids(uint32_t ehash, Set<uint32_t>& out) const;
-
-   //void get_entity_uids(uint32_t ehash, Vector<uint32_t>& out) const;
-
    Ref<kehSnapEntityBase> get_entity(uint32_t nhash, uint32_t uid) const;
 
+   // Compact the slots left by removed entities and restore the unique ID order of the collections that need it.
+   // Must be called once the snapshot has been built (or changed), before its collections are retrieved
+   void finish();
+
    uint32_t get_signature() const { return m_signature; }
    void set_input_sig(uint32_t s) { m_inputsig = s; }
    uint32_t get_input_sig() const { return m_inputsig; }
 
-   void build_tracker(Map<uint32_t, Set<uint32_t>>& output) const;
-
-   // Retrieve the EntityCollection element iterator from the outer container. This will give access to both inner containers
-   const entity_data_t::Element* get_entity_collection(uint32_t ehash) const { return m_entity_data.find(ehash); }
+   // Retrieve the EntityCollection element iterator from the outer container. The entity array is sorted by
+   // unique ID, provided finish() was called after the last change
+   const entity_data_t::Element* get_entity_collection(uint32_t ehash) const;
 
 
    kehSnapshot(uint32_t sig, uint32_t isig = 0) : m_signature(sig), m_inputsig(isig) {}
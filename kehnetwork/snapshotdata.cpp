@@ -24,7 +24,9 @@
 #include "snapshot.h"
 #include "entityinfo.h"
 #include "snapentity.h"
+#include "nativeentity.h"
 #include "nodespawner.h"
+#include "profiler.h"
 
 #include "../kehgeneral/encdecbuffer.h"
 
@@ -79,6 +81,31 @@ void kehSnapshotData::register_entity_types()
          }
       }
    }
+
+   // Then the entity types declared in C++
+   const Vector<kehNativeEntityType*>& native = kehNativeEntityType::get_registered();
+   for (int i = 0; i < native.size(); i++)
+   {
+      EntityInfo info = memnew(kehEntityInfo);
+      const String err = info->check_native(native[i]);
+
+      if (err.empty())
+      {
+         if (pdebug)
+         {
+            print_line(vformat("Registering native snapshot object type '%s' with hash %d", native[i]->get_name(), info->get_name_hash()));
+         }
+
+         ERR_CONTINUE_MSG(m_entity_info.has(info->get_name_hash()), vformat("Native snapshot entity type '%s' conflicts with an already registered type.", native[i]->get_name()));
+
+         m_entity_info[info->get_name_hash()] = info;
+         m_native_name[native[i]->get_name()] = info->get_name_hash();
+      }
+      else
+      {
+         WARN_PRINT(vformat("Skipping registration of native class '%s' (%d). Reason: %s", native[i]->get_name(), info->get_name_hash(), err));
+      }
+   }
 }
 
 
@@ -182,6 +209,7 @@ void kehSnapshotData::check_history_size(uint32_t maxsize, bool has_authority)
 
    while (m_history.size() > maxsize)
    {
+      recycle_entities(m_history[0]);
       m_ssig_to_snap.erase(m_history[0]->get_signature());
       m_isig_to_snap.erase(m_history[0]->get_input_sig());
       m_history.remove(0);
@@ -191,6 +219,18 @@ void kehSnapshotData::check_history_size(uint32_t maxsize, bool has_authority)
    if (has_authority)
    {
       update_prediction_count(1 - popped);
+
+      // Deltas are never encoded relative to a snapshot that is not in the history anymore, so dirty tracking records
+      // of entities not seen since then are not needed
+      if (popped > 0 && m_history.size() > 0)
+      {
+         const uint32_t oldest = m_history[0]->get_signature();
+         for (Map<uint32_t, EntityInfo>::Element* e = m_entity_info.front(); e; e = e->next())
+         {
+            if (e->value()->has_dirty_tracking())
+               e->value()->purge_dirty(oldest);
+         }
+      }
    }
 }
 
@@ -213,12 +253,19 @@ void kehSnapshotData::reset()
    for (Map<uint32_t, EntityInfo>::Element* e = m_entity_info.front(); e; e = e->next())
    {
       e->value()->clear_nodes();
+      // Records are based on the snapshot signatures, which restart
+      e->value()->clear_dirty();
    }
 
    m_server_state = Ref<kehSnapshot>(NULL);
+   m_received.resize(0);
    m_history.resize(0);
    m_ssig_to_snap.clear();
    m_isig_to_snap.clear();
+
+   // Signatures restart after a reset, which would break the replay index
+   stop_recording();
+   close_replay();
 }
 
 
@@ -253,6 +300,8 @@ void kehSnapshotData::client_check_snapshot(const Ref<kehSnapshot>& snapshot)
       while (m_history.size() > 0 && m_history[0]->get_input_sig() <= isig)
       {
          finding_snap = m_history[0];
+         // The entities will only be reused after the finding_snap reference is gone, so this is safe
+         recycle_entities(finding_snap);
          m_ssig_to_snap.erase(finding_snap->get_signature());
          m_isig_to_snap.erase(finding_snap->get_input_sig());
          m_history.remove(0);
@@ -285,7 +334,10 @@ void kehSnapshotData::client_check_snapshot(const Ref<kehSnapshot>& snapshot)
       return;
    }
 
+   // The previous server state stays in the received list, which gives its entities back to the pools once
+   // it's evicted from there
    m_server_state = snapshot;
+   add_received(snapshot);
 
    for (Map<uint32_t, EntityInfo>::Element* ehash = m_entity_info.front(); ehash; ehash = ehash->next())
    {
@@ -294,34 +346,41 @@ void kehSnapshotData::client_check_snapshot(const Ref<kehSnapshot>& snapshot)
       // TODO: Remove this from release builds, keeping only on debug/editor builds.
       ERR_FAIL_COND_MSG(!local->has_type(ehash->key()) || !snapshot->has_type(ehash->key()), "Entity type must exist on both ends.");
 
-      // Obtain list of entities in the local snapshot. This will be used to track ones that are locally
-      // present but not in the server data.
-      Set<uint32_t> local_entity;
-      local->get_entity_uids(ehash->key(), local_entity);
-
-      // Iterate through entities of the server snapshot
-      const kehSnapshot::entity_data_t::Element* ecol = snapshot->get_entity_collection(ehash->key());
-
-      for (uint32_t i = 0; i < ecol->value().entity_array.size(); i++)
+      // Both entity arrays are sorted by unique ID, so a single merge tells which entities exist on both ends,
+      // only on the server data or only locally. Taking a copy of the local array is cheap and keeps the
+      // iteration valid when the corrected data is propagated into the history (which may contain the local
+      // snapshot)
+      const Vector<Ref<kehSnapEntityBase>> larray = local->get_entity_collection(ehash->key())->value().entity_array;
+      const Vector<Ref<kehSnapEntityBase>>& rarray = snapshot->get_entity_collection(ehash->key())->value().entity_array;
+      const uint32_t lcount = larray.size();
+      const uint32_t rcount = rarray.size();
+      uint32_t l = 0;
+      uint32_t r = 0;
+
+      while (l < lcount || r < rcount)
       {
-         Ref<kehSnapEntityBase> rentity = ecol->value().entity_array[i];
-         Ref<kehSnapEntityBase> lentity = local->get_entity(ehash->key(), rentity->get_uid());
+         if (r == rcount || (l < lcount && larray[l]->get_uid() < rarray[r]->get_uid()))
+         {
+            // The entity is in the local snapshot but not in the remote (server) one. It must be removed from the game
+            einfo->despawn_node(larray[l]->get_uid());
+            l++;
+            continue;
+         }
+
+         Ref<kehSnapEntityBase> rentity = rarray[r];
          Node* node = NULL;
 
-         if (rentity.is_valid() && lentity.is_valid())
+         if (l < lcount && larray[l]->get_uid() == rentity->get_uid())
          {
-            // Entity exists on both ends. First update the local entity array because it's meant to
-            // hold entities that are present only in the local machine (client)
-            local_entity.erase(rentity->get_uid());
+            // Entity exists on both ends. Check if there is any difference
+            const kehChangeMask cmask = einfo->calculate_change_mask(rentity, larray[l]);
+            l++;
 
-            // Check if there is any difference
-            const uint32_t cmask = einfo->calculate_change_mask(rentity, lentity);
-
-            if (cmask > 0)
+            if (!cmask.is_empty())
             {
                // There is at least one property with different values. This means it must be corrected.
-               // For now just obtain the corresponding node. At the end of this function if the variable
-               // is valid the apply_state() will be called.
+               // For now just obtain the corresponding node. Below, if the variable is valid the apply_state()
+               // will be called.
                node = einfo->get_game_node(rentity->get_uid());
             }
          }
@@ -334,11 +393,12 @@ void kehSnapshotData::client_check_snapshot(const Ref<kehSnapshot>& snapshot)
                node = einfo->spawn_node(rentity->get_uid(), rentity->get_class_hash());
             }
          }
+         r++;
 
          if (node)
          {
             // If here then it's necessary to apply the server state into the node
-            rentity->call("apply_state", node);
+            einfo->apply_state(rentity, node);
 
             // Propagate the new data into every snapshot in the local history.
             for (uint32_t i = 0; i < m_history.size(); i++)
@@ -347,13 +407,12 @@ void kehSnapshotData::client_check_snapshot(const Ref<kehSnapshot>& snapshot)
             }
          }
       }
+   }
 
-      // Check entities that are in the local snapshot but not in the remote (server) one.
-      // The local ones must be removed from the game
-      for (Set<uint32_t>::Element* e = local_entity.front(); e; e = e->next())
-      {
-         despawn_node(einfo->get_resource(), e->get());
-      }
+   // Corrections may have added entities into the history snapshots
+   for (uint32_t i = 0; i < m_history.size(); i++)
+   {
+      m_history[i]->finish();
    }
 
    // All entities have been verified. Update the prediction count
@@ -361,6 +420,284 @@ void kehSnapshotData::client_check_snapshot(const Ref<kehSnapshot>& snapshot)
 }
 
 
+void kehSnapshotData::apply_snapshot(const Ref<kehSnapshot>& snapshot)
+{
+   for (Map<uint32_t, EntityInfo>::Element* ehash = m_entity_info.front(); ehash; ehash = ehash->next())
+   {
+      EntityInfo einfo = ehash->value();
+
+      // Entities of the previous state. Those that are not in the new snapshot must be removed from the game.
+      // Both arrays are sorted by unique ID so those are found while merging
+      Vector<Ref<kehSnapEntityBase>> parray;
+      if (m_server_state.is_valid() && m_server_state->has_type(ehash->key()))
+         parray = m_server_state->get_entity_collection(ehash->key())->value().entity_array;
+      
+      Vector<Ref<kehSnapEntityBase>> earray;
+      if (snapshot->has_type(ehash->key()))
+         earray = snapshot->get_entity_collection(ehash->key())->value().entity_array;
+      
+      const uint32_t pcount = parray.size();
+      const uint32_t ecount = earray.size();
+      uint32_t p = 0;
+
+      for (uint32_t i = 0; i < ecount; i++)
+      {
+         const Ref<kehSnapEntityBase> entity = earray[i];
+
+         for (; p < pcount && parray[p]->get_uid() <= entity->get_uid(); p++)
+         {
+            if (parray[p]->get_uid() < entity->get_uid())
+               einfo->despawn_node(parray[p]->get_uid());
+         }
+
+         Node* node = einfo->get_game_node(entity->get_uid());
+         if (!node)
+            node = einfo->spawn_node(entity->get_uid(), entity->get_class_hash());
+         
+         if (node)
+            einfo->apply_state(entity, node);
+      }
+
+      for (; p < pcount; p++)
+      {
+         einfo->despawn_node(parray[p]->get_uid());
+      }
+   }
+
+   set_server_state(snapshot);
+}
+
+
+void kehSnapshotData::set_server_state(const Ref<kehSnapshot>& snapshot)
+{
+   if (snapshot.is_valid() && m_server_state != snapshot)
+   {
+      add_received(snapshot);
+   }
+   m_server_state = snapshot;
+}
+
+
+void kehSnapshotData::add_received(const Ref<kehSnapshot>& snapshot)
+{
+   m_received.push_back(snapshot);
+
+   // Entities are only given back to the pools here, as any snapshot in this list may still be used as
+   // reference to decode incoming data. The newest one is always kept, as it's the current server state
+   if ((uint32_t)m_received.size() > MAX(m_max_received, 1))
+   {
+      recycle_entities(m_received[0]);
+      m_received.remove(0);
+   }
+}
+
+
+Ref<kehSnapshot> kehSnapshotData::get_received(uint32_t signature) const
+{
+   // Most of the time the requested one is among the most recent
+   for (int i = m_received.size() - 1; i >= 0; i--)
+   {
+      if (m_received[i]->get_signature() == signature)
+         return m_received[i];
+   }
+
+   return Ref<kehSnapshot>();
+}
+
+
+Error kehSnapshotData::start_recording(const String& path, float tick_rate, uint32_t keyframe_interval)
+{
+   ERR_FAIL_COND_V_MSG(is_replaying(), ERR_BUSY, "Cannot record snapshots while a replay is open.");
+
+   const Error err = m_replay.create(path, tick_rate);
+   if (err != OK)
+      return err;
+   
+   m_keyframe_interval = MAX(1, keyframe_interval);
+   m_recorded_count = 0;
+   m_last_recorded = Ref<kehSnapshot>();
+
+   return OK;
+}
+
+void kehSnapshotData::stop_recording()
+{
+   if (!is_recording())
+      return;
+   
+   m_replay.close();
+   m_last_recorded = Ref<kehSnapshot>();
+}
+
+
+void kehSnapshotData::record_snapshot(const Ref<kehSnapshot>& snapshot)
+{
+   if (!is_recording())
+      return;
+   
+   m_replay_buffer->set_buffer(PoolByteArray());
+
+   // Input signature is not relevant for replays, and leaving it at 0 skips the history check when decoding
+   if (!m_last_recorded.is_valid() || m_recorded_count % m_keyframe_interval == 0)
+   {
+      encode_full(snapshot, m_replay_buffer, 0);
+      m_replay.write_record(kehReplayFile::REC_Keyframe, snapshot->get_signature(), m_replay_buffer->get_buffer());
+   }
+   else
+   {
+      encode_delta(snapshot, m_last_recorded, m_replay_buffer, 0);
+      m_replay.write_record(kehReplayFile::REC_Delta, snapshot->get_signature(), m_replay_buffer->get_buffer());
+   }
+
+   m_recorded_count++;
+   m_last_recorded = snapshot;
+}
+
+void kehSnapshotData::record_events(uint32_t sig, const PoolByteArray& encoded)
+{
+   if (!is_recording())
+      return;
+   
+   m_replay.write_record(kehReplayFile::REC_Events, sig, encoded);
+}
+
+
+Error kehSnapshotData::open_replay(const String& path)
+{
+   ERR_FAIL_COND_V_MSG(is_recording(), ERR_BUSY, "Cannot open a replay while recording snapshots.");
+
+   const Error err = m_replay.open(path);
+   if (err != OK)
+      return err;
+   
+   set_server_state(Ref<kehSnapshot>());
+
+   return OK;
+}
+
+void kehSnapshotData::close_replay()
+{
+   if (!is_replaying())
+      return;
+   
+   m_replay.close();
+}
+
+
+Ref<kehSnapshot> kehSnapshotData::decode_replay_record(const kehReplayFile::Record& record)
+{
+   m_replay_buffer->set_buffer(record.data);
+
+   if (record.type == kehReplayFile::REC_Keyframe)
+      return decode_full(m_replay_buffer);
+   
+   // A delta without its reference means the replay is not being read from a keyframe
+   ERR_FAIL_COND_V_MSG(!m_server_state.is_valid(), NULL, "Replay delta snapshot found without reference state.");
+   return decode_delta(m_replay_buffer);
+}
+
+
+bool kehSnapshotData::replay_step(PoolVector<PoolByteArray>& out_events)
+{
+   if (!is_replaying())
+      return false;
+   
+   kehReplayFile::Record record;
+   Ref<kehSnapshot> decoded;
+
+   while (!decoded.is_valid())
+   {
+      if (!m_replay.read_record(record))
+         return false;
+      
+      // Events recorded before any snapshot (should not happen) are dropped
+      if (record.type == kehReplayFile::REC_Events)
+         continue;
+      
+      kehNetProfileScope scope(kehNetProfiler::SEC_SnapshotDecode);
+      decoded = decode_replay_record(record);
+      if (!decoded.is_valid())
+         return false;
+   }
+
+   {
+      kehNetProfileScope scope(kehNetProfiler::SEC_ClientCheck);
+      apply_snapshot(decoded);
+   }
+
+   // Events of this snapshot are recorded right after it
+   uint64_t pos = m_replay.get_position();
+   while (m_replay.read_record(record))
+   {
+      if (record.type != kehReplayFile::REC_Events)
+         break;
+      
+      out_events.push_back(record.data);
+      pos = m_replay.get_position();
+   }
+   m_replay.set_position(pos);
+
+   return true;
+}
+
+
+bool kehSnapshotData::replay_seek(uint32_t sig)
+{
+   if (!is_replaying())
+      return false;
+   
+   const uint64_t start_pos = m_replay.get_position();
+   if (!m_replay.seek_keyframe(sig))
+      return false;
+   
+   // The game nodes reflect this state, which is needed to know what must be despawned after the seek
+   const Ref<kehSnapshot> before = m_server_state;
+   m_server_state = Ref<kehSnapshot>();
+
+   // Decode everything from the keyframe up to the requested snapshot, only applying the last one
+   kehReplayFile::Record record;
+   Ref<kehSnapshot> state;
+
+   uint64_t pos = m_replay.get_position();
+   while (m_replay.read_record(record))
+   {
+      if (record.type != kehReplayFile::REC_Events)
+      {
+         if (record.signature > sig)
+            break;
+         
+         Ref<kehSnapshot> decoded = decode_replay_record(record);
+         if (!decoded.is_valid())
+            break;
+         
+         state = decoded;
+         set_server_state(state);
+      }
+
+      pos = m_replay.get_position();
+   }
+
+   m_server_state = before;
+
+   if (!state.is_valid())
+   {
+      m_replay.set_position(start_pos);
+      return false;
+   }
+
+   m_replay.set_position(pos);
+   apply_snapshot(state);
+
+   return true;
+}
+
+
+uint32_t kehSnapshotData::get_replay_signature() const
+{
+   return m_server_state.is_valid() ? m_server_state->get_signature() : 0;
+}
+
+
 void kehSnapshotData::encode_full(const Ref<kehSnapshot>& snapshot, Ref<kehEncDecBuffer>& into, uint32_t input_sig) const
 {
    // Encode the signature of the snapshot
@@ -446,17 +783,20 @@ Ref<kehSnapshot> kehSnapshotData::decode_full(Ref<kehEncDecBuffer> from) const
       }
    }
 
+   ret->finish();
 
    return ret;
 }
 
 void kehSnapshotData::encode_delta(const Ref<kehSnapshot>& snap, const Ref<kehSnapshot>& oldsnap, Ref<kehEncDecBuffer>& into, uint32_t isig) const
 {
-   // Scan oldsnap comparing to snap. Encode only the changes. Removed entities must be explicitly marked
-   // with a changed mask = 0.
-   // Scanning will iterate through entities in the snap object. The same entity will be retrieved from oldsnap.
-   // If not found then assume iterate entity is new. A list must be used to keep track of entities that are in
-   // the older snapshot but not in the newer one, indicating removed game objects.
+   // Scan oldsnap comparing to snap. Encode only the changes.
+   // Entities are sorted by unique ID in both snapshots, so a single merge of the two arrays tells which
+   // entities are new (only in snap), removed (only in oldsnap) or possibly changed (in both). Entities are
+   // encoded in unique ID order, which is relied upon by the decoding.
+   // For each entity type with changes the layout is: type hash, change count, [removal count, removed UIDs],
+   // changed entities. The highest bit of the change count tells if the removal list is present. Removals
+   // come first because the decoder must know them while merging the reference entities.
 
    // Write snapshot signature
    into->write_uint(snap->get_signature());
@@ -464,16 +804,21 @@ void kehSnapshotData::encode_delta(const Ref<kehSnapshot>& snap, const Ref<kehSn
    // Then the input signature
    into->write_uint(isig);
 
+   // And the signature of the reference snapshot, so the decoder uses the exact same baseline
+   into->write_uint(oldsnap->get_signature());
+
    // Encode a flag indicating if there is any change at all in this snapshot. Assume there isn't
+   const uint32_t flagpos = into->get_current_size();
    into->write_bool(false);
    
    // But not for the actual flag here. It's easier to change this to true
    bool has_data = false;
 
-   // During entity scanning, entries from this container will be removed. After the loop any remaining
-   // entries are entities removed from the game
-   Map<uint32_t, Set<uint32_t>> tracker;
-   oldsnap->build_tracker(tracker);
+   // Change masks are calculated for each entity, so timing is accumulated and given to the profiler at the end
+   kehNetProfiler* profiler = kehNetProfiler::get_singleton();
+   const bool profiling = profiler && profiler->is_enabled();
+   uint64_t cmask_time = 0;
+   uint64_t cmask_calls = 0;
 
    // Iterate through valid entity types
    for (const Map<uint32_t, EntityInfo>::Element* einfo = m_entity_info.front(); einfo; einfo = einfo->next())
@@ -482,110 +827,197 @@ void kehSnapshotData::encode_delta(const Ref<kehSnapshot>& snap, const Ref<kehSn
       const kehSnapshot::entity_data_t::Element* necol = snap->get_entity_collection(einfo->key());
       const kehSnapshot::entity_data_t::Element* oecol = oldsnap->get_entity_collection(einfo->key());
 
+      const Vector<Ref<kehSnapEntityBase>>& narray = necol->value().entity_array;
+      const Vector<Ref<kehSnapEntityBase>>& oarray = oecol->value().entity_array;
+
       // Get entity count in the recent snapshot
-      const uint32_t necount = necol->value().entity_array.size();
+      const uint32_t necount = narray.size();
       // Get entity count in the old snapshot
-      const uint32_t oecount = oecol->value().entity_array.size();
+      const uint32_t oecount = oarray.size();
 
       // Skip this entity type if both quantities are 0
       if (necount == 0 && oecount == 0)
          continue;
       
-      // At least one of the snapshots contains entities of this type. Assume every single one has been changed
-      uint32_t ccount = necount;
+      // Amount of encoded entities of this type
+      uint32_t ccount = 0;
+
+      // First pass, only unique IDs are checked in order to gather the removed entities (the ones that are
+      // in the old snapshot but not in the new one) and the entities that exist in both snapshots. For each
+      // entity in the new snapshot, match holds the index of the same entity in the old one or -1 if new.
+      // The scratch containers only grow, so after the first few snapshots nothing is allocated here. Sizes are
+      // tracked with the counters instead of resizing down, which would free the memory
+      if (m_delta_match.size() < (int)necount)
+         m_delta_match.resize(necount);
+      const uint32_t maxpairs = MIN(necount, oecount);
+      if (m_delta_old.size() < (int)maxpairs)
+      {
+         m_delta_old.resize(maxpairs);
+         m_delta_new.resize(maxpairs);
+         m_delta_cmask.resize(maxpairs);
+      }
+      if (m_delta_removed.size() < (int)oecount)
+         m_delta_removed.resize(oecount);
+
+      int32_t* match = m_delta_match.ptrw();
+      const kehSnapEntityBase** pold = m_delta_old.ptrw();
+      const kehSnapEntityBase** pnew = m_delta_new.ptrw();
+      kehChangeMask* cmasks = m_delta_cmask.ptrw();
+      uint32_t* removed = m_delta_removed.ptrw();
+      uint32_t pcount = 0;
+      uint32_t rcount = 0;
+      {
+         uint32_t n = 0;
+         for (uint32_t o = 0; o < oecount; o++)
+         {
+            const uint32_t ouid = oarray[o]->get_uid();
+            for (; n < necount && narray[n]->get_uid() < ouid; n++)
+            {
+               match[n] = -1;
+            }
+
+            if (n < necount && narray[n]->get_uid() == ouid)
+            {
+               match[n] = o;
+               pold[pcount] = oarray[o].ptr();
+               pnew[pcount] = narray[n].ptr();
+               pcount++;
+               n++;
+            }
+            else
+            {
+               removed[rcount++] = ouid;
+            }
+         }
+
+         for (; n < necount; n++)
+         {
+            match[n] = -1;
+         }
+      }
 
-      // Postponing encoding of type has and change count to a moment where it is sure there is at least one
-      // changed entity of this type. Originally tried to do things normally and remove the relevant bytes from
-      // the buffer array but it didn't work very well.
+      // Change masks of all entities existing in both snapshots, calculated in a single batch. Those are in the
+      // same order of the new snapshot entities. With dirty tracking the masks come from what game code marked,
+      // taken while encoding below so unchanged entities are skipped without comparing or building any mask
+      const bool dirty_tracking = einfo->value()->has_dirty_tracking();
+      const uint32_t refsig = oldsnap->get_signature();
+      if (pcount > 0 && !dirty_tracking)
+      {
+         const uint64_t cmask_start = profiling ? kehNetProfiler::now() : 0;
+         einfo->value()->calculate_change_masks(pold, pnew, pcount, cmasks);
+         if (profiling)
+         {
+            cmask_time += kehNetProfiler::now() - cmask_start;
+            cmask_calls += pcount;
+         }
+      }
+
+      // Postponing encoding of type hash and change count to a moment where it is sure there is at least one
+      // changed or removed entity of this type. The count is rewritten once all entities of this type are encoded.
       // This flag is used to tell if the type hash and change count have been encded or not, just to prevent
       // multiple encodings of this data
       bool written_type_header = false;
 
-      // Get writing position of the entity count as most likely it will be updated (rewritten)
+      // Get writing position of the entity count as it will be updated (rewritten)
       const uint32_t countpos = into->get_current_size() + 4;
 
-      // Iterate through the entities of this type.
-      for (uint32_t i = 0; i < necount; i++)
+      if (rcount > 0)
       {
-         // Retrieve the new state of the entity.
-         Ref<kehSnapEntityBase> enew = necol->value().entity_array[i];
-
-         // Retrieve the old state of the entity - obviously if it exists.
-         const Map<uint32_t, Ref<kehSnapEntityBase>>::Element* eoldit = oecol->value().uid_to_entity.find(enew->get_uid());
-         Ref<kehSnapEntityBase> eold = eoldit ? eoldit->value() : NULL;
-
-         // Assume the entity is new
-         uint32_t cmask = einfo->value()->get_full_change_mask();
+         into->write_uint(einfo->key());
+         into->write_uint(0x80000000);
+         written_type_header = true;
 
-         if (enew.is_valid() && eold.is_valid())
+         into->write_uint(rcount);
+         for (uint32_t r = 0; r < rcount; r++)
          {
-            // The entity exist on both snapshots so it's not new. Calculate the "real" change mask.
-            cmask = einfo->value()->calculate_change_mask(eold, enew);
-
-            // Remove this from the tracker so it isn't considered as a removed entity
-            tracker[einfo->key()].erase(enew->get_uid());
+            into->write_uint(removed[r]);
          }
+         // Removals are also data, otherwise a delta containing only removals would be ignored when decoding
+         has_data = true;
+      }
 
-         if (cmask != 0)
-         {
-            if (!written_type_header)
-            {
-               // Write the entity type hash ID
-               into->write_uint(einfo->key());
+      // Index within the change masks
+      uint32_t p = 0;
+      for (uint32_t n = 0; n < necount; n++)
+      {
+         const Ref<kehSnapEntityBase>& enew = narray[n];
+         Ref<kehSnapEntityBase> eold;
 
-               // Write the change counter
-               into->write_uint(ccount);
+         // Assume the entity is new
+         kehChangeMask cmask = einfo->value()->get_full_change_mask();
 
-               // Prevent rewriting of this information
-               written_type_header = true;
+         if (match[n] >= 0)
+         {
+            // The entity exist on both snapshots so it's not new. Take the "real" change mask.
+            eold = oarray[match[n]];
+            if (dirty_tracking)
+            {
+               if (!einfo->value()->get_dirty_mask(enew->get_uid(), refsig, cmask))
+                  continue;
+            }
+            else
+            {
+               cmask = cmasks[p++];
             }
 
-            // This entity requires encoding. Do so
-            einfo->value()->encode_delta_entity(enew->get_uid(), enew, cmask, into);
-            has_data = true;
+            if (cmask.is_empty())
+               continue;
          }
-         else
-         {
-            // The entity was not changed. Update the change counter
-            ccount--;
-         }
-      }
 
-      // Check th tracker for entities that are in the old snapshot but not in the new one.
-      // In other words, entities that were removed from the game world.
-      // Those must be encoded with a change mask set to 0, which will indicate "remove entities"
-      // when decoding the data.
-      for (Set<uint32_t>::Element* uid = tracker[einfo->key()].front(); uid; uid = uid->next())
-      {
          if (!written_type_header)
          {
+            // Write the entity type hash ID
             into->write_uint(einfo->key());
-            into->write_uint(ccount);
+
+            // Write the change counter
+            into->write_uint(0);
+
+            // Prevent rewriting of this information
             written_type_header = true;
          }
 
-         einfo->value()->encode_delta_entity(uid->get(), NULL, 0, into);
+         // This entity requires encoding. Do so
+         einfo->value()->encode_delta_entity(enew, eold, cmask, into);
+         has_data = true;
          ccount++;
       }
 
       if (ccount > 0)
       {
-         into->rewrite_uint(ccount, countpos);
+         into->rewrite_uint(ccount | (rcount > 0 ? 0x80000000 : 0), countpos);
       }
    }
 
    // Everything iterated through. Check if there is anything encoded at all
    if (has_data)
-      into->rewrite_bool(true, 8);
+      into->rewrite_bool(true, flagpos);
+   
+   if (profiling)
+      profiler->add_accumulated(kehNetProfiler::SEC_ChangeMask, cmask_calls, cmask_time);
 }
 
 
 Ref<kehSnapshot> kehSnapshotData::decode_delta(Ref<kehEncDecBuffer>& from) const
+{
+   return decode_delta(from, Ref<kehSnapshot>());
+}
+
+Ref<kehSnapshot> kehSnapshotData::decode_delta(Ref<kehEncDecBuffer>& from, const Ref<kehSnapshot>& given) const
 {
    // Decode snapshot signature
    const uint32_t snapsig = from->read_uint();
    // Input signature
    const uint32_t isig = from->read_uint();
+   // Signature of the snapshot used as reference when encoding
+   const uint32_t refsig = from->read_uint();
+
+   const Ref<kehSnapshot> reference = given.is_valid() ? given : get_received(refsig);
+   if (!reference.is_valid())
+   {
+      // The reference is not known anymore (or was never received). Not acknowledging this snapshot will make
+      // the server eventually send full data
+      return NULL;
+   }
 
    if (isig > 0 && m_history.size() > 0 && isig < m_history[0]->get_input_sig())
    {
@@ -605,18 +1037,26 @@ Ref<kehSnapshot> kehSnapshotData::decode_delta(Ref<kehEncDecBuffer>& from) const
    // Read the "has_data" flag
    const bool has_data = from->read_bool();
 
-   // This will be used to track unchanged entities. Basically, when an entity is decoded the corresponding
-   // entry will be removed from this data. After that, remaining entries here are indicating entities that
-   // didn't change and must be copied from m_server_state into the new snapshot.
-   Map<uint32_t, Set<uint32_t>> tracker;
-   m_server_state->build_tracker(tracker);
+   // Both the reference and the encoded entities are sorted by unique ID, and entity types are encoded in the
+   // same order they are iterated here. Entities of the reference that are not in the encoded data didn't change
+   // and are copied into the new snapshot while merging.
+   const Map<uint32_t, EntityInfo>::Element* einfo = m_entity_info.front();
 
    if (has_data)
    {
       while (from->has_read_data())
       {
          const uint32_t ehash = from->read_uint();
-         const Map<uint32_t, EntityInfo>::Element* einfo = m_entity_info.find(ehash);
+
+         // Types without any change are entirely copied from the reference
+         for (; einfo && einfo->key() != ehash; einfo = einfo->next())
+         {
+            const Vector<Ref<kehSnapEntityBase>>& rarray = reference->get_entity_collection(einfo->key())->value().entity_array;
+            for (int r = 0; r < rarray.size(); r++)
+            {
+               ret->add_entity(einfo->key(), einfo->value()->clone_entity(rarray[r]));
+            }
+         }
 
          if (!einfo)
          {
@@ -624,61 +1064,88 @@ Ref<kehSnapshot> kehSnapshotData::decode_delta(Ref<kehEncDecBuffer>& from) const
             return NULL;
          }
 
-         // Take number of encoded entities of this type
-         const uint32_t count = from->read_uint();
+         // Take number of encoded entities of this type. The highest bit tells if there is a list of removed entities
+         const uint32_t hcount = from->read_uint();
+         const uint32_t count = hcount & 0x7FFFFFFF;
 
-         // Decode those entities
-         for (uint32_t i = 0; i < count; i++)
+         const Vector<Ref<kehSnapEntityBase>>& rarray = reference->get_entity_collection(ehash)->value().entity_array;
+         const uint32_t rcount = rarray.size();
+         uint32_t r = 0;
+
+         uint32_t remcount = 0;
+         if (hcount & 0x80000000)
          {
-            uint32_t cmask = 0;
-            Ref<kehSnapEntityBase> nent = einfo->value()->decode_delta_entity(from, cmask);
+            // Only entities of the reference can be removed, so anything above that count is corrupted data
+            remcount = from->read_uint();
+            if (remcount > rcount)
+            {
+               print_error(vformat("While decoding delta snapshot data, got %d removed entities of type %d while the reference snapshot holds %d.", remcount, ehash, rcount));
+               return NULL;
+            }
 
-            Ref<kehSnapEntityBase> oldent = m_server_state->get_entity(ehash, nent->get_uid());
+            if (m_decode_removed.size() < (int)remcount)
+               m_decode_removed.resize(remcount);
+            
+            for (uint32_t i = 0; i < remcount; i++)
+            {
+               m_decode_removed.write[i] = from->read_uint();
+            }
+         }
+         const uint32_t* removed = m_decode_removed.ptr();
+         uint32_t rem = 0;
 
-            if (oldent.is_valid())
+         // Decode those entities
+         for (uint32_t i = 0; i <= count; i++)
+         {
+            // One extra iteration is done in order to deal with the reference entities after the last encoded one
+            const uint32_t uid = i < count ? from->read_uint() : 0;
+
+            // Entities that come before the decoded one didn't change, unless removed
+            for (; r < rcount && (i == count || rarray[r]->get_uid() < uid); r++)
             {
-               // The entity exists in the old state. Check if it's not marked for removal
-               if (cmask > 0)
-               {
-                  // It isn't so "match" the delta to make the data correct (that is, take unchanged)
-                  // data from the old state and apply into the new one.
-                  einfo->value()->match_delta(nent, oldent, cmask);
-
-                  // Add the changed entity into the decoded snapshot
-                  ret->add_entity(ehash, nent);
-               }
-
-               // This is a changed entity so remove it from the tracker
-               tracker[ehash].erase(nent->get_uid());
+               const uint32_t ruid = rarray[r]->get_uid();
+               for (; rem < remcount && removed[rem] < ruid; rem++);
+
+               if (rem == remcount || removed[rem] != ruid)
+                  ret->add_entity(ehash, einfo->value()->clone_entity(rarray[r]));
             }
-            else
+
+            if (i == count)
+               break;
+
+            // The entity in the reference snapshot is the baseline used when encoding
+            const Ref<kehSnapEntityBase> baseline = (r < rcount && rarray[r]->get_uid() == uid) ? rarray[r++] : Ref<kehSnapEntityBase>();
+
+            kehChangeMask cmask;
+            Ref<kehSnapEntityBase> nent = einfo->value()->decode_delta_entity(uid, baseline, from, cmask);
+
+            if (baseline.is_valid())
             {
-               // Entity is not in the old state. Add the decoded data into the return value in the hopes
-               // it is holding the entire correct data (this can be checked by comparing the cmask through).
-               // Change mask can be 0 in this case, when the acknowledgement still didn't arrive there, when
-               // server dispatched a new data set.
-               if (cmask > 0)
-               {
-                  ret->add_entity(ehash, nent);
-               }
+               // The entity exists in the old state. "Match" the delta to make the data correct (that is, take
+               // unchanged data from the old state and apply into the new one).
+               einfo->value()->match_delta(nent, baseline, cmask);
             }
+
+            // If the entity is not in the old state then the decoded data is hopefully holding the entire correct
+            // data (this can be checked by comparing the cmask through).
+            ret->add_entity(ehash, nent);
          }
+
+         einfo = einfo->next();
       }
    }
 
-   // Check the tracker
-   for (Map<uint32_t, Set<uint32_t>>::Element* ehash = tracker.front(); ehash; ehash = ehash->next())
+   // Types after the last encoded one
+   for (; einfo; einfo = einfo->next())
    {
-      const Map<uint32_t, EntityInfo>::Element* einfo = m_entity_info.find(ehash->key());
-
-      for (Set<uint32_t>::Element* uid = ehash->value().front(); uid; uid = uid->next())
+      const Vector<Ref<kehSnapEntityBase>>& rarray = reference->get_entity_collection(einfo->key())->value().entity_array;
+      for (int r = 0; r < rarray.size(); r++)
       {
-         Ref<kehSnapEntityBase> entity = m_server_state->get_entity(ehash->key(), uid->get());
-
-         ret->add_entity(ehash->key(), einfo->value()->clone_entity(entity));
+         ret->add_entity(einfo->key(), einfo->value()->clone_entity(rarray[r]));
       }
    }
 
+   ret->finish();
 
    return ret;
 }
@@ -703,6 +1170,42 @@ uint32_t kehSnapshotData::get_ehash(const Ref<Script>& script) const
 }
 
 
+uint32_t kehSnapshotData::get_entity_hash(const Ref<kehSnapEntityBase>& entity) const
+{
+   Ref<Script> script = entity->get_script();
+   if (script.is_valid())
+   {
+      return get_ehash(script);
+   }
+
+   return get_native_ehash(entity->get_class_name());
+}
+
+
+void kehSnapshotData::track_dirty(uint32_t ehash, const Ref<kehSnapEntityBase>& entity, uint32_t sig, uint32_t prevsig)
+{
+   Map<uint32_t, EntityInfo>::Element* e = m_entity_info.find(ehash);
+   if (e && e->value()->has_dirty_tracking())
+   {
+      e->value()->track_dirty(entity, sig, prevsig);
+   }
+}
+
+
+uint32_t kehSnapshotData::get_native_ehash(const StringName& cname) const
+{
+   const Map<StringName, uint32_t>::Element* e = m_native_name.find(cname);
+   return e ? e->value() : 0;
+}
+
+
+Ref<kehEntityInfo> kehSnapshotData::get_entity_info(uint32_t ehash) const
+{
+   const Map<uint32_t, EntityInfo>::Element* e = m_entity_info.find(ehash);
+   return e ? e->value() : EntityInfo();
+}
+
+
 Ref<kehSnapEntityBase> kehSnapshotData::instantiate_snap_entity(const Ref<Script>& snap_entity, uint32_t uid, uint32_t chash) const
 {
    Ref<kehSnapEntityBase> ret;
@@ -719,6 +1222,20 @@ Ref<kehSnapEntityBase> kehSnapshotData::instantiate_snap_entity(const Ref<Script
 }
 
 
+Ref<kehSnapEntityBase> kehSnapshotData::instantiate_native_entity(const StringName& cname, uint32_t uid, uint32_t chash) const
+{
+   Ref<kehSnapEntityBase> ret;
+
+   const uint32_t ehash = get_native_ehash(cname);
+   if (ehash > 0)
+   {
+      ret = m_entity_info[ehash]->create_instance(uid, chash);
+   }
+
+   return ret;
+}
+
+
 String kehSnapshotData::get_comparer_data(const Ref<Script>& eclass) const
 {
    const Map<Ref<Script>, ResInfo>::Element* e = m_entity_name.find(eclass);
@@ -734,6 +1251,23 @@ String kehSnapshotData::get_comparer_data(const Ref<Script>& eclass) const
 
 
 
+void kehSnapshotData::recycle_entities(const Ref<kehSnapshot>& snapshot)
+{
+   for (Map<uint32_t, EntityInfo>::Element* einfo = m_entity_info.front(); einfo; einfo = einfo->next())
+   {
+      const kehSnapshot::entity_data_t::Element* ecol = snapshot->get_entity_collection(einfo->key());
+      if (!ecol)
+         continue;
+      
+      const uint32_t ecount = ecol->value().entity_array.size();
+      for (uint32_t i = 0; i < ecount; i++)
+      {
+         einfo->value()->recycle(ecol->value().entity_array[i]);
+      }
+   }
+}
+
+
 void kehSnapshotData::update_prediction_count(int32_t delta)
 {
    for (Map<uint32_t, EntityInfo>::Element* einfo = m_entity_info.front(); einfo; einfo = einfo->next())
@@ -751,6 +1285,7 @@ void kehSnapshotData::_notification(int what)
       case NOTIFICATION_PREDELETE:
       {
          m_entity_info.clear();
+         m_native_name.clear();
          kehPropComparer::cleanup();
       }
    }
@@ -772,6 +1307,11 @@ void kehSnapshotData::_bind_methods()
 
 kehSnapshotData::kehSnapshotData()
 {
+   m_replay_buffer = Ref<kehEncDecBuffer>(memnew(kehEncDecBuffer));
+   m_keyframe_interval = 60;
+   m_recorded_count = 0;
+   m_max_received = GLOBAL_GET("keh_modules/network/snapshot/max_client_history");
+
    register_entity_types();
 }
 
@@ -26,6 +26,9 @@
 #include "core/reference.h"
 #include "core/func_ref.h"
 
+#include "changemask.h"
+#include "replayfile.h"
+
 
 class Script;
 class kehEntityInfo;
@@ -59,6 +62,8 @@ private:
    // Used to deal with "descriptions" of the entity types.
    Map<uint32_t, EntityInfo> m_entity_info;
    Map<Ref<Script>, ResInfo> m_entity_name;
+   // Entity types declared in C++ don't have a script. Those are found by class name, mapped into the hash
+   Map<StringName, uint32_t> m_native_name;
 
    // Local snapshot history.
    PoolVector<Ref<kehSnapshot>> m_history;
@@ -73,9 +78,47 @@ private:
    // this is also used as reference to rebuild full snapshots when delta data is received.
    Ref<kehSnapshot> m_server_state;
 
+   // The server encodes delta snapshots against the last snapshot acknowledged by the client, which may be older
+   // than m_server_state when acknowledgements are still in flight. Properties can be encoded relative to their
+   // value in that snapshot, so the most recent received snapshots are kept here, oldest first.
+   PoolVector<Ref<kehSnapshot>> m_received;
+   uint32_t m_max_received;
+
+   // Push a snapshot received from the server (or decoded from a replay/spectator stream)
+   void add_received(const Ref<kehSnapshot>& snapshot);
+   Ref<kehSnapshot> get_received(uint32_t signature) const;
+
+   // Snapshot recording (server) and replay (client without server). A single file is used because both
+   // things are not meant to happen at the same time
+   kehReplayFile m_replay;
+   Ref<kehEncDecBuffer> m_replay_buffer;
+   // Every this amount of recorded snapshots a full one is written
+   uint32_t m_keyframe_interval;
+   uint32_t m_recorded_count;
+   // The previous recorded snapshot, used as reference to encode the delta
+   Ref<kehSnapshot> m_last_recorded;
+
+   // Scratch containers of encode_delta(), kept between calls (hence mutable) so the per entity type work doesn't
+   // allocate every snapshot. Those only grow and are not meant to be used by two encodings at the same time
+   mutable Vector<int32_t> m_delta_match;
+   mutable Vector<const kehSnapEntityBase*> m_delta_old;
+   mutable Vector<const kehSnapEntityBase*> m_delta_new;
+   mutable Vector<kehChangeMask> m_delta_cmask;
+   mutable Vector<uint32_t> m_delta_removed;
+   // Same for the removed unique IDs read by decode_delta()
+   mutable Vector<uint32_t> m_decode_removed;
+
 private:
    void update_prediction_count(int32_t delta);
 
+   // Give the entities of a snapshot that is being discarded back to the pools of their entity infos
+   void recycle_entities(const Ref<kehSnapshot>& snapshot);
+
+   // Decode a snapshot record taken from the replay file, using m_server_state as reference for deltas
+   Ref<kehSnapshot> decode_replay_record(const kehReplayFile::Record& record);
+   // Replace m_server_state, also pushing the new one into the received list
+   void set_server_state(const Ref<kehSnapshot>& snapshot);
+
 protected:
    void _notification(int what);
 
@@ -130,6 +173,11 @@ public:
    // tasks to correct if necessary.
    void client_check_snapshot(const Ref<kehSnapshot>& snapshot);
 
+   // Apply the state of every entity in the given snapshot into the game nodes, spawning the nodes that don't
+   // exist and despawning the ones that are not in the snapshot anymore. Unlike client_check_snapshot(), there
+   // is no comparison with predicted data. The snapshot becomes the new server state.
+   void apply_snapshot(const Ref<kehSnapshot>& snapshot);
+
    // Encode the provided snapshot into the given EncDecBuffer, "attaching" the given input signature as
    // part of the data. This function encodes the entire snapshot.
    void encode_full(const Ref<kehSnapshot>& snapshot, Ref<kehEncDecBuffer>& into, uint32_t input_sig) const;
@@ -141,16 +189,65 @@ public:
    // into the given EncDecBuffer then send the resulting data through the network
    void encode_delta(const Ref<kehSnapshot>& snap, const Ref<kehSnapshot>& oldsnap, Ref<kehEncDecBuffer>& into, uint32_t isig) const;
 
-   // In here the "old snapshot" is not needed because it is basically a property in this class (m_server_state)
+   // In here the "old snapshot" is not needed because the encoded data tells its signature and it is taken from
+   // the recently received snapshots. Returns an invalid reference if that snapshot is not available anymore
    Ref<kehSnapshot> decode_delta(Ref<kehEncDecBuffer>& from) const;
 
+   // Decode delta snapshot data using the given snapshot as the reference rather than a received one
+   Ref<kehSnapshot> decode_delta(Ref<kehEncDecBuffer>& from, const Ref<kehSnapshot>& reference) const;
+
+
+
+   /// Recording and replay
+   // Start recording every authoritative snapshot into the given file. One full snapshot is written every
+   // keyframe_interval snapshots, the others are delta encoded
+   Error start_recording(const String& path, float tick_rate, uint32_t keyframe_interval);
+   void stop_recording();
+   bool is_recording() const { return m_replay.is_writing(); }
+
+   void record_snapshot(const Ref<kehSnapshot>& snapshot);
+   // Record encoded events. The data must be in the same format given to kehNetwork::decode_events()
+   void record_events(uint32_t sig, const PoolByteArray& encoded);
+
+   Error open_replay(const String& path);
+   void close_replay();
+   bool is_replaying() const { return m_replay.is_reading(); }
+
+   // Decode and apply the next recorded snapshot. Events recorded for that snapshot are appended into out_events.
+   // Returns false when the end of the replay is reached
+   bool replay_step(PoolVector<PoolByteArray>& out_events);
+   // Jump to the given snapshot signature, decoding from the nearest keyframe. Events in between are skipped.
+   bool replay_seek(uint32_t sig);
+
+   float get_replay_tick_rate() const { return m_replay.get_tick_rate(); }
+   uint32_t get_replay_first_signature() const { return m_replay.get_first_signature(); }
+   uint32_t get_replay_last_signature() const { return m_replay.get_last_signature(); }
+   uint32_t get_replay_signature() const;
 
 
    uint32_t get_ehash(const Ref<Script>& script) const;
 
+   // Obtain the hash of the entity type of the given instance, either scripted or native. Returns 0 if the type is not
+   // registered
+   uint32_t get_entity_hash(const Ref<kehSnapEntityBase>& entity) const;
+
+   // Entity was added into the snapshot with the given signature, prevsig being the one of the previous snapshot. If
+   // its type has dirty tracking enabled then the properties marked as dirty are recorded
+   void track_dirty(uint32_t ehash, const Ref<kehSnapEntityBase>& entity, uint32_t sig, uint32_t prevsig);
+
+   // Obtain the hash of a native entity type given its class name. Returns 0 if not registered
+   uint32_t get_native_ehash(const StringName& cname) const;
+
+   // Obtain the information of a registered entity type given its hash. Returns an invalid reference if the
+   // hash does not match any registered type
+   Ref<kehEntityInfo> get_entity_info(uint32_t ehash) const;
+
    // Creates an instance of SnapEntity given its script. Unique ID and Class hash will be assigned
    Ref<kehSnapEntityBase> instantiate_snap_entity(const Ref<Script>& snap_entity, uint32_t uid, uint32_t chash) const;
 
+   // Creates an instance of a native entity type given its class name
+   Ref<kehSnapEntityBase> instantiate_native_entity(const StringName& cname, uint32_t uid, uint32_t chash) const;
+
 
    // This function is here mostly for debugging purposes. It will return a String containing detailed information
    // regarding the comparers used by each replicable property found on the given SnapEntity script.
@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "spectator.h"
+#include "../kehgeneral/encdecbuffer.h"
+
+#include "snapshot.h"
+#include "snapshotdata.h"
+
+
+void kehSpectatorStream::configure(uint32_t delay, uint32_t keyframe_interval)
+{
+   m_delay = delay;
+   m_keyframe_interval = MAX(1, keyframe_interval);
+}
+
+
+bool kehSpectatorStream::add(uint32_t id)
+{
+   if (m_spectator.has(id))
+      return false;
+   
+   m_spectator.insert(id);
+   return true;
+}
+
+bool kehSpectatorStream::remove(uint32_t id)
+{
+   return m_spectator.erase(id);
+}
+
+
+PoolByteArray kehSpectatorStream::encode(uint32_t sig, const Ref<kehSnapshotData>& sdata, Ref<kehEncDecBuffer>& encdec)
+{
+   if (sig <= m_delay)
+      return PoolByteArray();
+   
+   const Ref<kehSnapshot> snap = sdata->get_snapshot(sig - m_delay);
+   if (!snap.is_valid())
+      return PoolByteArray();
+   
+   m_last_sent_sig = sig;
+
+   const bool keyframe = !m_last.is_valid() || m_since_keyframe + 1 >= m_keyframe_interval;
+
+   encdec->set_buffer(PoolByteArray());
+   if (keyframe)
+   {
+      encdec->write_byte(PK_Keyframe);
+      sdata->encode_full(snap, encdec, 0);
+      m_since_keyframe = 0;
+   }
+   else
+   {
+      encdec->write_byte(PK_Delta);
+      sdata->encode_delta(snap, m_last, encdec, 0);
+      m_since_keyframe++;
+   }
+
+   m_last = snap;
+
+   const PoolByteArray ret = encdec->get_buffer();
+   push_packet(ret);
+   return ret;
+}
+
+
+void kehSpectatorStream::push_packet(const PoolByteArray& packet)
+{
+   if (packet.size() == 0)
+      return;
+   
+   if (packet[0] == PK_Keyframe)
+      m_cache.clear();
+   
+   // Without a keyframe the deltas are useless to a spectator that is catching up
+   if (m_cache.size() > 0 || packet[0] == PK_Keyframe)
+      m_cache.push_back(packet);
+}
+
+
+void kehSpectatorStream::reset_stream()
+{
+   m_cache.clear();
+   m_last = Ref<kehSnapshot>();
+   m_last_sent_sig = 0;
+   m_since_keyframe = 0;
+}
+
+void kehSpectatorStream::clear()
+{
+   m_spectator.clear();
+   reset_stream();
+}
+
+
+kehSpectatorStream::kehSpectatorStream() :
+   m_last_sent_sig(0),
+   m_since_keyframe(0),
+   m_delay(0),
+   m_keyframe_interval(60)
+{
+}
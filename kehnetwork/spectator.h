@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_SPECTATOR_H
+#define _KEHNETWORK_SPECTATOR_H 1
+
+#include "core/reference.h"
+#include "core/set.h"
+#include "core/vector.h"
+
+// Spectators are not players. They don't have player nodes, don't send input nor custom properties and don't
+// predict anything. Instead of encoding one delta per spectator, the server encodes a single stream once per
+// send tick and the same packets are given to every spectator. The stream is delayed by a number of ticks and
+// is sent through the reliable channel, so each packet is a delta from the previous one, except for the
+// keyframes (full snapshots) that are periodically inserted.
+// The packets since the last keyframe are cached so a spectator connecting in the middle of the game can
+// catch up. Because the packets are opaque, a relay can cache and forward those without decoding anything.
+// Each packet is prefixed by a byte indicating its kind (PK_Keyframe or PK_Delta).
+
+class kehSnapshot;
+class kehSnapshotData;
+class kehEncDecBuffer;
+
+class kehSpectatorStream
+{
+public:
+   enum PacketKind
+   {
+      PK_Keyframe,
+      PK_Delta,
+   };
+
+private:
+   // Network IDs of the spectators
+   Set<uint32_t> m_spectator;
+
+   // The last keyframe followed by all the deltas built after it
+   Vector<PoolByteArray> m_cache;
+
+   // Server only. The last snapshot given to the stream, which is the reference for the next delta
+   Ref<kehSnapshot> m_last;
+   // Signature of the snapshot being built when the last packet was encoded
+   uint32_t m_last_sent_sig;
+   // Amount of deltas since the last keyframe
+   uint32_t m_since_keyframe;
+
+   // Amount of ticks the stream is behind the game
+   uint32_t m_delay;
+   // A keyframe is encoded every this amount of packets
+   uint32_t m_keyframe_interval;
+
+public:
+   void configure(uint32_t delay, uint32_t keyframe_interval);
+   uint32_t get_delay() const { return m_delay; }
+
+   // Returns false if the ID was already registered (or not registered, when removing)
+   bool add(uint32_t id);
+   bool remove(uint32_t id);
+   bool has(uint32_t id) const { return m_spectator.has(id); }
+   uint32_t get_count() const { return m_spectator.size(); }
+   const Set<uint32_t>& get_spectators() const { return m_spectator; }
+
+   // Returns true if, given the send interval, a packet should be built when the snapshot with the given signature
+   // is finished
+   bool is_send_due(uint32_t sig, uint32_t interval) const { return (m_last_sent_sig == 0 || sig >= m_last_sent_sig + interval); }
+
+   // Server only. Encode the snapshot that is "delay" ticks behind the given signature, taking it from the history
+   // in the snapshot data. The resulting packet is cached and returned. If the delayed snapshot does not exist the
+   // returned packet is empty
+   PoolByteArray encode(uint32_t sig, const Ref<kehSnapshotData>& sdata, Ref<kehEncDecBuffer>& encdec);
+
+   // Add a packet into the cache. A keyframe discards everything that was previously cached
+   void push_packet(const PoolByteArray& packet);
+   const Vector<PoolByteArray>& get_cache() const { return m_cache; }
+
+   // Drop the cache and the reference snapshot, so the next encoded packet is a keyframe
+   void reset_stream();
+   // Remove the spectators and reset the stream
+   void clear();
+
+   kehSpectatorStream();
+};
+
+
+#endif
@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_SPSCQUEUE_H
+#define _KEHNETWORK_SPSCQUEUE_H 1
+
+// Fixed capacity ring buffer meant to move data between exactly two threads, one pushing (producer) and the
+// other popping (consumer). Because each index is only written by one of the threads, no lock is necessary,
+// just proper memory ordering when publishing the indices.
+// The capacity is rounded up to a power of two so wrapping around is a simple mask.
+
+#include "core/typedefs.h"
+#include "core/vector.h"
+
+#include <atomic>
+
+template <class T>
+class kehSPSCQueue
+{
+private:
+   Vector<T> m_slot;
+   uint32_t m_mask;
+
+   // Only written by the producer
+   std::atomic<uint32_t> m_tail;
+   // Only written by the consumer
+   std::atomic<uint32_t> m_head;
+
+public:
+   // Must be called before the threads start using the queue
+   void set_capacity(uint32_t capacity)
+   {
+      const uint32_t size = next_power_of_2(MAX(capacity, 2));
+      m_slot.resize(size);
+      m_mask = size - 1;
+      m_tail.store(0, std::memory_order_relaxed);
+      m_head.store(0, std::memory_order_relaxed);
+   }
+   uint32_t get_capacity() const { return m_mask + 1; }
+
+   // Producer only. Returns false if the queue is full
+   bool push(const T& val)
+   {
+      const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+      if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+         return false;
+      
+      m_slot.write[tail & m_mask] = val;
+      m_tail.store(tail + 1, std::memory_order_release);
+      return true;
+   }
+
+   // Consumer only. Returns false if the queue is empty
+   bool pop(T& out)
+   {
+      const uint32_t head = m_head.load(std::memory_order_relaxed);
+      if (head == m_tail.load(std::memory_order_acquire))
+         return false;
+      
+      // Move the data out of the slot so it doesn't hold references until overwritten
+      T& slot = m_slot.write[head & m_mask];
+      out = slot;
+      slot = T();
+      m_head.store(head + 1, std::memory_order_release);
+      return true;
+   }
+
+   // Approximation, as the other thread may be changing the queue at the same time
+   uint32_t get_size() const { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+   bool is_empty() const { return get_size() == 0; }
+
+   kehSPSCQueue(uint32_t capacity = 1024) : m_mask(0), m_tail(0), m_head(0) { set_capacity(capacity); }
+};
+
+
+#endif
@@ -0,0 +1,336 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "threadedpeer.h"
+
+#include "core/os/os.h"
+
+
+void kehThreadedPeer::thread_func(void* userdata)
+{
+   kehThreadedPeer* self = (kehThreadedPeer*)userdata;
+   self->thread_loop();
+}
+
+
+void kehThreadedPeer::thread_loop()
+{
+   NetworkedMultiplayerPeer* peer = m_peer.ptr();
+   Outgoing out;
+   bool exiting = false;
+
+   // When exiting one last iteration is performed, so anything queued right before stopping (a kick message as
+   // an example) still gets sent
+   while (!exiting)
+   {
+      exiting = m_exit.load();
+      bool busy = false;
+
+      // First send everything the main thread queued
+      while (m_outgoing.pop(out))
+      {
+         busy = true;
+
+         switch (out.type)
+         {
+            case OUT_Packet:
+            {
+               peer->set_transfer_mode(out.mode);
+               peer->set_target_peer(out.peer);
+               peer->put_packet(out.data.ptr(), out.data.size());
+            } break;
+
+            case OUT_DisconnectPeer:
+            {
+               // Not part of the NetworkedMultiplayerPeer interface, so relying on the binding
+               peer->call("disconnect_peer", out.peer);
+            } break;
+
+            case OUT_RefuseConnections:
+            {
+               peer->set_refuse_new_connections(out.value != 0);
+            } break;
+         }
+      }
+
+      // Connection events are given through signals emitted during this call
+      peer->poll();
+      m_status.store(peer->get_connection_status());
+
+      // Incoming packets are only taken while there is space in the queue, otherwise those are simply left
+      // in the wrapped peer until the main thread catches up
+      while (peer->get_available_packet_count() > 0 && m_incoming.get_size() < m_incoming.get_capacity())
+      {
+         busy = true;
+
+         Incoming in;
+         in.type = IN_Packet;
+         in.peer = peer->get_packet_peer();
+         in.time = OS::get_singleton()->get_ticks_usec();
+
+         const uint8_t* buffer;
+         int size;
+         if (peer->get_packet(&buffer, size) != OK)
+            break;
+         
+         in.data.resize(size);
+         copymem(in.data.ptrw(), buffer, size);
+
+         m_incoming.push(in);
+      }
+
+      if (!busy && !exiting)
+      {
+         OS::get_singleton()->delay_usec(m_idle_usec);
+      }
+   }
+}
+
+
+void kehThreadedPeer::push_incoming(const Incoming& in)
+{
+   // Connection events can't be left in the wrapped peer, so wait for space
+   while (!m_incoming.push(in) && !m_exit.load())
+   {
+      OS::get_singleton()->delay_usec(m_idle_usec);
+   }
+}
+
+
+void kehThreadedPeer::on_peer_connected(int id)
+{
+   Incoming in;
+   in.type = IN_PeerConnected;
+   in.peer = id;
+   push_incoming(in);
+}
+
+void kehThreadedPeer::on_peer_disconnected(int id)
+{
+   Incoming in;
+   in.type = IN_PeerDisconnected;
+   in.peer = id;
+   push_incoming(in);
+}
+
+void kehThreadedPeer::on_connection_succeeded()
+{
+   Incoming in;
+   in.type = IN_ConnectionSucceeded;
+   push_incoming(in);
+}
+
+void kehThreadedPeer::on_connection_failed()
+{
+   Incoming in;
+   in.type = IN_ConnectionFailed;
+   push_incoming(in);
+}
+
+void kehThreadedPeer::on_server_disconnected()
+{
+   Incoming in;
+   in.type = IN_ServerDisconnected;
+   push_incoming(in);
+}
+
+
+void kehThreadedPeer::push_command(OutgoingType type, int peer, int value)
+{
+   Outgoing out;
+   out.type = type;
+   out.peer = peer;
+   out.value = value;
+
+   ERR_FAIL_COND_MSG(!m_outgoing.push(out), "Outgoing network queue is full, command has been dropped.");
+}
+
+
+void kehThreadedPeer::start(const Ref<NetworkedMultiplayerPeer>& peer, uint32_t queue_size, uint32_t idle_usec)
+{
+   ERR_FAIL_COND_MSG(m_thread, "The network thread is already running.");
+   ERR_FAIL_COND(!peer.is_valid());
+
+   m_peer = peer;
+   m_incoming.set_capacity(queue_size);
+   m_outgoing.set_capacity(queue_size);
+   m_idle_usec = idle_usec;
+
+   // Those don't change during the lifetime of the connection
+   m_unique_id = peer->get_unique_id();
+   m_is_server = peer->is_server();
+   m_max_packet_size = peer->get_max_packet_size();
+   m_refusing = peer->is_refusing_new_connections();
+   m_status.store(peer->get_connection_status());
+
+   peer->connect("peer_connected", this, "_on_peer_connected");
+   peer->connect("peer_disconnected", this, "_on_peer_disconnected");
+   peer->connect("connection_succeeded", this, "_on_connection_succeeded");
+   peer->connect("connection_failed", this, "_on_connection_failed");
+   peer->connect("server_disconnected", this, "_on_server_disconnected");
+
+   m_exit.store(false);
+   m_thread = Thread::create(&kehThreadedPeer::thread_func, this);
+}
+
+
+void kehThreadedPeer::stop()
+{
+   if (!m_thread)
+      return;
+   
+   m_exit.store(true);
+   Thread::wait_to_finish(m_thread);
+   memdelete(m_thread);
+   m_thread = NULL;
+
+   m_peer->disconnect("peer_connected", this, "_on_peer_connected");
+   m_peer->disconnect("peer_disconnected", this, "_on_peer_disconnected");
+   m_peer->disconnect("connection_succeeded", this, "_on_connection_succeeded");
+   m_peer->disconnect("connection_failed", this, "_on_connection_failed");
+   m_peer->disconnect("server_disconnected", this, "_on_server_disconnected");
+}
+
+
+void kehThreadedPeer::disconnect_peer(int id)
+{
+   push_command(OUT_DisconnectPeer, id, 0);
+}
+
+
+int kehThreadedPeer::get_packet_peer() const
+{
+   ERR_FAIL_COND_V(m_pending.size() == 0, 0);
+   return m_pending.front()->get().peer;
+}
+
+
+void kehThreadedPeer::poll()
+{
+   // Connection events and packets share the queue so the ordering is kept. Events are given right away
+   // while the packets are held until retrieved through get_packet()
+   Incoming in;
+   while (m_incoming.pop(in))
+   {
+      switch (in.type)
+      {
+         case IN_Packet:
+         {
+            m_pending.push_back(in);
+         } break;
+
+         case IN_PeerConnected:
+         {
+            emit_signal("peer_connected", in.peer);
+         } break;
+
+         case IN_PeerDisconnected:
+         {
+            emit_signal("peer_disconnected", in.peer);
+         } break;
+
+         case IN_ConnectionSucceeded:
+         {
+            emit_signal("connection_succeeded");
+         } break;
+
+         case IN_ConnectionFailed:
+         {
+            emit_signal("connection_failed");
+         } break;
+
+         case IN_ServerDisconnected:
+         {
+            emit_signal("server_disconnected");
+         } break;
+      }
+   }
+}
+
+
+void kehThreadedPeer::set_refuse_new_connections(bool enable)
+{
+   m_refusing = enable;
+   push_command(OUT_RefuseConnections, 0, enable ? 1 : 0);
+}
+
+
+Error kehThreadedPeer::get_packet(const uint8_t** r_buffer, int& r_buffer_size)
+{
+   ERR_FAIL_COND_V(m_pending.size() == 0, ERR_UNAVAILABLE);
+
+   m_current = m_pending.front()->get();
+   m_pending.pop_front();
+
+   *r_buffer = m_current.data.ptr();
+   r_buffer_size = m_current.data.size();
+
+   return OK;
+}
+
+
+Error kehThreadedPeer::put_packet(const uint8_t* buffer, int buffer_size)
+{
+   ERR_FAIL_COND_V_MSG(!m_thread, ERR_UNCONFIGURED, "The network thread is not running.");
+
+   Outgoing out;
+   out.type = OUT_Packet;
+   out.peer = m_target_peer;
+   out.mode = m_transfer_mode;
+   out.data.resize(buffer_size);
+   copymem(out.data.ptrw(), buffer, buffer_size);
+
+   ERR_FAIL_COND_V_MSG(!m_outgoing.push(out), ERR_BUSY, "Outgoing network queue is full, packet has been dropped.");
+
+   return OK;
+}
+
+
+void kehThreadedPeer::_bind_methods()
+{
+   // Bind non exposed (to scripting) functions
+   ClassDB::bind_method(D_METHOD("_on_peer_connected", "id"), &kehThreadedPeer::on_peer_connected);
+   ClassDB::bind_method(D_METHOD("_on_peer_disconnected", "id"), &kehThreadedPeer::on_peer_disconnected);
+   ClassDB::bind_method(D_METHOD("_on_connection_succeeded"), &kehThreadedPeer::on_connection_succeeded);
+   ClassDB::bind_method(D_METHOD("_on_connection_failed"), &kehThreadedPeer::on_connection_failed);
+   ClassDB::bind_method(D_METHOD("_on_server_disconnected"), &kehThreadedPeer::on_server_disconnected);
+}
+
+
+kehThreadedPeer::kehThreadedPeer()
+{
+   m_thread = NULL;
+   m_exit.store(false);
+   m_status.store(CONNECTION_DISCONNECTED);
+   m_unique_id = 0;
+   m_is_server = false;
+   m_max_packet_size = 0;
+   m_refusing = false;
+   m_transfer_mode = TRANSFER_MODE_RELIABLE;
+   m_target_peer = 0;
+   m_idle_usec = 1000;
+}
+
+kehThreadedPeer::~kehThreadedPeer()
+{
+   stop();
+}
@@ -0,0 +1,182 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_THREADEDPEER_H
+#define _KEHNETWORK_THREADEDPEER_H 1
+
+// Normally the network peer is polled by the SceneTree (through the MultiplayerAPI) on the main thread and
+// every RPC directly goes into the socket. This peer wraps the actual one (ENet) and moves all of the socket
+// work into a dedicated thread. Incoming packets and connection events are queued by the network thread and
+// dispatched by the main thread when poll() is called, while outgoing packets are queued by the main thread
+// and sent by the network thread. Both directions use lock free single producer/single consumer queues.
+//
+// The wrapped peer is only touched by the network thread after start() is called, so it must not be directly
+// used from anywhere else.
+//
+// As a bonus, incoming packets are timestamped as soon as they are taken from the wrapped peer, which gives
+// more precise round trip time measurements than the time in which the main thread handles the packet.
+
+#include "core/io/networked_multiplayer_peer.h"
+#include "core/os/thread.h"
+
+#include "spscqueue.h"
+
+#include <atomic>
+
+class kehThreadedPeer : public NetworkedMultiplayerPeer
+{
+   GDCLASS(kehThreadedPeer, NetworkedMultiplayerPeer);
+private:
+   enum IncomingType
+   {
+      IN_Packet,
+      IN_PeerConnected,
+      IN_PeerDisconnected,
+      IN_ConnectionSucceeded,
+      IN_ConnectionFailed,
+      IN_ServerDisconnected,
+   };
+
+   enum OutgoingType
+   {
+      OUT_Packet,
+      OUT_DisconnectPeer,
+      OUT_RefuseConnections,
+   };
+
+   struct Incoming
+   {
+      IncomingType type;
+      int peer;                  // Sender of the packet or the peer ID given by the connection event
+      Vector<uint8_t> data;
+      uint64_t time;             // In microseconds, when the packet was taken from the wrapped peer
+
+      Incoming() : type(IN_Packet), peer(0), time(0) {}
+   };
+
+   struct Outgoing
+   {
+      OutgoingType type;
+      int peer;                  // Target of the packet or peer to be disconnected
+      TransferMode mode;
+      int value;                 // Used by commands
+      Vector<uint8_t> data;
+
+      Outgoing() : type(OUT_Packet), peer(0), mode(TRANSFER_MODE_RELIABLE), value(0) {}
+   };
+
+   // The actual network peer
+   Ref<NetworkedMultiplayerPeer> m_peer;
+
+   Thread* m_thread;
+   std::atomic<bool> m_exit;
+
+   // Filled by the network thread, drained by the main thread
+   kehSPSCQueue<Incoming> m_incoming;
+   // Filled by the main thread, drained by the network thread
+   kehSPSCQueue<Outgoing> m_outgoing;
+
+   // Incoming packets already taken from the queue (during poll()) and waiting to be retrieved through get_packet()
+   List<Incoming> m_pending;
+   // The last retrieved packet must be kept alive while the caller is using its buffer
+   Incoming m_current;
+
+   // Those are given to the main thread without touching the wrapped peer
+   std::atomic<int> m_status;
+   int m_unique_id;
+   bool m_is_server;
+   int m_max_packet_size;
+   bool m_refusing;
+
+   // Settings for the next outgoing packet
+   TransferMode m_transfer_mode;
+   int m_target_peer;
+
+   // Amount of microseconds the network thread sleeps when there is nothing to be done
+   uint32_t m_idle_usec;
+
+private:
+   static void thread_func(void* userdata);
+   void thread_loop();
+
+   // Push from the network thread, waiting for space if the main thread is lagging behind
+   void push_incoming(const Incoming& in);
+
+   // Connected to the signals of the wrapped peer, so those run on the network thread
+   void on_peer_connected(int id);
+   void on_peer_disconnected(int id);
+   void on_connection_succeeded();
+   void on_connection_failed();
+   void on_server_disconnected();
+
+   void push_command(OutgoingType type, int peer, int value);
+
+protected:
+   static void _bind_methods();
+
+public:
+   // Take the given (already created) peer and start the network thread
+   void start(const Ref<NetworkedMultiplayerPeer>& peer, uint32_t queue_size, uint32_t idle_usec);
+   // Stop the network thread. After this the wrapped peer can be used from the main thread again
+   void stop();
+
+   bool is_running() const { return m_thread != NULL; }
+
+   // Disconnect a remote peer. Only meaningful on the server
+   void disconnect_peer(int id);
+
+   // Time, in microseconds (OS::get_ticks_usec()), in which the packet currently being handled arrived
+   uint64_t get_packet_timestamp() const { return m_current.time; }
+
+
+   /// NetworkedMultiplayerPeer interface
+   virtual void set_transfer_mode(TransferMode mode) { m_transfer_mode = mode; }
+   virtual TransferMode get_transfer_mode() const { return m_transfer_mode; }
+   virtual void set_target_peer(int peer_id) { m_target_peer = peer_id; }
+
+   virtual int get_packet_peer() const;
+
+   virtual bool is_server() const { return m_is_server; }
+
+   virtual void poll();
+
+   virtual int get_unique_id() const { return m_unique_id; }
+
+   virtual void set_refuse_new_connections(bool enable);
+   virtual bool is_refusing_new_connections() const { return m_refusing; }
+
+   virtual ConnectionStatus get_connection_status() const { return (ConnectionStatus)m_status.load(); }
+
+
+   /// PacketPeer interface
+   virtual int get_available_packet_count() const { return m_pending.size(); }
+   virtual Error get_packet(const uint8_t** r_buffer, int& r_buffer_size);
+   virtual Error put_packet(const uint8_t* buffer, int buffer_size);
+   virtual int get_max_packet_size() const { return m_max_packet_size; }
+
+
+   kehThreadedPeer();
+   ~kehThreadedPeer();
+};
+
+
+#endif
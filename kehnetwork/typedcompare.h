@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2021 Yuri Sarudiansky
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _KEHNETWORK_TYPEDCOMPARE_H
+#define _KEHNETWORK_TYPEDCOMPARE_H 1
+
+// Comparison of raw typed values, without Variants or virtual calls. This is what the kehPropComparer instances
+// use once the Variants are converted and what native entity fields use directly on their members.
+//
+// The tolerance follows the rules of the property meta: negative means exact comparison, 0 means automatic
+// tolerance (is_equal_approx()) and any other value is used as custom tolerance. Types that are not floating
+// point based are always compared for exact equality.
+//
+// compare_column() compares one property across many entities, with the values stored contiguously. The
+// tolerance mode is resolved once, outside of the loop, so the loop body is just the comparison itself. Types
+// made of 32 bit integers or floats are compared by the vectorized kernels in kehSimdCompare.
+
+#include "core/math/quat.h"
+#include "core/math/rect2.h"
+#include "core/math/vector3.h"
+#include "core/color.h"
+
+#include "simdcompare.h"
+
+
+struct kehTypedCompare
+{
+   // Automatic tolerance
+   static bool approx(float v1, float v2) { return Math::is_equal_approx(v1, v2); }
+   static bool approx(const Vector2& v1, const Vector2& v2) { return v1.is_equal_approx(v2); }
+   static bool approx(const Rect2& v1, const Rect2& v2) { return v1.is_equal_approx(v2); }
+   static bool approx(const Vector3& v1, const Vector3& v2) { return v1.is_equal_approx(v2); }
+   static bool approx(const Quat& v1, const Quat& v2) { return v1.is_equal_approx(v2); }
+   static bool approx(const Color& v1, const Color& v2) { return v1.is_equal_approx(v2); }
+   template <typename T>
+   static bool approx(const T& v1, const T& v2) { return v1 == v2; }
+
+   // Custom tolerance
+   static bool within(float v1, float v2, float tol) { return Math::abs(v1 - v2) < tol; }
+   static bool within(const Vector2& v1, const Vector2& v2, float tol)
+   {
+      return within(v1.x, v2.x, tol) && within(v1.y, v2.y, tol);
+   }
+   static bool within(const Rect2& v1, const Rect2& v2, float tol)
+   {
+      return within(v1.position, v2.position, tol) && within(v1.size, v2.size, tol);
+   }
+   static bool within(const Vector3& v1, const Vector3& v2, float tol)
+   {
+      return within(v1.x, v2.x, tol) && within(v1.y, v2.y, tol) && within(v1.z, v2.z, tol);
+   }
+   static bool within(const Quat& v1, const Quat& v2, float tol)
+   {
+      return within(v1.x, v2.x, tol) && within(v1.y, v2.y, tol) && within(v1.z, v2.z, tol) && within(v1.w, v2.w, tol);
+   }
+   static bool within(const Color& v1, const Color& v2, float tol)
+   {
+      return within(v1.r, v2.r, tol) && within(v1.g, v2.g, tol) && within(v1.b, v2.b, tol) && within(v1.a, v2.a, tol);
+   }
+   template <typename T>
+   static bool within(const T& v1, const T& v2, float) { return v1 == v2; }
+
+
+   template <typename T>
+   static bool equal(const T& v1, const T& v2, float tolerance)
+   {
+      if (tolerance < 0.0f)
+         return v1 == v2;
+      if (tolerance == 0.0f)
+         return approx(v1, v2);
+      return within(v1, v2, tolerance);
+   }
+
+   // Compare count pairs of values, setting changed[i] to 1 if v1[i] and v2[i] are different or 0 otherwise.
+   // Returns the amount of changed values.
+   template <typename T>
+   static uint32_t compare_column(const T* v1, const T* v2, uint32_t count, float tolerance, uint8_t* changed)
+   {
+      if (tolerance < 0.0f)
+      {
+         for (uint32_t i = 0; i < count; i++)
+            changed[i] = !(v1[i] == v2[i]);
+      }
+      else if (tolerance == 0.0f)
+      {
+         for (uint32_t i = 0; i < count; i++)
+            changed[i] = !approx(v1[i], v2[i]);
+      }
+      else
+      {
+         for (uint32_t i = 0; i < count; i++)
+            changed[i] = !within(v1[i], v2[i], tolerance);
+      }
+
+      uint32_t ret = 0;
+      for (uint32_t i = 0; i < count; i++)
+         ret += changed[i];
+      return ret;
+   }
+
+   static uint32_t compare_column(const int32_t* v1, const int32_t* v2, uint32_t count, float, uint8_t* changed)
+   {
+      return kehSimdCompare::changed_int((const uint32_t*)v1, (const uint32_t*)v2, count, changed);
+   }
+   static uint32_t compare_column(const uint32_t* v1, const uint32_t* v2, uint32_t count, float, uint8_t* changed)
+   {
+      return kehSimdCompare::changed_int(v1, v2, count, changed);
+   }
+   static uint32_t compare_column(const float* v1, const float* v2, uint32_t count, float tolerance, uint8_t* changed)
+   {
+      return kehSimdCompare::changed_float(v1, v2, count, 1, tolerance, changed);
+   }
+   static uint32_t compare_column(const Color* v1, const Color* v2, uint32_t count, float tolerance, uint8_t* changed)
+   {
+      return kehSimdCompare::changed_float((const float*)v1, (const float*)v2, count, 4, tolerance, changed);
+   }
+#ifndef REAL_T_IS_DOUBLE
+   // The math types are only arrays of floats when real_t is float
+   static uint32_t compare_column(const Vector2* v1, const Vector2* v2, uint32_t count, float tolerance, uint8_t* changed)
+   {
+      return kehSimdCompare::changed_float((const float*)v1, (const float*)v2, count, 2, tolerance, changed);
+   }
+   static uint32_t compare_column(const Rect2* v1, const Rect2* v2, uint32_t count, float tolerance, uint8_t* changed)
+   {
+      return kehSimdCompare::changed_float((const float*)v1, (const float*)v2, count, 4, tolerance, changed);
+   }
+   static uint32_t compare_column(const Vector3* v1, const Vector3* v2, uint32_t count, float tolerance, uint8_t* changed)
+   {
+      return kehSimdCompare::changed_float((const float*)v1, (const float*)v2, count, 3, tolerance, changed);
+   }
+   static uint32_t compare_column(const Quat* v1, const Quat* v2, uint32_t count, float tolerance, uint8_t* changed)
+   {
+      return kehSimdCompare::changed_float((const float*)v1, (const float*)v2, count, 4, tolerance, changed);
+   }
+#endif
+};
+
+
+#endif
@@ -21,6 +21,7 @@
  */
 
 #include "updtcontrol.h"
+#include "profiler.h"
 #include "snapentity.h"
 
 
@@ -33,8 +34,11 @@ uint32_t kehUpdateControl::get_signature() const
    return m_snap->get_signature();
 }
 
-void kehUpdateControl::start(const PoolVector<uint32_t>& snap_types)
+void kehUpdateControl::start(const PoolVector<uint32_t>& snap_types, bool defer_finish)
 {
+   if (kehNetProfiler* profiler = kehNetProfiler::get_singleton())
+      profiler->on_tick_start();
+
    m_sig++;
    m_snap = Ref<kehSnapshot>(memnew(kehSnapshot(m_sig)));
 
@@ -43,7 +47,8 @@ void kehUpdateControl::start(const PoolVector<uint32_t>& snap_types)
       m_snap->add_type(snap_types[i]);
    }
 
-   call_deferred("_finish");
+   if (defer_finish)
+      call_deferred("_finish");
 }
 
 
@@ -74,18 +79,16 @@ void kehUpdateControl::add_to_snapshot(uint32_t ehash, const Ref<kehSnapEntityBa
 }
 
 
-void kehUpdateControl::push_event(uint16_t code, const Array& params)
+void kehUpdateControl::push_event(const kehNetEvent& evt)
 {
-   kehNetEvent mevt;
-   mevt.type = code;
-   mevt.params = params;
-   m_event.push_back(mevt);
+   m_event.push_back(evt);
 }
 
 
 void kehUpdateControl::reset()
 {
    m_sig = 0;
+   m_prev_sig = 0;
    m_snap = Ref<kehSnapshot>();
    m_event.resize(0);
 }
@@ -98,6 +101,9 @@ void kehUpdateControl::finish()
       return;
    }
 
+   // Entities may have been given out of order, which the delta encoding can't deal with
+   m_snap->finish();
+
    // Custom properties are sent through the reliable channel so send them first
    if (m_cpropcheck.is_valid())
       m_cpropcheck();
@@ -111,7 +117,11 @@ void kehUpdateControl::finish()
    m_event.resize(0);
 
    // Reset internal snapshot reference
+   m_prev_sig = m_snap->get_signature();
    m_snap = Ref<kehSnapshot>(NULL);
+
+   if (kehNetProfiler* profiler = kehNetProfiler::get_singleton())
+      profiler->on_tick_end();
 }
 
 
@@ -125,5 +135,7 @@ void kehUpdateControl::_bind_methods()
 kehUpdateControl::kehUpdateControl()
 {
    m_sig = 0;
+   m_prev_sig = 0;
+   m_send_interval = 1;
    m_encdec = Ref<kehEncDecBuffer>(memnew(kehEncDecBuffer));
 }
\ No newline at end of file
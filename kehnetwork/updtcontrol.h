@@ -51,11 +51,17 @@ public:
 private:
    // Signature of the snapshot being built. This also is used to "calculate" the signature of the next snapshot.
    uint32_t m_sig;
+   // Signature of the last finished snapshot, 0 if there is none
+   uint32_t m_prev_sig;
    // The snapshot that is being built during a frame
    Ref<kehSnapshot> m_snap;
    // Accumulate events here
    PoolVector<kehNetEvent> m_event;
 
+   // Data is only sent to the clients once every this amount of ticks (snapshots). Anything generated in between
+   // is accumulated and sent together.
+   uint32_t m_send_interval;
+
    // This will be used to encode and decode snapshot data.
    Ref<kehEncDecBuffer> m_encdec;
 
@@ -68,19 +74,28 @@ private:
    // Will be called during when snapshot is finished. The function should dispatch accumulated events
    EventDispatcherT m_evtdispatch;
 
-
-private:
-   // Called through a defer, will perform tasks to "finalize" the snapshot
-   void finish();
-
 protected:
    static void _bind_methods();
 
 public:
    uint32_t get_signature() const;
+   uint32_t get_previous_signature() const { return m_prev_sig; }
    Ref<kehEncDecBuffer> get_enc_dec() { return m_encdec; }
 
-   void start(const PoolVector<uint32_t>& snap_types);
+   // If defer_finish is true then the snapshot will be automatically finished at the end of the frame. Otherwise
+   // finish() must be called
+   void start(const PoolVector<uint32_t>& snap_types, bool defer_finish = true);
+
+   // Called through a defer (or directly when the network tick scheduler is used), will perform tasks to
+   // "finalize" the snapshot
+   void finish();
+
+   void set_send_interval(uint32_t interval) { m_send_interval = interval > 0 ? interval : 1; }
+   uint32_t get_send_interval() const { return m_send_interval; }
+
+   // Returns true if the snapshot being built (or just finished) corresponds to a tick in which accumulated
+   // data should be sent to the clients
+   bool is_send_tick() const { return (m_sig % m_send_interval) == 0; }
 
    void set_custom_prop_checker(const CustomPropCheckT& pcheck);
    void set_snapshot_finished(const SnapshotFinishedT& finished);
@@ -91,7 +106,7 @@ public:
 
    void add_to_snapshot(uint32_t ehash, const Ref<kehSnapEntityBase>& entity);
 
-   void push_event(uint16_t code, const Array& params);
+   void push_event(const kehNetEvent& evt);
 
    void reset();
 